@@ -0,0 +1,311 @@
+#include "aec.h"
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+#if defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+// NLMS step size (normalised by the far-end power over the whole tail)
+#define AEC_MU              0.5f
+
+// Geigel double-talk detector: assumes the speaker->mic path loses at
+// least 6 dB, so a mic peak above half the far-end peak is the near end
+#define AEC_GEIGEL          0.5f
+
+// Far-end peak below this (about -60 dBFS) is treated as silence
+#define AEC_FAR_ACTIVE      0.001f
+
+// Regularisation of the per-bin power, relative to a full-scale block
+#define AEC_DELTA           1e-6f
+
+// Per-bin power is never taken below this fraction of the mean over bins
+#define AEC_POWER_FLOOR     0.3f
+
+// Y += W * X over all bins of one partition
+static void cmul_acc(float *y_re, float *y_im, const float *w_re, const float *w_im,
+                     const float *x_re, const float *x_im) {
+#if defined(__ARM_NEON)
+    for (int k = 0; k < AEC_BINS_PAD; k += 4) {
+        float32x4_t wr = vld1q_f32(w_re + k);
+        float32x4_t wi = vld1q_f32(w_im + k);
+        float32x4_t xr = vld1q_f32(x_re + k);
+        float32x4_t xi = vld1q_f32(x_im + k);
+        float32x4_t yr = vld1q_f32(y_re + k);
+        float32x4_t yi = vld1q_f32(y_im + k);
+        yr = vmlaq_f32(yr, wr, xr);
+        yr = vmlsq_f32(yr, wi, xi);
+        yi = vmlaq_f32(yi, wr, xi);
+        yi = vmlaq_f32(yi, wi, xr);
+        vst1q_f32(y_re + k, yr);
+        vst1q_f32(y_im + k, yi);
+    }
+#else
+    for (int k = 0; k < AEC_BINS_PAD; k++) {
+        y_re[k] += w_re[k] * x_re[k] - w_im[k] * x_im[k];
+        y_im[k] += w_re[k] * x_im[k] + w_im[k] * x_re[k];
+    }
+#endif
+}
+
+// W += conj(X) * G over all bins of one partition
+static void cmul_conj_update(float *w_re, float *w_im, const float *x_re, const float *x_im,
+                             const float *g_re, const float *g_im) {
+#if defined(__ARM_NEON)
+    for (int k = 0; k < AEC_BINS_PAD; k += 4) {
+        float32x4_t xr = vld1q_f32(x_re + k);
+        float32x4_t xi = vld1q_f32(x_im + k);
+        float32x4_t gr = vld1q_f32(g_re + k);
+        float32x4_t gi = vld1q_f32(g_im + k);
+        float32x4_t wr = vld1q_f32(w_re + k);
+        float32x4_t wi = vld1q_f32(w_im + k);
+        wr = vmlaq_f32(wr, xr, gr);
+        wr = vmlaq_f32(wr, xi, gi);
+        wi = vmlaq_f32(wi, xr, gi);
+        wi = vmlsq_f32(wi, xi, gr);
+        vst1q_f32(w_re + k, wr);
+        vst1q_f32(w_im + k, wi);
+    }
+#else
+    for (int k = 0; k < AEC_BINS_PAD; k++) {
+        w_re[k] += x_re[k] * g_re[k] + x_im[k] * g_im[k];
+        w_im[k] += x_re[k] * g_im[k] - x_im[k] * g_re[k];
+    }
+#endif
+}
+
+int aec_init(aec_ctx_t *ctx, int tail_ms) {
+    memset(ctx, 0, sizeof(aec_ctx_t));
+
+    if (fft_init(&ctx->fft, AEC_FFT_SIZE) < 0) {
+        return -1;
+    }
+
+    if (tail_ms <= 0) tail_ms = AEC_DEFAULT_TAIL_MS;
+    int taps = tail_ms * SAMPLE_RATE / 1000;
+    ctx->parts = (taps + AEC_BLOCK - 1) / AEC_BLOCK;
+    if (ctx->parts > AEC_MAX_PARTS) {
+        fprintf(stderr, "AEC: %d ms tail too long, using %d ms\n", tail_ms,
+                AEC_MAX_PARTS * AEC_BLOCK * 1000 / SAMPLE_RATE);
+        ctx->parts = AEC_MAX_PARTS;
+    }
+    ctx->mu = AEC_MU;
+
+    // Output starts one block behind so every frame can be filled
+    ctx->out_count = AEC_BLOCK;
+
+    if (pthread_mutex_init(&ctx->ref_lock, NULL) != 0) {
+        perror("AEC mutex");
+        return -1;
+    }
+
+    ctx->initialized = true;
+    printf("AEC initialised: %d ms tail (%d x %d taps)\n",
+           ctx->parts * AEC_BLOCK * 1000 / SAMPLE_RATE, ctx->parts, AEC_BLOCK);
+    return 0;
+}
+
+void aec_cleanup(aec_ctx_t *ctx) {
+    if (ctx->initialized) {
+        pthread_mutex_destroy(&ctx->ref_lock);
+        ctx->initialized = false;
+    }
+}
+
+// Constrain one partition back to a linear (not circular) convolution:
+// the second half of its time-domain response must be zero
+static void constrain_partition(aec_ctx_t *ctx, int p) {
+    float w[AEC_FFT_SIZE];
+
+    fft_inverse(&ctx->fft, ctx->w_re[p], ctx->w_im[p], w);
+    memset(w + AEC_BLOCK, 0, AEC_BLOCK * sizeof(float));
+    fft_forward(&ctx->fft, w, ctx->w_re[p], ctx->w_im[p]);
+}
+
+// One overlap-save block: mic/ref in, echo-cancelled out
+static void process_block(aec_ctx_t *ctx, const float *mic, const float *ref, float *out) {
+    float buf[AEC_FFT_SIZE];
+    float y_re[AEC_BINS_PAD], y_im[AEC_BINS_PAD];
+    float e_re[AEC_BINS_PAD], e_im[AEC_BINS_PAD];
+    int parts = ctx->parts;
+
+    // Newest far-end spectrum replaces the oldest, keeping the tail power current
+    ctx->head = (ctx->head + parts - 1) % parts;
+    float *xr = ctx->x_re[ctx->head];
+    float *xi = ctx->x_im[ctx->head];
+
+    for (int k = 0; k < AEC_BINS; k++) {
+        ctx->x_pow[k] -= xr[k] * xr[k] + xi[k] * xi[k];
+    }
+
+    memcpy(buf, ctx->x_prev, AEC_BLOCK * sizeof(float));
+    memcpy(buf + AEC_BLOCK, ref, AEC_BLOCK * sizeof(float));
+    memcpy(ctx->x_prev, ref, AEC_BLOCK * sizeof(float));
+    fft_forward(&ctx->fft, buf, xr, xi);
+
+    float ref_peak = 0.0f;
+    for (int i = 0; i < AEC_BLOCK; i++) {
+        float a = fabsf(ref[i]);
+        if (a > ref_peak) ref_peak = a;
+    }
+    ctx->far_peak[ctx->head] = ref_peak;
+
+    for (int k = 0; k < AEC_BINS; k++) {
+        ctx->x_pow[k] += xr[k] * xr[k] + xi[k] * xi[k];
+        if (ctx->x_pow[k] < 0.0f) ctx->x_pow[k] = 0.0f;
+    }
+
+    // Echo estimate: sum of every partition filtering its delayed block
+    memset(y_re, 0, sizeof(y_re));
+    memset(y_im, 0, sizeof(y_im));
+    for (int p = 0; p < parts; p++) {
+        int idx = (ctx->head + p) % parts;
+        cmul_acc(y_re, y_im, ctx->w_re[p], ctx->w_im[p], ctx->x_re[idx], ctx->x_im[idx]);
+    }
+    fft_inverse(&ctx->fft, y_re, y_im, buf);
+
+    float mic_peak = 0.0f;
+    double mic_energy = 0.0, out_energy = 0.0;
+    for (int i = 0; i < AEC_BLOCK; i++) {
+        out[i] = mic[i] - buf[AEC_BLOCK + i];
+        float a = fabsf(mic[i]);
+        if (a > mic_peak) mic_peak = a;
+        mic_energy += (double)mic[i] * mic[i];
+        out_energy += (double)out[i] * out[i];
+    }
+
+    float far_peak = 0.0f;
+    for (int p = 0; p < parts; p++) {
+        if (ctx->far_peak[p] > far_peak) far_peak = ctx->far_peak[p];
+    }
+    if (far_peak < AEC_FAR_ACTIVE) {
+        return;
+    }
+
+    // Near-end talker present: freeze the filter so it does not diverge
+    if (mic_peak > AEC_GEIGEL * far_peak) {
+        ctx->dt_hold = AEC_DT_HOLD_BLOCKS;
+    }
+    if (ctx->dt_hold > 0) {
+        ctx->dt_hold--;
+        ctx->stats.blocks_doubletalk++;
+        return;
+    }
+
+    ctx->stats.mic_energy = 0.99 * ctx->stats.mic_energy + 0.01 * mic_energy;
+    ctx->stats.out_energy = 0.99 * ctx->stats.out_energy + 0.01 * out_energy;
+
+    // Error spectrum, normalised per bin by the far-end power over the tail
+    memset(buf, 0, AEC_BLOCK * sizeof(float));
+    memcpy(buf + AEC_BLOCK, out, AEC_BLOCK * sizeof(float));
+    fft_forward(&ctx->fft, buf, e_re, e_im);
+
+    // Weak bins next to strong harmonics pick up leakage from the zero-padded
+    // error block, so their step is limited by a floor under the mean power
+    float mean_pow = 0.0f;
+    for (int k = 0; k < AEC_BINS; k++) mean_pow += ctx->x_pow[k];
+    mean_pow /= AEC_BINS;
+    float floor_pow = AEC_POWER_FLOOR * mean_pow + AEC_DELTA * AEC_FFT_SIZE * parts;
+
+    for (int k = 0; k < AEC_BINS; k++) {
+        float pow = ctx->x_pow[k] > floor_pow ? ctx->x_pow[k] : floor_pow;
+        float g = ctx->mu / pow;
+        e_re[k] *= g;
+        e_im[k] *= g;
+    }
+    memset(e_re + AEC_BINS, 0, (AEC_BINS_PAD - AEC_BINS) * sizeof(float));
+    memset(e_im + AEC_BINS, 0, (AEC_BINS_PAD - AEC_BINS) * sizeof(float));
+
+    for (int p = 0; p < parts; p++) {
+        int idx = (ctx->head + p) % parts;
+        cmul_conj_update(ctx->w_re[p], ctx->w_im[p], ctx->x_re[idx], ctx->x_im[idx],
+                         e_re, e_im);
+    }
+
+    // Constraining every partition costs two FFTs each, so rotate through them
+    constrain_partition(ctx, ctx->constrain_next);
+    ctx->constrain_next = (ctx->constrain_next + 1) % parts;
+
+    ctx->stats.blocks_adapted++;
+}
+
+void aec_process(aec_ctx_t *ctx, const int16_t *mic, const int16_t *ref, int16_t *out) {
+    for (int i = 0; i < FRAME_SIZE; i++) {
+        ctx->in_mic[ctx->in_count] = mic[i] * (1.0f / 32768.0f);
+        ctx->in_ref[ctx->in_count] = ref[i] * (1.0f / 32768.0f);
+
+        if (++ctx->in_count == AEC_BLOCK) {
+            process_block(ctx, ctx->in_mic, ctx->in_ref, ctx->out_buf + ctx->out_count);
+            ctx->out_count += AEC_BLOCK;
+            ctx->in_count = 0;
+        }
+    }
+
+    for (int i = 0; i < FRAME_SIZE; i++) {
+        float s = ctx->out_buf[i] * 32768.0f;
+        if (s > 32767.0f) s = 32767.0f;
+        if (s < -32768.0f) s = -32768.0f;
+        out[i] = (int16_t)lrintf(s);
+    }
+
+    ctx->out_count -= FRAME_SIZE;
+    memmove(ctx->out_buf, ctx->out_buf + FRAME_SIZE, ctx->out_count * sizeof(float));
+    ctx->stats.frames++;
+}
+
+void aec_playback(aec_ctx_t *ctx, const int16_t *pcm, int samples) {
+    const int size = AEC_REF_FRAMES * FRAME_SIZE;
+
+    pthread_mutex_lock(&ctx->ref_lock);
+    for (int i = 0; i < samples; i++) {
+        if (ctx->ref_fill == size) {
+            ctx->ref_read = (ctx->ref_read + 1) % size;
+            ctx->ref_fill--;
+            ctx->stats.ref_dropped++;
+        }
+        ctx->ref_ring[(ctx->ref_read + ctx->ref_fill) % size] = pcm[i];
+        ctx->ref_fill++;
+    }
+    pthread_mutex_unlock(&ctx->ref_lock);
+}
+
+void aec_capture(aec_ctx_t *ctx, const int16_t *mic, int16_t *out) {
+    const int size = AEC_REF_FRAMES * FRAME_SIZE;
+    int16_t ref[FRAME_SIZE];
+
+    pthread_mutex_lock(&ctx->ref_lock);
+
+    // Playback queued up while we were not capturing is too old to line up
+    // with the mic; keep the reference at most AEC_REF_MAX_LAG frames behind
+    int excess = ctx->ref_fill - AEC_REF_MAX_LAG * FRAME_SIZE;
+    if (excess > 0) {
+        ctx->ref_read = (ctx->ref_read + excess) % size;
+        ctx->ref_fill -= excess;
+        ctx->stats.ref_dropped += excess;
+    }
+
+    int take = ctx->ref_fill < FRAME_SIZE ? ctx->ref_fill : FRAME_SIZE;
+    for (int i = 0; i < take; i++) {
+        ref[i] = ctx->ref_ring[(ctx->ref_read + i) % size];
+    }
+    ctx->ref_read = (ctx->ref_read + take) % size;
+    ctx->ref_fill -= take;
+
+    pthread_mutex_unlock(&ctx->ref_lock);
+
+    // Nothing was played for the rest of this frame
+    if (take < FRAME_SIZE) {
+        memset(ref + take, 0, (FRAME_SIZE - take) * sizeof(int16_t));
+        if (take > 0) ctx->stats.ref_underruns++;
+    }
+
+    aec_process(ctx, mic, ref, out);
+}
+
+double aec_erle_db(const aec_ctx_t *ctx) {
+    if (ctx->stats.out_energy <= 0.0 || ctx->stats.mic_energy <= 0.0) {
+        return 0.0;
+    }
+    return 10.0 * log10(ctx->stats.mic_energy / ctx->stats.out_energy);
+}
@@ -0,0 +1,89 @@
+#ifndef AEC_H
+#define AEC_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <pthread.h>
+
+#include "opus_helper.h"
+#include "fft.h"
+
+// Acoustic echo canceller for full-duplex mode.
+// Partitioned-block frequency-domain NLMS (overlap-save): the speaker
+// signal is the reference, the echo estimate is subtracted from the
+// microphone before Opus encoding.
+
+#define AEC_BLOCK           128                     // Samples per adaptation block
+#define AEC_FFT_SIZE        (2 * AEC_BLOCK)
+#define AEC_BINS            (AEC_BLOCK + 1)
+#define AEC_BINS_PAD        132                     // AEC_BINS rounded up to 4 for SIMD
+#define AEC_DEFAULT_TAIL_MS 80
+#define AEC_MAX_PARTS       40                      // Longest tail ~116 ms
+
+// Playback reference queued between the RX and TX threads
+#define AEC_REF_FRAMES      8
+#define AEC_REF_MAX_LAG     2                       // Frames kept before the oldest is dropped
+
+// Double-talk hangover after the near-end talker is detected
+#define AEC_DT_HOLD_BLOCKS  12
+
+typedef struct {
+    uint64_t frames;
+    uint64_t blocks_adapted;
+    uint64_t blocks_doubletalk;
+    uint64_t ref_underruns;         // Capture found only part of a playback frame queued
+    uint64_t ref_dropped;           // Stale playback samples discarded
+    double mic_energy;              // Smoothed, far-end active blocks only
+    double out_energy;
+} aec_stats_t;
+
+typedef struct {
+    fft_ctx_t fft;
+    int parts;
+    int head;                       // Newest entry in the far-end spectrum history
+    int constrain_next;             // Partition to constrain on the next block
+    float mu;
+
+    // Far-end spectra of the last 'parts' blocks and the filter partitions
+    float x_re[AEC_MAX_PARTS][AEC_BINS_PAD];
+    float x_im[AEC_MAX_PARTS][AEC_BINS_PAD];
+    float w_re[AEC_MAX_PARTS][AEC_BINS_PAD];
+    float w_im[AEC_MAX_PARTS][AEC_BINS_PAD];
+    float x_pow[AEC_BINS_PAD];      // Far-end power per bin summed over the tail
+
+    float x_prev[AEC_BLOCK];
+    float far_peak[AEC_MAX_PARTS];  // Per-block far-end peak, for double-talk detection
+    int dt_hold;
+
+    // Frame <-> block buffering (adds AEC_BLOCK samples of latency)
+    float in_mic[AEC_BLOCK];
+    float in_ref[AEC_BLOCK];
+    int in_count;
+    float out_buf[FRAME_SIZE + 2 * AEC_BLOCK];
+    int out_count;
+
+    // Playback reference FIFO, written by the RX thread
+    pthread_mutex_t ref_lock;
+    int16_t ref_ring[AEC_REF_FRAMES * FRAME_SIZE];
+    int ref_read;
+    int ref_fill;
+
+    aec_stats_t stats;
+    bool initialized;
+} aec_ctx_t;
+
+int aec_init(aec_ctx_t *ctx, int tail_ms);
+void aec_cleanup(aec_ctx_t *ctx);
+
+// Cancel echo of ref from one FRAME_SIZE mic frame (out may alias mic)
+void aec_process(aec_ctx_t *ctx, const int16_t *mic, const int16_t *ref, int16_t *out);
+
+// Threaded use: the RX thread queues what it plays, the TX thread
+// cancels each captured frame against the queued reference
+void aec_playback(aec_ctx_t *ctx, const int16_t *pcm, int samples);
+void aec_capture(aec_ctx_t *ctx, const int16_t *mic, int16_t *out);
+
+// Echo return loss enhancement while the far end is active
+double aec_erle_db(const aec_ctx_t *ctx);
+
+#endif // AEC_H
@@ -0,0 +1,504 @@
+#include "archive.h"
+#include "red.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+
+// Ogg Opus constants (RFC 7845). Granule positions always count 48 kHz
+// samples, whatever rate the audio was captured at.
+#define OGG_GRANULE_RATE        48000
+#define OPUS_PRE_SKIP           312         // libopus encoder lookahead at 48 kHz
+#define OGG_HEADER_SIZE         27
+#define OGG_FLAG_BOS            0x02
+#define OGG_FLAG_EOS            0x04
+
+// A page holds at most 255 lacing values; close it after ~1 s of audio
+// anyway so a player can seek and a crash loses little
+#define ARCHIVE_PAGE_PACKETS    50
+#define ARCHIVE_PAGE_BODY       (255 * 255)
+
+// Output buffer per stream: write() once 64 KB of pages are ready (or
+// every few seconds of a quiet stream), never more than one page behind
+#define ARCHIVE_BUFFER          (128 * 1024)
+#define ARCHIVE_WRITE_AT        (64 * 1024)
+#define ARCHIVE_FLUSH_MS        5000
+#define ARCHIVE_WAKE_MS         250
+
+static uint32_t ogg_crc_table[256];
+
+// Ogg's CRC-32: polynomial 0x04c11db7, no reflection, zero initial value
+static void ogg_crc_init(void) {
+    for (int i = 0; i < 256; i++) {
+        uint32_t r = (uint32_t)i << 24;
+        for (int b = 0; b < 8; b++) {
+            r = (r & 0x80000000) ? (r << 1) ^ 0x04c11db7 : (r << 1);
+        }
+        ogg_crc_table[i] = r;
+    }
+}
+
+static uint32_t ogg_crc(const uint8_t *data, size_t len) {
+    uint32_t crc = 0;
+    for (size_t i = 0; i < len; i++) {
+        crc = (crc << 8) ^ ogg_crc_table[((crc >> 24) ^ data[i]) & 0xFF];
+    }
+    return crc;
+}
+
+static void put_le16(uint8_t *p, uint16_t v) {
+    p[0] = v & 0xFF;
+    p[1] = v >> 8;
+}
+
+static void put_le32(uint8_t *p, uint32_t v) {
+    for (int i = 0; i < 4; i++) p[i] = (v >> (8 * i)) & 0xFF;
+}
+
+static void put_le64(uint8_t *p, uint64_t v) {
+    for (int i = 0; i < 8; i++) p[i] = (v >> (8 * i)) & 0xFF;
+}
+
+// Signed distance between sequence numbers (handles wrap around)
+static inline int32_t seq_diff(uint32_t a, uint32_t b) {
+    return (int32_t)(a - b);
+}
+
+// Hand the buffered pages to the kernel
+static int stream_write(archive_ctx_t *ctx, archive_stream_t *s, uint64_t now_us) {
+    size_t off = 0;
+    int ret = 0;
+
+    while (off < s->out_len) {
+        ssize_t n = write(s->fd, s->out + off, s->out_len - off);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            perror("archive write");
+            ctx->stats.write_errors++;
+            ret = -1;
+            break;
+        }
+        off += n;
+    }
+
+    // On error the rest is dropped; the buffer must not stall the stream
+    ctx->stats.bytes_written += off;
+    s->out_len = 0;
+    s->written_us = now_us;
+    return ret;
+}
+
+// Finish the page being built and queue it for writing
+static void page_flush(archive_ctx_t *ctx, archive_stream_t *s, uint8_t header_type) {
+    uint8_t *page = s->out + s->out_len;
+    size_t size = OGG_HEADER_SIZE + s->segments + s->body_len;
+
+    memcpy(page, "OggS", 4);
+    page[4] = 0;                                // Version
+    page[5] = header_type;
+    put_le64(page + 6, s->granule);
+    put_le32(page + 14, s->serial);
+    put_le32(page + 18, s->page_seq++);
+    put_le32(page + 22, 0);                     // CRC, filled in below
+    page[26] = (uint8_t)s->segments;
+    memcpy(page + OGG_HEADER_SIZE, s->lacing, s->segments);
+    memcpy(page + OGG_HEADER_SIZE + s->segments, s->body, s->body_len);
+    put_le32(page + 22, ogg_crc(page, size));
+
+    s->out_len += size;
+    s->body_len = 0;
+    s->segments = 0;
+    s->page_packets = 0;
+
+    if (s->out_len >= ARCHIVE_WRITE_AT) {
+        stream_write(ctx, s, s->last_us);
+    }
+}
+
+// Append one packet to the page, starting a new page first if it is full
+static void page_add(archive_ctx_t *ctx, archive_stream_t *s,
+                     const uint8_t *data, int len, int samples) {
+    int segments = len / 255 + 1;
+
+    if (s->page_packets > 0 &&
+        (s->segments + segments > 255 || s->page_packets >= ARCHIVE_PAGE_PACKETS)) {
+        page_flush(ctx, s, 0);
+    }
+
+    // Lacing: 255 per full segment, then the remainder (0 if len % 255 == 0)
+    for (int i = 0; i < segments - 1; i++) {
+        s->lacing[s->segments++] = 255;
+    }
+    s->lacing[s->segments++] = (uint8_t)(len % 255);
+
+    memcpy(s->body + s->body_len, data, len);
+    s->body_len += len;
+    s->page_packets++;
+    s->granule += samples;
+}
+
+// ID and comment headers, each on a page of its own as RFC 7845 requires
+static void stream_headers(archive_ctx_t *ctx, archive_stream_t *s, const struct tm *tm) {
+    uint8_t head[19];
+    memcpy(head, "OpusHead", 8);
+    head[8] = 1;                                // Version
+    head[9] = CHANNELS;
+    put_le16(head + 10, OPUS_PRE_SKIP);
+    put_le32(head + 12, SAMPLE_RATE);           // Original input rate, informational
+    put_le16(head + 16, 0);                     // Output gain
+    head[18] = 0;                               // Mapping family: mono/stereo
+    page_add(ctx, s, head, sizeof(head), 0);
+    page_flush(ctx, s, OGG_FLAG_BOS);
+
+    // Vendor string and the comments a compliance search needs
+    char comments[3][64];
+    snprintf(comments[0], sizeof(comments[0]), "BOARD_ID=%u", s->board_id);
+    snprintf(comments[1], sizeof(comments[1]), "TALKGROUP=%u", s->talkgroup);
+    strftime(comments[2], sizeof(comments[2]), "DATE=%Y-%m-%dT%H:%M:%S%z", tm);
+
+    static const char vendor[] = "walkietalkie";
+    uint8_t tags[256];
+    int n = 0;
+    memcpy(tags, "OpusTags", 8);
+    n += 8;
+    put_le32(tags + n, sizeof(vendor) - 1);
+    n += 4;
+    memcpy(tags + n, vendor, sizeof(vendor) - 1);
+    n += sizeof(vendor) - 1;
+    put_le32(tags + n, 3);
+    n += 4;
+    for (int i = 0; i < 3; i++) {
+        int len = (int)strlen(comments[i]);
+        put_le32(tags + n, (uint32_t)len);
+        n += 4;
+        memcpy(tags + n, comments[i], len);
+        n += len;
+    }
+    page_add(ctx, s, tags, n, 0);
+    page_flush(ctx, s, 0);
+}
+
+// Create the file at the first audio packet of a burst
+static int stream_open(archive_ctx_t *ctx, archive_stream_t *s) {
+    struct timeval tv;
+    struct tm tm;
+    gettimeofday(&tv, NULL);
+    localtime_r(&tv.tv_sec, &tm);
+
+    char stamp[20];
+    strftime(stamp, sizeof(stamp), "%Y%m%d-%H%M%S", &tm);
+
+    // Two bursts from one board within a second get a suffix
+    for (int n = 1; n <= 9; n++) {
+        if (n == 1) {
+            snprintf(s->path, sizeof(s->path), "%s/%s-b%u-tg%u.opus",
+                     ctx->dir, stamp, s->board_id, s->talkgroup);
+        } else {
+            snprintf(s->path, sizeof(s->path), "%s/%s-b%u-tg%u-%d.opus",
+                     ctx->dir, stamp, s->board_id, s->talkgroup, n);
+        }
+        s->fd = open(s->path, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+        if (s->fd >= 0 || errno != EEXIST) break;
+    }
+    if (s->fd < 0) {
+        perror(s->path);
+        s->failed = true;
+        return -1;
+    }
+
+    s->serial = s->board_id * 2654435761u ^ (uint32_t)tv.tv_usec;
+    s->page_seq = 0;
+    s->granule = 0;
+    s->body_len = 0;
+    s->segments = 0;
+    s->page_packets = 0;
+    s->out_len = 0;
+    s->written_us = s->last_us;
+    s->packets = 0;
+    s->gap_frames = 0;
+
+    stream_headers(ctx, s, &tm);
+    return 0;
+}
+
+// Last page (end of stream), everything to disk, file closed
+static void stream_close(archive_ctx_t *ctx, archive_stream_t *s) {
+    if (s->fd >= 0) {
+        page_flush(ctx, s, OGG_FLAG_EOS);
+        stream_write(ctx, s, s->last_us);
+        fdatasync(s->fd);
+        close(s->fd);
+        s->fd = -1;
+
+        ctx->stats.bursts++;
+        printf("Archive: %s (%.1f s, %lu lost)\n", s->path,
+               (double)(s->granule - OPUS_PRE_SKIP) / OGG_GRANULE_RATE,
+               (unsigned long)s->gap_frames);
+    }
+    s->active = false;
+    s->failed = false;
+}
+
+// Stream for this sender; a new burst takes a free slot, or the one that
+// has been quiet longest
+static archive_stream_t *stream_find(archive_ctx_t *ctx, const archive_rec_t *rec, bool create) {
+    archive_stream_t *free_slot = NULL;
+    archive_stream_t *oldest = NULL;
+
+    for (int i = 0; i < ARCHIVE_MAX_STREAMS; i++) {
+        archive_stream_t *s = &ctx->streams[i];
+        if (!s->active) {
+            if (!free_slot) free_slot = s;
+            continue;
+        }
+        if (s->board_id == rec->board_id && s->talkgroup == rec->talkgroup) return s;
+        if (!oldest || s->last_us < oldest->last_us) oldest = s;
+    }
+
+    if (!create) return NULL;
+    if (!free_slot) {
+        stream_close(ctx, oldest);
+        free_slot = oldest;
+    }
+    return free_slot;
+}
+
+static void stream_start(archive_stream_t *s, const archive_rec_t *rec, uint32_t next_seq) {
+    s->active = true;
+    s->failed = false;
+    s->board_id = rec->board_id;
+    s->talkgroup = rec->talkgroup;
+    s->fd = -1;
+    s->next_seq = next_seq;
+    s->last_us = rec->arrival_us;
+}
+
+// Empty packets (TOC byte only) for frames that never arrived; decoders
+// treat them as lost and conceal, and the granule keeps real time
+static void stream_fill(archive_ctx_t *ctx, archive_stream_t *s, int frames) {
+    uint8_t toc = s->toc & 0xFC;                // Code 0: one frame
+    int samples = opus_packet_get_nb_samples(&toc, 1, OGG_GRANULE_RATE);
+    if (samples <= 0) return;
+
+    for (int i = 0; i < frames; i++) {
+        page_add(ctx, s, &toc, 1, samples);
+    }
+    s->gap_frames += frames;
+    ctx->stats.gap_frames += frames;
+}
+
+// Writer thread: one record from the ring
+static void archive_process(archive_ctx_t *ctx, const archive_rec_t *rec) {
+    archive_stream_t *s;
+
+    if (rec->flags & PKT_FLAG_START) {
+        s = stream_find(ctx, rec, true);
+        if (s->active) stream_close(ctx, s);
+        stream_start(s, rec, rec->seq_num + 1);
+        return;
+    }
+
+    if (rec->flags & PKT_FLAG_END) {
+        s = stream_find(ctx, rec, false);
+        if (!s) return;
+        // Frames lost at the very end still count towards the length
+        int32_t gap = seq_diff(rec->seq_num, s->next_seq);
+        if (s->fd >= 0 && gap > 0 && gap <= ARCHIVE_MAX_GAP_FRAMES) {
+            stream_fill(ctx, s, gap);
+        }
+        s->last_us = rec->arrival_us;
+        stream_close(ctx, s);
+        return;
+    }
+
+    if (rec->opus_size == 0) return;
+
+    // Joined mid-burst (START lost, or we came up late): start here
+    s = stream_find(ctx, rec, true);
+    if (!s->active) stream_start(s, rec, rec->seq_num);
+    s->last_us = rec->arrival_us;
+    if (s->failed) return;
+
+    int32_t gap = seq_diff(rec->seq_num, s->next_seq);
+    if (gap < 0) {
+        // Its place in the file is already taken by a gap packet
+        ctx->stats.late++;
+        return;
+    }
+
+    int samples = opus_packet_get_nb_samples(rec->data, rec->opus_size, OGG_GRANULE_RATE);
+    if (samples <= 0) return;
+
+    if (s->fd < 0) {
+        if (stream_open(ctx, s) < 0) return;
+    } else if (gap > 0 && gap <= ARCHIVE_MAX_GAP_FRAMES) {
+        stream_fill(ctx, s, gap);
+    }
+    // Longer gaps: the sender restarted or we lost contact; carry on
+    // without padding rather than write seconds of concealment
+
+    page_add(ctx, s, rec->data, rec->opus_size, samples);
+    s->next_seq = rec->seq_num + 1;
+    s->toc = rec->data[0];
+    s->packets++;
+    ctx->stats.packets++;
+}
+
+// Close bursts whose END never came, and push out what quiet streams buffered
+static void archive_housekeeping(archive_ctx_t *ctx, uint64_t now_us) {
+    for (int i = 0; i < ARCHIVE_MAX_STREAMS; i++) {
+        archive_stream_t *s = &ctx->streams[i];
+        if (!s->active) continue;
+
+        if (now_us - s->last_us > (uint64_t)ARCHIVE_IDLE_MS * 1000) {
+            stream_close(ctx, s);
+        } else if (s->fd >= 0 && s->out_len > 0 &&
+                   now_us - s->written_us > (uint64_t)ARCHIVE_FLUSH_MS * 1000) {
+            stream_write(ctx, s, now_us);
+        }
+    }
+}
+
+static void *archive_writer(void *arg) {
+    archive_ctx_t *ctx = arg;
+
+    for (;;) {
+        struct timespec ts;
+        clock_gettime(CLOCK_REALTIME, &ts);
+        ts.tv_nsec += ARCHIVE_WAKE_MS * 1000000L;
+        if (ts.tv_nsec >= 1000000000L) {
+            ts.tv_sec++;
+            ts.tv_nsec -= 1000000000L;
+        }
+        sem_timedwait(&ctx->ready, &ts);
+
+        // Everything queued so far; the posts for it are consumed by the
+        // next waits, which then find the ring empty
+        uint32_t head = __atomic_load_n(&ctx->head, __ATOMIC_ACQUIRE);
+        uint32_t tail = ctx->tail;
+        while (tail != head) {
+            archive_process(ctx, &ctx->ring[tail & (ARCHIVE_RING_SLOTS - 1)]);
+            tail++;
+            __atomic_store_n(&ctx->tail, tail, __ATOMIC_RELEASE);
+        }
+
+        archive_housekeeping(ctx, network_time_us());
+
+        if (__atomic_load_n(&ctx->stop, __ATOMIC_ACQUIRE) &&
+            __atomic_load_n(&ctx->head, __ATOMIC_ACQUIRE) == tail) {
+            break;
+        }
+    }
+
+    for (int i = 0; i < ARCHIVE_MAX_STREAMS; i++) {
+        stream_close(ctx, &ctx->streams[i]);
+    }
+    return NULL;
+}
+
+int archive_init(archive_ctx_t *ctx, const char *dir) {
+    memset(ctx, 0, sizeof(archive_ctx_t));
+
+    if (snprintf(ctx->dir, sizeof(ctx->dir), "%s", dir) >= (int)sizeof(ctx->dir)) {
+        fprintf(stderr, "Archive directory name too long\n");
+        return -1;
+    }
+    if (mkdir(dir, 0755) < 0 && errno != EEXIST) {
+        perror(dir);
+        return -1;
+    }
+
+    ogg_crc_init();
+
+    // All buffers up front, nothing is allocated while archiving
+    ctx->ring = calloc(ARCHIVE_RING_SLOTS, sizeof(archive_rec_t));
+    ctx->arena = malloc((size_t)ARCHIVE_MAX_STREAMS * (ARCHIVE_PAGE_BODY + ARCHIVE_BUFFER));
+    if (!ctx->ring || !ctx->arena) {
+        fprintf(stderr, "Archive: out of memory\n");
+        free(ctx->ring);
+        free(ctx->arena);
+        return -1;
+    }
+
+    for (int i = 0; i < ARCHIVE_MAX_STREAMS; i++) {
+        archive_stream_t *s = &ctx->streams[i];
+        s->body = ctx->arena + (size_t)i * (ARCHIVE_PAGE_BODY + ARCHIVE_BUFFER);
+        s->out = s->body + ARCHIVE_PAGE_BODY;
+        s->fd = -1;
+    }
+
+    if (sem_init(&ctx->ready, 0, 0) < 0) {
+        perror("sem_init");
+        free(ctx->ring);
+        free(ctx->arena);
+        return -1;
+    }
+
+    if (pthread_create(&ctx->writer, NULL, archive_writer, ctx) != 0) {
+        fprintf(stderr, "Archive: failed to start writer thread\n");
+        sem_destroy(&ctx->ready);
+        free(ctx->ring);
+        free(ctx->arena);
+        return -1;
+    }
+
+    ctx->initialized = true;
+    printf("Archive: talk-bursts to %s\n", ctx->dir);
+    return 0;
+}
+
+void archive_tap(archive_ctx_t *ctx, const network_packet_t *packet, int len, uint64_t now_us) {
+    if (!ctx->initialized || len < (int)PACKET_HEADER_SIZE) return;
+    if ((packet->flags & PKT_FLAG_SYNC) || (size_t)len < PACKET_HEADER_SIZE + packet->opus_size) {
+        return;
+    }
+
+    // Only the packet's own frame is filed, not the redundant copies
+    const uint8_t *data;
+    int size = red_primary(packet, &data);
+    if (size > MAX_PACKET_SIZE || (size == 0 && packet->opus_size > 0)) return;
+
+    uint32_t head = ctx->head;
+    if (head - __atomic_load_n(&ctx->tail, __ATOMIC_ACQUIRE) >= ARCHIVE_RING_SLOTS) {
+        ctx->stats.ring_drops++;
+        return;
+    }
+
+    archive_rec_t *rec = &ctx->ring[head & (ARCHIVE_RING_SLOTS - 1)];
+    rec->board_id = packet->board_id;
+    rec->seq_num = packet->seq_num;
+    rec->flags = packet->flags;
+    rec->talkgroup = packet->talkgroup;
+    rec->opus_size = (uint16_t)size;
+    rec->arrival_us = now_us;
+    memcpy(rec->data, data, size);
+
+    __atomic_store_n(&ctx->head, head + 1, __ATOMIC_RELEASE);
+    sem_post(&ctx->ready);
+}
+
+void archive_cleanup(archive_ctx_t *ctx) {
+    if (!ctx->initialized) return;
+
+    __atomic_store_n(&ctx->stop, true, __ATOMIC_RELEASE);
+    sem_post(&ctx->ready);
+    pthread_join(ctx->writer, NULL);
+
+    printf("Archive: %lu bursts, %lu packets, %lu gap frames, %lu late, %lu dropped, %lu KB\n",
+           (unsigned long)ctx->stats.bursts, (unsigned long)ctx->stats.packets,
+           (unsigned long)ctx->stats.gap_frames, (unsigned long)ctx->stats.late,
+           (unsigned long)ctx->stats.ring_drops,
+           (unsigned long)(ctx->stats.bytes_written / 1024));
+
+    sem_destroy(&ctx->ready);
+    free(ctx->ring);
+    free(ctx->arena);
+    ctx->ring = NULL;
+    ctx->arena = NULL;
+    ctx->initialized = false;
+}
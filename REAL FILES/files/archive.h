@@ -0,0 +1,114 @@
+#ifndef ARCHIVE_H
+#define ARCHIVE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include <semaphore.h>
+
+#include "opus_helper.h"
+#include "network.h"
+
+// Talk-burst archive: every received transmission is written, as sent, to
+// its own Ogg Opus file (RFC 7845) that any player opens. No decoding or
+// re-encoding; the Opus packets go straight into Ogg pages.
+//
+// The RX thread only copies each packet into a ring (archive_tap never
+// blocks or touches the disk). A writer thread sorts packets by sender,
+// fills sequence gaps with empty packets (the player conceals them, so
+// the timeline stays right), builds pages and writes them in large
+// batches.
+//
+// Files: <dir>/YYYYMMDD-HHMMSS-b<board>-tg<talkgroup>.opus, from
+// WT_ARCHIVE=<dir> (or "archive" in the config file).
+
+#define ARCHIVE_RING_SLOTS      256         // ~5 s of one talker, power of 2
+#define ARCHIVE_MAX_STREAMS     8           // Senders archived at once
+#define ARCHIVE_MAX_GAP_FRAMES  250         // Longer gaps restart the timeline (5 s)
+#define ARCHIVE_IDLE_MS         2000        // No END: close after this much silence
+#define ARCHIVE_PATH_MAX        256
+
+// One received packet as the RX thread saw it
+typedef struct {
+    uint32_t board_id;
+    uint32_t seq_num;
+    uint8_t flags;
+    uint8_t talkgroup;
+    uint16_t opus_size;
+    uint64_t arrival_us;
+    uint8_t data[MAX_PACKET_SIZE];
+} archive_rec_t;
+
+// One sender's file in progress
+typedef struct {
+    bool active;                    // Burst seen, file may not be open yet
+    uint32_t board_id;
+    uint8_t talkgroup;
+    int fd;                         // -1 until the first audio packet
+    bool failed;                    // File could not be created, skip this burst
+    char path[ARCHIVE_PATH_MAX];
+
+    uint32_t next_seq;              // Next audio packet expected
+    uint8_t toc;                    // Last TOC byte, for gap packets
+    uint64_t last_us;               // Arrival of the last packet
+
+    // Ogg stream
+    uint32_t serial;
+    uint32_t page_seq;
+    uint64_t granule;               // 48 kHz samples up to the last packet
+
+    // Page being built
+    uint8_t *body;
+    int body_len;
+    uint8_t lacing[255];
+    int segments;
+    int page_packets;
+
+    // Finished pages, written out in large chunks
+    uint8_t *out;
+    size_t out_len;
+    uint64_t written_us;            // Last write()
+
+    uint64_t packets;
+    uint64_t gap_frames;
+} archive_stream_t;
+
+typedef struct {
+    uint64_t bursts;                // Files written
+    uint64_t packets;               // Audio packets archived
+    uint64_t gap_frames;            // Filled with empty packets
+    uint64_t late;                  // Arrived after their slot was written
+    uint64_t ring_drops;            // Writer fell behind
+    uint64_t bytes_written;
+    uint64_t write_errors;
+} archive_stats_t;
+
+typedef struct {
+    char dir[ARCHIVE_PATH_MAX - 64]; // Room left for the file names
+
+    // RX thread -> writer, single producer / single consumer
+    archive_rec_t *ring;
+    uint32_t head;                  // Written by archive_tap
+    uint32_t tail;                  // Written by the writer
+    sem_t ready;
+
+    archive_stream_t streams[ARCHIVE_MAX_STREAMS];
+    uint8_t *arena;                 // Page and output buffers of all streams
+
+    pthread_t writer;
+    bool stop;
+
+    archive_stats_t stats;
+    bool initialized;
+} archive_ctx_t;
+
+// Creates dir if needed and starts the writer thread
+int archive_init(archive_ctx_t *ctx, const char *dir);
+
+// RX thread: queue one packet exactly as network_recv returned it
+void archive_tap(archive_ctx_t *ctx, const network_packet_t *packet, int len, uint64_t now_us);
+
+// Writes out what is queued, closes every open file, stops the writer
+void archive_cleanup(archive_ctx_t *ctx);
+
+#endif // ARCHIVE_H
@@ -1,4 +1,5 @@
 #include "audio_dma.h"
+#include "wtlog.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -6,111 +7,245 @@
 #include <fcntl.h>
 #include <sys/mman.h>
 #include <errno.h>
-
-// MM2S (Memory to Stream): Playback (to speaker)
-// S2MM (Stream to Memory): Capture (from microphone)
-// CTRL: Start/reset/control
-// STATUS: Flags about DMA status
-// SA/DA: Source/Destination addresses
-// LENGTH: How many bytes to transfer
-
-// DMA Register Offsets
-#define MM2S_CTRL       0x00
-#define MM2S_STATUS     0x04
-#define MM2S_SA         0x18
-#define MM2S_LENGTH     0x28
-
-#define S2MM_CTRL       0x30
-#define S2MM_STATUS     0x34
-#define S2MM_DA         0x48
-#define S2MM_LENGTH     0x58
-
-// CTRL_RUN: Start DMA
-// CTRL_RESET: Reset DMA channel
-// STAT_HALTED: DMA stopped
-// STAT_IDLE: DMA is idle
-// STAT_IOC: Interrupt on completion flag
-
-// Control register bits
-#define CTRL_RUN        0x00000001
-#define CTRL_RESET      0x00000004
-
-// Status register bits
-#define STAT_HALTED     0x00000001
-#define STAT_IDLE       0x00000002
-#define STAT_IOC        0x00001000
-
+#include <time.h>
 
 // Register access macros
 // Thes are the macros that read and write to the DMA registers using pointer arithmetic
+// (or through the simulator's accessors, see dma_sim.h)
 #define DMA_WRITE(ctx, offset, value) \
-    (*((volatile uint32_t *)((ctx)->dma_regs + (offset))) = (value))
+    ((ctx)->regs_ops ? (ctx)->regs_ops->write((ctx)->regs_arg, (offset), (value)) : \
+     (void)(*((volatile uint32_t *)((ctx)->dma_regs + (offset))) = (value)))
 
 #define DMA_READ(ctx, offset) \
-    (*((volatile uint32_t *)((ctx)->dma_regs + (offset))))
+    ((ctx)->regs_ops ? (ctx)->regs_ops->read((ctx)->regs_arg, (offset)) : \
+     *((volatile uint32_t *)((ctx)->dma_regs + (offset))))
 
-// Initialize DMA
+static const uint32_t ctrl_reg[DMA_CHANNELS] = { MM2S_CTRL, S2MM_CTRL };
+static const uint32_t status_reg[DMA_CHANNELS] = { MM2S_STATUS, S2MM_STATUS };
+static const uint32_t addr_reg[DMA_CHANNELS] = { MM2S_SA, S2MM_DA };
+static const uint32_t length_reg[DMA_CHANNELS] = { MM2S_LENGTH, S2MM_LENGTH };
+static const char *channel_name[DMA_CHANNELS] = { "MM2S", "S2MM" };
+
+static uint64_t now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+// Initialize DMA at the default addresses
 int dma_init(dma_ctx_t *ctx) {
-    // Clear the context structure
-    memset(ctx, 0, sizeof(dma_ctx_t));
+    return dma_init_at(ctx, DMA_BASE_ADDR, DMA_MEM_BASE);
+}
+
+// Initialize DMA with the registers at regs_base and buffers from mem_base
+// (or u-dma-buf, when the board has it)
+int dma_init_at(dma_ctx_t *ctx, uint32_t regs_base, uint32_t mem_base) {
+    return dma_init_buf(ctx, regs_base, mem_base, NULL);
+}
+
+// One number from a u-dma-buf sysfs attribute (decimal or 0x hex)
+static int udmabuf_attr(const char *dev, const char *attr, unsigned long long *value) {
+    char path[128];
+    char text[32];
     
-    // Open /dev/mem to allow direct memory access to DMA registers and buffers
-    ctx->mem_fd = open("/dev/mem", O_RDWR | O_SYNC);
-    if (ctx->mem_fd < 0) {
-        perror("Failed to open /dev/mem");
+    snprintf(path, sizeof(path), DMA_UDMABUF_SYSFS "/%s/%s", dev, attr);
+    FILE *f = fopen(path, "r");
+    if (!f) return -1;
+    
+    int ok = fgets(text, sizeof(text), f) != NULL;
+    fclose(f);
+    if (!ok) return -1;
+    
+    char *end;
+    errno = 0;
+    *value = strtoull(text, &end, 0);
+    return (errno || end == text) ? -1 : 0;
+}
+
+// Cached buffers from /dev/<dev>: both buffers in one mapping, sync
+// attributes opened once so a sync is only a few small writes
+static int udmabuf_open(dma_ctx_t *ctx, const char *dev, bool quiet) {
+    static const char *sync_names[DMA_SYNC_FILES] = {
+        "sync_offset", "sync_size", "sync_direction", "sync_for_cpu", "sync_for_device"
+    };
+    unsigned long long phys, size;
+    char path[128];
+    
+    if (udmabuf_attr(dev, "phys_addr", &phys) < 0 || udmabuf_attr(dev, "size", &size) < 0) {
+        if (!quiet) fprintf(stderr, "u-dma-buf %s not found\n", dev);
+        return -1;
+    }
+    if (size < DMA_TX_OFFSET + DMA_TX_BYTES || phys + size > 0x100000000ULL) {
+        fprintf(stderr, "u-dma-buf %s: need %d bytes below 4 GB, have %llu at 0x%llx\n",
+                dev, DMA_TX_OFFSET + DMA_TX_BYTES, size, phys);
         return -1;
     }
     
-    // Map the DMA hardware registers into user space.
-    ctx->dma_regs = mmap(NULL, 0x10000, PROT_READ | PROT_WRITE,
-                         MAP_SHARED, ctx->mem_fd, DMA_BASE_ADDR);
-    if (ctx->dma_regs == MAP_FAILED) {
-        perror("Failed to map DMA registers");
-        close(ctx->mem_fd);
+    // No O_SYNC: the driver maps the buffer cacheable
+    snprintf(path, sizeof(path), "/dev/%s", dev);
+    ctx->buf_fd = open(path, O_RDWR);
+    if (ctx->buf_fd < 0) {
+        perror(path);
         return -1;
     }
     
+    ctx->buf_size = size;
+    ctx->buf_map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, ctx->buf_fd, 0);
+    if (ctx->buf_map == MAP_FAILED) {
+        perror("Failed to map u-dma-buf");
+        ctx->buf_map = NULL;
+        close(ctx->buf_fd);
+        ctx->buf_fd = -1;
+        return -1;
+    }
+    
+    for (int i = 0; i < DMA_SYNC_FILES; i++) {
+        snprintf(path, sizeof(path), DMA_UDMABUF_SYSFS "/%s/%s", dev, sync_names[i]);
+        ctx->sync_fd[i] = open(path, O_WRONLY);
+        if (ctx->sync_fd[i] < 0) {
+            perror(path);
+            while (i-- > 0) close(ctx->sync_fd[i]);
+            munmap(ctx->buf_map, ctx->buf_size);
+            ctx->buf_map = NULL;
+            close(ctx->buf_fd);
+            ctx->buf_fd = -1;
+            return -1;
+        }
+    }
+    pthread_mutex_init(&ctx->sync_lock, NULL);
+    
+    ctx->rx_buffer = ctx->buf_map;
+    ctx->tx_buffer = (uint8_t *)ctx->buf_map + DMA_TX_OFFSET;
+    ctx->rx_phys_addr = (uint32_t)phys;
+    ctx->tx_phys_addr = (uint32_t)phys + DMA_TX_OFFSET;
+    ctx->buf_mode = DMA_BUF_UDMABUF;
+    return 0;
+}
+
+// The original uncached buffers at a fixed physical address
+static int devmem_open(dma_ctx_t *ctx, uint32_t mem_base) {
     // Map RX audio buffer into virtual memory.
-    ctx->rx_phys_addr = DMA_MEM_BASE;
+    ctx->rx_phys_addr = mem_base;
 
     // PROT_READ | PROT_WRITE allows reading and writing
     // MAP_SHARED means changes are shared with other processes
     // mem_fd is the file descriptor for /dev/mem
     // rx_phys_addr is the physical address to map
     
-    ctx->rx_buffer = mmap(NULL, FRAME_BYTES, PROT_READ | PROT_WRITE,
+    ctx->rx_buffer = mmap(NULL, DMA_RX_BYTES, PROT_READ | PROT_WRITE,
                          MAP_SHARED, ctx->mem_fd, ctx->rx_phys_addr);
     if (ctx->rx_buffer == MAP_FAILED) {
         perror("Failed to map RX buffer");
-        munmap(ctx->dma_regs, 0x10000);
-        close(ctx->mem_fd);
+        ctx->rx_buffer = NULL;
         return -1;
     }
     
     // Map TX buffer (for playback to speaker)
-    ctx->tx_phys_addr = DMA_MEM_BASE + 0x10000;  // Offset from RX buffer
-    ctx->tx_buffer = mmap(NULL, FRAME_BYTES, PROT_READ | PROT_WRITE,
+    ctx->tx_phys_addr = mem_base + DMA_TX_OFFSET;  // Offset from RX buffer
+    ctx->tx_buffer = mmap(NULL, DMA_TX_BYTES, PROT_READ | PROT_WRITE,
                          MAP_SHARED, ctx->mem_fd, ctx->tx_phys_addr);
     if (ctx->tx_buffer == MAP_FAILED) {
         perror("Failed to map TX buffer");
-        munmap(ctx->rx_buffer, FRAME_BYTES);
+        munmap(ctx->rx_buffer, DMA_RX_BYTES);
+        ctx->rx_buffer = NULL;
+        ctx->tx_buffer = NULL;
+        return -1;
+    }
+    
+    ctx->buf_mode = DMA_BUF_DEVMEM;
+    return 0;
+}
+
+int dma_init_buf(dma_ctx_t *ctx, uint32_t regs_base, uint32_t mem_base, const char *udmabuf) {
+    // Clear the context structure
+    memset(ctx, 0, sizeof(dma_ctx_t));
+    ctx->regs_phys_addr = regs_base;
+    ctx->buf_fd = -1;
+    
+    // Open /dev/mem to allow direct memory access to DMA registers and buffers
+    ctx->mem_fd = open("/dev/mem", O_RDWR | O_SYNC);
+    if (ctx->mem_fd < 0) {
+        perror("Failed to open /dev/mem");
+        return -1;
+    }
+    
+    // Map the DMA hardware registers into user space (always uncached).
+    ctx->dma_regs = mmap(NULL, 0x10000, PROT_READ | PROT_WRITE,
+                         MAP_SHARED, ctx->mem_fd, regs_base);
+    if (ctx->dma_regs == MAP_FAILED) {
+        perror("Failed to map DMA registers");
+        close(ctx->mem_fd);
+        return -1;
+    }
+    
+    // Cached buffers unless turned off; a named device that does not work
+    // is worth a warning, a missing default one is not
+    bool explicit = udmabuf && udmabuf[0];
+    bool cached = false;
+    if (!explicit || strcmp(udmabuf, "off") != 0) {
+        cached = udmabuf_open(ctx, explicit ? udmabuf : DMA_UDMABUF_DEFAULT, !explicit) == 0;
+        if (!cached && explicit) {
+            fprintf(stderr, "Falling back to uncached /dev/mem audio buffers\n");
+        }
+    }
+    
+    if (!cached && devmem_open(ctx, mem_base) < 0) {
         munmap(ctx->dma_regs, 0x10000);
         close(ctx->mem_fd);
         return -1;
     }
     
+    pthread_mutex_init(&ctx->regs_lock, NULL);
     ctx->initialized = true;
     
     printf("DMA initialised:\n");
-    printf("  Registers: 0x%08X\n", DMA_BASE_ADDR);
+    printf("  Registers: 0x%08X\n", ctx->regs_phys_addr);
     printf("  RX Buffer: 0x%08X\n", ctx->rx_phys_addr);
     printf("  TX Buffer: 0x%08X\n", ctx->tx_phys_addr);
+    printf("  Buffers: %s\n", cached ? "cached (u-dma-buf, synced per transfer)" : "uncached (/dev/mem)");
     printf("  Frame size: %d bytes (%d samples)\n", 
            FRAME_BYTES, SAMPLES_PER_FRAME);
     
     return 0;
 }
 
+// Write one value to a sync attribute
+static int sync_write(int fd, unsigned long value) {
+    char text[24];
+    int len = snprintf(text, sizeof(text), "%lu", value);
+    return pwrite(fd, text, len, 0) == len ? 0 : -1;
+}
+
+// Set up the range and direction, then trigger the sync. RX buffer data
+// comes from the device, TX buffer data goes to it.
+static void udmabuf_sync(dma_ctx_t *ctx, const void *buf, size_t bytes, int trigger) {
+    if (ctx->buf_mode != DMA_BUF_UDMABUF) return;
+    
+    size_t offset = (const uint8_t *)buf - (const uint8_t *)ctx->buf_map;
+    if (offset >= ctx->buf_size) return;
+    if (bytes > ctx->buf_size - offset) bytes = ctx->buf_size - offset;
+    unsigned long direction = offset >= DMA_TX_OFFSET ? 1 : 2;    // DMA_TO/FROM_DEVICE
+    
+    pthread_mutex_lock(&ctx->sync_lock);
+    int r = sync_write(ctx->sync_fd[DMA_SYNC_OFFSET], offset);
+    r |= sync_write(ctx->sync_fd[DMA_SYNC_SIZE], bytes);
+    r |= sync_write(ctx->sync_fd[DMA_SYNC_DIRECTION], direction);
+    r |= sync_write(ctx->sync_fd[trigger], 1);
+    pthread_mutex_unlock(&ctx->sync_lock);
+    
+    if (r < 0) {
+        WTLOG_ERROR("u-dma-buf sync failed: %s", strerror(errno));
+    }
+}
+
+void dma_sync_for_cpu(dma_ctx_t *ctx, const void *buf, size_t bytes) {
+    udmabuf_sync(ctx, buf, bytes, DMA_SYNC_FOR_CPU);
+}
+
+void dma_sync_for_device(dma_ctx_t *ctx, const void *buf, size_t bytes) {
+    udmabuf_sync(ctx, buf, bytes, DMA_SYNC_FOR_DEVICE);
+}
+
 // Write to reset the DMA channels and wait for them to halt
 int dma_reset(dma_ctx_t *ctx) {
     if (!ctx->initialized) {
@@ -144,10 +279,22 @@ int dma_reset(dma_ctx_t *ctx) {
     return 0;
 }
 
+// Arm one channel: run, address, then length starts the transfer
+static void arm_channel(dma_ctx_t *ctx, dma_channel_t ch, uint32_t phys_addr, uint32_t bytes) {
+    ctx->armed_addr[ch] = phys_addr;
+    ctx->armed_bytes[ch] = bytes;
+    __atomic_store_n(&ctx->armed_us[ch], now_us(), __ATOMIC_RELAXED);
+    __atomic_store_n(&ctx->reset_idle[ch], false, __ATOMIC_RELEASE);
+    
+    DMA_WRITE(ctx, ctrl_reg[ch], CTRL_RUN);
+    DMA_WRITE(ctx, addr_reg[ch], phys_addr);
+    DMA_WRITE(ctx, length_reg[ch], bytes);
+}
+
 // Start audio capture
 int dma_start_capture(dma_ctx_t *ctx, int32_t *buffer, size_t bytes) {
     if (!ctx->initialized) {
-        fprintf(stderr, "DMA not initialised\n");
+        WTLOG_ERROR("DMA not initialised");
         return -1;
     }
     
@@ -155,10 +302,15 @@ int dma_start_capture(dma_ctx_t *ctx, int32_t *buffer, size_t bytes) {
     uintptr_t offset = (uintptr_t)buffer - (uintptr_t)ctx->rx_buffer;
     uint32_t phys_addr = ctx->rx_phys_addr + offset;
     
+    // No dirty cache lines may be written back over what the DMA writes
+    dma_sync_for_device(ctx, buffer, bytes);
+    ctx->capture_buf = buffer;
+    ctx->capture_bytes = bytes;
+    
     // Then sets up and starts the S2MM channel for capture
-    DMA_WRITE(ctx, S2MM_CTRL, CTRL_RUN);
-    DMA_WRITE(ctx, S2MM_DA, phys_addr);
-    DMA_WRITE(ctx, S2MM_LENGTH, bytes);
+    pthread_mutex_lock(&ctx->regs_lock);
+    arm_channel(ctx, DMA_CH_S2MM, phys_addr, bytes);
+    pthread_mutex_unlock(&ctx->regs_lock);
     
     return 0;
 }
@@ -166,73 +318,182 @@ int dma_start_capture(dma_ctx_t *ctx, int32_t *buffer, size_t bytes) {
 // Start audio playback
 int dma_start_playback(dma_ctx_t *ctx, const int32_t *buffer, size_t bytes) {
     if (!ctx->initialized) {
-        fprintf(stderr, "DMA not initialised\n");
+        WTLOG_ERROR("DMA not initialised");
         return -1;
     }
     
-    // First copy the supplied audio data into the TX buffer
-    memcpy(ctx->tx_buffer, buffer, bytes);
+    // First copy the supplied audio data into the TX buffer (callers
+    // that converted straight into the TX area have nothing to copy)
+    uintptr_t offset = (uintptr_t)buffer - (uintptr_t)ctx->tx_buffer;
+    if (offset > DMA_TX_BYTES || bytes > DMA_TX_BYTES - offset) {
+        memcpy(ctx->tx_buffer, buffer, bytes);
+        offset = 0;
+    }
+    void *src = (uint8_t *)ctx->tx_buffer + offset;
+    
+    // Push the CPU's writes out of the cache before the DMA reads them
+    dma_sync_for_device(ctx, src, bytes);
     
     // Start MM2S channel
-    DMA_WRITE(ctx, MM2S_CTRL, CTRL_RUN);
-    DMA_WRITE(ctx, MM2S_SA, ctx->tx_phys_addr);
-    DMA_WRITE(ctx, MM2S_LENGTH, bytes);
+    pthread_mutex_lock(&ctx->regs_lock);
+    arm_channel(ctx, DMA_CH_MM2S, ctx->tx_phys_addr + (uint32_t)offset, bytes);
+    pthread_mutex_unlock(&ctx->regs_lock);
     
     return 0;
 }
 
-// Check if capture is busy
-bool dma_capture_busy(dma_ctx_t *ctx) {
+// Busy unless idle, or reset by a recovery with no transfer to restart
+static bool channel_busy(dma_ctx_t *ctx, dma_channel_t ch) {
     if (!ctx->initialized) return false;
+    if (__atomic_load_n(&ctx->reset_idle[ch], __ATOMIC_ACQUIRE)) return false;
     
-    uint32_t status = DMA_READ(ctx, S2MM_STATUS);
+    uint32_t status = DMA_READ(ctx, status_reg[ch]);
     // Return true if not idle
     return !(status & STAT_IDLE);
 }
 
+// Check if capture is busy
+bool dma_capture_busy(dma_ctx_t *ctx) {
+    return channel_busy(ctx, DMA_CH_S2MM);
+}
+
 // Check if playback is busy
 bool dma_playback_busy(dma_ctx_t *ctx) {
-    if (!ctx->initialized) return false;
+    return channel_busy(ctx, DMA_CH_MM2S);
+}
+
+uint32_t dma_channel_errors(dma_ctx_t *ctx, dma_channel_t ch) {
+    if (!ctx->initialized) return 0;
+    return DMA_READ(ctx, status_reg[ch]) & DMA_ERR_MASK;
+}
+
+const char *dma_error_names(uint32_t errors, char *buf, size_t len) {
+    static const struct { uint32_t bit; const char *name; } names[] = {
+        { DMA_ERR_INTERNAL, "DMAIntErr" },
+        { DMA_ERR_SLAVE, "DMASlvErr" },
+        { DMA_ERR_DECODE, "DMADecErr" },
+    };
+    size_t used = 0;
     
-    uint32_t status = DMA_READ(ctx, MM2S_STATUS);
-    return !(status & STAT_IDLE);
+    buf[0] = '\0';
+    for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); i++) {
+        if (!(errors & names[i].bit) || used >= len) continue;
+        used += snprintf(buf + used, len - used, "%s%s", used ? "|" : "", names[i].name);
+    }
+    if (!buf[0]) snprintf(buf, len, errors ? "0x%08X" : "stalled", errors);
+    return buf;
 }
 
-// Wait for capture to complete
-int dma_wait_capture(dma_ctx_t *ctx, int timeout_ms) {
-    int elapsed = 0;
+static void count_errors(dma_health_t *h, uint32_t status) {
+    h->last_status = status;
+    if (status & DMA_ERR_INTERNAL) h->internal_errors++;
+    if (status & DMA_ERR_SLAVE) h->slave_errors++;
+    if (status & DMA_ERR_DECODE) h->decode_errors++;
+}
+
+int dma_recover(dma_ctx_t *ctx, dma_channel_t ch, uint32_t errors) {
+    if (!ctx->initialized) return -1;
     
-    // Polling loop to wait for capture to finish
-    while (dma_capture_busy(ctx) && elapsed < timeout_ms) {
-        usleep(100);
-        elapsed++;
+    uint64_t start = now_us();
+    dma_channel_t other = ch == DMA_CH_MM2S ? DMA_CH_S2MM : DMA_CH_MM2S;
+    dma_health_t *h = &ctx->health[ch];
+    
+    pthread_mutex_lock(&ctx->regs_lock);
+    
+    // Both threads can see the same failure; the second finds it gone
+    uint32_t status = DMA_READ(ctx, status_reg[ch]);
+    if (errors && !(status & DMA_ERR_MASK)) {
+        pthread_mutex_unlock(&ctx->regs_lock);
+        return 0;
     }
     
-    if (elapsed >= timeout_ms) {
-        fprintf(stderr, "Capture timeout\n");
+    count_errors(h, status);
+    if (!errors) h->stalls++;
+    
+    // The other channel loses whatever it was doing. A capture in flight
+    // (or failed at the same time) starts again, its waiter is none the
+    // wiser; playback is left idle so the playout thread moves on to the
+    // next period rather than play this one twice.
+    uint32_t other_status = DMA_READ(ctx, status_reg[other]);
+    bool restart = other == DMA_CH_S2MM &&
+                   !__atomic_load_n(&ctx->reset_idle[other], __ATOMIC_ACQUIRE) &&
+                   !(other_status & STAT_IDLE) &&
+                   (!(other_status & STAT_HALTED) || (other_status & DMA_ERR_MASK));
+    if (other_status & DMA_ERR_MASK) count_errors(&ctx->health[other], other_status);
+    
+    // The reset bit clears itself when the engine is back, halted
+    DMA_WRITE(ctx, ctrl_reg[ch], CTRL_RESET);
+    bool done = false;
+    while (!done && now_us() - start < DMA_RESET_TIMEOUT_US) {
+        done = !(DMA_READ(ctx, ctrl_reg[ch]) & CTRL_RESET) &&
+               (DMA_READ(ctx, MM2S_STATUS) & STAT_HALTED) &&
+               (DMA_READ(ctx, S2MM_STATUS) & STAT_HALTED);
+    }
+    
+    if (!done) {
+        h->failed++;
+        pthread_mutex_unlock(&ctx->regs_lock);
+        WTLOG_ERROR("DMA %s reset did not finish in %d us", channel_name[ch], DMA_RESET_TIMEOUT_US);
         return -1;
     }
     
+    // The failed transfer is lost; its owner arms the next one
+    __atomic_store_n(&ctx->reset_idle[ch], true, __ATOMIC_RELEASE);
+    if (restart) {
+        arm_channel(ctx, other, ctx->armed_addr[other], ctx->armed_bytes[other]);
+    } else {
+        __atomic_store_n(&ctx->reset_idle[other], true, __ATOMIC_RELEASE);
+    }
+    
+    uint32_t took = (uint32_t)(now_us() - start);
+    h->recoveries++;
+    if (took > h->recover_us_max) h->recover_us_max = took;
+    if (took > DMA_RECOVER_BUDGET_US) h->over_budget++;
+    pthread_mutex_unlock(&ctx->regs_lock);
+    
+    char names[48];
+    WTLOG_WARN("DMA %s %s (status 0x%08X), reset in %u us%s", channel_name[ch],
+               dma_error_names(errors, names, sizeof(names)), status, took,
+               restart ? ", capture restarted" : "");
     return 0;
 }
 
-// Wait for playback to complete
-int dma_wait_playback(dma_ctx_t *ctx, int timeout_ms) {
-    int elapsed = 0;
-    
-    while (dma_playback_busy(ctx) && elapsed < timeout_ms) {
+// Wait for a transfer, recovering the channel if it fails. The timeout
+// runs from when the transfer was armed (a recovery may restart it).
+static int wait_channel(dma_ctx_t *ctx, dma_channel_t ch, int timeout_ms) {
+    // Polling loop to wait for the transfer to finish
+    while (channel_busy(ctx, ch)) {
+        uint32_t errors = dma_channel_errors(ctx, ch);
+        if (errors) {
+            dma_recover(ctx, ch, errors);
+            return -1;
+        }
+        uint64_t armed = __atomic_load_n(&ctx->armed_us[ch], __ATOMIC_RELAXED);
+        if (now_us() >= armed + (uint64_t)timeout_ms * 1000) {
+            // Still busy: stuck (dma_recover says so)
+            dma_recover(ctx, ch, 0);
+            return -1;
+        }
         usleep(100);
-        elapsed++;
     }
     
-    if (elapsed >= timeout_ms) {
-        fprintf(stderr, "Playback timeout\n");
-        return -1;
-    }
+    return 0;
+}
+
+// Wait for capture to complete
+int dma_wait_capture(dma_ctx_t *ctx, int timeout_ms) {
+    if (wait_channel(ctx, DMA_CH_S2MM, timeout_ms) < 0) return -1;
     
+    // Drop stale cache lines so the CPU sees the new samples
+    dma_sync_for_cpu(ctx, ctx->capture_buf, ctx->capture_bytes);
     return 0;
 }
 
+// Wait for playback to complete
+int dma_wait_playback(dma_ctx_t *ctx, int timeout_ms) {
+    return wait_channel(ctx, DMA_CH_MM2S, timeout_ms);
+}
+
 // Get RX buffer pointer
 int32_t* dma_get_rx_buffer(dma_ctx_t *ctx) {
     if (!ctx->initialized) return NULL;
@@ -248,11 +509,20 @@ int32_t* dma_get_tx_buffer(dma_ctx_t *ctx) {
 // Cleanup DMA
 void dma_cleanup(dma_ctx_t *ctx) {
     if (ctx->initialized) {
-        if (ctx->tx_buffer && ctx->tx_buffer != MAP_FAILED) {
-            munmap(ctx->tx_buffer, FRAME_BYTES);
-        }
-        if (ctx->rx_buffer && ctx->rx_buffer != MAP_FAILED) {
-            munmap(ctx->rx_buffer, FRAME_BYTES);
+        if (ctx->buf_mode == DMA_BUF_UDMABUF) {
+            for (int i = 0; i < DMA_SYNC_FILES; i++) {
+                close(ctx->sync_fd[i]);
+            }
+            pthread_mutex_destroy(&ctx->sync_lock);
+            munmap(ctx->buf_map, ctx->buf_size);
+            close(ctx->buf_fd);
+        } else if (ctx->buf_mode == DMA_BUF_DEVMEM) {
+            if (ctx->tx_buffer && ctx->tx_buffer != MAP_FAILED) {
+                munmap(ctx->tx_buffer, DMA_TX_BYTES);
+            }
+            if (ctx->rx_buffer && ctx->rx_buffer != MAP_FAILED) {
+                munmap(ctx->rx_buffer, DMA_RX_BYTES);
+            }
         }
         if (ctx->dma_regs && ctx->dma_regs != MAP_FAILED) {
             munmap(ctx->dma_regs, 0x10000);
@@ -260,6 +530,7 @@ void dma_cleanup(dma_ctx_t *ctx) {
         if (ctx->mem_fd >= 0) {
             close(ctx->mem_fd);
         }
+        pthread_mutex_destroy(&ctx->regs_lock);
         ctx->initialized = false;
     }
 }
\ No newline at end of file
@@ -4,6 +4,7 @@
 #include <stdint.h>
 #include <stdbool.h>
 #include <stddef.h>
+#include <pthread.h>
 
 // DMA configuration
 #define DMA_BASE_ADDR       0xA0010000
@@ -14,6 +15,108 @@
 #define SAMPLES_PER_FRAME   960             // 20ms at 48kHz
 #define BYTES_PER_SAMPLE    4               // 32-bit samples
 #define FRAME_BYTES         (SAMPLES_PER_FRAME * BYTES_PER_SAMPLE)
+#define DMA_TX_OFFSET       0x10000         // TX buffer after the RX buffer
+#define DMA_RX_BYTES        DMA_TX_OFFSET   // RX area, room for a multi-mic frame (beamform.h)
+#define DMA_TX_BYTES        (2 * FRAME_BYTES)   // Two playback periods (playout.h)
+
+// MM2S (Memory to Stream): Playback (to speaker)
+// S2MM (Stream to Memory): Capture (from microphone)
+// CTRL: Start/reset/control
+// STATUS: Flags about DMA status
+// SA/DA: Source/Destination addresses
+// LENGTH: How many bytes to transfer
+
+// DMA Register Offsets
+#define MM2S_CTRL       0x00
+#define MM2S_STATUS     0x04
+#define MM2S_SA         0x18
+#define MM2S_LENGTH     0x28
+
+#define S2MM_CTRL       0x30
+#define S2MM_STATUS     0x34
+#define S2MM_DA         0x48
+#define S2MM_LENGTH     0x58
+
+// CTRL_RUN: Start DMA
+// CTRL_RESET: Reset DMA channel
+// STAT_HALTED: DMA stopped
+// STAT_IDLE: DMA is idle
+// STAT_IOC: Interrupt on completion flag
+
+// Control register bits
+#define CTRL_RUN        0x00000001
+#define CTRL_RESET      0x00000004
+
+// Status register bits; a channel that sets an error bit halts until reset
+#define STAT_HALTED     0x00000001
+#define STAT_IDLE       0x00000002
+#define STAT_IOC        0x00001000
+#define DMA_ERR_INTERNAL    0x00000010      // DMAIntErr: bad length, or a stream error
+#define DMA_ERR_SLAVE       0x00000020      // DMASlvErr: the memory slave answered SLVERR
+#define DMA_ERR_DECODE      0x00000040      // DMADecErr: address decodes to nothing
+#define DMA_ERR_MASK        (DMA_ERR_INTERNAL | DMA_ERR_SLAVE | DMA_ERR_DECODE)
+
+// Audio buffers. /dev/mem with O_SYNC maps them uncached, so every sample
+// the CPU touches is a bus access. The u-dma-buf driver (ikwzm) instead
+// hands out contiguous CMA memory that maps cached and tells us its
+// physical address; the cache is then cleaned/invalidated around each
+// transfer through its sysfs sync_* attributes. Plain dma-heap buffers
+// would be cached too but never reveal the physical address the AXI DMA
+// needs. Device tree:
+//   udmabuf0 { compatible = "ikwzm,u-dma-buf"; device-name = "udmabuf0";
+//              size = <0x20000>; };
+#define DMA_UDMABUF_DEFAULT "udmabuf0"
+#define DMA_UDMABUF_SYSFS   "/sys/class/u-dma-buf"
+
+typedef enum {
+    DMA_BUF_DEVMEM = 0,                     // Uncached, from dma_mem_base
+    DMA_BUF_UDMABUF,                        // Cached, explicit sync
+    DMA_BUF_SIM,                            // Heap buffers, simulated engine (dma_sim.h)
+} dma_buf_mode_t;
+
+// Channel health. A channel that reports an error (DMA_ERR_* above) or
+// does not finish a transfer in time is recovered on the spot: the engine
+// is reset, a capture in flight on the other channel is started again,
+// and the owner re-arms the failed channel with its next transfer. The
+// AXI DMA soft reset always resets both channels, so "only the failed
+// channel" means only its transfer (or a playback period) is lost.
+typedef enum {
+    DMA_CH_MM2S = 0,                        // Playback
+    DMA_CH_S2MM,                            // Capture
+    DMA_CHANNELS
+} dma_channel_t;
+
+#define DMA_STALL_MS            40          // Two frames: a capture still busy is stuck
+#define DMA_RESET_TIMEOUT_US    5000        // Reset must finish within this
+#define DMA_RECOVER_BUDGET_US   20000       // One frame period, detection to re-armed
+
+typedef struct {
+    uint64_t internal_errors;
+    uint64_t slave_errors;
+    uint64_t decode_errors;
+    uint64_t stalls;                        // Busy past the caller's timeout, no error bits
+    uint64_t recoveries;                    // Reset and running again
+    uint64_t failed;                        // Reset did not finish
+    uint64_t over_budget;                   // Recoveries longer than DMA_RECOVER_BUDGET_US
+    uint32_t recover_us_max;
+    uint32_t last_status;                   // STATUS as the last failure left it
+} dma_health_t;
+
+// Register access other than through the mapping (the simulator)
+typedef struct {
+    uint32_t (*read)(void *arg, uint32_t offset);
+    void (*write)(void *arg, uint32_t offset, uint32_t value);
+} dma_regs_ops_t;
+
+// u-dma-buf sync attributes, kept open
+enum {
+    DMA_SYNC_OFFSET = 0,
+    DMA_SYNC_SIZE,
+    DMA_SYNC_DIRECTION,
+    DMA_SYNC_FOR_CPU,
+    DMA_SYNC_FOR_DEVICE,
+    DMA_SYNC_FILES
+};
 
 // DMA context
 typedef struct {
@@ -21,19 +124,72 @@ typedef struct {
     void *dma_regs;
     void *rx_buffer;
     void *tx_buffer;
+    uint32_t regs_phys_addr;
     uint32_t rx_phys_addr;
     uint32_t tx_phys_addr;
+    
+    dma_buf_mode_t buf_mode;
+    int buf_fd;                             // /dev/udmabufN
+    void *buf_map;                          // Both buffers, buf_size bytes
+    size_t buf_size;
+    int sync_fd[DMA_SYNC_FILES];
+    pthread_mutex_t sync_lock;              // TX and RX threads share the attributes
+    const void *capture_buf;                // In flight, synced when it completes
+    size_t capture_bytes;
+    
+    const dma_regs_ops_t *regs_ops;         // NULL: the mapped registers
+    void *regs_arg;
+    
+    // Last transfer armed on each channel, to start it again after a reset
+    pthread_mutex_t regs_lock;              // Arming and resetting, across threads
+    uint32_t armed_addr[DMA_CHANNELS];
+    uint32_t armed_bytes[DMA_CHANNELS];
+    uint64_t armed_us[DMA_CHANNELS];
+    bool reset_idle[DMA_CHANNELS];          // Reset with nothing to restart: not busy
+    dma_health_t health[DMA_CHANNELS];
+    
     bool initialized;
 } dma_ctx_t;
 
 int dma_init(dma_ctx_t *ctx);
+int dma_init_at(dma_ctx_t *ctx, uint32_t regs_base, uint32_t mem_base);
+
+// udmabuf: device name, NULL or "" to use DMA_UDMABUF_DEFAULT if it is
+// there, "off" for the uncached /dev/mem buffers at mem_base. Falls back
+// to /dev/mem when the device cannot be used.
+int dma_init_buf(dma_ctx_t *ctx, uint32_t regs_base, uint32_t mem_base, const char *udmabuf);
+
+// Cache maintenance for a cached buffer (no-ops on /dev/mem): before the
+// CPU reads what the device wrote, and after the CPU wrote what the
+// device will read. dma_start_*/dma_wait_capture already call them.
+void dma_sync_for_cpu(dma_ctx_t *ctx, const void *buf, size_t bytes);
+void dma_sync_for_device(dma_ctx_t *ctx, const void *buf, size_t bytes);
 int dma_start_capture(dma_ctx_t *ctx, int32_t *buffer, size_t bytes);
+
+// buffer anywhere in the TX area plays in place, anything else is copied
+// to the start of it first
 int dma_start_playback(dma_ctx_t *ctx, const int32_t *buffer, size_t bytes);
+
+// -1 when the channel failed (error bits, or still busy at the timeout);
+// it has been recovered by then and the next dma_start_* goes ahead
 int dma_wait_capture(dma_ctx_t *ctx, int timeout_ms);
 int dma_wait_playback(dma_ctx_t *ctx, int timeout_ms);
+
+// Busy: running a transfer (a halted channel is not busy)
 bool dma_capture_busy(dma_ctx_t *ctx);
 bool dma_playback_busy(dma_ctx_t *ctx);
 int dma_reset(dma_ctx_t *ctx);
+
+// Error bits (DMA_ERR_*) a channel reports, 0 when healthy
+uint32_t dma_channel_errors(dma_ctx_t *ctx, dma_channel_t ch);
+
+// Error bits as text, e.g. "DMASlvErr|DMADecErr"
+const char *dma_error_names(uint32_t errors, char *buf, size_t len);
+
+// Recover a failed channel (errors: the bits it reported, 0 for a stall):
+// reset, restart a capture that was running on the other channel, count.
+// Safe from the TX and playout threads at once. -1 if the reset hung.
+int dma_recover(dma_ctx_t *ctx, dma_channel_t ch, uint32_t errors);
 void dma_cleanup(dma_ctx_t *ctx);
 int32_t* dma_get_rx_buffer(dma_ctx_t *ctx);
 int32_t* dma_get_tx_buffer(dma_ctx_t *ctx);
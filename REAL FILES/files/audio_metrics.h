@@ -0,0 +1,23 @@
+#ifndef AUDIO_METRICS_H
+#define AUDIO_METRICS_H
+
+#include <stdint.h>
+
+// Objective quality proxies for offline tools (no PESQ/POLQA needed)
+
+// Segments quieter than this (RMS) are skipped by segmental SNR
+#define SEGSNR_SILENCE_RMS  64.0
+
+// Whole-signal SNR of test against ref, in dB
+double snr_db(const int16_t *ref, const int16_t *test, int samples);
+
+// Mean per-segment SNR, each segment clamped to [-10, 35] dB
+double segsnr_db(const int16_t *ref, const int16_t *test, int samples, int segment);
+
+// Lag (in samples, within +-max_lag) that best aligns test to ref
+int best_lag(const int16_t *ref, const int16_t *test, int samples, int max_lag);
+
+// Deterministic speech-like test signal (voiced syllables, pauses, noise)
+void test_signal_speechlike(int16_t *out, int samples, int sample_rate, uint32_t seed);
+
+#endif // AUDIO_METRICS_H
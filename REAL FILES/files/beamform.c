@@ -0,0 +1,150 @@
+#include "beamform.h"
+#include "dsp_simd.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+void beam_config_default(beam_config_t *cfg) {
+    cfg->mics = 1;
+    cfg->spacing_mm = 35.0f;
+    cfg->steer_deg = 0.0f;
+}
+
+// Samples between the two end mics for sound from the steering direction
+static double beam_spread(const beam_config_t *cfg) {
+    return (cfg->mics - 1) * cfg->spacing_mm / 1000.0 *
+           fabs(sin(cfg->steer_deg * M_PI / 180.0)) * SAMPLE_RATE / BEAM_SOUND_MPS;
+}
+
+int beam_parse(beam_config_t *cfg, const char *spec) {
+    char buf[256];
+    snprintf(buf, sizeof(buf), "%s", spec);
+
+    char *save = NULL;
+    for (char *tok = strtok_r(buf, ", ", &save); tok; tok = strtok_r(NULL, ", ", &save)) {
+        if (strcmp(tok, "off") == 0) {
+            cfg->mics = 1;
+            continue;
+        }
+
+        char *eq = strchr(tok, '=');
+        if (!eq) {
+            fprintf(stderr, "beamform: expected key=value, got '%s'\n", tok);
+            return -1;
+        }
+        *eq = '\0';
+        const char *key = tok;
+        const char *val = eq + 1;
+
+        if (strcmp(key, "mics") == 0) {
+            cfg->mics = atoi(val);
+        } else if (strcmp(key, "spacing") == 0) {
+            cfg->spacing_mm = atof(val);
+        } else if (strcmp(key, "steer") == 0) {
+            cfg->steer_deg = atof(val);
+        } else {
+            fprintf(stderr, "beamform: unknown key '%s'\n", key);
+            return -1;
+        }
+    }
+
+    if (cfg->mics < 1 || cfg->mics > BEAM_MAX_MICS || cfg->spacing_mm <= 0.0f ||
+        cfg->steer_deg < -90.0f || cfg->steer_deg > 90.0f) {
+        fprintf(stderr, "beamform: 1-%d mics, spacing above 0 mm, steer -90 to 90 in '%s'\n",
+                BEAM_MAX_MICS, spec);
+        return -1;
+    }
+
+    // The delays and the filter have to fit the history
+    if (beam_spread(cfg) > BEAM_MAX_DELAY - BEAM_TAPS + 1) {
+        fprintf(stderr, "beamform: array too long for that steering in '%s' "
+                "(%.0f samples end to end, %d at most)\n", spec, beam_spread(cfg),
+                BEAM_MAX_DELAY - BEAM_TAPS + 1);
+        return -1;
+    }
+    return 0;
+}
+
+int beam_init(beam_ctx_t *ctx, const beam_config_t *cfg) {
+    memset(ctx, 0, sizeof(beam_ctx_t));
+    ctx->cfg = *cfg;
+    if (cfg->mics < 1 || cfg->mics > BEAM_MAX_MICS ||
+        beam_spread(cfg) > BEAM_MAX_DELAY - BEAM_TAPS + 1) {
+        fprintf(stderr, "beamform: bad array configuration\n");
+        return -1;
+    }
+
+    // Mic m sits at x_m along the array, centred on 0. Sound from the
+    // steering direction reaches it x_m * sin(steer) / c before the
+    // centre, so it waits that much longer; on top, everything waits the
+    // filter's half length and half the spread, to stay causal
+    int n = cfg->mics;
+    double s = sin(cfg->steer_deg * M_PI / 180.0);
+    double per_mic = cfg->spacing_mm / 1000.0 * s * SAMPLE_RATE / BEAM_SOUND_MPS;
+    double base = BEAM_HALF_TAPS - 1 + beam_spread(cfg) / 2.0;
+    ctx->latency = (int)ceil(base);
+
+    for (int m = 0; m < n; m++) {
+        double x = m - (n - 1) / 2.0;
+        double delay = base + x * per_mic;
+        int whole = (int)floor(delay);
+        double frac = delay - whole;
+        ctx->shift[m] = whole - BEAM_HALF_TAPS + 1;
+
+        // Blackman-windowed sinc centred on the fractional part
+        double sum = 0.0;
+        double h[BEAM_TAPS];
+        for (int j = 0; j < BEAM_TAPS; j++) {
+            double t = j - (BEAM_HALF_TAPS - 1) - frac;
+            double sinc = fabs(t) < 1e-9 ? 1.0 : sin(M_PI * t) / (M_PI * t);
+            double w = 0.0;
+            if (fabs(t) < BEAM_HALF_TAPS) {
+                double a = M_PI * t / BEAM_HALF_TAPS;
+                w = 0.42 + 0.5 * cos(a) + 0.08 * cos(2.0 * a);
+            }
+            h[j] = sinc * w;
+            sum += h[j];
+        }
+
+        // Unity gain at DC for the array as a whole
+        for (int j = 0; j < BEAM_TAPS; j++) {
+            ctx->taps[m][j] = (float)(h[j] / sum / n);
+        }
+    }
+
+    ctx->initialized = true;
+    return 0;
+}
+
+void beam_reset(beam_ctx_t *ctx) {
+    memset(ctx->hist, 0, sizeof(ctx->hist));
+}
+
+void beam_process(beam_ctx_t *ctx, const int32_t *dma, int16_t *pcm) {
+    int n = ctx->cfg.mics;
+    float *frame[BEAM_MAX_MICS];
+    for (int m = 0; m < n; m++) {
+        frame[m] = ctx->hist[m] + BEAM_MAX_DELAY;
+    }
+
+    // Slots to one float stream per mic, behind its history
+    dsp_deinterleave_i32(dma, n, frame, FRAME_SIZE);
+
+    // Delay and sum
+    memset(ctx->out, 0, sizeof(ctx->out));
+    for (int m = 0; m < n; m++) {
+        dsp_fir_add(ctx->out, frame[m] - ctx->shift[m], ctx->taps[m], BEAM_TAPS, FRAME_SIZE);
+    }
+    dsp_f32_to_i16(ctx->out, pcm, FRAME_SIZE);
+
+    // The end of this frame is the next one's history
+    for (int m = 0; m < n; m++) {
+        memmove(ctx->hist[m], ctx->hist[m] + FRAME_SIZE, BEAM_MAX_DELAY * sizeof(float));
+    }
+    ctx->frames++;
+}
@@ -0,0 +1,75 @@
+#ifndef BEAMFORM_H
+#define BEAMFORM_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "opus_helper.h"
+
+// Multi-microphone capture: the I2S/TDM stream carries one 32-bit slot
+// per mic, so a DMA frame is FRAME_SIZE sample periods of `mics`
+// interleaved words. Delay-and-sum brings it down to the one channel the
+// encoder takes: each mic is delayed so sound from the steering direction
+// lines up across the array, then they are averaged. Speech from there
+// adds in phase; noise that differs from mic to mic (self-noise, wind,
+// diffuse machinery at higher frequencies) does not, so the SNR rises by
+// up to 10*log10(mics) dB.
+//
+// Uniform linear array, mics numbered along it in TDM slot order. Steering
+// is the angle off broadside: 0 = straight in front of the array, +90 =
+// along it beyond the last mic. The delays are fractional, a windowed-sinc
+// filter per mic; deinterleaving and filtering are NEON kernels on the A53
+// (dsp_simd.h). No allocation after init.
+//
+// A frame is FRAME_SIZE * mics * 4 bytes in one S2MM transfer: past four
+// mics the AXI DMA's buffer length register has to be wider than its
+// default 14 bits (Vivado: "Width of Buffer Length Register", 15 or more).
+
+#define BEAM_MAX_MICS       8
+#define BEAM_HALF_TAPS      8           // Fractional delay filter, taps either side
+#define BEAM_TAPS           (2 * BEAM_HALF_TAPS)
+#define BEAM_MAX_DELAY      64          // Samples, spread across the array plus the filter
+#define BEAM_SOUND_MPS      343.0
+
+typedef struct {
+    int mics;                   // 1 = mono capture as before, no beamformer
+    float spacing_mm;           // Between neighbouring mics
+    float steer_deg;            // Off broadside, -90..90
+} beam_config_t;
+
+typedef struct {
+    beam_config_t cfg;
+    int latency;                // Delay through it, samples (rounded up)
+
+    // Per mic: delay filter (with the 1/mics weight) and where it starts
+    float taps[BEAM_MAX_MICS][BEAM_TAPS];
+    int shift[BEAM_MAX_MICS];   // Samples of delay before the first tap
+
+    // Per mic: BEAM_MAX_DELAY samples of history, then the current frame
+    float hist[BEAM_MAX_MICS][BEAM_MAX_DELAY + FRAME_SIZE];
+    float out[FRAME_SIZE];
+
+    uint64_t frames;
+    bool initialized;
+} beam_ctx_t;
+
+void beam_config_default(beam_config_t *cfg);
+
+// Parse "mics=4,spacing=35,steer=0" (mm, degrees); "off" is mics=1
+int beam_parse(beam_config_t *cfg, const char *spec);
+
+int beam_init(beam_ctx_t *ctx, const beam_config_t *cfg);
+
+// Forget the history (a new burst)
+void beam_reset(beam_ctx_t *ctx);
+
+// One DMA frame of cfg.mics interleaved slots to one mono frame
+void beam_process(beam_ctx_t *ctx, const int32_t *dma, int16_t *pcm);
+
+// Bytes the DMA has to capture per frame
+static inline size_t beam_frame_bytes(const beam_config_t *cfg) {
+    return (size_t)FRAME_SIZE * cfg->mics * sizeof(int32_t);
+}
+
+#endif // BEAMFORM_H
@@ -0,0 +1,229 @@
+/*
+ * bench_aec.c - Echo canceller cost and ERLE
+ *
+ * Without arguments, builds a synthetic room: speech-like far-end audio
+ * through a decaying echo path with a bulk delay, low-level mic noise,
+ * and a near-end talker in the middle (double talk). With two WAV files,
+ * runs a recorded speaker reference and mic capture instead.
+ *
+ * Reports time per 20 ms frame against the real-time budget, ERLE per
+ * 2 s window while only the far end talks, and how much of the near-end
+ * talker survives double talk.
+ *
+ * Usage: ./bench_aec [-t tail_ms] [-d seconds] [far.wav mic.wav [out.wav]]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "aec.h"
+#include "audio_metrics.h"
+#include "wav.h"
+
+#define WINDOW_FRAMES   100     // 2 s ERLE windows
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int cmp_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a;
+    uint64_t y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+// Far end through a room: 4 ms bulk delay, 30 ms exponentially decaying tail
+static void synth_echo(const int16_t *far, int16_t *mic, int samples, uint32_t seed) {
+    int delay = 4 * SAMPLE_RATE / 1000;
+    int len = 30 * SAMPLE_RATE / 1000;
+    float *h = malloc(len * sizeof(float));
+    uint32_t rng = seed;
+
+    for (int i = 0; i < len; i++) {
+        rng = rng * 1664525u + 1013904223u;
+        float noise = ((rng >> 8) / 16777216.0f) - 0.5f;
+        h[i] = noise * 0.08f * expf(-(float)i / (len / 6.0f));
+    }
+
+    for (int n = 0; n < samples; n++) {
+        float acc = 0.0f;
+        for (int i = 0; i < len; i++) {
+            int j = n - delay - i;
+            if (j < 0) break;
+            acc += h[i] * far[j];
+        }
+
+        // Mic self-noise around -66 dBFS
+        rng = rng * 1664525u + 1013904223u;
+        acc += (((rng >> 8) / 16777216.0f) - 0.5f) * 32.0f;
+
+        if (acc > 32767.0f) acc = 32767.0f;
+        if (acc < -32768.0f) acc = -32768.0f;
+        mic[n] = (int16_t)lrintf(acc);
+    }
+
+    free(h);
+}
+
+static double energy(const int16_t *x, int samples) {
+    double e = 0.0;
+    for (int i = 0; i < samples; i++) e += (double)x[i] * x[i];
+    return e;
+}
+
+int main(int argc, char *argv[]) {
+    int tail_ms = AEC_DEFAULT_TAIL_MS;
+    int seconds = 20;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "t:d:")) != -1) {
+        switch (opt) {
+        case 't': tail_ms = atoi(optarg); break;
+        case 'd': seconds = atoi(optarg); break;
+        default:
+            fprintf(stderr, "Usage: %s [-t tail_ms] [-d seconds] [far.wav mic.wav [out.wav]]\n",
+                    argv[0]);
+            return 1;
+        }
+    }
+
+    int16_t *far, *mic, *near = NULL;
+    int samples;
+    int dt_start = 0, dt_end = 0;       // Double-talk span, in frames
+
+    if (argc - optind >= 2) {
+        int rate_f, ch_f, n_f, rate_m, ch_m, n_m;
+        far = wav_read(argv[optind], &rate_f, &ch_f, &n_f);
+        mic = wav_read(argv[optind + 1], &rate_m, &ch_m, &n_m);
+        if (!far || !mic) return 1;
+        if (ch_f != 1 || ch_m != 1 || rate_f != SAMPLE_RATE || rate_m != SAMPLE_RATE) {
+            fprintf(stderr, "Need mono %d Hz recordings\n", SAMPLE_RATE);
+            return 1;
+        }
+        samples = n_f < n_m ? n_f : n_m;
+        printf("Recorded: %s (far) / %s (mic), %.1f s\n",
+               argv[optind], argv[optind + 1], (double)samples / SAMPLE_RATE);
+    } else {
+        samples = seconds * SAMPLE_RATE;
+        far = malloc(samples * sizeof(int16_t));
+        mic = malloc(samples * sizeof(int16_t));
+        near = calloc(samples, sizeof(int16_t));
+        test_signal_speechlike(far, samples, SAMPLE_RATE, 1);
+        synth_echo(far, mic, samples, 7);
+
+        // Near-end talker for 3 s, starting 60% of the way in
+        int frames = samples / FRAME_SIZE;
+        dt_start = frames * 6 / 10;
+        dt_end = dt_start + 3 * SAMPLE_RATE / FRAME_SIZE;
+        if (dt_end > frames) dt_end = frames;
+        int span = (dt_end - dt_start) * FRAME_SIZE;
+        test_signal_speechlike(near + dt_start * FRAME_SIZE, span, SAMPLE_RATE, 2);
+        for (int i = dt_start * FRAME_SIZE; i < dt_end * FRAME_SIZE; i++) {
+            int s = mic[i] + near[i] / 2;
+            mic[i] = s > 32767 ? 32767 : (s < -32768 ? -32768 : s);
+            near[i] /= 2;
+        }
+        printf("Synthetic: %d s speech-like far end, 4 ms + 30 ms echo path, "
+               "double talk %.1f-%.1f s\n", seconds,
+               dt_start * 0.02, dt_end * 0.02);
+    }
+
+    int frames = samples / FRAME_SIZE;
+    int16_t *out = malloc((size_t)frames * FRAME_SIZE * sizeof(int16_t));
+    uint64_t *cost = malloc(frames * sizeof(uint64_t));
+
+    static aec_ctx_t aec;
+    if (aec_init(&aec, tail_ms) < 0) return 1;
+
+    for (int f = 0; f < frames; f++) {
+        uint64_t t0 = now_ns();
+        aec_process(&aec, mic + (size_t)f * FRAME_SIZE, far + (size_t)f * FRAME_SIZE,
+                    out + (size_t)f * FRAME_SIZE);
+        cost[f] = now_ns() - t0;
+    }
+
+    // Output lags the mic by one AEC block; line them back up for scoring
+    int lag = AEC_BLOCK;
+    int scored = frames * FRAME_SIZE - lag;
+    const int16_t *aligned = out + lag;
+
+    printf("\nERLE (far end only, 2 s windows):\n");
+    double far_floor = 1e4 * WINDOW_FRAMES * FRAME_SIZE;    // ~-50 dBFS
+    double mic_total = 0.0, out_total = 0.0;
+    for (int w = 0; (w + 1) * WINDOW_FRAMES * FRAME_SIZE <= scored; w++) {
+        int start = w * WINDOW_FRAMES;
+        int end = start + WINDOW_FRAMES;
+        if (near && end > dt_start && start < dt_end) {
+            printf("  %5.1f s  (double talk)\n", start * 0.02);
+            continue;
+        }
+        size_t off = (size_t)start * FRAME_SIZE;
+        int len = WINDOW_FRAMES * FRAME_SIZE;
+        if (energy(far + off, len) < far_floor) {
+            printf("  %5.1f s  (far end silent)\n", start * 0.02);
+            continue;
+        }
+        double em = energy(mic + off, len);
+        double eo = energy(aligned + off, len);
+        printf("  %5.1f s  %6.1f dB\n", start * 0.02, 10.0 * log10(em / (eo + 1.0)));
+
+        // Steady state: everything after the first window
+        if (w > 0) {
+            mic_total += em;
+            out_total += eo;
+        }
+    }
+    if (mic_total > 0.0) {
+        printf("  Steady-state ERLE: %.1f dB\n", 10.0 * log10(mic_total / (out_total + 1.0)));
+    }
+
+    if (near && dt_end > dt_start) {
+        size_t off = (size_t)dt_start * FRAME_SIZE;
+        int len = (dt_end - dt_start) * FRAME_SIZE;
+        if (off + len > (size_t)scored) len = scored - off;
+        printf("\nDouble talk: near-end SNR in %.1f dB, out %.1f dB\n",
+               snr_db(near + off, mic + off, len), snr_db(near + off, aligned + off, len));
+    }
+
+    double avg = 0.0;
+    for (int f = 0; f < frames; f++) avg += cost[f];
+    avg /= frames;
+    qsort(cost, frames, sizeof(uint64_t), cmp_u64);
+    double budget_ns = (double)FRAME_SIZE * 1e9 / SAMPLE_RATE;
+
+    printf("\nCost per %d-sample frame (%d partitions%s):\n", FRAME_SIZE, aec.parts,
+#if defined(__ARM_NEON)
+           ", NEON"
+#else
+           ", scalar"
+#endif
+           );
+    printf("  mean %.1f us  median %.1f us  p99 %.1f us  max %.1f us\n",
+           avg / 1000.0, cost[frames / 2] / 1000.0, cost[frames * 99 / 100] / 1000.0,
+           cost[frames - 1] / 1000.0);
+    printf("  %.2f%% of one core in real time\n", 100.0 * avg / budget_ns);
+    printf("  Blocks adapted %lu, frozen for double talk %lu\n",
+           aec.stats.blocks_adapted, aec.stats.blocks_doubletalk);
+
+    if (argc - optind >= 3) {
+        wav_writer_t wav;
+        if (wav_open_write(&wav, argv[optind + 2], SAMPLE_RATE, 1) == 0) {
+            wav_write(&wav, out, frames * FRAME_SIZE);
+            wav_close(&wav);
+        }
+    }
+
+    aec_cleanup(&aec);
+    free(cost);
+    free(out);
+    free(near);
+    free(mic);
+    free(far);
+    return 0;
+}
@@ -0,0 +1,409 @@
+/*
+ * bench_beam.c - Multi-mic delay-and-sum: cost per frame and SNR gain
+ *
+ * Simulated: a linear array (-a, default 35 mm apart, steered at the
+ * talker straight ahead) in free field hears the speech-like talker as a
+ * plane wave, plus one kind of noise at a time, each scaled to 0 dB SNR at
+ * every mic:
+ *   sensor       independent noise per mic (self-noise, wind, handling)
+ *   diffuse      16 broadband machines all around the array
+ *   interferer   one broadband machine 60 degrees off to the side
+ * for 2, 4 and 8 mics. Speech and noise go through the beamformer
+ * separately (it is linear), so the SNR after it is exact.
+ *
+ * Recorded: -s speech.wav -n noise.wav, the talker alone and the noise
+ * alone through the same array, one channel per mic in slot order, at
+ * SAMPLE_RATE; -a describes the array, -o writes what the beamformer makes
+ * of the two together. -w <prefix> writes the simulated diffuse set in
+ * that form, to try the recorded path.
+ *
+ * Per frame cost is the deinterleave from the DMA layout (32-bit slots),
+ * the delay filters and the conversion to int16, as the TX thread runs it.
+ *
+ * Usage: ./bench_beam [-d seconds] [-a mics=4,spacing=35,steer=0]
+ *                     [-s speech.wav -n noise.wav [-o out.wav]] [-w prefix]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "beamform.h"
+#include "audio_metrics.h"
+#include "wav.h"
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+#define SIM_HALF        32          // Simulation's own delay filter, longer than the beamformer's
+#define SIM_OFFSET      (SIM_HALF + 40)
+#define DIFFUSE_SOURCES 16
+#define INTERFERER_DEG  60.0
+
+enum { NOISE_SENSOR, NOISE_DIFFUSE, NOISE_INTERFERER, NOISE_KINDS };
+static const char *noise_names[NOISE_KINDS] = { "sensor", "diffuse", "interferer" };
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int cmp_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a;
+    uint64_t y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+static uint32_t rng_next(uint32_t *rng) {
+    *rng = *rng * 1664525u + 1013904223u;
+    return *rng;
+}
+
+// Broadband machine noise: white, gently low-passed (corner ~2.5 kHz)
+static void make_noise(float *out, int samples, uint32_t seed) {
+    uint32_t rng = seed;
+    double lp = 0.0;
+    for (int i = 0; i < samples; i++) {
+        double white = (double)(rng_next(&rng) >> 8) / 8388608.0 - 1.0;
+        lp += (white - lp) * 0.3;
+        out[i] = (float)lp;
+    }
+}
+
+// dst[i] += gain * src[i - delay], fractional delay through a long
+// Blackman-windowed sinc (delay >= SIM_HALF)
+static void delay_add(float *dst, const float *src, int samples, double delay, double gain) {
+    int whole = (int)floor(delay);
+    double frac = delay - whole;
+    float h[2 * SIM_HALF];
+    for (int j = 0; j < 2 * SIM_HALF; j++) {
+        double t = j - (SIM_HALF - 1) - frac;
+        double sinc = fabs(t) < 1e-9 ? 1.0 : sin(M_PI * t) / (M_PI * t);
+        double a = M_PI * t / SIM_HALF;
+        double w = fabs(t) < SIM_HALF ? 0.42 + 0.5 * cos(a) + 0.08 * cos(2.0 * a) : 0.0;
+        h[j] = (float)(gain * sinc * w);
+    }
+    int first = whole - SIM_HALF + 1;
+    for (int i = whole + SIM_HALF; i < samples; i++) {
+        float acc = 0.0f;
+        const float *x = src + i - first;
+        for (int j = 0; j < 2 * SIM_HALF; j++) acc += h[j] * x[-j];
+        dst[i] += acc;
+    }
+}
+
+// Plane wave from deg off broadside onto the array: mic m at x_m hears
+// it x_m * sin(deg) / c early
+static void arrive(float **mics, int n, double spacing_mm, const float *src, int samples,
+                   double deg, double gain) {
+    double per_mic = spacing_mm / 1000.0 * sin(deg * M_PI / 180.0) * SAMPLE_RATE / BEAM_SOUND_MPS;
+    for (int m = 0; m < n; m++) {
+        double x = m - (n - 1) / 2.0;
+        delay_add(mics[m], src, samples, SIM_OFFSET - x * per_mic, gain);
+    }
+}
+
+static double energy(const float *x, int samples) {
+    double e = 0.0;
+    for (int i = 0; i < samples; i++) e += (double)x[i] * x[i];
+    return e;
+}
+
+// Float channels to the DMA's interleaved 32-bit slots (16-bit precision,
+// as a 16-bit codec would deliver)
+static void to_slots(float **mics, int n, int samples, int32_t *slots) {
+    for (int i = 0; i < samples; i++) {
+        for (int m = 0; m < n; m++) {
+            float v = mics[m][i] * 32768.0f;
+            if (v > 32767.0f) v = 32767.0f;
+            if (v < -32768.0f) v = -32768.0f;
+            slots[(size_t)i * n + m] = (int32_t)lrintf(v) * 65536;
+        }
+    }
+}
+
+// Every frame through a fresh beamformer; returns the output energy past
+// the first frame, and the per frame cost when asked
+static double run(const beam_config_t *cfg, const int32_t *slots, int frames, int16_t *out,
+                  uint64_t *cost) {
+    static beam_ctx_t beam;
+    static int16_t pcm[FRAME_SIZE];
+    beam_init(&beam, cfg);
+
+    double e = 0.0;
+    for (int f = 0; f < frames; f++) {
+        uint64_t t0 = now_ns();
+        beam_process(&beam, slots + (size_t)f * FRAME_SIZE * cfg->mics, pcm);
+        if (cost) cost[f] = now_ns() - t0;
+
+        if (out) memcpy(out + (size_t)f * FRAME_SIZE, pcm, sizeof(pcm));
+        if (f == 0) continue;
+        for (int i = 0; i < FRAME_SIZE; i++) e += (double)pcm[i] * pcm[i];
+    }
+    return e;
+}
+
+static void print_cost(int mics, uint64_t *cost, int frames) {
+    double total = 0.0;
+    for (int f = 0; f < frames; f++) total += cost[f];
+    qsort(cost, frames, sizeof(uint64_t), cmp_u64);
+    printf("  %d mics   mean %6.2f us  median %6.2f us  p99 %6.2f us  (%.2f%% of a core)\n",
+           mics, total / frames / 1000.0, cost[frames / 2] / 1000.0,
+           cost[frames * 99 / 100] / 1000.0,
+           100.0 * total / frames / ((double)FRAME_SIZE * 1e9 / SAMPLE_RATE));
+}
+
+// One simulated array: speech and each kind of noise at 0 dB per mic
+static void simulate(const beam_config_t *arr, int frames, double gains[NOISE_KINDS],
+                     const char *write_prefix) {
+    int n = arr->mics;
+    int samples = frames * FRAME_SIZE;
+    float *speech[BEAM_MAX_MICS], *noise[BEAM_MAX_MICS];
+    float *src = malloc(samples * sizeof(float));
+    int16_t *pcm = malloc(samples * sizeof(int16_t));
+    int32_t *slots = malloc((size_t)samples * n * sizeof(int32_t));
+
+    test_signal_speechlike(pcm, samples, SAMPLE_RATE, 1);
+    for (int i = 0; i < samples; i++) src[i] = pcm[i] / 32768.0f * 0.25f;
+    for (int m = 0; m < n; m++) {
+        speech[m] = calloc(samples, sizeof(float));
+        noise[m] = calloc(samples, sizeof(float));
+    }
+    arrive(speech, n, arr->spacing_mm, src, samples, arr->steer_deg, 1.0);
+
+    double es_in = 0.0;
+    for (int m = 0; m < n; m++) es_in += energy(speech[m], samples) / n;
+    to_slots(speech, n, samples, slots);
+    double es_out = run(arr, slots, frames, NULL, NULL);
+
+    uint32_t seed = 100;
+    for (int kind = 0; kind < NOISE_KINDS; kind++) {
+        for (int m = 0; m < n; m++) memset(noise[m], 0, samples * sizeof(float));
+
+        if (kind == NOISE_SENSOR) {
+            for (int m = 0; m < n; m++) {
+                make_noise(src, samples, seed++);
+                memcpy(noise[m] + SIM_OFFSET, src, (samples - SIM_OFFSET) * sizeof(float));
+            }
+        } else if (kind == NOISE_DIFFUSE) {
+            uint32_t rng = 7;
+            for (int k = 0; k < DIFFUSE_SOURCES; k++) {
+                make_noise(src, samples, seed++);
+                double deg = (double)(rng_next(&rng) % 36000) / 100.0;
+                arrive(noise, n, arr->spacing_mm, src, samples, deg, 1.0);
+            }
+        } else {
+            make_noise(src, samples, seed++);
+            arrive(noise, n, arr->spacing_mm, src, samples, INTERFERER_DEG, 1.0);
+        }
+
+        // 0 dB at the mics
+        double en_in = 0.0;
+        for (int m = 0; m < n; m++) en_in += energy(noise[m], samples) / n;
+        float scale = (float)sqrt(es_in / en_in);
+        for (int m = 0; m < n; m++) {
+            for (int i = 0; i < samples; i++) noise[m][i] *= scale;
+        }
+
+        to_slots(noise, n, samples, slots);
+        double en_out = run(arr, slots, frames, NULL, NULL);
+        gains[kind] = 10.0 * log10(es_out / en_out);
+
+        if (kind == NOISE_DIFFUSE && write_prefix) {
+            char path[256];
+            wav_writer_t wav;
+            int16_t *inter = malloc((size_t)samples * n * sizeof(int16_t));
+            for (int set = 0; set < 2; set++) {
+                float **ch = set ? noise : speech;
+                for (int i = 0; i < samples; i++) {
+                    for (int m = 0; m < n; m++) {
+                        float v = ch[m][i] * 32768.0f;
+                        inter[(size_t)i * n + m] = (int16_t)(v > 32767.0f ? 32767 :
+                                                             v < -32768.0f ? -32768 : lrintf(v));
+                    }
+                }
+                snprintf(path, sizeof(path), "%s-%s.wav", write_prefix, set ? "noise" : "speech");
+                if (wav_open_write(&wav, path, SAMPLE_RATE, n) == 0) {
+                    wav_write(&wav, inter, samples);
+                    wav_close(&wav);
+                    printf("  Wrote %s\n", path);
+                }
+            }
+            free(inter);
+        }
+    }
+
+    for (int m = 0; m < n; m++) {
+        free(speech[m]);
+        free(noise[m]);
+    }
+    free(src);
+    free(pcm);
+    free(slots);
+}
+
+// Interleaved 16-bit recording to 32-bit slots
+static int32_t *load_slots(const char *path, int mics, int *frames) {
+    int rate, channels, samples;
+    int16_t *pcm = wav_read(path, &rate, &channels, &samples);
+    if (!pcm) {
+        fprintf(stderr, "Cannot read %s\n", path);
+        return NULL;
+    }
+    if (channels != mics || rate != SAMPLE_RATE) {
+        fprintf(stderr, "%s: %d channels at %d Hz, the array needs %d at %d Hz\n",
+                path, channels, rate, mics, SAMPLE_RATE);
+        free(pcm);
+        return NULL;
+    }
+
+    *frames = samples / FRAME_SIZE;
+    int32_t *slots = malloc((size_t)*frames * FRAME_SIZE * mics * sizeof(int32_t));
+    for (size_t i = 0; i < (size_t)*frames * FRAME_SIZE * mics; i++) {
+        slots[i] = pcm[i] * 65536;
+    }
+    free(pcm);
+    return slots;
+}
+
+static double slot_energy(const int32_t *slots, int mics, int mic, int frames) {
+    double e = 0.0;
+    for (size_t i = FRAME_SIZE; i < (size_t)frames * FRAME_SIZE; i++) {
+        double v = slots[i * mics + mic] / 65536.0;
+        e += v * v;
+    }
+    return e;
+}
+
+static int recorded(const beam_config_t *arr, const char *speech_path, const char *noise_path,
+                    const char *out_path) {
+    int n = arr->mics;
+    int fs, fn;
+    int32_t *speech = load_slots(speech_path, n, &fs);
+    int32_t *noise = load_slots(noise_path, n, &fn);
+    if (!speech || !noise) return 1;
+    int frames = fs < fn ? fs : fn;
+    if (frames < 2) {
+        fprintf(stderr, "Recordings shorter than two frames\n");
+        return 1;
+    }
+
+    printf("\n%d mics, %.0f mm apart, steered %.0f degrees, %d frames\n", n,
+           arr->spacing_mm, arr->steer_deg, frames);
+    double best = -99.0, mean = 0.0;
+    for (int m = 0; m < n; m++) {
+        double snr = 10.0 * log10(slot_energy(speech, n, m, frames) /
+                                  (slot_energy(noise, n, m, frames) + 1e-9));
+        printf("  Mic %d          SNR %6.2f dB\n", m + 1, snr);
+        if (snr > best) best = snr;
+        mean += snr / n;
+    }
+
+    uint64_t *cost = malloc(frames * sizeof(uint64_t));
+    int16_t *out_s = malloc((size_t)frames * FRAME_SIZE * sizeof(int16_t));
+    int16_t *out_n = malloc((size_t)frames * FRAME_SIZE * sizeof(int16_t));
+    double es = run(arr, speech, frames, out_s, cost);
+    double en = run(arr, noise, frames, out_n, NULL);
+    double snr = 10.0 * log10(es / (en + 1e-9));
+    printf("  Beamformed     SNR %6.2f dB: %+.2f dB over the mean mic, %+.2f over the best\n",
+           snr, snr - mean, snr - best);
+    print_cost(n, cost, frames);
+
+    if (out_path) {
+        // The beamformer is linear: its output for both at once is the sum
+        wav_writer_t wav;
+        for (size_t i = 0; i < (size_t)frames * FRAME_SIZE; i++) {
+            int v = out_s[i] + out_n[i];
+            out_s[i] = (int16_t)(v > 32767 ? 32767 : (v < -32768 ? -32768 : v));
+        }
+        if (wav_open_write(&wav, out_path, SAMPLE_RATE, 1) == 0) {
+            wav_write(&wav, out_s, frames * FRAME_SIZE);
+            wav_close(&wav);
+            printf("  Wrote %s\n", out_path);
+        }
+    }
+
+    free(cost);
+    free(out_s);
+    free(out_n);
+    free(speech);
+    free(noise);
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    int seconds = 5;
+    const char *spec = NULL;
+    const char *speech_path = NULL, *noise_path = NULL, *out_path = NULL, *write_prefix = NULL;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "d:a:s:n:o:w:")) != -1) {
+        switch (opt) {
+        case 'd': seconds = atoi(optarg); break;
+        case 'a': spec = optarg; break;
+        case 's': speech_path = optarg; break;
+        case 'n': noise_path = optarg; break;
+        case 'o': out_path = optarg; break;
+        case 'w': write_prefix = optarg; break;
+        default:
+            fprintf(stderr, "Usage: %s [-d seconds] [-a mics=4,spacing=35,steer=0] "
+                    "[-s speech.wav -n noise.wav [-o out.wav]] [-w prefix]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    beam_config_t arr;
+    beam_config_default(&arr);
+    arr.mics = 4;
+    if (spec && beam_parse(&arr, spec) < 0) return 1;
+
+    if (speech_path || noise_path) {
+        if (!speech_path || !noise_path) {
+            fprintf(stderr, "-s and -n go together\n");
+            return 1;
+        }
+        return recorded(&arr, speech_path, noise_path, out_path);
+    }
+
+    int frames = seconds * SAMPLE_RATE / FRAME_SIZE;
+    if (frames < 2) frames = 2;
+
+    // Cost: the same work whatever the audio, so random slots will do
+    printf("Per frame cost (deinterleave, delay and sum, to int16)\n");
+    int counts[] = { 2, 4, 8 };
+    uint64_t *cost = malloc(frames * sizeof(uint64_t));
+    int32_t *slots = malloc((size_t)frames * FRAME_SIZE * BEAM_MAX_MICS * sizeof(int32_t));
+    uint32_t rng = 1;
+    for (size_t i = 0; i < (size_t)frames * FRAME_SIZE * BEAM_MAX_MICS; i++) {
+        slots[i] = (int32_t)(rng_next(&rng) & 0xffff0000u) >> 2;
+    }
+    for (int c = 0; c < 3; c++) {
+        beam_config_t cfg = arr;
+        cfg.mics = counts[c];
+        run(&cfg, slots, frames, NULL, cost);
+        print_cost(cfg.mics, cost, frames);
+    }
+    free(slots);
+    free(cost);
+
+    printf("\nSNR gain, noise at 0 dB on every mic, %.0f mm apart, steered %.0f degrees\n",
+           arr.spacing_mm, arr.steer_deg);
+    printf("  %-6s", "mics");
+    for (int k = 0; k < NOISE_KINDS; k++) printf("  %12s", noise_names[k]);
+    printf("  %12s\n", "10log10(N)");
+    for (int c = 0; c < 3; c++) {
+        beam_config_t cfg = arr;
+        cfg.mics = counts[c];
+        double gains[NOISE_KINDS];
+        simulate(&cfg, frames, gains, cfg.mics == arr.mics ? write_prefix : NULL);
+        printf("  %-6d", cfg.mics);
+        for (int k = 0; k < NOISE_KINDS; k++) printf("  %9.2f dB", gains[k]);
+        printf("  %9.2f dB\n", 10.0 * log10(cfg.mics));
+    }
+    return 0;
+}
@@ -0,0 +1,295 @@
+/*
+ * bench_clocksync.c - Clock sync between boards and synchronised playout,
+ * as separate processes on one host
+ *
+ * Forks one process per board, each with its own network context on a
+ * private multicast group (loopback) and its own clock: a fixed offset of
+ * up to -o ms and a rate error of up to -p ppm (clocksync_set_skew), the
+ * lowest board ID included. They elect a master and synchronise exactly
+ * as the application does. Because the processes really share one
+ * CLOCK_MONOTONIC, each can compare its estimate of master time with the
+ * true value every few ms.
+ *
+ * Then every board schedules the same instant in master time with
+ * playout_write_at on a timer-clocked playout stream: a step that starts
+ * at a sub-frame offset. The playout tap says when it reached the
+ * "speaker"; its distance from the true instant is what a listener
+ * standing between two boards would hear as an echo.
+ *
+ * Reported per board: time to lock, exchanges, offset error against the
+ * truth once locked (mean, RMS, worst), drift estimate error, and the
+ * on-air error of the scheduled step; then the spread across boards.
+ *
+ * Usage: ./bench_clocksync [-n boards] [-d seconds] [-o max_offset_ms]
+ *                          [-p max_ppm] [-s seed]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include "clocksync.h"
+#include "playout.h"
+
+#define BENCH_GROUP     "239.0.0.99"
+#define BENCH_PORT      5098
+#define MAX_BOARDS      16
+#define STEP_LEVEL      16000
+
+typedef struct {
+    uint32_t board;
+    bool master;
+    int lock_ms;                            // -1: never
+    uint64_t exchanges;
+    uint32_t rtt_min_us;
+    int measured;
+    double err_mean_us;                     // |estimate - truth|
+    double err_rms_us;
+    double err_max_us;
+    double drift_err_ppm;
+    bool played;
+    double onair_err_us;                    // Heard minus the true instant
+} result_t;
+
+static int boards = 4;
+static int seconds = 8;
+static int64_t skew_us[MAX_BOARDS];
+static double skew_ppm[MAX_BOARDS];
+static uint64_t play_true_us;               // The instant, on the real clock
+static uint64_t play_master_us;             // The same, in master time
+
+static volatile uint64_t heard_us;
+
+static uint64_t now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+// What board b's clock reads at a real time (as clocksync_board_time)
+static uint64_t board_clock(int b, uint64_t mono_us) {
+    return mono_us + skew_us[b] + (int64_t)((double)mono_us * skew_ppm[b] * 1e-6);
+}
+
+// First sample of the step, in the period the playout thread just started
+static void tap(void *arg, const int16_t *pcm, int samples) {
+    playout_ctx_t *po = arg;
+    if (heard_us) return;
+    for (int i = 0; i < samples; i++) {
+        if (pcm[i] > 100) {
+            heard_us = po->period_start_us + (uint64_t)i * 1000000 / SAMPLE_RATE;
+            return;
+        }
+    }
+}
+
+static void run_board(int b, int fd, uint64_t start_us) {
+    result_t res = {0};
+    res.board = b + 1;
+    res.lock_ms = -1;
+
+    network_config_t cfg;
+    network_config_default(&cfg);
+    snprintf(cfg.group, sizeof(cfg.group), "%s", BENCH_GROUP);
+    cfg.port = BENCH_PORT;
+    cfg.talkgroup = 0;
+    cfg.keyring = "";
+    cfg.netem = NULL;
+
+    static network_ctx_t net;
+    static clocksync_ctx_t cs;
+    static playout_ctx_t po;
+    if (network_init_cfg(&net, res.board, &cfg) < 0 || clocksync_init(&cs, &net) < 0 ||
+        playout_init(&po, NULL, PLAYOUT_MAX_FRAMES - 1) < 0) {
+        exit(1);
+    }
+    clocksync_set_skew(&cs, skew_us[b], skew_ppm[b]);
+    playout_set_tap(&po, tap, &po);
+    playout_start(&po);
+
+    int16_t step[FRAME_SIZE];
+    for (int i = 0; i < FRAME_SIZE; i++) step[i] = STEP_LEVEL;
+
+    // Errors are measured from 2 s after lock (the fit has a few exchanges)
+    uint64_t end_us = start_us + (uint64_t)seconds * 1000000;
+    uint64_t locked_us = 0, next_measure = 0;
+    double sum = 0, sum2 = 0;
+    int queued = 0;                         // Step frames written
+    network_packet_t packet;
+
+    while (now_us() < end_us) {
+        int r = network_recv(&net, &packet, 2);
+        if (r >= (int)PACKET_HEADER_SIZE && (packet.flags & PKT_FLAG_SYNC)) {
+            clocksync_receive(&cs, &packet, r, network_rx_time_us(&net));
+        }
+        uint64_t now = now_us();
+        clocksync_poll(&cs, now);
+
+        // Every board claims the master role until it hears a lower ID, so
+        // the lock that counts is the last one
+        if (!clocksync_locked(&cs)) {
+            locked_us = 0;
+            continue;
+        }
+        if (!locked_us) {
+            locked_us = now;
+            next_measure = now + 2000000;
+            res.lock_ms = (int)((now - start_us) / 1000);
+        }
+
+        // Estimate against the truth: the master's clock at the same moment
+        int master = (int)cs.master - 1;
+        if (now >= next_measure && master >= 0 && master < boards) {
+            double err = (double)(int64_t)(clocksync_to_master(&cs, now) - board_clock(master, now));
+            sum += fabs(err);
+            sum2 += err * err;
+            if (fabs(err) > res.err_max_us) res.err_max_us = fabs(err);
+            res.measured++;
+            next_measure = now + 10000;
+        }
+
+        // The step and a few frames after it, each at its time
+        if (queued < 5 && now < play_true_us + 100000) {
+            uint64_t at = clocksync_to_local(&cs, play_master_us + queued * PLAYOUT_PERIOD_US);
+            int w = playout_write_at(&po, step, at);
+            if (w == 0) {
+                queued++;
+            } else if (w < 0) {
+                queued = 5;
+            }
+            if (queued == 5) playout_align_end(&po);
+        }
+    }
+
+    // The stream has played out by now
+    playout_stop(&po);
+
+    res.master = clocksync_is_master(&cs);
+    res.exchanges = cs.stats.exchanges;
+    res.rtt_min_us = cs.stats.rtt_min_us;
+    if (res.measured) {
+        res.err_mean_us = sum / res.measured;
+        res.err_rms_us = sqrt(sum2 / res.measured);
+    }
+
+    // Drift of our clock against the master's, as the fit has it
+    int master = (int)cs.master - 1;
+    if (!res.master && master >= 0 && master < boards) {
+        double truth = (skew_ppm[b] - skew_ppm[master]) / (1.0 + skew_ppm[master] * 1e-6);
+        res.drift_err_ppm = clocksync_drift_ppm(&cs) - truth;
+    }
+    if (heard_us) {
+        res.played = true;
+        res.onair_err_us = (double)(int64_t)(heard_us - play_true_us);
+    }
+
+    if (write(fd, &res, sizeof(res)) != sizeof(res)) exit(1);
+    playout_cleanup(&po);
+    clocksync_cleanup(&cs);
+    network_cleanup(&net);
+    exit(0);
+}
+
+int main(int argc, char *argv[]) {
+    double max_offset_ms = 50, max_ppm = 100;
+    unsigned seed = 1;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:d:o:p:s:")) != -1) {
+        switch (opt) {
+        case 'n': boards = atoi(optarg); break;
+        case 'd': seconds = atoi(optarg); break;
+        case 'o': max_offset_ms = atof(optarg); break;
+        case 'p': max_ppm = atof(optarg); break;
+        case 's': seed = (unsigned)strtoul(optarg, NULL, 0); break;
+        default:
+            fprintf(stderr, "Usage: %s [-n boards] [-d seconds] [-o max_offset_ms] [-p max_ppm] "
+                    "[-s seed]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (boards < 2) boards = 2;
+    if (boards > MAX_BOARDS) boards = MAX_BOARDS;
+    if (seconds < 6) seconds = 6;
+    srand(seed);
+
+    for (int b = 0; b < boards; b++) {
+        skew_us[b] = (int64_t)((rand() / (double)RAND_MAX * 2 - 1) * max_offset_ms * 1000);
+        skew_ppm[b] = (rand() / (double)RAND_MAX * 2 - 1) * max_ppm;
+    }
+
+    // Everyone locks within about 2 s (election, then MIN_SAMPLES exchanges);
+    // the step plays 1.5 s before the end, at an odd offset into a frame
+    uint64_t start_us = now_us();
+    play_true_us = start_us + (uint64_t)(seconds * 1000 - 1500) * 1000 + 7321;
+    play_master_us = board_clock(0, play_true_us);
+
+    int pipes[MAX_BOARDS][2];
+    for (int b = 0; b < boards; b++) {
+        if (pipe(pipes[b]) < 0) {
+            perror("pipe");
+            return 1;
+        }
+        fflush(stdout);
+        pid_t pid = fork();
+        if (pid < 0) {
+            perror("fork");
+            return 1;
+        }
+        if (pid == 0) {
+            // The children's init messages would only interleave
+            if (!freopen("/dev/null", "w", stdout)) exit(1);
+            close(pipes[b][0]);
+            run_board(b, pipes[b][1], start_us);
+        }
+        close(pipes[b][1]);
+    }
+
+    result_t res[MAX_BOARDS];
+    int got = 0;
+    for (int b = 0; b < boards; b++) {
+        if (read(pipes[b][0], &res[got], sizeof(result_t)) == sizeof(result_t)) got++;
+        close(pipes[b][0]);
+    }
+    while (wait(NULL) > 0) {
+    }
+    if (got < boards) {
+        fprintf(stderr, "%d of %d boards did not report\n", boards - got, boards);
+        return 1;
+    }
+
+    printf("\n%d boards, %d s, clocks off by up to %.0f ms and %.0f ppm, SYNC every %d ms\n\n",
+           boards, seconds, max_offset_ms, max_ppm, CLOCKSYNC_INTERVAL_MS);
+    printf("  %-5s %-6s %9s %8s %7s %9s %6s   %9s %8s %8s %9s   %10s\n", "board", "role",
+           "offset ms", "ppm", "lock ms", "exchanges", "rtt us", "err mean", "err rms",
+           "err max", "drift err", "on-air err");
+
+    double worst = 0, lo = 0, hi = 0;
+    bool first = true;
+    for (int i = 0; i < got; i++) {
+        const result_t *r = &res[i];
+        int b = r->board - 1;
+        printf("  %-5u %-6s %9.3f %8.1f %7d %9lu %6u   %9.1f %8.1f %8.1f %9.2f   ", r->board,
+               r->master ? "master" : "slave", skew_us[b] / 1000.0, skew_ppm[b], r->lock_ms,
+               (unsigned long)r->exchanges, r->rtt_min_us, r->err_mean_us, r->err_rms_us,
+               r->err_max_us, r->drift_err_ppm);
+        if (r->played) {
+            printf("%10.0f\n", r->onair_err_us);
+            if (first || r->onair_err_us < lo) lo = r->onair_err_us;
+            if (first || r->onair_err_us > hi) hi = r->onair_err_us;
+            first = false;
+        } else {
+            printf("%10s\n", "not played");
+        }
+        if (r->err_max_us > worst) worst = r->err_max_us;
+    }
+
+    printf("\n  worst offset error %.1f us; scheduled step on air %.0f .. %.0f us from its "
+           "instant, spread %.0f us (%s 1 ms)\n", worst, lo, hi, hi - lo,
+           !first && hi - lo <= 1000 ? "within" : "NOT within");
+    return 0;
+}
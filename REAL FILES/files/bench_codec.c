@@ -0,0 +1,264 @@
+/*
+ * bench_codec.c - Opus configuration sweep on pipeline-sized frames
+ *
+ * Encodes and decodes a speech corpus with opus_encode_frame and
+ * opus_decode_frame, one setting at a time around the board defaults
+ * (bitrate, complexity, frame length, bandwidth, FEC, DTX), or the full
+ * grid with -g. One CSV row per setting and file: encode/decode cost per
+ * frame, real-time factor, packet sizes, DTX share and SNR/segmental SNR
+ * of the decoded audio against the source (aligned for codec delay).
+ *
+ * Usage: ./bench_codec [-g] [-o out.csv] [speech.wav ...]
+ *        (default bench_codec.csv; no files: 20 s of synthetic speech)
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "codec_pool.h"
+#include "audio_metrics.h"
+#include "wav.h"
+
+#define MAX_FRAME_MS    60
+#define MAX_FRAME       (SAMPLE_RATE * MAX_FRAME_MS / 1000)
+#define MAX_LAG         (SAMPLE_RATE / 100)     // Codec delay is a few ms
+
+static const int sweep_bitrate[] = { 12000, 16000, 24000, 32000, 48000 };
+static const int sweep_complexity[] = { 0, 2, 5, 8, 10 };
+static const int sweep_frame_ms[] = { 10, 20, 40, 60 };
+static const int sweep_bandwidth[] = { OPUS_BANDWIDTH_NARROWBAND, OPUS_BANDWIDTH_WIDEBAND,
+                                       OPUS_BANDWIDTH_SUPERWIDEBAND, OPUS_AUTO };
+static const int sweep_onoff[] = { 0, 1 };
+
+#define COUNT(a) ((int)(sizeof(a) / sizeof((a)[0])))
+
+typedef struct {
+    const char *name;
+    int16_t *pcm;
+    int samples;
+} corpus_file_t;
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int cmp_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a;
+    uint64_t y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+static const char *bandwidth_name(int bw) {
+    switch (bw) {
+    case OPUS_BANDWIDTH_NARROWBAND:     return "nb";
+    case OPUS_BANDWIDTH_MEDIUMBAND:     return "mb";
+    case OPUS_BANDWIDTH_WIDEBAND:       return "wb";
+    case OPUS_BANDWIDTH_SUPERWIDEBAND:  return "swb";
+    case OPUS_BANDWIDTH_FULLBAND:       return "fb";
+    default:                            return "auto";
+    }
+}
+
+static void run_config(FILE *csv, codec_pool_t *pool, const opus_enc_params_t *params,
+                       int frame_ms, const corpus_file_t *file, int16_t *decoded,
+                       uint64_t *enc_cost, uint64_t *dec_cost) {
+    opus_enc_ctx_t *enc = codec_pool_acquire_enc(pool);
+    opus_dec_ctx_t *dec = codec_pool_acquire_dec(pool);
+    uint8_t packet[MAX_PACKET_SIZE];
+
+    if (!enc || !dec || opus_enc_apply(enc, params) < 0) {
+        fprintf(stderr, "%s: skipping configuration\n", file->name);
+        if (enc) codec_pool_release_enc(pool, enc);
+        if (dec) codec_pool_release_dec(pool, dec);
+        return;
+    }
+
+    int n = SAMPLE_RATE * frame_ms / 1000;
+    int frames = file->samples / n;
+    long bytes = 0;
+    int max_bytes = 0, dtx_frames = 0, failed = 0;
+    double enc_total = 0.0, dec_total = 0.0;
+
+    for (int f = 0; f < frames; f++) {
+        uint64_t t0 = now_ns();
+        int size = opus_encode_frame(enc, file->pcm + (size_t)f * n, n, packet, MAX_PACKET_SIZE);
+        uint64_t t1 = now_ns();
+
+        int got = size > 0 ? opus_decode_frame(dec, packet, size, decoded + (size_t)f * n, n) : -1;
+        uint64_t t2 = now_ns();
+
+        if (size <= 0 || got != n) {
+            memset(decoded + (size_t)f * n, 0, n * sizeof(int16_t));
+            failed++;
+        }
+
+        enc_cost[f] = t1 - t0;
+        dec_cost[f] = t2 - t1;
+        enc_total += enc_cost[f];
+        dec_total += dec_cost[f];
+
+        if (size > 0) {
+            bytes += size;
+            if (size > max_bytes) max_bytes = size;
+            if (size <= 2) dtx_frames++;    // DTX: nothing worth sending
+        }
+    }
+
+    int samples = frames * n;
+    int lag = best_lag(file->pcm, decoded, samples, MAX_LAG);
+    const int16_t *ref = lag >= 0 ? file->pcm : file->pcm - lag;
+    const int16_t *out = lag >= 0 ? decoded + lag : decoded;
+    int len = samples - (lag >= 0 ? lag : -lag);
+    double snr = snr_db(ref, out, len);
+    double segsnr = segsnr_db(ref, out, len, SAMPLE_RATE / 50);
+
+    qsort(enc_cost, frames, sizeof(uint64_t), cmp_u64);
+    qsort(dec_cost, frames, sizeof(uint64_t), cmp_u64);
+    double seconds = (double)samples / SAMPLE_RATE;
+
+    fprintf(csv, "%s,%d,%d,%d,%s,%d,%d,%.2f,%.2f,%.2f,%.2f,%.4f,%.1f,%d,%.2f,%.1f,%d,%.2f,%.2f\n",
+            file->name, params->bitrate, params->complexity, frame_ms,
+            bandwidth_name(params->bandwidth), params->fec, params->dtx,
+            enc_total / frames / 1000.0, enc_cost[frames * 99 / 100] / 1000.0,
+            dec_total / frames / 1000.0, dec_cost[frames * 99 / 100] / 1000.0,
+            (enc_total + dec_total) / 1e9 / seconds,
+            (double)bytes / frames, max_bytes, bytes * 8.0 / seconds / 1000.0,
+            100.0 * dtx_frames / frames, failed, snr, segsnr);
+    fflush(csv);
+
+    codec_pool_release_enc(pool, enc);
+    codec_pool_release_dec(pool, dec);
+}
+
+int main(int argc, char *argv[]) {
+    const char *csv_path = "bench_codec.csv";
+    bool grid = false;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "go:")) != -1) {
+        switch (opt) {
+        case 'g': grid = true; break;
+        case 'o': csv_path = optarg; break;
+        default:
+            fprintf(stderr, "Usage: %s [-g] [-o out.csv] [speech.wav ...]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    int nfiles = argc - optind > 0 ? argc - optind : 1;
+    corpus_file_t *corpus = calloc(nfiles, sizeof(corpus_file_t));
+    int max_samples = 0;
+
+    if (optind >= argc) {
+        corpus[0].name = "synthetic";
+        corpus[0].samples = 20 * SAMPLE_RATE;
+        corpus[0].pcm = malloc(corpus[0].samples * sizeof(int16_t));
+        test_signal_speechlike(corpus[0].pcm, corpus[0].samples, SAMPLE_RATE, 1);
+    } else {
+        for (int i = 0; i < nfiles; i++) {
+            int rate, channels;
+            corpus[i].name = argv[optind + i];
+            corpus[i].pcm = wav_read(corpus[i].name, &rate, &channels, &corpus[i].samples);
+            if (!corpus[i].pcm) return 1;
+            if (channels != 1 || rate != SAMPLE_RATE) {
+                fprintf(stderr, "%s: need mono %d Hz (the pipeline rate)\n", corpus[i].name, SAMPLE_RATE);
+                return 1;
+            }
+        }
+    }
+    for (int i = 0; i < nfiles; i++) {
+        if (corpus[i].samples > max_samples) max_samples = corpus[i].samples;
+    }
+
+    FILE *csv = fopen(csv_path, "w");
+    if (!csv) {
+        perror(csv_path);
+        return 1;
+    }
+
+    // One encoder and decoder, reset between configurations
+    static codec_pool_t pool;
+    if (codec_pool_init(&pool, 1, 1, BITRATE) < 0) {
+        fprintf(stderr, "Opus rejected %d Hz mono, nothing to measure\n", SAMPLE_RATE);
+        return 1;
+    }
+
+    int16_t *decoded = malloc((size_t)(max_samples + MAX_FRAME) * sizeof(int16_t));
+    uint64_t *enc_cost = malloc((size_t)(max_samples / (SAMPLE_RATE / 100) + 1) * sizeof(uint64_t));
+    uint64_t *dec_cost = malloc((size_t)(max_samples / (SAMPLE_RATE / 100) + 1) * sizeof(uint64_t));
+
+    fprintf(csv, "file,bitrate,complexity,frame_ms,bandwidth,fec,dtx,"
+                 "enc_us_mean,enc_us_p99,dec_us_mean,dec_us_p99,rtf,"
+                 "pkt_bytes_mean,pkt_bytes_max,kbps,dtx_pct,failed_frames,snr_db,segsnr_db\n");
+
+    opus_enc_params_t base;
+    opus_enc_params_default(&base, BITRATE);
+    int base_ms = FRAME_SIZE * 1000 / SAMPLE_RATE;
+    int runs = 0;
+
+    for (int i = 0; i < nfiles; i++) {
+        const corpus_file_t *file = &corpus[i];
+        opus_enc_params_t p;
+
+        if (grid) {
+            for (int b = 0; b < COUNT(sweep_bitrate); b++)
+            for (int c = 0; c < COUNT(sweep_complexity); c++)
+            for (int m = 0; m < COUNT(sweep_frame_ms); m++)
+            for (int w = 0; w < COUNT(sweep_bandwidth); w++)
+            for (int f = 0; f < COUNT(sweep_onoff); f++)
+            for (int d = 0; d < COUNT(sweep_onoff); d++) {
+                p = base;
+                p.bitrate = sweep_bitrate[b];
+                p.complexity = sweep_complexity[c];
+                p.bandwidth = sweep_bandwidth[w];
+                p.fec = sweep_onoff[f];
+                p.dtx = sweep_onoff[d];
+                run_config(csv, &pool, &p, sweep_frame_ms[m], file, decoded, enc_cost, dec_cost);
+                runs++;
+            }
+            continue;
+        }
+
+        // One axis at a time around the defaults (first row is the baseline)
+        run_config(csv, &pool, &base, base_ms, file, decoded, enc_cost, dec_cost);
+        for (int k = 0; k < COUNT(sweep_bitrate); k++) {
+            p = base; p.bitrate = sweep_bitrate[k];
+            run_config(csv, &pool, &p, base_ms, file, decoded, enc_cost, dec_cost);
+        }
+        for (int k = 0; k < COUNT(sweep_complexity); k++) {
+            p = base; p.complexity = sweep_complexity[k];
+            run_config(csv, &pool, &p, base_ms, file, decoded, enc_cost, dec_cost);
+        }
+        for (int k = 0; k < COUNT(sweep_frame_ms); k++) {
+            run_config(csv, &pool, &base, sweep_frame_ms[k], file, decoded, enc_cost, dec_cost);
+        }
+        for (int k = 0; k < COUNT(sweep_bandwidth); k++) {
+            p = base; p.bandwidth = sweep_bandwidth[k];
+            run_config(csv, &pool, &p, base_ms, file, decoded, enc_cost, dec_cost);
+        }
+        for (int k = 0; k < COUNT(sweep_onoff); k++) {
+            p = base; p.fec = sweep_onoff[k];
+            run_config(csv, &pool, &p, base_ms, file, decoded, enc_cost, dec_cost);
+            p = base; p.dtx = sweep_onoff[k];
+            run_config(csv, &pool, &p, base_ms, file, decoded, enc_cost, dec_cost);
+        }
+        runs += 1 + COUNT(sweep_bitrate) + COUNT(sweep_complexity) + COUNT(sweep_frame_ms) +
+                COUNT(sweep_bandwidth) + 2 * COUNT(sweep_onoff);
+    }
+
+    printf("%d configurations over %d file(s) written to %s\n", runs, nfiles, csv_path);
+
+    fclose(csv);
+    codec_pool_cleanup(&pool);
+    free(dec_cost);
+    free(enc_cost);
+    free(decoded);
+    for (int i = 0; i < nfiles; i++) free(corpus[i].pcm);
+    free(corpus);
+    return 0;
+}
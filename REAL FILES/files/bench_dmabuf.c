@@ -0,0 +1,166 @@
+/*
+ * bench_dmabuf.c - Audio buffer access: uncached /dev/mem against cached
+ * u-dma-buf with explicit cache sync
+ *
+ * For each kind of buffer, times what the audio threads do with it every
+ * frame: the capture side (sync for CPU, then convert_i32_to_i16 out of
+ * the RX buffer) and the playback side (convert_i16_to_i32 into the TX
+ * buffer, then sync for device), plus raw read and write bandwidth over
+ * one frame with the same syncs, and the cost of the syncs alone. A heap
+ * buffer with no sync at all is the upper bound.
+ *
+ * Nothing is transferred, the DMA engine is not started; the buffers are
+ * only mapped. Must run on the board (uses the configured addresses).
+ *
+ * Usage: ./bench_dmabuf [-d udmabuf] [-n frames] [-r regs_base] [-m mem_base]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "audio_dma.h"
+#include "opus_helper.h"
+
+typedef struct {
+    const char *name;
+    dma_ctx_t *dma;                 // NULL: heap, no sync
+    int32_t *rx;
+    int32_t *tx;
+} target_t;
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void sync_cpu(const target_t *t, const void *buf) {
+    if (t->dma) dma_sync_for_cpu(t->dma, buf, FRAME_BYTES);
+}
+
+static void sync_device(const target_t *t, const void *buf) {
+    if (t->dma) dma_sync_for_device(t->dma, buf, FRAME_BYTES);
+}
+
+static void run(const target_t *t, int frames) {
+    static int16_t pcm[FRAME_SIZE];
+    volatile uint64_t sink = 0;
+
+    for (int i = 0; i < FRAME_SIZE; i++) pcm[i] = (int16_t)(i * 37);
+
+    // Write: fill the TX buffer, then make it visible to the device
+    uint64_t t0 = now_ns();
+    for (int f = 0; f < frames; f++) {
+        memset(t->tx, f & 0xFF, FRAME_BYTES);
+        sync_device(t, t->tx);
+        __asm__ volatile("" ::: "memory");
+    }
+    double write_ns = (double)(now_ns() - t0) / frames;
+
+    // Read: fetch the RX buffer after the device "wrote" it
+    t0 = now_ns();
+    for (int f = 0; f < frames; f++) {
+        sync_cpu(t, t->rx);
+        const uint64_t *p = (const uint64_t *)t->rx;
+        uint64_t sum = 0;
+        for (size_t i = 0; i < FRAME_BYTES / sizeof(uint64_t); i++) sum += p[i];
+        sink += sum;
+    }
+    double read_ns = (double)(now_ns() - t0) / frames;
+
+    // What the TX thread does per captured frame
+    t0 = now_ns();
+    for (int f = 0; f < frames; f++) {
+        sync_cpu(t, t->rx);
+        convert_i32_to_i16(t->rx, pcm, FRAME_SIZE);
+        sink += pcm[f % FRAME_SIZE];
+    }
+    double capture_ns = (double)(now_ns() - t0) / frames;
+
+    // What the RX thread does per played frame
+    t0 = now_ns();
+    for (int f = 0; f < frames; f++) {
+        convert_i16_to_i32(pcm, t->tx, FRAME_SIZE);
+        sync_device(t, t->tx);
+        __asm__ volatile("" ::: "memory");
+    }
+    double playback_ns = (double)(now_ns() - t0) / frames;
+
+    // Cache maintenance alone
+    t0 = now_ns();
+    for (int f = 0; f < frames; f++) {
+        sync_cpu(t, t->rx);
+        sync_device(t, t->tx);
+    }
+    double sync_ns = (double)(now_ns() - t0) / frames;
+
+    // A frame is FRAME_BYTES, so bytes per ns is GB/s; print MB/s
+    printf("  %-22s %9.0f %9.0f %10.2f %10.2f %8.2f\n", t->name,
+           FRAME_BYTES * 1000.0 / write_ns, FRAME_BYTES * 1000.0 / read_ns,
+           capture_ns / 1000.0, playback_ns / 1000.0, sync_ns / 1000.0);
+    (void)sink;
+}
+
+int main(int argc, char *argv[]) {
+    const char *udmabuf = DMA_UDMABUF_DEFAULT;
+    int frames = 2000;
+    uint32_t regs_base = DMA_BASE_ADDR;
+    uint32_t mem_base = DMA_MEM_BASE;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "d:n:r:m:")) != -1) {
+        switch (opt) {
+        case 'd': udmabuf = optarg; break;
+        case 'n': frames = atoi(optarg); break;
+        case 'r': regs_base = (uint32_t)strtoul(optarg, NULL, 0); break;
+        case 'm': mem_base = (uint32_t)strtoul(optarg, NULL, 0); break;
+        default:
+            fprintf(stderr, "Usage: %s [-d udmabuf] [-n frames] [-r regs_base] [-m mem_base]\n",
+                    argv[0]);
+            return 1;
+        }
+    }
+    if (frames < 1) frames = 1;
+
+    static dma_ctx_t uncached, cached;
+    bool have_uncached = dma_init_buf(&uncached, regs_base, mem_base, "off") == 0;
+    bool have_cached = dma_init_buf(&cached, regs_base, mem_base, udmabuf) == 0 &&
+                       cached.buf_mode == DMA_BUF_UDMABUF;
+    if (!have_cached && cached.initialized) dma_cleanup(&cached);
+
+    int32_t *heap = aligned_alloc(64, DMA_TX_OFFSET + FRAME_BYTES);
+    memset(heap, 0, DMA_TX_OFFSET + FRAME_BYTES);
+
+    printf("\n%d frames of %d bytes (%d samples)\n\n", frames, FRAME_BYTES, FRAME_SIZE);
+    printf("  %-22s %9s %9s %10s %10s %8s\n", "buffer", "write", "read", "capture", "playback",
+           "sync");
+    printf("  %-22s %9s %9s %10s %10s %8s\n", "", "MB/s", "MB/s", "us/frame", "us/frame", "us");
+
+    target_t t;
+    if (have_uncached) {
+        t = (target_t){ "uncached (/dev/mem)", &uncached, dma_get_rx_buffer(&uncached),
+                        dma_get_tx_buffer(&uncached) };
+        run(&t, frames);
+    } else {
+        printf("  %-22s unavailable\n", "uncached (/dev/mem)");
+    }
+
+    if (have_cached) {
+        t = (target_t){ "cached + sync", &cached, dma_get_rx_buffer(&cached),
+                        dma_get_tx_buffer(&cached) };
+        run(&t, frames);
+    } else {
+        printf("  %-22s unavailable (no %s)\n", "cached + sync", udmabuf);
+    }
+
+    t = (target_t){ "heap, no sync", NULL, heap, heap + DMA_TX_OFFSET / sizeof(int32_t) };
+    run(&t, frames);
+
+    if (have_uncached) dma_cleanup(&uncached);
+    if (have_cached) dma_cleanup(&cached);
+    free(heap);
+    return 0;
+}
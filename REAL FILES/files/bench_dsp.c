@@ -0,0 +1,314 @@
+/*
+ * bench_dsp.c - Per-stage cost of the capture and playback DSP chains
+ *
+ * Feeds a speech-like signal mixed with fan-like noise and mains hum
+ * through each capture stage on its own and then the whole chain,
+ * timing every 20 ms frame. Also prints what the chain did to the
+ * background (in speech pauses) and to the speech level.
+ *
+ * The playback side gets a quiet and a hot talker taking 2 s turns,
+ * with beeps queued now and then, and reports the level each talker
+ * ends up at and the highest peak that reached the speaker.
+ *
+ * Usage: ./bench_dsp [-d seconds] [-i in.wav] [-o out.wav]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "capture_dsp.h"
+#include "playback_dsp.h"
+#include "audio_metrics.h"
+#include "wav.h"
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int cmp_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a;
+    uint64_t y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+// Quiet talker (-12 dB) over low-passed fan noise and 50 Hz hum
+static void make_input(int16_t *speech, int16_t *mixed, int samples) {
+    uint32_t rng = 12345;
+    double lp = 0.0;
+
+    test_signal_speechlike(speech, samples, SAMPLE_RATE, 1);
+    for (int i = 0; i < samples; i++) {
+        rng = rng * 1664525u + 1013904223u;
+        double white = (double)(rng >> 8) / 8388608.0 - 1.0;
+        lp += (white - lp) * 0.05;
+        double noise = lp * 1500.0 + 300.0 * sin(2.0 * M_PI * 50.0 * i / SAMPLE_RATE);
+
+        speech[i] = (int16_t)(speech[i] / 4);
+        double s = speech[i] + noise;
+        if (s > 32767.0) s = 32767.0;
+        if (s < -32768.0) s = -32768.0;
+        mixed[i] = (int16_t)s;
+    }
+}
+
+static void run_stage(const char *name, const capture_dsp_config_t *cfg,
+                      const int16_t *input, int16_t *output, int frames) {
+    static capture_dsp_ctx_t ctx;
+    uint64_t *cost = malloc(frames * sizeof(uint64_t));
+
+    capture_dsp_init(&ctx, cfg);
+    memcpy(output, input, (size_t)frames * FRAME_SIZE * sizeof(int16_t));
+
+    double total = 0.0;
+    for (int f = 0; f < frames; f++) {
+        int16_t *frame = output + (size_t)f * FRAME_SIZE;
+        uint64_t t0 = now_ns();
+        capture_dsp_process(&ctx, frame);
+        cost[f] = now_ns() - t0;
+        total += cost[f];
+    }
+
+    qsort(cost, frames, sizeof(uint64_t), cmp_u64);
+    printf("  %-10s  mean %7.2f us  median %7.2f us  p99 %7.2f us  (%.2f%% of a core)\n",
+           name, total / frames / 1000.0, cost[frames / 2] / 1000.0,
+           cost[frames * 99 / 100] / 1000.0,
+           100.0 * total / frames / ((double)FRAME_SIZE * 1e9 / SAMPLE_RATE));
+    free(cost);
+}
+
+// RMS in dBFS over the samples where the clean speech is (or is not) active
+static double level_dbfs(const int16_t *x, const int16_t *speech, int samples,
+                         bool want_speech, int lag) {
+    double sum = 0.0;
+    long count = 0;
+    for (int start = 0; start + FRAME_SIZE <= samples - lag; start += FRAME_SIZE) {
+        double e = 0.0;
+        for (int i = start; i < start + FRAME_SIZE; i++) e += (double)speech[i] * speech[i];
+        bool active = sqrt(e / FRAME_SIZE) > 200.0;
+        if (active != want_speech) continue;
+        for (int i = start; i < start + FRAME_SIZE; i++) {
+            sum += (double)x[i + lag] * x[i + lag];
+        }
+        count += FRAME_SIZE;
+    }
+    if (count == 0) return -99.0;
+    return 10.0 * log10(sum / count / (32768.0 * 32768.0) + 1e-12);
+}
+
+static void print_levels(const char *name, const int16_t *input, const int16_t *output,
+                         const int16_t *speech, int samples, const capture_dsp_config_t *cfg) {
+    // Noise suppressor output trails the input by one hop
+    printf("  %-10s  background in pauses %.1f -> %.1f dBFS, speech %.1f -> %.1f dBFS (AGC target %.0f)\n",
+           name,
+           level_dbfs(input, speech, samples, false, 0),
+           level_dbfs(output, speech, samples, false, NS_HOP),
+           level_dbfs(input, speech, samples, true, 0),
+           level_dbfs(output, speech, samples, true, NS_HOP),
+           cfg->agc_target_dbfs);
+}
+
+// Two talkers 24 dB apart taking turns every 2 s; sender[f] is the board per frame
+#define TURN_FRAMES (2 * SAMPLE_RATE / FRAME_SIZE)
+
+static void make_talkers(int16_t *pcm, uint32_t *sender, int frames) {
+    int samples = frames * FRAME_SIZE;
+    int16_t *quiet = malloc(samples * sizeof(int16_t));
+    int16_t *hot = malloc(samples * sizeof(int16_t));
+
+    test_signal_speechlike(quiet, samples, SAMPLE_RATE, 2);
+    test_signal_speechlike(hot, samples, SAMPLE_RATE, 3);
+    for (int f = 0; f < frames; f++) {
+        sender[f] = (f / TURN_FRAMES) % 2 ? 20 : 10;
+        for (int i = f * FRAME_SIZE; i < (f + 1) * FRAME_SIZE; i++) {
+            if (sender[f] == 10) {
+                pcm[i] = (int16_t)(quiet[i] / 8);
+            } else {
+                int v = hot[i] * 2;
+                pcm[i] = (int16_t)(v > 32767 ? 32767 : (v < -32768 ? -32768 : v));
+            }
+        }
+    }
+    free(quiet);
+    free(hot);
+}
+
+static void run_playback(const char *name, const playback_dsp_config_t *cfg,
+                         const int16_t *input, const uint32_t *sender,
+                         int16_t *output, int frames) {
+    static playback_dsp_ctx_t ctx;
+    uint64_t *cost = malloc(frames * sizeof(uint64_t));
+
+    playback_dsp_init(&ctx, cfg);
+    memcpy(output, input, (size_t)frames * FRAME_SIZE * sizeof(int16_t));
+
+    double total = 0.0;
+    for (int f = 0; f < frames; f++) {
+        int16_t *frame = output + (size_t)f * FRAME_SIZE;
+        if (f % 25 == 0) playback_dsp_tone(&ctx, f % 50 ? PB_TONE_ROGER : PB_TONE_TALK_PERMIT);
+
+        uint64_t t0 = now_ns();
+        playback_dsp_process(&ctx, frame, sender[f]);
+        cost[f] = now_ns() - t0;
+        total += cost[f];
+    }
+
+    qsort(cost, frames, sizeof(uint64_t), cmp_u64);
+    printf("  %-10s  mean %7.2f us  median %7.2f us  p99 %7.2f us  (%.2f%% of a core)\n",
+           name, total / frames / 1000.0, cost[frames / 2] / 1000.0,
+           cost[frames * 99 / 100] / 1000.0,
+           100.0 * total / frames / ((double)FRAME_SIZE * 1e9 / SAMPLE_RATE));
+    free(cost);
+}
+
+// Speech level of one talker, skipping the first second of each turn
+static double talker_dbfs(const int16_t *x, const int16_t *ref, const uint32_t *sender,
+                          int frames, uint32_t board, int lag) {
+    double sum = 0.0;
+    long count = 0;
+    for (int f = 0; f < frames - 1; f++) {
+        if (sender[f] != board || f % TURN_FRAMES < TURN_FRAMES / 2) continue;
+        double e = 0.0;
+        for (int i = f * FRAME_SIZE; i < (f + 1) * FRAME_SIZE; i++) e += (double)ref[i] * ref[i];
+        if (10.0 * log10(e / FRAME_SIZE / (32768.0 * 32768.0) + 1e-12) < -50.0) continue;
+        for (int i = f * FRAME_SIZE; i < (f + 1) * FRAME_SIZE; i++) {
+            sum += (double)x[i + lag] * x[i + lag];
+        }
+        count += FRAME_SIZE;
+    }
+    if (count == 0) return -99.0;
+    return 10.0 * log10(sum / count / (32768.0 * 32768.0) + 1e-12);
+}
+
+static double peak_dbfs(const int16_t *x, int samples) {
+    int peak = 0;
+    for (int i = 0; i < samples; i++) {
+        int a = x[i] < 0 ? -x[i] : x[i];
+        if (a > peak) peak = a;
+    }
+    return 20.0 * log10(peak / 32768.0 + 1e-12);
+}
+
+int main(int argc, char *argv[]) {
+    int seconds = 20;
+    const char *input_path = NULL;
+    const char *output_path = NULL;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "d:i:o:")) != -1) {
+        switch (opt) {
+        case 'd': seconds = atoi(optarg); break;
+        case 'i': input_path = optarg; break;
+        case 'o': output_path = optarg; break;
+        default:
+            fprintf(stderr, "Usage: %s [-d seconds] [-i in.wav] [-o out.wav]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    int16_t *speech = NULL, *input;
+    int samples;
+    if (input_path) {
+        int rate, channels;
+        input = wav_read(input_path, &rate, &channels, &samples);
+        if (!input) return 1;
+        if (channels != 1 || rate != SAMPLE_RATE) {
+            fprintf(stderr, "%s: need mono %d Hz input\n", input_path, SAMPLE_RATE);
+            return 1;
+        }
+    } else {
+        samples = seconds * SAMPLE_RATE;
+        speech = malloc(samples * sizeof(int16_t));
+        input = malloc(samples * sizeof(int16_t));
+        make_input(speech, input, samples);
+    }
+
+    int frames = samples / FRAME_SIZE;
+    int16_t *output = malloc((size_t)frames * FRAME_SIZE * sizeof(int16_t));
+
+    capture_dsp_config_t full, cfg;
+    capture_dsp_config_default(&full);
+
+    printf("Capture DSP, %d frames of %d samples\n", frames, FRAME_SIZE);
+
+    cfg = full;
+    cfg.ns = cfg.agc = cfg.limiter = false;
+    run_stage("high-pass", &cfg, input, output, frames);
+
+    cfg = full;
+    cfg.hpf = cfg.agc = cfg.limiter = false;
+    run_stage("noise sup", &cfg, input, output, frames);
+    if (speech) print_levels("noise sup", input, output, speech, frames * FRAME_SIZE, &full);
+
+    cfg = full;
+    cfg.hpf = cfg.ns = cfg.limiter = false;
+    run_stage("agc", &cfg, input, output, frames);
+
+    cfg = full;
+    cfg.hpf = cfg.ns = cfg.agc = false;
+    run_stage("limiter", &cfg, input, output, frames);
+
+    run_stage("full chain", &full, input, output, frames);
+    if (speech) print_levels("full chain", input, output, speech, frames * FRAME_SIZE, &full);
+
+    int16_t *talkers = malloc((size_t)frames * FRAME_SIZE * sizeof(int16_t));
+    int16_t *played = malloc((size_t)frames * FRAME_SIZE * sizeof(int16_t));
+    uint32_t *sender = malloc(frames * sizeof(uint32_t));
+    make_talkers(talkers, sender, frames);
+
+    playback_dsp_config_t pb_full, pb;
+    playback_dsp_config_default(&pb_full);
+
+    printf("\nPlayback DSP, two talkers in 2 s turns\n");
+
+    pb = pb_full;
+    pb.tones = pb.limiter = false;
+    run_playback("normalize", &pb, talkers, sender, played, frames);
+
+    pb = pb_full;
+    pb.normalize = pb.limiter = false;
+    run_playback("tones", &pb, talkers, sender, played, frames);
+
+    pb = pb_full;
+    pb.normalize = pb.tones = false;
+    run_playback("limiter", &pb, talkers, sender, played, frames);
+
+    pb = pb_full;
+    pb.tones = false;
+    run_playback("norm+limit", &pb, talkers, sender, played, frames);
+    printf("  levels      quiet talker %.1f -> %.1f dBFS, hot talker %.1f -> %.1f dBFS (target %.0f)\n",
+           talker_dbfs(talkers, talkers, sender, frames, 10, 0),
+           talker_dbfs(played, talkers, sender, frames, 10, PB_BLOCK),
+           talker_dbfs(talkers, talkers, sender, frames, 20, 0),
+           talker_dbfs(played, talkers, sender, frames, 20, PB_BLOCK),
+           pb_full.target_dbfs);
+    printf("  peaks       in %.2f dBFS, out %.2f dBFS (ceiling %.1f)\n",
+           peak_dbfs(talkers, frames * FRAME_SIZE), peak_dbfs(played, frames * FRAME_SIZE),
+           pb_full.limit_dbfs);
+
+    free(sender);
+    free(played);
+    free(talkers);
+
+    if (output_path) {
+        wav_writer_t wav;
+        if (wav_open_write(&wav, output_path, SAMPLE_RATE, 1) == 0) {
+            wav_write(&wav, output, frames * FRAME_SIZE);
+            wav_close(&wav);
+        }
+    }
+
+    free(output);
+    free(input);
+    free(speech);
+    return 0;
+}
@@ -0,0 +1,337 @@
+/*
+ * bench_fanout.c - Multi-talkgroup TX fan-out throughput
+ *
+ * Encodes the same speech into N streams (alternating bitrates and
+ * complexities) with tx_fanout, for 0 up to cores-1 worker threads, and
+ * reports the time per 20 ms frame, streams per second and the speed-up
+ * over encoding everything on the TX thread. Packets go to a loopback
+ * UDP socket, once batched (sendmmsg) and once with a sendto per stream.
+ *
+ * With -o, the streams then run in real time (a frame every 20 ms, no
+ * helpers) while that many threads hog the cores for a while, each
+ * spinning 0.9 ms of every ms above the TX thread (SCHED_FIFO where
+ * allowed), once with the settings fixed and once under deadline control
+ * with a budget of three times the unloaded frame. Per phase (before, under and after the
+ * load): frames over the budget, deadline misses, the worst frame and
+ * the level the encoders ended at.
+ *
+ * Before that, deadline control is walked down to its last level and back
+ * up without pacing, and every encoder is read back: it has to be at its
+ * configured bandwidth and complexity again (exit status 1 if not).
+ *
+ * Usage: ./bench_fanout [-s streams] [-f frames] [-w max_workers] [-o hogs]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
+#include <arpa/inet.h>
+
+#include "tx_fanout.h"
+#include "audio_metrics.h"
+
+#define BENCH_PORT  5999
+
+// Paced run: frames before, under and after the load
+#define PHASE_QUIET     50
+#define PHASE_LOAD      200
+#define PHASE_RECOVER   600
+
+static volatile int hogging;
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// Enough of a network context to send to localhost, no multicast or keys
+static int loopback_init(network_ctx_t *net) {
+    memset(net, 0, sizeof(network_ctx_t));
+    net->sockfd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (net->sockfd < 0) {
+        perror("socket");
+        return -1;
+    }
+    net->multicast_addr.sin_family = AF_INET;
+    net->multicast_addr.sin_port = htons(BENCH_PORT);
+    net->multicast_addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    net->my_board_id = 1;
+    crypto_init(&net->crypto);
+    net->initialized = true;
+    return 0;
+}
+
+static double run(network_ctx_t *net, codec_pool_t *pool, tx_fanout_config_t *cfg,
+                  const int16_t *speech, int frames) {
+    static tx_fanout_t tx;
+    if (tx_fanout_init(&tx, cfg, net, pool) < 0) return -1.0;
+
+    const int16_t *sources[1];
+    uint64_t t0 = now_ns();
+    for (int f = 0; f < frames; f++) {
+        sources[0] = speech + (size_t)f * FRAME_SIZE;
+        tx_fanout_send(&tx, sources);
+    }
+    double per_frame_us = (now_ns() - t0) / 1000.0 / frames;
+
+    if (tx.stats.send_errors > 0) {
+        printf("    (%lu short batches)\n", tx.stats.send_errors);
+    }
+    tx_fanout_cleanup(&tx);
+    return per_frame_us;
+}
+
+// What a stream's encoder is set to now, against what it was configured
+// with (OPUS_AUTO runs as fullband)
+static bool settings_back(tx_stream_t *s) {
+    opus_int32 bw = 0, cx = 0;
+    opus_encoder_ctl(s->encoder->encoder, OPUS_GET_MAX_BANDWIDTH(&bw));
+    opus_encoder_ctl(s->encoder->encoder, OPUS_GET_COMPLEXITY(&cx));
+    int want = s->cfg.params.bandwidth == OPUS_AUTO ? OPUS_BANDWIDTH_FULLBAND :
+               s->cfg.params.bandwidth;
+    if (bw == want && cx == s->cfg.params.complexity) return true;
+
+    printf("    talkgroup %u: bandwidth %d complexity %d, configured %d and %d\n",
+           s->cfg.talkgroup, bw, cx, want, s->cfg.params.complexity);
+    return false;
+}
+
+// Deadline control all the way down and back up, unpaced: a 1 us budget
+// every frame is over, then one of a whole frame that none is. The
+// encoders have to end where they started. Returns the streams that did
+// not, or -1 if the levels never got there.
+static int cycle(network_ctx_t *net, codec_pool_t *pool, tx_fanout_config_t *cfg,
+                 const int16_t *speech, int frames) {
+    static tx_fanout_t tx;
+    cfg->budget_us = 1;
+    int ok = tx_fanout_init(&tx, cfg, net, pool);
+    cfg->budget_us = 0;
+    if (ok < 0) return -1;
+
+    // A step takes the hold and TX_ADAPT_PRESSURE frames down, a window
+    // per quiet run up
+    const int16_t *sources[1];
+    int limit = (TX_ADAPT_HOLD + TX_ADAPT_WINDOW) * (TX_ADAPT_RECOVER + 1) * (tx.levels + 1);
+    int f = 0;
+    for (; tx.level < tx.levels && f < limit; f++) {
+        sources[0] = speech + (size_t)(f % frames) * FRAME_SIZE;
+        tx_fanout_send(&tx, sources);
+    }
+    int bottom = tx.level;
+
+    tx_fanout_set_budget(&tx, TX_FRAME_US);
+    for (int down = f; tx.level > 0 && f < down + limit; f++) {
+        sources[0] = speech + (size_t)(f % frames) * FRAME_SIZE;
+        tx_fanout_send(&tx, sources);
+    }
+
+    int wrong = 0;
+    for (int i = 0; i < tx.n_streams; i++) {
+        if (!settings_back(&tx.streams[i])) wrong++;
+    }
+    printf("\n  Deadline control down to level %d of %d and back to %d in %d frames: "
+           "%d of %d streams at their configured settings, %lu refused\n", bottom, tx.levels,
+           tx.level, f, tx.n_streams - wrong, tx.n_streams,
+           (unsigned long)tx.stats.update_failures);
+    if (bottom < tx.levels || tx.level > 0 || tx.stats.update_failures > 0) wrong = -1;
+
+    tx_fanout_cleanup(&tx);
+    return wrong;
+}
+
+// Most of each ms, above the TX thread when we may
+static void *hog(void *arg) {
+    (void)arg;
+    struct sched_param sp = { .sched_priority = 1 };
+    pthread_setschedparam(pthread_self(), SCHED_FIFO, &sp);
+
+    volatile uint32_t x = 1;
+    while (hogging) {
+        uint64_t until = now_ns() + 900000;
+        while (now_ns() < until) x = x * 1664525u + 1013904223u;
+        usleep(100);
+    }
+    return NULL;
+}
+
+// A frame every 20 ms, hogs running through the middle phase
+static int paced(network_ctx_t *net, codec_pool_t *pool, tx_fanout_config_t *cfg,
+                 const int16_t *speech, int frames, int hogs, int budget, bool recover) {
+    static tx_fanout_t tx;
+    if (tx_fanout_init(&tx, cfg, net, pool) < 0) return -1;
+
+    static const char *phases[] = { "quiet", "loaded", "after" };
+    int ends[] = { PHASE_QUIET, PHASE_QUIET + PHASE_LOAD,
+                   PHASE_QUIET + PHASE_LOAD + (recover ? PHASE_RECOVER : 0) };
+    pthread_t tids[64];
+    int n_hogs = 0;
+
+    const int16_t *sources[1];
+    struct timespec next;
+    clock_gettime(CLOCK_MONOTONIC, &next);
+    int f = 0;
+    for (int p = 0; p < 3 && f < ends[2]; p++) {
+        if (p == 1) {
+            hogging = 1;
+            for (; n_hogs < hogs && n_hogs < 64; n_hogs++) {
+                if (pthread_create(&tids[n_hogs], NULL, hog, NULL) != 0) break;
+            }
+        }
+
+        tx_fanout_stats_t before = tx.stats;
+        uint64_t worst = 0, total = 0, over = 0;
+        int start = f;
+        for (; f < ends[p]; f++) {
+            next.tv_nsec += TX_FRAME_US * 1000;
+            if (next.tv_nsec >= 1000000000) {
+                next.tv_nsec -= 1000000000;
+                next.tv_sec++;
+            }
+            clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+
+            sources[0] = speech + (size_t)(f % frames) * FRAME_SIZE;
+            uint64_t t0 = now_ns();
+            tx_fanout_send(&tx, sources);
+            uint64_t took = (now_ns() - t0) / 1000;
+            total += took;
+            if (took > worst) worst = took;
+            if (took > (uint64_t)budget) over++;
+        }
+
+        if (p == 1) {
+            hogging = 0;
+            for (int i = 0; i < n_hogs; i++) pthread_join(tids[i], NULL);
+        }
+        if (f == start) continue;
+        printf("    %-7s %5d frames  mean %6.0f us  worst %6lu us  %4lu over budget  "
+               "%3lu missed  level %d\n", phases[p], f - start, (double)total / (f - start),
+               (unsigned long)worst, (unsigned long)over,
+               tx.stats.deadline_misses - before.deadline_misses, tx.stats.level);
+    }
+    printf("    %lu steps down, %lu up, lowest level %d\n", tx.stats.steps_down,
+           tx.stats.steps_up, tx.stats.level_max);
+
+    tx_fanout_cleanup(&tx);
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    int streams = 8;
+    int frames = 500;
+    int max_workers = -1;
+    int hogs = 0;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "s:f:w:o:")) != -1) {
+        switch (opt) {
+        case 's': streams = atoi(optarg); break;
+        case 'f': frames = atoi(optarg); break;
+        case 'w': max_workers = atoi(optarg); break;
+        case 'o': hogs = atoi(optarg); break;
+        default:
+            fprintf(stderr, "Usage: %s [-s streams] [-f frames] [-w max_workers] [-o hogs]\n",
+                    argv[0]);
+            return 1;
+        }
+    }
+    if (streams < 1) streams = 1;
+    if (streams > TX_FANOUT_MAX_STREAMS) streams = TX_FANOUT_MAX_STREAMS;
+    if (frames < 1) frames = 1;
+
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    if (cores < 1) cores = 1;
+
+    network_ctx_t net;
+    if (loopback_init(&net) < 0) return 1;
+
+    static codec_pool_t pool;
+    if (codec_pool_init(&pool, streams, 1, BITRATE) < 0) return 1;
+
+    int16_t *speech = malloc((size_t)frames * FRAME_SIZE * sizeof(int16_t));
+    test_signal_speechlike(speech, frames * FRAME_SIZE, SAMPLE_RATE, 3);
+
+    // Dispatch-console mix: talkgroups at different rates and complexities
+    tx_fanout_config_t cfg;
+    tx_fanout_config_default(&cfg, 0, NULL);
+    static const int rates[] = { 24000, 12000, 32000, 16000 };
+    for (int i = 0; i < streams; i++) {
+        cfg.streams[i].talkgroup = (uint8_t)(i % CRYPTO_MAX_TALKGROUPS);
+        opus_enc_params_default(&cfg.streams[i].params, rates[i % 4]);
+        cfg.streams[i].params.complexity = i % 2 ? 3 : 5;
+        cfg.streams[i].source = 0;
+    }
+    cfg.count = streams;
+    cfg.budget_us = 0;                      // Throughput at the settings as given
+
+    printf("%d streams, %d frames of %d samples, %ld core(s)\n", streams, frames, FRAME_SIZE, cores);
+    printf("  workers  us/frame  streams/s  speed-up  frame budget\n");
+
+    double serial = 0.0;
+    if (max_workers < 0) max_workers = (int)cores - 1;
+    if (max_workers > streams - 1) max_workers = streams - 1;
+    if (max_workers > TX_FANOUT_MAX_WORKERS) max_workers = TX_FANOUT_MAX_WORKERS;
+
+    for (int w = 0; w <= max_workers; w++) {
+        cfg.workers = w;
+        double us = run(&net, &pool, &cfg, speech, frames);
+        if (us < 0) return 1;
+        if (w == 0) serial = us;
+        printf("  %7d  %8.1f  %9.0f  %7.2fx  %5.1f%%\n", w, us, streams * 1e6 / us,
+               serial / us, 100.0 * us / 20000.0);
+    }
+
+    // Syscall cost alone: one sendmmsg against a sendto per stream
+    network_packet_t packets[TX_FANOUT_MAX_STREAMS];
+    network_packet_t *ptrs[TX_FANOUT_MAX_STREAMS];
+    int lens[TX_FANOUT_MAX_STREAMS];
+    for (int i = 0; i < streams; i++) {
+        memset(packets[i].opus_data, 0x55, 60);
+        lens[i] = network_prepare(&net, &packets[i], (uint8_t)i, 0, 60, 0);
+        ptrs[i] = &packets[i];
+    }
+
+    uint64_t t0 = now_ns();
+    for (int f = 0; f < frames; f++) {
+        network_send_batch(&net, ptrs, lens, streams);
+    }
+    double batched = (now_ns() - t0) / 1000.0 / frames;
+
+    t0 = now_ns();
+    for (int f = 0; f < frames; f++) {
+        for (int i = 0; i < streams; i++) {
+            sendto(net.sockfd, ptrs[i], lens[i], 0,
+                   (struct sockaddr *)&net.multicast_addr, sizeof(net.multicast_addr));
+        }
+    }
+    double single = (now_ns() - t0) / 1000.0 / frames;
+
+    printf("\n  send %d packets: sendmmsg %.1f us, sendto x%d %.1f us (%.2fx)\n",
+           streams, batched, streams, single, single / batched);
+
+    if (cycle(&net, &pool, &cfg, speech, frames) != 0) return 1;
+
+    if (hogs > 0) {
+        int budget = (int)(3 * serial);
+        if (budget < 100) budget = 100;
+        if (budget > TX_FRAME_US) budget = TX_FRAME_US;
+        printf("\n  Real time on the TX thread alone, %d busy threads under load, "
+               "budget %d us:\n", hogs, budget);
+
+        cfg.workers = 0;
+        printf("  fixed settings\n");
+        if (paced(&net, &pool, &cfg, speech, frames, hogs, budget, false) < 0) return 1;
+        cfg.budget_us = budget;
+        printf("  deadline control\n");
+        if (paced(&net, &pool, &cfg, speech, frames, hogs, budget, true) < 0) return 1;
+    }
+
+    free(speech);
+    codec_pool_cleanup(&pool);
+    close(net.sockfd);
+    return 0;
+}
@@ -0,0 +1,223 @@
+/*
+ * bench_latejoin.c - Time to first audible sample when the START is lost
+ *
+ * A talker sends one burst of speech-like audio, a frame every 20 ms. The
+ * receiver sees it through the RX pipeline exactly as the RX thread does
+ * (push on arrival, then pull what is ready) and plays the frames back to
+ * back from the moment they come out. Measured, on that virtual clock:
+ *
+ *   first packet   first packet the receiver got -> first output sample
+ *                  above AUDIBLE_LEVEL
+ *   over source    the same, less how long the talker's own audio took to
+ *                  get that loud from that packet on (what the receive
+ *                  path adds: decode, jitter buffer, fade-in)
+ *
+ * Cases: START received; START dropped with late join off (the burst is
+ * never heard) and on; and a receiver that comes up at a random point in
+ * the middle of the burst, each join landing inside a word.
+ *
+ * Usage: ./bench_latejoin [-j joins] [-f frames_per_burst] [-s seed]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "rx_pipeline.h"
+#include "audio_metrics.h"
+
+#define MAX_FRAMES      1500
+#define AUDIBLE_LEVEL   1000            // About -30 dBFS
+
+#define NEVER           UINT64_MAX
+
+static network_packet_t packets[MAX_FRAMES];
+static int packet_len[MAX_FRAMES];
+static bool voiced[MAX_FRAMES];
+static uint64_t onset_us[MAX_FRAMES];  // From frame start to audible input, NEVER if none
+static opus_dec_ctx_t decoder;
+
+typedef struct {
+    uint64_t first_packet_us;           // Arrival of the first packet pushed
+    uint64_t audible_us;                // First audible output sample, NEVER if none
+    uint64_t onset_us;                  // First audible input sample from there on
+    uint64_t late_joins;
+} result_t;
+
+static bool frame_audible(const int16_t *pcm, int *first) {
+    for (int i = 0; i < FRAME_SIZE; i++) {
+        if (pcm[i] > AUDIBLE_LEVEL || pcm[i] < -AUDIBLE_LEVEL) {
+            *first = i;
+            return true;
+        }
+    }
+    return false;
+}
+
+// Burst of frames packets from seq 1 (START at seq 0, END after the last);
+// the receiver listens from frame join on, drop_start loses the START
+static result_t run(int frames, int join, bool drop_start, bool late_join) {
+    static rx_pipeline_t rx;
+    int16_t pcm[FRAME_SIZE];
+    result_t r = { 0, NEVER, NEVER, 0 };
+
+    opus_dec_reset(&decoder);
+    rx_pipeline_init(&rx, &decoder, JITTER_DEFAULT_TARGET);
+    rx.late_join = late_join;
+
+    uint64_t t0 = (uint64_t)join * FRAME_US;
+    r.first_packet_us = t0;
+
+    if (join == 0 && !drop_start) {
+        network_packet_t ctl;
+        memset(&ctl, 0, PACKET_HEADER_SIZE);
+        ctl.board_id = 7;
+        ctl.flags = PKT_FLAG_START;
+        rx_pipeline_push(&rx, &ctl, PACKET_HEADER_SIZE, t0);
+    }
+
+    // Output timeline: frames play back to back, starting when they come out
+    uint64_t play_us = 0;
+    for (int f = join; f < frames && r.audible_us == NEVER; f++) {
+        uint64_t now_us = (uint64_t)f * FRAME_US;
+        rx_pipeline_push(&rx, &packets[f], packet_len[f], now_us);
+
+        while (r.audible_us == NEVER && rx_pipeline_pull(&rx, pcm, false) > 0) {
+            if (play_us < now_us) play_us = now_us;
+            int first;
+            if (frame_audible(pcm, &first)) {
+                r.audible_us = play_us + (uint64_t)first * 1000000 / SAMPLE_RATE;
+            }
+            play_us += FRAME_US;
+        }
+    }
+    r.late_joins = rx.stats.late_joins;
+
+    for (int f = join; f < frames; f++) {
+        if (onset_us[f] != NEVER) {
+            r.onset_us = (uint64_t)f * FRAME_US + onset_us[f];
+            break;
+        }
+    }
+    return r;
+}
+
+static void report(const char *name, const result_t *r, int n) {
+    double sum = 0, max = 0, over_sum = 0, over_max = -1e9;
+    int heard = 0;
+    for (int i = 0; i < n; i++) {
+        if (r[i].audible_us == NEVER) continue;
+        double d = (double)(r[i].audible_us - r[i].first_packet_us);
+        double over = (double)r[i].audible_us - (double)r[i].onset_us;
+        sum += d;
+        over_sum += over;
+        if (d > max) max = d;
+        if (over > over_max) over_max = over;
+        heard++;
+    }
+
+    if (heard == 0) {
+        printf("  %-28s %5d/%-4d %9s %9s %9s %9s\n", name, heard, n, "never", "", "", "");
+    } else {
+        printf("  %-28s %5d/%-4d %9.1f %9.1f %9.1f %9.1f\n", name, heard, n,
+               sum / 1000.0 / heard, max / 1000.0, over_sum / 1000.0 / heard, over_max / 1000.0);
+    }
+}
+
+int main(int argc, char *argv[]) {
+    int joins = 200;
+    int frames = 250;
+    unsigned seed = 1;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "j:f:s:")) != -1) {
+        switch (opt) {
+        case 'j': joins = atoi(optarg); break;
+        case 'f': frames = atoi(optarg); break;
+        case 's': seed = (unsigned)strtoul(optarg, NULL, 0); break;
+        default:
+            fprintf(stderr, "Usage: %s [-j joins] [-f frames_per_burst] [-s seed]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (frames < 10) frames = 10;
+    if (frames > MAX_FRAMES) frames = MAX_FRAMES;
+    if (joins < 1) joins = 1;
+
+    // Speech-like audio, started on a voiced frame so a burst that is
+    // heard from its first packet is audible right away
+    int total = frames + 200;
+    int16_t *speech = malloc((size_t)total * FRAME_SIZE * sizeof(int16_t));
+    test_signal_speechlike(speech, total * FRAME_SIZE, SAMPLE_RATE, seed);
+    int offset = 0;
+    int first;
+    while (offset < 200 && !frame_audible(speech + offset * FRAME_SIZE, &first)) offset++;
+
+    opus_enc_ctx_t enc;
+    if (opus_enc_init(&enc, BITRATE) < 0) return 1;
+    int n_voiced = 0;
+    for (int f = 0; f < frames; f++) {
+        const int16_t *in = speech + (size_t)(offset + f) * FRAME_SIZE;
+        network_packet_t *pkt = &packets[f];
+        memset(pkt, 0, PACKET_HEADER_SIZE);
+        pkt->board_id = 7;
+        pkt->seq_num = 1 + f;
+        int size = opus_encode_frame(&enc, in, FRAME_SIZE, pkt->opus_data,
+                                     MAX_PACKET_SIZE);
+        if (size <= 0) return 1;
+        pkt->opus_size = size;
+        packet_len[f] = PACKET_HEADER_SIZE + size;
+        voiced[f] = frame_audible(in, &first);
+        onset_us[f] = voiced[f] ? (uint64_t)first * 1000000 / SAMPLE_RATE : NEVER;
+    }
+    for (int f = 1; f < frames - 1; f++) {
+        if (voiced[f] && voiced[f + 1]) n_voiced++;
+    }
+    opus_enc_cleanup(&enc);
+    free(speech);
+    if (opus_dec_init(&decoder) < 0) return 1;
+
+    printf("Burst of %d frames (%.1f s), %d mid-burst joins, audible above %d\n\n", frames,
+           frames * FRAME_US / 1e6, joins, AUDIBLE_LEVEL);
+    printf("  %-28s %10s %19s %19s\n", "", "", "first packet", "over source");
+    printf("  %-28s %10s %9s %9s %9s %9s\n", "", "heard", "mean ms", "max ms", "mean ms",
+           "max ms");
+
+    result_t r = run(frames, 0, false, true);
+    report("START received", &r, 1);
+    r = run(frames, 0, true, false);
+    report("START dropped, no late join", &r, 1);
+    r = run(frames, 0, true, true);
+    report("START dropped, late join", &r, 1);
+
+    if (n_voiced == 0) {
+        printf("  no voiced frames to join at\n");
+        opus_dec_cleanup(&decoder);
+        return 0;
+    }
+
+    // Random points in the middle of a word: this frame and the next voiced
+    result_t *mid = malloc(sizeof(result_t) * joins);
+    int *at = malloc(sizeof(int) * joins);
+    srand(seed);
+    for (int j = 0; j < joins; j++) {
+        do at[j] = 1 + rand() % (frames - 2); while (!voiced[at[j]] || !voiced[at[j] + 1]);
+    }
+
+    for (int j = 0; j < joins; j++) mid[j] = run(frames, at[j], true, false);
+    report("mid-burst, no late join", mid, joins);
+    uint64_t joined = 0;
+    for (int j = 0; j < joins; j++) {
+        mid[j] = run(frames, at[j], true, true);
+        joined += mid[j].late_joins;
+    }
+    report("mid-burst, late join", mid, joins);
+    printf("\n  %lu of %d mid-burst receivers opened the burst from an audio packet\n",
+           (unsigned long)joined, joins);
+
+    free(at);
+    free(mid);
+    opus_dec_cleanup(&decoder);
+    return 0;
+}
@@ -0,0 +1,189 @@
+/*
+ * bench_log.c - Hot-path cost of a log call
+ *
+ * Times every single call (min, median, p99, p99.9, worst, in ns) of
+ * wtlog against printf + fflush, once with the console on /dev/null and
+ * once on a slow console: a pipe with a 4 KB buffer drained at serial
+ * port speed (115200 baud), where printf ends up waiting for the port and
+ * wtlog only drops records once its ring is full. Calls come in bursts of 128 every 25 ms,
+ * far more than the application logs, so the drain thread has to keep up.
+ *
+ * Usage: ./bench_log [-n calls]
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+
+#include "wtlog.h"
+
+#define BURST           128
+#define BURST_GAP_US    25000
+#define SERIAL_BYTES_S  11520           // 115200 baud, 8N1
+
+static FILE *report;
+static int slow_pipe[2];
+static volatile int slow_stop;
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int cmp_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+// Reads the pipe no faster than a serial port would send it
+static void *slow_console(void *arg) {
+    (void)arg;
+    char buf[128];
+    while (!slow_stop) {
+        if (read(slow_pipe[0], buf, sizeof(buf)) <= 0) break;
+        usleep(1000000 / (SERIAL_BYTES_S / sizeof(buf)));
+    }
+    return NULL;
+}
+
+// Point stdout and stderr at fd, flushing what is buffered for the old one
+static void redirect(int fd) {
+    fflush(stdout);
+    fflush(stderr);
+    dup2(fd, STDOUT_FILENO);
+    dup2(fd, STDERR_FILENO);
+}
+
+static uint64_t timer_overhead;
+
+enum { CASE_FILTERED, CASE_LIMITED, CASE_NOARGS, CASE_INTS, CASE_MIXED, CASE_PRINTF };
+
+static void run(const char *name, int which, int calls) {
+    uint64_t *t = malloc(sizeof(uint64_t) * calls);
+    wtlog_site_t site;
+    memset(&site, 0, sizeof(site));
+
+    for (int i = 0; i < calls; i++) {
+        // A fresh site has its full burst, so only CASE_LIMITED is limited
+        if (which != CASE_LIMITED) memset(&site, 0, sizeof(site));
+
+        uint64_t t0 = now_ns();
+        switch (which) {
+        case CASE_FILTERED:
+            WTLOG_DEBUG("frame %d", i);
+            break;
+        case CASE_LIMITED:
+        case CASE_NOARGS:
+            wtlog_write(&site, WTLOG_LVL_INFO, "DMA capture timeout");
+            break;
+        case CASE_INTS:
+            wtlog_write(&site, WTLOG_LVL_INFO, "seq %u gap %d depth %d", (unsigned)i, 3, 2);
+            break;
+        case CASE_MIXED:
+            wtlog_write(&site, WTLOG_LVL_INFO, "%s: %d frames, %.2f ms", "Opus decode error",
+                        i, i * 0.02);
+            break;
+        case CASE_PRINTF:
+            printf("[%10.6f] I tx     seq %u gap %d depth %d\n", 0.0, (unsigned)i, 3, 2);
+            fflush(stdout);
+            break;
+        }
+        uint64_t dt = now_ns() - t0;
+        t[i] = dt > timer_overhead ? dt - timer_overhead : 0;
+
+        if ((i + 1) % BURST == 0) usleep(BURST_GAP_US);
+    }
+
+    qsort(t, calls, sizeof(uint64_t), cmp_u64);
+    fprintf(report, "  %-26s %6lu %7lu %8lu %8lu %10lu\n", name,
+            (unsigned long)t[0], (unsigned long)t[calls / 2],
+            (unsigned long)t[(size_t)calls * 99 / 100],
+            (unsigned long)t[(size_t)calls * 999 / 1000],
+            (unsigned long)t[calls - 1]);
+    fflush(report);
+    free(t);
+}
+
+int main(int argc, char *argv[]) {
+    int calls = 10000;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:")) != -1) {
+        switch (opt) {
+        case 'n': calls = atoi(optarg); break;
+        default:
+            fprintf(stderr, "Usage: %s [-n calls]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (calls < 1000) calls = 1000;
+
+    report = fdopen(dup(STDOUT_FILENO), "w");
+    int null_fd = open("/dev/null", O_WRONLY);
+    if (!report || null_fd < 0 || pipe(slow_pipe) < 0) {
+        perror("bench_log setup");
+        return 1;
+    }
+
+    // Cost of the timestamps themselves, taken off every sample
+    timer_overhead = UINT64_MAX;
+    for (int i = 0; i < 10000; i++) {
+        uint64_t t0 = now_ns();
+        uint64_t dt = now_ns() - t0;
+        if (dt < timer_overhead) timer_overhead = dt;
+    }
+
+    fprintf(report, "%d calls per case, timer overhead %lu ns subtracted\n\n",
+            calls, (unsigned long)timer_overhead);
+    fprintf(report, "  %-26s %6s %7s %8s %8s %10s\n", "console /dev/null", "min", "median",
+            "p99", "p99.9", "worst ns");
+
+    redirect(null_fd);
+    wtlog_init(WTLOG_LVL_INFO);
+    wtlog_thread("bench");
+    run("wtlog below level", CASE_FILTERED, calls);
+    run("wtlog rate limited", CASE_LIMITED, calls);
+    run("wtlog no arguments", CASE_NOARGS, calls);
+    run("wtlog 3 integers", CASE_INTS, calls);
+    run("wtlog string+int+double", CASE_MIXED, calls);
+    run("printf + fflush", CASE_PRINTF, calls);
+    wtlog_cleanup();
+
+    wtlog_stats_t fast;
+    wtlog_get_stats(&fast);
+
+    // Slow console, with a UART-sized buffer; few calls, as printf has to
+    // wait out the port
+    fcntl(slow_pipe[1], F_SETPIPE_SZ, 4096);
+    int slow_calls = calls / 40 > BURST * 2 ? calls / 40 : BURST * 2;
+    pthread_t reader;
+    pthread_create(&reader, NULL, slow_console, NULL);
+
+    fprintf(report, "\n  %-26s %6s %7s %8s %8s %10s\n", "console 115200 baud", "min", "median",
+            "p99", "p99.9", "worst ns");
+    redirect(slow_pipe[1]);
+    wtlog_init(WTLOG_LVL_INFO);
+    run("wtlog 3 integers", CASE_INTS, slow_calls);
+    wtlog_cleanup();
+
+    wtlog_stats_t slow;
+    wtlog_get_stats(&slow);
+
+    run("printf + fflush", CASE_PRINTF, slow_calls);
+
+    redirect(null_fd);
+    slow_stop = 1;
+    close(slow_pipe[1]);
+    pthread_join(reader, NULL);
+
+    fprintf(report, "\n  wtlog records dropped (ring full): %lu on /dev/null, %lu on the slow console\n",
+            (unsigned long)fast.dropped, (unsigned long)(slow.dropped - fast.dropped));
+    fclose(report);
+    return 0;
+}
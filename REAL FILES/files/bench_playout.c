@@ -0,0 +1,245 @@
+/*
+ * bench_playout.c - Speaker gaps and latency: stop/start per packet
+ * against the continuous playout ring
+ *
+ * One burst of speech-like audio arrives with random network delay
+ * (uniform 0..jitter ms per packet, so packets also reorder). The same
+ * arrivals are played two ways:
+ *
+ *   per packet   the old RX loop: decode as packets come in, start the
+ *                DMA, wait for it. The speaker stops whenever the next
+ *                frame is not there as the last one ends (a gap).
+ *   ring         the RX loop of the application over the playout ring,
+ *                timer clocked (no DMA), in real time: dropouts are fill
+ *                periods inside the burst, concealment is the jitter
+ *                buffer's.
+ *
+ * Reported per jitter: gaps/dropouts, total silence inside the burst,
+ * concealed frames and the latency from packet arrival to heard (mean,
+ * max; frames played from a packet).
+ *
+ * Usage: ./bench_playout [-f frames] [-j jitter_ms,...] [-q ahead_frames] [-s seed]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "playout.h"
+#include "rx_pipeline.h"
+#include "audio_metrics.h"
+
+#define MAX_FRAMES  1500
+#define MAX_JITTERS 8
+
+static network_packet_t packets[MAX_FRAMES + 2];
+static int packet_len[MAX_FRAMES + 2];
+static uint64_t arrival_us[MAX_FRAMES + 2];
+static int order[MAX_FRAMES + 2];
+
+static uint64_t now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static void sleep_until(uint64_t us) {
+    struct timespec ts = { (time_t)(us / 1000000), (long)(us % 1000000) * 1000 };
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) != 0) {
+    }
+}
+
+static int cmp_arrival(const void *a, const void *b) {
+    uint64_t x = arrival_us[*(const int *)a], y = arrival_us[*(const int *)b];
+    return x < y ? -1 : x > y;
+}
+
+// START, frames audio packets, END; sent every 20 ms, each delayed 0..jitter
+static void make_arrivals(int frames, int jitter_ms) {
+    int n = frames + 2;
+    for (int i = 0; i < n; i++) {
+        uint64_t sent = (uint64_t)(i > 0 ? i - 1 : 0) * PLAYOUT_PERIOD_US;
+        arrival_us[i] = sent + (jitter_ms > 0 ? (uint64_t)(rand() % (jitter_ms * 1000)) : 0);
+        order[i] = i;
+    }
+    qsort(order, n, sizeof(int), cmp_arrival);
+}
+
+// The old loop, in virtual time: the frame plays as soon as it is decoded
+// and the speaker is free, then the RX thread waits for it to finish
+static void run_per_packet(int frames, opus_dec_ctx_t *decoder) {
+    static rx_pipeline_t rx;
+    int16_t pcm[FRAME_SIZE];
+    rx_pipeline_init(&rx, decoder, JITTER_DEFAULT_TARGET);
+    opus_dec_reset(decoder);
+
+    uint64_t clock = 0, speaker_free = 0, last_end = 0;
+    uint64_t gaps = 0, gap_us = 0, lat_sum = 0, lat_max = 0, played = 0, timed = 0;
+
+    for (int k = 0; k < frames + 2; k++) {
+        int i = order[k];
+        // The thread was blocked on the DMA until clock; later packets wait
+        if (arrival_us[i] > clock) clock = arrival_us[i];
+        rx_pipeline_push(&rx, &packets[i], packet_len[i], clock);
+
+        while (rx_pipeline_pull(&rx, pcm, false) > 0) {
+            uint64_t start = clock > speaker_free ? clock : speaker_free;
+            if (played > 0 && start > last_end) {
+                gaps++;
+                gap_us += start - last_end;
+            }
+            if (!rx.last_concealed) {
+                uint64_t lat = start - rx.last_played_arrival_us;
+                lat_sum += lat;
+                if (lat > lat_max) lat_max = lat;
+                timed++;
+            }
+
+            last_end = start + PLAYOUT_PERIOD_US;
+            speaker_free = last_end;
+            clock = last_end;               // dma_wait_playback
+            played++;
+        }
+    }
+
+    printf("  %-10s %8lu %10.1f %10lu %10.1f %10.1f\n", "per packet", (unsigned long)gaps,
+           gap_us / 1000.0, (unsigned long)rx.stats.frames_concealed,
+           timed ? lat_sum / 1000.0 / timed : 0.0, lat_max / 1000.0);
+}
+
+// The application's RX loop over the ring, in real time
+static void run_ring(int frames, int ahead, opus_dec_ctx_t *decoder) {
+    static rx_pipeline_t rx;
+    static playout_ctx_t po;
+    int16_t pcm[FRAME_SIZE];
+    rx_pipeline_init(&rx, decoder, JITTER_DEFAULT_TARGET);
+    opus_dec_reset(decoder);
+    if (playout_init(&po, NULL, ahead) < 0) exit(1);
+
+    uint64_t lat_sum = 0, lat_max = 0, timed = 0;
+    playout_start(&po);
+    // Let the stream settle on fill before the burst starts
+    sleep_until(now_us() + 3 * PLAYOUT_PERIOD_US);
+    uint64_t t0 = now_us();
+
+    int k = 0;
+    while (k < frames + 2 || rx_pipeline_active(&rx)) {
+        bool active = rx_pipeline_active(&rx);
+        bool clocked = active && playout_needs_frame(&po);
+        int timeout = active ? playout_wait_ms(&po, 20) : 20;
+        if (timeout < 1) timeout = 1;
+
+        if (!clocked) {
+            // "Receive": the next arrival, or the timeout
+            uint64_t wake = now_us() + (uint64_t)timeout * 1000;
+            if (k < frames + 2 && t0 + arrival_us[order[k]] < wake) wake = t0 + arrival_us[order[k]];
+            sleep_until(wake);
+
+            if (k < frames + 2 && now_us() >= t0 + arrival_us[order[k]]) {
+                int i = order[k++];
+                rx_pipeline_push(&rx, &packets[i], packet_len[i], now_us() - t0);
+            } else {
+                rx_pipeline_poll(&rx, now_us() - t0);
+            }
+        }
+
+        while (rx_pipeline_pull(&rx, pcm, clocked) > 0) {
+            uint64_t heard = now_us() - t0 + playout_latency_us(&po);
+            if (playout_write(&po, pcm) == 0 && !rx.last_concealed) {
+                uint64_t lat = heard - rx.last_played_arrival_us;
+                lat_sum += lat;
+                if (lat > lat_max) lat_max = lat;
+                timed++;
+            }
+            if (clocked) break;
+        }
+    }
+
+    // Drain what is queued before the numbers are read
+    sleep_until(now_us() + playout_latency_us(&po) + 2 * PLAYOUT_PERIOD_US);
+    playout_stop(&po);
+
+    printf("  %-10s %8lu %10.1f %10lu %10.1f %10.1f   (%lu trimmed, %lu refused, "
+           "%u us worst restart)\n", "ring", (unsigned long)po.stats.underruns,
+           po.stats.underrun_periods * PLAYOUT_PERIOD_US / 1000.0,
+           (unsigned long)rx.stats.frames_concealed, timed ? lat_sum / 1000.0 / timed : 0.0,
+           lat_max / 1000.0, (unsigned long)po.stats.trimmed,
+           (unsigned long)po.stats.overflows, po.stats.gap_us_max);
+    playout_cleanup(&po);
+}
+
+int main(int argc, char *argv[]) {
+    int frames = 250;
+    int ahead = PLAYOUT_DEFAULT_FRAMES;
+    int jitters[MAX_JITTERS] = { 0, 10, 30, 60 };
+    int n_jitters = 4;
+    unsigned seed = 1;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "f:j:q:s:")) != -1) {
+        switch (opt) {
+        case 'f': frames = atoi(optarg); break;
+        case 'q': ahead = atoi(optarg); break;
+        case 's': seed = (unsigned)strtoul(optarg, NULL, 0); break;
+        case 'j': {
+            n_jitters = 0;
+            for (char *tok = strtok(optarg, ","); tok && n_jitters < MAX_JITTERS;
+                 tok = strtok(NULL, ",")) {
+                jitters[n_jitters++] = atoi(tok);
+            }
+            break;
+        }
+        default:
+            fprintf(stderr, "Usage: %s [-f frames] [-j jitter_ms,...] [-q ahead_frames] [-s seed]\n",
+                    argv[0]);
+            return 1;
+        }
+    }
+    if (frames < 10) frames = 10;
+    if (frames > MAX_FRAMES) frames = MAX_FRAMES;
+
+    // START, the encoded burst, END
+    int16_t *speech = malloc((size_t)frames * FRAME_SIZE * sizeof(int16_t));
+    test_signal_speechlike(speech, frames * FRAME_SIZE, SAMPLE_RATE, seed);
+    opus_enc_ctx_t enc;
+    if (opus_enc_init(&enc, BITRATE) < 0) return 1;
+    for (int i = 0; i < frames + 2; i++) {
+        network_packet_t *pkt = &packets[i];
+        memset(pkt, 0, PACKET_HEADER_SIZE);
+        pkt->board_id = 7;
+        pkt->seq_num = i;
+        packet_len[i] = PACKET_HEADER_SIZE;
+        if (i == 0) {
+            pkt->flags = PKT_FLAG_START;
+        } else if (i == frames + 1) {
+            pkt->flags = PKT_FLAG_END;
+        } else {
+            int size = opus_encode_frame(&enc, speech + (size_t)(i - 1) * FRAME_SIZE, FRAME_SIZE,
+                                         pkt->opus_data, MAX_PACKET_SIZE);
+            if (size <= 0) return 1;
+            pkt->opus_size = size;
+            packet_len[i] += size;
+        }
+    }
+    opus_enc_cleanup(&enc);
+    free(speech);
+
+    opus_dec_ctx_t decoder;
+    if (opus_dec_init(&decoder) < 0) return 1;
+
+    for (int j = 0; j < n_jitters; j++) {
+        srand(seed + j);
+        make_arrivals(frames, jitters[j]);
+
+        printf("\n%d frames, delay 0-%d ms, ring up to %d frames ahead\n", frames, jitters[j], ahead);
+        printf("  %-10s %8s %10s %10s %10s %10s\n", "", "gaps", "silent ms", "concealed",
+               "lat ms", "max ms");
+        run_per_packet(frames, &decoder);
+        run_ring(frames, ahead, &decoder);
+    }
+
+    opus_dec_cleanup(&decoder);
+    return 0;
+}
@@ -0,0 +1,179 @@
+/*
+ * bench_pool.c - Heap traffic and cost of per-talker Opus decoders
+ *
+ * Counts every malloc/calloc/realloc in the process (glibc interposition)
+ * while bursts from several talkers go through the RX pipeline with a
+ * pooled decoder per burst, and compares with creating and destroying a
+ * decoder per talker. Steady state with the pool must not touch the heap;
+ * the exit status is non-zero if it does.
+ *
+ * Usage: ./bench_pool [-b bursts] [-f frames_per_burst] [-t talkers]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "codec_pool.h"
+#include "rx_pipeline.h"
+#include "audio_metrics.h"
+
+// glibc's allocator entry points, ours wrap them with a counter
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t n, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+
+static volatile int counting;
+static volatile unsigned long heap_calls;
+
+void *malloc(size_t size) {
+    if (counting) __atomic_add_fetch(&heap_calls, 1, __ATOMIC_RELAXED);
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t n, size_t size) {
+    if (counting) __atomic_add_fetch(&heap_calls, 1, __ATOMIC_RELAXED);
+    return __libc_calloc(n, size);
+}
+
+void *realloc(void *ptr, size_t size) {
+    if (counting) __atomic_add_fetch(&heap_calls, 1, __ATOMIC_RELAXED);
+    return __libc_realloc(ptr, size);
+}
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+#define MAX_FRAMES 500
+
+static network_packet_t packets[MAX_FRAMES];
+static int packet_len[MAX_FRAMES];
+
+// One burst: START, the audio frames, END, each frame pulled as it lands
+static void run_burst(rx_pipeline_t *rx, uint32_t talker, int frames, uint32_t seq0) {
+    network_packet_t ctl;
+    int16_t pcm[FRAME_SIZE];
+
+    memset(&ctl, 0, PACKET_HEADER_SIZE);
+    ctl.board_id = talker;
+    ctl.seq_num = seq0;
+    ctl.flags = PKT_FLAG_START;
+    rx_pipeline_push(rx, &ctl, PACKET_HEADER_SIZE, 0);
+
+    for (int f = 0; f < frames; f++) {
+        network_packet_t *pkt = &packets[f];
+        pkt->board_id = talker;
+        pkt->seq_num = seq0 + 1 + f;
+        rx_pipeline_push(rx, pkt, packet_len[f], (uint64_t)f * FRAME_US);
+        while (rx_pipeline_pull(rx, pcm, false) > 0) {
+        }
+    }
+
+    ctl.seq_num = seq0 + frames + 1;
+    ctl.flags = PKT_FLAG_END;
+    rx_pipeline_push(rx, &ctl, PACKET_HEADER_SIZE, 0);
+    while (rx_pipeline_pull(rx, pcm, true) > 0) {
+    }
+}
+
+int main(int argc, char *argv[]) {
+    int bursts = 200;
+    int frames = 50;
+    int talkers = 4;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "b:f:t:")) != -1) {
+        switch (opt) {
+        case 'b': bursts = atoi(optarg); break;
+        case 'f': frames = atoi(optarg); break;
+        case 't': talkers = atoi(optarg); break;
+        default:
+            fprintf(stderr, "Usage: %s [-b bursts] [-f frames_per_burst] [-t talkers]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (frames > MAX_FRAMES) frames = MAX_FRAMES;
+
+    static codec_pool_t pool;
+    if (codec_pool_init(&pool, 1, CODEC_POOL_DECODERS, BITRATE) < 0) {
+        return 1;
+    }
+
+    // Encode a burst worth of speech once with the pooled encoder
+    opus_enc_ctx_t *enc = codec_pool_acquire_enc(&pool);
+    int16_t *speech = malloc((size_t)frames * FRAME_SIZE * sizeof(int16_t));
+    test_signal_speechlike(speech, frames * FRAME_SIZE, SAMPLE_RATE, 1);
+    for (int f = 0; f < frames; f++) {
+        network_packet_t *pkt = &packets[f];
+        memset(pkt, 0, PACKET_HEADER_SIZE);
+        int size = opus_encode_frame(enc, speech + f * FRAME_SIZE, FRAME_SIZE,
+                                     pkt->opus_data, MAX_PACKET_SIZE);
+        if (size <= 0) return 1;
+        pkt->opus_size = size;
+        packet_len[f] = PACKET_HEADER_SIZE + size;
+    }
+    codec_pool_release_enc(&pool, enc);
+    free(speech);
+
+    static rx_pipeline_t rx;
+    rx_pipeline_init(&rx, NULL, JITTER_DEFAULT_TARGET);
+    rx_pipeline_use_pool(&rx, &pool);
+
+    printf("%d bursts of %d frames from %d talkers\n", bursts, frames, talkers);
+
+    // Warm up (first touch of the stack, stdio buffers) outside the count
+    run_burst(&rx, 1, frames, 0);
+
+    heap_calls = 0;
+    counting = 1;
+    uint64_t t0 = now_ns();
+    for (int b = 0; b < bursts; b++) {
+        run_burst(&rx, 1 + b % talkers, frames, (uint32_t)b * (frames + 2));
+    }
+    uint64_t pooled_ns = now_ns() - t0;
+    counting = 0;
+    unsigned long pooled_calls = heap_calls;
+
+    // Decoder hand-out and reset alone
+    t0 = now_ns();
+    for (int b = 0; b < bursts; b++) {
+        opus_dec_ctx_t *dec = codec_pool_acquire_dec(&pool);
+        codec_pool_release_dec(&pool, dec);
+    }
+    uint64_t recycle_ns = now_ns() - t0;
+
+    // The old way: opus_decoder_create/destroy per talker burst
+    heap_calls = 0;
+    counting = 1;
+    t0 = now_ns();
+    for (int b = 0; b < bursts; b++) {
+        int error;
+        OpusDecoder *dec = opus_decoder_create(SAMPLE_RATE, CHANNELS, &error);
+        if (dec) opus_decoder_destroy(dec);
+    }
+    uint64_t create_ns = now_ns() - t0;
+    counting = 0;
+    unsigned long create_calls = heap_calls;
+
+    printf("  pooled decoders   %lu heap calls in steady state, %.1f us per burst\n",
+           pooled_calls, pooled_ns / 1000.0 / bursts);
+    printf("  acquire+reset     %.2f us per burst\n", recycle_ns / 1000.0 / bursts);
+    printf("  create+destroy    %lu heap calls (%.1f per burst), %.2f us per burst\n",
+           create_calls, (double)create_calls / bursts, create_ns / 1000.0 / bursts);
+    printf("  pool high water   %d of %d decoders, %lu bursts refused\n",
+           pool.dec_stats.high_water, pool.n_dec, rx.stats.no_decoder);
+
+    codec_pool_cleanup(&pool);
+
+    if (pooled_calls != 0) {
+        printf("FAIL: steady-state RX path allocated\n");
+        return 1;
+    }
+    printf("PASS: no heap allocation in steady state\n");
+    return 0;
+}
@@ -0,0 +1,167 @@
+/*
+ * bench_ptt.c - PTT press to first packet latency on the mock GPIO chip
+ *
+ * Runs the application's TX loop shape against the in-process mock
+ * chip, pressing the fake PTT at random moments (with contact bounce),
+ * and measures from the press to the START packet and to the first
+ * audio packet (one 20 ms capture later). Compares the old 10 ms sleep
+ * polling with waiting on edge events, and the debounce on and off.
+ * Runs on any Linux box.
+ *
+ * Usage: ./bench_ptt [-n presses] [-b bounces]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "gpio_ptt.h"
+
+#define CAPTURE_US      20000   // One frame of DMA capture before the first packet
+#define MAX_PRESSES     4096
+
+typedef struct {
+    gpio_ctx_t gpio;
+    bool use_events;
+    volatile bool running;
+
+    // Filled by the TX loop
+    uint64_t start_ns[MAX_PRESSES];
+    uint64_t first_ns[MAX_PRESSES];
+    int starts;
+    int firsts;
+} bench_t;
+
+static bench_t bench;
+
+static int cmp_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a;
+    uint64_t y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+// Same structure as tx_thread_func, with capture and send stubbed out
+static void *tx_loop(void *arg) {
+    bench_t *b = arg;
+    bool last_ptt = false;
+    bool first_packet = false;
+
+    while (b->running) {
+        bool ptt = gpio_read_ptt(&b->gpio);
+
+        if (ptt && !last_ptt) {
+            if (b->starts < MAX_PRESSES) b->start_ns[b->starts] = gpio_time_ns();
+            b->starts++;
+            first_packet = true;
+        }
+
+        if (ptt) {
+            usleep(CAPTURE_US);
+            if (first_packet) {
+                if (b->firsts < MAX_PRESSES) b->first_ns[b->firsts] = gpio_time_ns();
+                b->firsts++;
+                first_packet = false;
+            }
+        } else if (b->use_events) {
+            gpio_wait_ptt(&b->gpio, 10);
+        } else {
+            usleep(10000);
+        }
+
+        last_ptt = ptt;
+    }
+    return NULL;
+}
+
+static void report(const char *what, uint64_t *lat, int n) {
+    if (n == 0) return;
+    double total = 0.0;
+    for (int i = 0; i < n; i++) total += lat[i];
+    qsort(lat, n, sizeof(uint64_t), cmp_u64);
+    printf("    %-14s mean %6.2f ms  median %6.2f ms  p99 %6.2f ms  max %6.2f ms\n",
+           what, total / n / 1e6, lat[n / 2] / 1e6, lat[n * 99 / 100] / 1e6, lat[n - 1] / 1e6);
+}
+
+static void run(const char *name, bool use_events, int debounce_ms, int presses, int bounces) {
+    static uint64_t press_ns[MAX_PRESSES];
+    static uint64_t lat[MAX_PRESSES];
+    uint32_t rng = 777;
+
+    memset(&bench, 0, sizeof(bench));
+    if (gpio_init_spec(&bench.gpio, "mock") < 0) return;
+    bench.gpio.debounce_ns = (uint64_t)debounce_ms * 1000000;
+    bench.use_events = use_events;
+    bench.running = true;
+
+    pthread_t thread;
+    pthread_create(&thread, NULL, tx_loop, &bench);
+
+    for (int p = 0; p < presses; p++) {
+        rng = rng * 1664525u + 1013904223u;
+        usleep(20000 + (rng >> 8) % 40000);
+
+        // Press, then a few bounces inside the first couple of ms
+        press_ns[p] = gpio_time_ns();
+        gpio_mock_set_ptt(&bench.gpio, true);
+        for (int i = 0; i < bounces; i++) {
+            usleep(300);
+            gpio_mock_set_ptt(&bench.gpio, false);
+            usleep(300);
+            gpio_mock_set_ptt(&bench.gpio, true);
+        }
+
+        usleep(60000);
+
+        gpio_mock_set_ptt(&bench.gpio, false);
+        for (int i = 0; i < bounces; i++) {
+            usleep(300);
+            gpio_mock_set_ptt(&bench.gpio, true);
+            usleep(300);
+            gpio_mock_set_ptt(&bench.gpio, false);
+        }
+    }
+
+    usleep(50000);
+    bench.running = false;
+    pthread_join(thread, NULL);
+
+    printf("  %s: %d presses, %d starts, %d bounces swallowed\n",
+           name, presses, bench.starts, (int)bench.gpio.stats.bounces);
+
+    // Latencies only line up when every press produced exactly one start
+    if (bench.starts == presses) {
+        for (int p = 0; p < presses; p++) lat[p] = bench.start_ns[p] - press_ns[p];
+        report("to START", lat, presses);
+        for (int p = 0; p < presses; p++) lat[p] = bench.first_ns[p] - press_ns[p];
+        report("to 1st packet", lat, presses);
+    } else {
+        printf("    spurious starts from bounce: %d\n", bench.starts - presses);
+    }
+
+    gpio_cleanup(&bench.gpio);
+}
+
+int main(int argc, char *argv[]) {
+    int presses = 100;
+    int bounces = 2;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:b:")) != -1) {
+        switch (opt) {
+        case 'n': presses = atoi(optarg); break;
+        case 'b': bounces = atoi(optarg); break;
+        default:
+            fprintf(stderr, "Usage: %s [-n presses] [-b bounces]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (presses > MAX_PRESSES) presses = MAX_PRESSES;
+
+    printf("PTT latency, mock chip, %d presses with %d bounces each edge\n", presses, bounces);
+    run("10 ms polling", false, GPIO_DEBOUNCE_MS, presses, bounces);
+    run("edge events", true, GPIO_DEBOUNCE_MS, presses, bounces);
+    run("edge events, no debounce", true, 0, presses, bounces);
+    return 0;
+}
@@ -0,0 +1,556 @@
+/*
+ * bench_rtpgw.c - RTP export gateway load and conformance
+ *
+ * N synthetic boards talk in real time on a private multicast group over
+ * loopback, each in its own talkgroup cycle: bursts of -b ms (a START,
+ * a frame every 20 ms with -r frames of redundancy, an END), then a
+ * pause. The gateway runs on its own thread exactly as wt_rtpgw does
+ * (network_recv_batch, rtpgw_input, rtpgw_poll) and sends everything to
+ * a receiver on 127.0.0.1, which checks each RTP packet as a player
+ * would: version, payload type, one SSRC per sender, sequence numbers
+ * that follow the sender's, timestamps 960 apart per frame, the marker
+ * on the first packet of every burst and nowhere else, the payload the
+ * sender encoded (redundancy stripped); and each RTCP packet: SR or RR
+ * first, a CNAME, a BYE per stream at the end.
+ *
+ * Before the load, one sender's packets go into a gateway directly with a
+ * burst's first packets arriving out of order, after a short and a long
+ * pause: RTP seq_nums and timestamps have to keep moving forwards.
+ *
+ * Reported: packets through, loss and every kind of mismatch, latency
+ * through the gateway (p50/p99/max), and the CPU time of the gateway
+ * thread, as a share of one core and as streams a core would carry.
+ *
+ * Usage: ./bench_rtpgw [-n senders] [-d seconds] [-b burst_ms] [-r redundancy]
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+
+#include "rtpgw.h"
+#include "red.h"
+
+#define BENCH_GROUP     "239.0.0.98"
+#define BENCH_PORT      5098
+#define RX_PORT         5996
+#define MAX_SENDERS     RTPGW_MAX_STREAMS
+#define FRAME_US        20000
+#define FRAME_BYTES     160             // About 64 kbps
+#define PAUSE_MS        1500
+#define LAT_BINS        1000            // 10 us each
+
+// Payload of every frame: who, which, when, and whether a burst opens here
+typedef struct __attribute__((packed)) {
+    uint32_t board_id;
+    uint32_t seq_num;
+    uint64_t sent_us;
+    uint8_t first;
+} frame_tag_t;
+
+typedef struct {
+    uint32_t board_id;
+    uint32_t seq_num;
+    uint64_t next_us;
+    uint64_t burst_end_us;
+    bool talking;
+    bool first;
+    red_encoder_t red;
+} sender_t;
+
+typedef struct {
+    bool seen;
+    uint32_t ssrc;
+    uint16_t last_rtp_seq;
+    uint32_t last_ts;
+    uint32_t last_seq;
+    bool cname;
+    uint64_t packets;
+} stream_check_t;
+
+static int n_senders = 200;
+static int seconds = 10;
+static int burst_ms = 4000;
+static int redundancy = 1;
+
+static volatile int senders_run = 1;
+static volatile int gateway_run = 1;
+static volatile int receiver_run = 1;
+
+static sender_t senders[MAX_SENDERS];
+static stream_check_t checks[MAX_SENDERS];
+static rtpgw_t gw;
+
+static uint64_t sent_frames;
+static double gw_cpu_s, gw_wall_s;
+
+static struct {
+    uint64_t rtp, rtcp;
+    uint64_t lost;
+    uint64_t bad_header, bad_ssrc, bad_seq, bad_ts, bad_payload, bad_marker;
+    uint64_t sr, bye, rtcp_bad;
+    uint64_t lat[LAT_BINS + 1];
+    uint64_t lat_max;
+} rx;
+
+static uint64_t now_us(void) {
+    return network_time_us();
+}
+
+static double cpu_time(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static uint32_t get32(const uint8_t *p) {
+    return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | p[3];
+}
+
+// Every sender due sends its frame, START and END around each burst
+static void *sender_thread(void *arg) {
+    (void)arg;
+    int fd = socket(AF_INET, SOCK_DGRAM, 0);
+    struct sockaddr_in group = {0};
+    group.sin_family = AF_INET;
+    group.sin_port = htons(BENCH_PORT);
+    inet_pton(AF_INET, BENCH_GROUP, &group.sin_addr);
+    int sndbuf = 4 << 20;
+    setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &sndbuf, sizeof(sndbuf));
+
+    static network_packet_t pkts[64];
+    struct mmsghdr msgs[64];
+    struct iovec iov[64];
+
+    uint64_t start = now_us();
+    for (int i = 0; i < n_senders; i++) {
+        senders[i].board_id = 1000 + i;
+        senders[i].seq_num = (uint32_t)rand();
+        senders[i].next_us = start + (uint64_t)i * FRAME_US / n_senders;
+        red_encoder_init(&senders[i].red, redundancy, 0);
+    }
+
+    while (senders_run) {
+        uint64_t now = now_us();
+        int n = 0;
+
+        for (int i = 0; i < n_senders; i++) {
+            sender_t *s = &senders[i];
+            if (now < s->next_us) continue;
+
+            network_packet_t *p = &pkts[n];
+            memset(p, 0, PACKET_HEADER_SIZE);
+            p->board_id = s->board_id;
+            p->talkgroup = (uint8_t)(i % CRYPTO_MAX_TALKGROUPS);
+
+            if (!s->talking) {
+                s->talking = true;
+                s->first = true;
+                s->burst_end_us = now + (uint64_t)burst_ms * 1000;
+                red_encoder_reset(&s->red);
+                p->flags = PKT_FLAG_START;
+            }
+
+            if (now >= s->burst_end_us) {
+                // END, then the pause
+                p->seq_num = s->seq_num++;
+                p->flags = PKT_FLAG_END;
+                s->talking = false;
+                s->next_us += (uint64_t)PAUSE_MS * 1000;
+            } else {
+                uint8_t frame[FRAME_BYTES];
+                memset(frame, 0x5a, sizeof(frame));
+                frame_tag_t tag = { s->board_id, s->seq_num, now, s->first };
+                memcpy(frame, &tag, sizeof(tag));
+
+                p->seq_num = s->seq_num++;
+                int size = red_pack(&s->red, p->seq_num, frame, FRAME_BYTES, p->opus_data,
+                                    MAX_OPUS_PACKET);
+                if (redundancy > 0) {
+                    p->flags |= PKT_FLAG_RED;
+                    p->opus_size = (uint16_t)size;
+                } else {
+                    memcpy(p->opus_data, frame, FRAME_BYTES);
+                    p->opus_size = FRAME_BYTES;
+                }
+                s->first = false;
+                s->next_us += FRAME_US;
+                sent_frames++;
+            }
+
+            iov[n].iov_base = p;
+            iov[n].iov_len = PACKET_HEADER_SIZE + p->opus_size;
+            memset(&msgs[n], 0, sizeof(msgs[n]));
+            msgs[n].msg_hdr.msg_name = &group;
+            msgs[n].msg_hdr.msg_namelen = sizeof(group);
+            msgs[n].msg_hdr.msg_iov = &iov[n];
+            msgs[n].msg_hdr.msg_iovlen = 1;
+            if (++n == 64) {
+                sendmmsg(fd, msgs, n, 0);
+                n = 0;
+            }
+        }
+        if (n > 0) sendmmsg(fd, msgs, n, 0);
+
+        struct timespec ts = { 0, 500000 };
+        nanosleep(&ts, NULL);
+    }
+
+    close(fd);
+    return NULL;
+}
+
+// wt_rtpgw's loop
+static void *gateway_thread(void *arg) {
+    network_ctx_t *net = arg;
+    static network_packet_t packets[NETWORK_BATCH_MAX];
+    int lens[NETWORK_BATCH_MAX];
+    uint64_t next_poll = 0;
+
+    double cpu0 = cpu_time();
+    uint64_t wall0 = now_us();
+    while (gateway_run) {
+        int n = network_recv_batch(net, packets, lens, NETWORK_BATCH_MAX, 10);
+        if (n < 0) break;
+
+        uint64_t now = now_us();
+        for (int i = 0; i < n; i++) {
+            if (lens[i] > 0) rtpgw_input(&gw, &packets[i], lens[i], now);
+        }
+        rtpgw_flush(&gw);
+        if (now >= next_poll) {
+            rtpgw_poll(&gw, now);
+            next_poll = now + 20000;
+        }
+    }
+    gw_cpu_s = cpu_time() - cpu0;
+    gw_wall_s = (now_us() - wall0) / 1e6;
+    return NULL;
+}
+
+static stream_check_t *check_for(uint32_t board_id) {
+    if (board_id < 1000 || board_id >= 1000 + (uint32_t)n_senders) return NULL;
+    return &checks[board_id - 1000];
+}
+
+static void check_rtp(const uint8_t *p, int len, uint64_t now) {
+    rx.rtp++;
+    if (len < RTPGW_HEADER + (int)sizeof(frame_tag_t) || (p[0] & 0xc0) != 0x80 ||
+        (p[0] & 0x3f) != 0 || (p[1] & 0x7f) != RTPGW_DEFAULT_PT) {
+        rx.bad_header++;
+        return;
+    }
+
+    bool marker = p[1] & 0x80;
+    uint16_t rtp_seq = (uint16_t)(p[2] << 8 | p[3]);
+    uint32_t ts = get32(p + 4);
+    uint32_t ssrc = get32(p + 8);
+    frame_tag_t tag;
+    memcpy(&tag, p + RTPGW_HEADER, sizeof(tag));
+
+    stream_check_t *c = check_for(tag.board_id);
+    if (!c || len != RTPGW_HEADER + FRAME_BYTES) {
+        rx.bad_payload++;
+        return;
+    }
+    if (marker != tag.first) rx.bad_marker++;
+
+    uint64_t lat = now > tag.sent_us ? now - tag.sent_us : 0;
+    rx.lat[lat / 10 < LAT_BINS ? lat / 10 : LAT_BINS]++;
+    if (lat > rx.lat_max) rx.lat_max = lat;
+
+    if (c->seen) {
+        if (ssrc != c->ssrc) rx.bad_ssrc++;
+
+        // Within a burst the RTP numbering moves with the sender's
+        int32_t d = (int32_t)(tag.seq_num - c->last_seq);
+        if (!tag.first) {
+            if (d > 1) rx.lost += d - 1;
+            if ((uint16_t)(c->last_rtp_seq + d) != rtp_seq) rx.bad_seq++;
+            if (c->last_ts + (uint32_t)d * RTPGW_FRAME_TS != ts) rx.bad_ts++;
+        } else if ((int16_t)(rtp_seq - c->last_rtp_seq) != 1) {
+            // A new burst carries on where the last left off
+            rx.bad_seq++;
+        }
+    }
+    c->seen = true;
+    c->ssrc = ssrc;
+    c->last_rtp_seq = rtp_seq;
+    c->last_ts = ts;
+    c->last_seq = tag.seq_num;
+    c->packets++;
+}
+
+// Compound RTCP: SR or RR, then SDES with the CNAME, BYE at the end
+static void check_rtcp(const uint8_t *p, int len) {
+    rx.rtcp++;
+    if (len < 8 || (p[1] != 200 && p[1] != 201)) {
+        rx.rtcp_bad++;
+        return;
+    }
+    uint32_t ssrc = get32(p + 4);
+
+    int pos = 0;
+    while (pos + 4 <= len) {
+        const uint8_t *q = p + pos;
+        int words = q[2] << 8 | q[3];
+        if ((q[0] & 0xc0) != 0x80 || pos + 4 + words * 4 > len) {
+            rx.rtcp_bad++;
+            return;
+        }
+        if (q[1] == 200) {
+            rx.sr++;
+        } else if (q[1] == 202 && q[8] == 1) {
+            uint32_t board, tg;
+            if (sscanf((const char *)q + 10, "wt-%u-tg%u", &board, &tg) == 2) {
+                stream_check_t *c = check_for(board);
+                if (c && c->seen && c->ssrc == ssrc) c->cname = true;
+                else rx.rtcp_bad++;
+            }
+        } else if (q[1] == 203) {
+            rx.bye++;
+        }
+        pos += 4 + words * 4;
+    }
+}
+
+static int bind_local(int port) {
+    int fd = socket(AF_INET, SOCK_DGRAM, 0);
+    int rcvbuf = 4 << 20;
+    setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+    struct timeval tv = { 0, 10000 };
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+
+    struct sockaddr_in addr = {0};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons((uint16_t)port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        perror("bind");
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static void *receiver_thread(void *arg) {
+    int *fds = arg;
+    static uint8_t bufs[32][RTPGW_HEADER + MAX_PACKET_SIZE];
+    struct mmsghdr msgs[32];
+    struct iovec iov[32];
+
+    while (receiver_run) {
+        for (int k = 0; k < 2; k++) {
+            memset(msgs, 0, sizeof(msgs));
+            for (int i = 0; i < 32; i++) {
+                iov[i].iov_base = bufs[i];
+                iov[i].iov_len = sizeof(bufs[i]);
+                msgs[i].msg_hdr.msg_iov = &iov[i];
+                msgs[i].msg_hdr.msg_iovlen = 1;
+            }
+            int n = recvmmsg(fds[k], msgs, 32, MSG_DONTWAIT, NULL);
+            uint64_t now = now_us();
+            for (int i = 0; i < n; i++) {
+                if (k == 0) check_rtp(bufs[i], (int)msgs[i].msg_len, now);
+                else check_rtcp(bufs[i], (int)msgs[i].msg_len);
+            }
+        }
+        struct timespec ts = { 0, 200000 };
+        nanosleep(&ts, NULL);
+    }
+    return NULL;
+}
+
+// One sender's packets straight into a gateway of its own, in the order
+// given, each `at` microseconds in. What comes out on fd has to keep the
+// sender's order in both RTP seq_num and timestamp, whatever order it
+// went out in, with no seq_num twice. Returns the mismatches.
+static int reorder_case(int fd, const rtpgw_config_t *cfg, const uint32_t *seqs,
+                        const uint64_t *at, const uint8_t *flags, int n, int want_late) {
+    static rtpgw_t g;
+    if (rtpgw_init(&g, cfg) < 0) return 1;
+
+    uint64_t t0 = now_us();
+    for (int i = 0; i < n; i++) {
+        network_packet_t p;
+        memset(&p, 0, PACKET_HEADER_SIZE);
+        p.board_id = 7;
+        p.seq_num = seqs[i];
+        p.flags = flags[i];
+        p.opus_size = FRAME_BYTES;
+        memset(p.opus_data, 0x5a, FRAME_BYTES);
+        memcpy(p.opus_data, &p.seq_num, sizeof(p.seq_num));
+        rtpgw_input(&g, &p, (int)(PACKET_HEADER_SIZE + FRAME_BYTES), t0 + at[i]);
+        rtpgw_flush(&g);
+    }
+
+    uint8_t buf[RTPGW_HEADER + MAX_PACKET_SIZE];
+    uint32_t seq[16], ts[16];
+    uint16_t rtp_seq[16];
+    int out = 0, bad = 0;
+    while (out < 16 && recv(fd, buf, sizeof(buf), MSG_DONTWAIT) >= RTPGW_HEADER + 4) {
+        rtp_seq[out] = (uint16_t)(buf[2] << 8 | buf[3]);
+        ts[out] = get32(buf + 4);
+        memcpy(&seq[out], buf + RTPGW_HEADER, sizeof(seq[out]));
+        out++;
+    }
+    for (int i = 0; i < out; i++) {
+        for (int j = 0; j < i; j++) {
+            int32_t d = (int32_t)(seq[i] - seq[j]);
+            int16_t d_rtp = (int16_t)(rtp_seq[i] - rtp_seq[j]);
+            int32_t d_ts = (int32_t)(ts[i] - ts[j]);
+            if (d_rtp == 0 || (d > 0) != (d_rtp > 0) || (d > 0 ? d_ts <= 0 : d_ts >= 0)) bad++;
+        }
+    }
+    if (out + (int)g.stats.late != n || (int)g.stats.late != want_late) bad++;
+
+    rtpgw_cleanup(&g);
+    return bad;
+}
+
+// The second burst's first packet (14) overtaken by the next one, with
+// and without its START, after a short pause and after one past
+// RTPGW_GAP_MS; after the long one 15 starts a new mapping and 14 is late
+static int reorder_check(int fd, const rtpgw_config_t *cfg) {
+    static const uint32_t seqs[] = { 10, 11, 12, 13, 15, 14, 16, 17 };
+    static const uint8_t plain[] = { PKT_FLAG_START, 0, 0, 0, 0, 0, 0, 0 };
+    static const uint8_t start[] = { PKT_FLAG_START, 0, 0, 0, 0, PKT_FLAG_START, 0, 0 };
+    static const uint64_t quick[] = { 0, 20000, 40000, 60000, 120000, 121000, 140000, 160000 };
+    static const uint64_t slow[] = { 0, 20000, 40000, 60000, 2060000, 2061000, 2080000, 2100000 };
+    int n = (int)(sizeof(seqs) / sizeof(seqs[0]));
+
+    return reorder_case(fd, cfg, seqs, quick, plain, n, 0) +
+           reorder_case(fd, cfg, seqs, quick, start, n, 0) +
+           reorder_case(fd, cfg, seqs, slow, plain, n, 1) +
+           reorder_case(fd, cfg, seqs, slow, start, n, 1);
+}
+
+static uint64_t lat_percentile(double pct) {
+    uint64_t total = 0, seen = 0;
+    for (int i = 0; i <= LAT_BINS; i++) total += rx.lat[i];
+    for (int i = 0; i <= LAT_BINS; i++) {
+        seen += rx.lat[i];
+        if (total && seen >= total * pct / 100.0) return (uint64_t)i * 10;
+    }
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    int opt;
+    while ((opt = getopt(argc, argv, "n:d:b:r:")) != -1) {
+        switch (opt) {
+        case 'n': n_senders = atoi(optarg); break;
+        case 'd': seconds = atoi(optarg); break;
+        case 'b': burst_ms = atoi(optarg); break;
+        case 'r': redundancy = atoi(optarg); break;
+        default:
+            fprintf(stderr, "Usage: %s [-n senders] [-d seconds] [-b burst_ms] [-r redundancy]\n",
+                    argv[0]);
+            return 1;
+        }
+    }
+    if (n_senders < 1 || n_senders > MAX_SENDERS || seconds < 1 || burst_ms < 100 ||
+        redundancy < 0 || redundancy > RED_MAX_DEPTH) {
+        fprintf(stderr, "1-%d senders, bursts of 100 ms or more, redundancy 0-%d\n",
+                MAX_SENDERS, RED_MAX_DEPTH);
+        return 1;
+    }
+    srand((unsigned)time(NULL));
+
+    network_config_t net_cfg;
+    network_config_default(&net_cfg);
+    snprintf(net_cfg.group, sizeof(net_cfg.group), "%s", BENCH_GROUP);
+    net_cfg.port = BENCH_PORT;
+    net_cfg.keyring = "";
+    net_cfg.netem = NULL;
+    net_cfg.all_talkgroups = true;
+
+    network_ctx_t net;
+    if (network_init_cfg(&net, 999, &net_cfg) < 0) return 1;
+
+    rtpgw_config_t gw_cfg;
+    rtpgw_config_default(&gw_cfg);
+    gw_cfg.dest.sin_port = htons(RX_PORT);
+    int fds[2] = { bind_local(RX_PORT), bind_local(RX_PORT + 1) };
+    if (fds[0] < 0 || fds[1] < 0) return 1;
+
+    // Only the summary below, not the gateway's line per stream
+    fflush(stdout);
+    int saved_stdout = dup(STDOUT_FILENO);
+    int devnull = open("/dev/null", O_WRONLY);
+    dup2(devnull, STDOUT_FILENO);
+    close(devnull);
+
+    int reorder_bad = reorder_check(fds[0], &gw_cfg);
+    char drain[RTPGW_HEADER + MAX_PACKET_SIZE];
+    while (recv(fds[1], drain, sizeof(drain), MSG_DONTWAIT) > 0) {}
+    if (rtpgw_init(&gw, &gw_cfg) < 0) return 1;
+
+    pthread_t tx, gw_tid, rx_tid;
+    pthread_create(&rx_tid, NULL, receiver_thread, fds);
+    pthread_create(&gw_tid, NULL, gateway_thread, &net);
+    pthread_create(&tx, NULL, sender_thread, NULL);
+
+    sleep((unsigned)seconds);
+    senders_run = 0;
+    pthread_join(tx, NULL);
+    usleep(200000);
+    gateway_run = 0;
+    pthread_join(gw_tid, NULL);
+    rtpgw_cleanup(&gw);
+    usleep(200000);
+    receiver_run = 0;
+    pthread_join(rx_tid, NULL);
+
+    fflush(stdout);
+    dup2(saved_stdout, STDOUT_FILENO);
+    close(saved_stdout);
+
+    int streams = 0, named = 0;
+    for (int i = 0; i < n_senders; i++) {
+        if (checks[i].seen) streams++;
+        if (checks[i].cname) named++;
+    }
+
+    double core = gw_wall_s > 0 ? gw_cpu_s / gw_wall_s : 0;
+    printf("\n%d senders, %d s, bursts of %d ms, redundancy %d\n", n_senders, seconds,
+           burst_ms, redundancy);
+    printf("  Frames sent           %lu\n", (unsigned long)sent_frames);
+    printf("  Gateway               %lu in, %lu RTP and %lu RTCP out, %lu send errors\n",
+           (unsigned long)gw.stats.packets_in, (unsigned long)gw.stats.rtp_out,
+           (unsigned long)gw.stats.rtcp_out, (unsigned long)gw.stats.send_errors);
+    printf("  Received              %lu RTP, %lu RTCP, %d SSRCs, %d with a CNAME\n",
+           (unsigned long)rx.rtp, (unsigned long)rx.rtcp, streams, named);
+    printf("  Lost                  %lu (%.3f%%)\n", (unsigned long)rx.lost,
+           sent_frames ? 100.0 * rx.lost / sent_frames : 0.0);
+    printf("  Mismatches            header %lu, SSRC %lu, seq %lu, timestamp %lu, "
+           "payload %lu, marker %lu, RTCP %lu\n",
+           (unsigned long)rx.bad_header, (unsigned long)rx.bad_ssrc, (unsigned long)rx.bad_seq,
+           (unsigned long)rx.bad_ts, (unsigned long)rx.bad_payload, (unsigned long)rx.bad_marker,
+           (unsigned long)rx.rtcp_bad);
+    printf("  Sender reports        %lu, BYEs %lu\n", (unsigned long)rx.sr,
+           (unsigned long)rx.bye);
+    printf("  Reordered burst starts %s (%lu dropped as late under load)\n",
+           reorder_bad ? "FAIL" : "OK", (unsigned long)gw.stats.late);
+    printf("  Latency               p50 %lu us, p99 %lu us, max %lu us\n",
+           (unsigned long)lat_percentile(50), (unsigned long)lat_percentile(99),
+           (unsigned long)rx.lat_max);
+    printf("  Gateway CPU           %.2f s of %.2f s, %.1f%% of a core, %.2f us per packet\n",
+           gw_cpu_s, gw_wall_s, 100.0 * core,
+           gw.stats.packets_in ? gw_cpu_s * 1e6 / gw.stats.packets_in : 0.0);
+    if (core > 0) {
+        printf("  Streams per core      about %.0f\n", n_senders / core);
+    }
+
+    close(fds[0]);
+    close(fds[1]);
+    network_cleanup(&net);
+    return reorder_bad ? 1 : 0;
+}
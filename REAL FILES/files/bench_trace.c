@@ -0,0 +1,254 @@
+/*
+ * bench_trace.c - Cost of pipeline tracing on the audio threads
+ *
+ * Several threads (TX, RX and playout stand-ins) each run frames of a
+ * few stages, every stage a WTTRACE_BEGIN/WTTRACE_END pair around a
+ * little work. Reported per span: what a pair costs with tracing off (a
+ * load and a branch) and on (two clock reads and a ring store), as min,
+ * median, p99 and worst in ns. Then, with the threads still recording,
+ * the rings are dumped twice as Chrome trace JSON, and the file is read
+ * back: events per thread, seq_nums in order with no torn records.
+ *
+ * Usage: ./bench_trace [-t threads] [-n frames] [-o trace.json]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "wttrace.h"
+#include "wtlog.h"
+
+#define MAX_THREADS     8
+#define STAGES          4
+
+static const char *stage_names[STAGES] = { "capture", "encode", "send", "decode" };
+
+typedef struct {
+    int id;
+    int frames;
+    uint64_t *cost_ns;                      // One per span, frames * STAGES
+} worker_t;
+
+static volatile int go;
+static volatile int stop;
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int cmp_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+// Stands in for a stage: a few hundred ns the compiler cannot drop
+static uint32_t work(uint32_t x) {
+    for (int i = 0; i < 64; i++) x = x * 1664525u + 1013904223u;
+    return x;
+}
+
+// Frames of STAGES spans; the span cost is the pair minus the bare work
+static void *worker(void *arg) {
+    worker_t *w = arg;
+    char name[16];
+    snprintf(name, sizeof(name), "stage%d", w->id);
+    wtlog_thread(name);
+
+    while (!go) {
+    }
+
+    volatile uint32_t sink = 0;
+    int n = 0;
+    for (uint32_t seq = 0; (int)seq < w->frames; seq++) {
+        for (int s = 0; s < STAGES; s++) {
+            uint64_t a = now_ns();
+            uint64_t t0 = WTTRACE_BEGIN();
+            sink = work(sink + seq);
+            WTTRACE_END(stage_names[s], t0, (uint32_t)w->id + 1, seq);
+            uint64_t b = now_ns();
+            w->cost_ns[n++] = b - a;
+        }
+    }
+
+    // Keep the rings moving while they are dumped
+    for (uint32_t seq = (uint32_t)w->frames; !stop; seq++) {
+        uint64_t t0 = WTTRACE_BEGIN();
+        sink = work(sink + seq);
+        WTTRACE_END("late", t0, (uint32_t)w->id + 1, seq);
+        usleep(50);
+    }
+    return NULL;
+}
+
+// Bare stage, timed the same way, to take out of the span cost
+static uint64_t work_ns(void) {
+    uint64_t cost[4096];
+    volatile uint32_t sink = 0;
+    for (int i = 0; i < 4096; i++) {
+        uint64_t a = now_ns();
+        sink = work(sink + i);
+        cost[i] = now_ns() - a;
+    }
+    qsort(cost, 4096, sizeof(uint64_t), cmp_u64);
+    return cost[2048];
+}
+
+static void run(bool enabled, int threads, int frames, uint64_t base) {
+    pthread_t tids[MAX_THREADS];
+    worker_t workers[MAX_THREADS];
+    int spans = frames * STAGES;
+
+    wttrace_enable(enabled);
+    go = 0;
+    stop = 1;                               // No tail for the timing runs
+    for (int t = 0; t < threads; t++) {
+        workers[t].id = t;
+        workers[t].frames = frames;
+        workers[t].cost_ns = malloc(spans * sizeof(uint64_t));
+        if (!workers[t].cost_ns || pthread_create(&tids[t], NULL, worker, &workers[t]) != 0) {
+            fprintf(stderr, "worker %d failed\n", t);
+            exit(1);
+        }
+    }
+    go = 1;
+    for (int t = 0; t < threads; t++) pthread_join(tids[t], NULL);
+
+    uint64_t *all = malloc((size_t)spans * threads * sizeof(uint64_t));
+    if (!all) exit(1);
+    for (int t = 0; t < threads; t++) {
+        memcpy(all + (size_t)t * spans, workers[t].cost_ns, spans * sizeof(uint64_t));
+        free(workers[t].cost_ns);
+    }
+    size_t n = (size_t)spans * threads;
+    qsort(all, n, sizeof(uint64_t), cmp_u64);
+
+    #define OVER(v) ((v) > base ? (v) - base : 0)
+    printf("  %-8s %8lu %8lu %8lu %10lu\n", enabled ? "on" : "off",
+           (unsigned long)OVER(all[0]), (unsigned long)OVER(all[n / 2]),
+           (unsigned long)OVER(all[n * 99 / 100]), (unsigned long)OVER(all[n - 1]));
+    #undef OVER
+    free(all);
+}
+
+// Read the dump back: X events per tid, and their seq_nums per stage in order
+static int check_dump(const char *path, int threads) {
+    FILE *f = fopen(path, "r");
+    if (!f) {
+        perror(path);
+        return -1;
+    }
+
+    char line[512];
+    int events = 0, meta = 0, bad = 0;
+    static int per_tid[WTTRACE_MAX_THREADS];
+    static long last_seq[WTTRACE_MAX_THREADS][STAGES + 1];
+    memset(per_tid, 0, sizeof(per_tid));
+    memset(last_seq, 0xff, sizeof(last_seq));
+
+    while (fgets(line, sizeof(line), f)) {
+        if (strstr(line, "\"ph\":\"M\"")) {
+            meta++;
+            continue;
+        }
+        if (!strstr(line, "\"ph\":\"X\"")) continue;
+
+        char name[32];
+        int tid;
+        double ts, dur;
+        unsigned board, seq;
+        if (sscanf(line, "{\"name\":\"%31[^\"]\",\"ph\":\"X\",\"pid\":%*u,\"tid\":%d,\"ts\":%lf,"
+                   "\"dur\":%lf,\"args\":{\"board\":%u,\"seq\":%u}}", name, &tid, &ts, &dur,
+                   &board, &seq) != 6 || tid < 0 || tid >= WTTRACE_MAX_THREADS) {
+            bad++;
+            continue;
+        }
+
+        int s = STAGES;
+        for (int i = 0; i < STAGES; i++) {
+            if (strcmp(name, stage_names[i]) == 0) s = i;
+        }
+        if ((long)seq <= last_seq[tid][s] && last_seq[tid][s] >= 0) bad++;
+        last_seq[tid][s] = seq;
+        per_tid[tid]++;
+        events++;
+    }
+    fclose(f);
+
+    printf("  %s: %d spans, %d metadata events, %d out of order or unreadable\n", path, events,
+           meta, bad);
+    for (int t = 0; t < threads && t < WTTRACE_MAX_THREADS; t++) {
+        printf("    tid %d: %d spans\n", t, per_tid[t]);
+    }
+    return bad ? -1 : events;
+}
+
+int main(int argc, char *argv[]) {
+    int threads = 3, frames = 20000;
+    const char *path = "/tmp/bench_trace.json";
+    int opt;
+
+    while ((opt = getopt(argc, argv, "t:n:o:")) != -1) {
+        switch (opt) {
+        case 't': threads = atoi(optarg); break;
+        case 'n': frames = atoi(optarg); break;
+        case 'o': path = optarg; break;
+        default:
+            fprintf(stderr, "Usage: %s [-t threads] [-n frames] [-o trace.json]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (threads < 1) threads = 1;
+    if (threads > MAX_THREADS) threads = MAX_THREADS;
+    if (frames < 1000) frames = 1000;
+
+    uint64_t base = work_ns();
+    printf("\n%d threads, %d frames of %d spans each; stage alone %lu ns\n\n", threads, frames,
+           STAGES, (unsigned long)base);
+    printf("  %-8s %8s %8s %8s %10s   (ns per span on top of the stage)\n", "tracing", "min",
+           "median", "p99", "worst");
+
+    // Off first: no thread has claimed a ring yet
+    run(false, threads, frames, base);
+    run(true, threads, frames, base);
+
+    // Dump while the writers keep going
+    pthread_t tids[MAX_THREADS];
+    worker_t workers[MAX_THREADS];
+    go = 0;
+    stop = 0;
+    for (int t = 0; t < threads; t++) {
+        workers[t].id = t;
+        workers[t].frames = 0;
+        workers[t].cost_ns = NULL;
+        if (pthread_create(&tids[t], NULL, worker, &workers[t]) != 0) return 1;
+    }
+    go = 1;
+    usleep(20000);
+
+    printf("\n");
+    int result = 0;
+    for (int i = 0; i < 2; i++) {
+        uint64_t t0 = now_ns();
+        int spans = wttrace_dump(path, 1, NULL, NULL);
+        uint64_t t1 = now_ns();
+        if (spans < 0) return 1;
+        printf("  dump %d: %d spans in %.1f ms\n", i + 1, spans, (t1 - t0) / 1e6);
+        // The rings of the run() threads went to these ones
+        if (check_dump(path, threads) < 0) result = 1;
+    }
+
+    stop = 1;
+    for (int t = 0; t < threads; t++) pthread_join(tids[t], NULL);
+
+    uint64_t spans, no_ring;
+    wttrace_get_stats(&spans, &no_ring);
+    printf("\n  %lu spans recorded, %lu without a ring (more than %d threads)\n",
+           (unsigned long)spans, (unsigned long)no_ring, WTTRACE_MAX_THREADS);
+    return result;
+}
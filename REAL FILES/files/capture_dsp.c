@@ -0,0 +1,304 @@
+#include "capture_dsp.h"
+#include "dsp_simd.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+#ifndef M_SQRT1_2
+#define M_SQRT1_2 0.70710678118654752440
+#endif
+
+// Noise estimate: averaged over the first hops, then tracks the minimum
+#define NS_INIT_HOPS        20
+#define NS_SMOOTH           0.2f        // Periodogram smoothing per hop
+#define NS_RISE_MAX         1.003f      // At most ~+5 dB/s while speech holds the bins up
+#define NS_DD_ALPHA         0.98f       // Decision-directed a priori SNR smoothing
+#define NS_SPEECH_RATIO     3.0f        // Hop power over noise power that counts as speech
+#define NS_BIAS             1.5f        // Minimum tracking sits below the mean noise power
+
+// AGC dynamics, per 20 ms frame
+#define AGC_ATTACK          0.3f
+#define AGC_RELEASE         0.05f
+#define AGC_UP_DB           0.25f       // Gain slew limits
+#define AGC_DOWN_DB         1.0f
+#define AGC_MIN_GAIN_DB     -12.0f
+#define AGC_GATE_DB         6.0f        // Above the tracked floor counts as speech
+#define AGC_SILENCE_DBFS    -55.0f
+#define AGC_FLOOR_RISE_DB   0.05f
+
+// Limiter release, fraction of the way back to unity per sub-block
+#define LIMIT_RELEASE       0.05f
+
+static float db_to_lin(float db) {
+    return powf(10.0f, db / 20.0f);
+}
+
+void capture_dsp_config_default(capture_dsp_config_t *cfg) {
+    cfg->hpf = true;
+    cfg->hpf_hz = 100.0f;
+    cfg->ns = true;
+    cfg->ns_max_atten_db = 15.0f;
+    cfg->agc = true;
+    cfg->agc_target_dbfs = -20.0f;
+    cfg->agc_max_gain_db = 20.0f;
+    cfg->limiter = true;
+    cfg->limit_dbfs = -1.0f;
+}
+
+int capture_dsp_parse(capture_dsp_config_t *cfg, const char *spec) {
+    char buf[256];
+    snprintf(buf, sizeof(buf), "%s", spec);
+
+    char *save = NULL;
+    for (char *tok = strtok_r(buf, ", ", &save); tok; tok = strtok_r(NULL, ", ", &save)) {
+        if (strcmp(tok, "off") == 0) {
+            cfg->hpf = cfg->ns = cfg->agc = cfg->limiter = false;
+            continue;
+        }
+
+        char *eq = strchr(tok, '=');
+        if (!eq) {
+            fprintf(stderr, "capture_dsp: expected key=value, got '%s'\n", tok);
+            return -1;
+        }
+        *eq = '\0';
+        const char *key = tok;
+        const char *val = eq + 1;
+        bool on = strcmp(val, "off") != 0;
+
+        if (strcmp(key, "hpf") == 0) {
+            cfg->hpf = on;
+            if (on) cfg->hpf_hz = atof(val);
+        } else if (strcmp(key, "ns") == 0) {
+            cfg->ns = on;
+            if (on) cfg->ns_max_atten_db = atof(val);
+        } else if (strcmp(key, "agc") == 0) {
+            cfg->agc = on;
+            if (on) cfg->agc_target_dbfs = atof(val);
+        } else if (strcmp(key, "gain") == 0) {
+            cfg->agc_max_gain_db = atof(val);
+        } else if (strcmp(key, "limit") == 0) {
+            cfg->limiter = on;
+            if (on) cfg->limit_dbfs = atof(val);
+        } else {
+            fprintf(stderr, "capture_dsp: unknown key '%s'\n", key);
+            return -1;
+        }
+    }
+
+    if ((cfg->hpf && (cfg->hpf_hz < 10.0f || cfg->hpf_hz > SAMPLE_RATE / 4)) ||
+        (cfg->ns && (cfg->ns_max_atten_db < 0.0f || cfg->ns_max_atten_db > 40.0f)) ||
+        (cfg->agc && (cfg->agc_target_dbfs > 0.0f || cfg->agc_max_gain_db < 0.0f)) ||
+        (cfg->limiter && cfg->limit_dbfs > 0.0f)) {
+        fprintf(stderr, "capture_dsp: parameter out of range in '%s'\n", spec);
+        return -1;
+    }
+    return 0;
+}
+
+int capture_dsp_init(capture_dsp_ctx_t *ctx, const capture_dsp_config_t *cfg) {
+    memset(ctx, 0, sizeof(capture_dsp_ctx_t));
+    ctx->cfg = *cfg;
+
+    // RBJ cookbook Butterworth high-pass
+    double w0 = 2.0 * M_PI * cfg->hpf_hz / SAMPLE_RATE;
+    double alpha = sin(w0) / (2.0 * M_SQRT1_2);
+    double a0 = 1.0 + alpha;
+    ctx->b0 = (float)((1.0 + cos(w0)) / 2.0 / a0);
+    ctx->b1 = (float)(-(1.0 + cos(w0)) / a0);
+    ctx->b2 = ctx->b0;
+    ctx->a1 = (float)(-2.0 * cos(w0) / a0);
+    ctx->a2 = (float)((1.0 - alpha) / a0);
+
+    if (fft_init(&ctx->fft, NS_FFT_SIZE) < 0) {
+        return -1;
+    }
+
+    // sqrt-Hann analysis and synthesis windows overlap-add to unity
+    for (int i = 0; i < NS_WINDOW; i++) {
+        ctx->window[i] = (float)sqrt(0.5 - 0.5 * cos(2.0 * M_PI * i / NS_WINDOW));
+    }
+    ctx->ns_gain_min = db_to_lin(-cfg->ns_max_atten_db);
+
+    ctx->agc_level_db = cfg->agc_target_dbfs;
+    ctx->agc_floor_db = AGC_SILENCE_DBFS;
+    ctx->limit_ceiling = db_to_lin(cfg->limit_dbfs);
+    ctx->limit_gain = 1.0f;
+
+    ctx->initialized = true;
+    return 0;
+}
+
+static void hpf_process(capture_dsp_ctx_t *ctx, float *x, int n) {
+    float b0 = ctx->b0, b1 = ctx->b1, b2 = ctx->b2;
+    float a1 = ctx->a1, a2 = ctx->a2;
+    float z1 = ctx->z1, z2 = ctx->z2;
+
+    // Recursive, so this one stays scalar
+    for (int i = 0; i < n; i++) {
+        float in = x[i];
+        float out = b0 * in + z1;
+        z1 = b1 * in - a1 * out + z2;
+        z2 = b2 * in - a2 * out;
+        x[i] = out;
+    }
+
+    // Keep the state out of denormals during digital silence
+    if (fabsf(z1) < 1e-15f) z1 = 0.0f;
+    if (fabsf(z2) < 1e-15f) z2 = 0.0f;
+    ctx->z1 = z1;
+    ctx->z2 = z2;
+}
+
+// One STFT hop: hop[] is replaced by the output for the previous hop
+static bool ns_hop(capture_dsp_ctx_t *ctx, float *hop) {
+    float buf[NS_FFT_SIZE];
+    float re[NS_BINS], im[NS_BINS], pow[NS_BINS];
+
+    memcpy(buf, ctx->in_prev, NS_HOP * sizeof(float));
+    memcpy(buf + NS_HOP, hop, NS_HOP * sizeof(float));
+    memset(buf + NS_WINDOW, 0, (NS_FFT_SIZE - NS_WINDOW) * sizeof(float));
+    memcpy(ctx->in_prev, hop, NS_HOP * sizeof(float));
+
+    dsp_mul(buf, buf, ctx->window, NS_WINDOW);
+    fft_forward(&ctx->fft, buf, re, im);
+    dsp_power(pow, re, im, NS_BINS);
+
+    float sum_pow = 0.0f, sum_noise = 0.0f;
+
+    // Noise is tracked on a time-smoothed periodogram; the raw one swings
+    // too much for minimum tracking
+    for (int k = 0; k < NS_BINS; k++) {
+        ctx->smooth[k] += (pow[k] - ctx->smooth[k]) * NS_SMOOTH;
+    }
+
+    if (ctx->ns_blocks < NS_INIT_HOPS) {
+        // Assume the first ~50 ms are background
+        float w = 1.0f / (ctx->ns_blocks + 1);
+        for (int k = 0; k < NS_BINS; k++) {
+            ctx->noise[k] += (pow[k] - ctx->noise[k]) * w;
+            ctx->smooth[k] = ctx->noise[k];
+        }
+        ctx->ns_blocks++;
+    } else {
+        for (int k = 0; k < NS_BINS; k++) {
+            float n = ctx->noise[k] * NS_RISE_MAX;
+            ctx->noise[k] = ctx->smooth[k] < n ? ctx->smooth[k] : n;
+        }
+    }
+
+    // Decision-directed Wiener gain per bin
+    for (int k = 0; k < NS_BINS; k++) {
+        float n = ctx->noise[k] * NS_BIAS + 1e-12f;
+        float post = pow[k] / n - 1.0f;
+        if (post < 0.0f) post = 0.0f;
+        float prio = NS_DD_ALPHA * ctx->clean_prev[k] / n + (1.0f - NS_DD_ALPHA) * post;
+        float g = prio / (1.0f + prio);
+        if (g < ctx->ns_gain_min) g = ctx->ns_gain_min;
+
+        re[k] *= g;
+        im[k] *= g;
+        ctx->clean_prev[k] = g * g * pow[k];
+
+        sum_pow += pow[k];
+        sum_noise += n;
+    }
+
+    fft_inverse(&ctx->fft, re, im, buf);
+    dsp_mul(buf, buf, ctx->window, NS_WINDOW);
+
+    for (int i = 0; i < NS_HOP; i++) {
+        hop[i] = ctx->ola[i] + buf[i];
+    }
+    memcpy(ctx->ola, buf + NS_HOP, NS_HOP * sizeof(float));
+
+    return sum_pow > NS_SPEECH_RATIO * sum_noise;
+}
+
+static bool ns_process(capture_dsp_ctx_t *ctx, float *x) {
+    bool speech = false;
+    for (int h = 0; h < NS_HOPS_PER_FRAME; h++) {
+        if (ns_hop(ctx, x + h * NS_HOP)) speech = true;
+    }
+    return speech;
+}
+
+static void agc_process(capture_dsp_ctx_t *ctx, float *x, int n, bool ns_speech) {
+    float rms = sqrtf(dsp_energy(x, n) / n);
+    float level = 20.0f * log10f(rms + 1e-9f);
+
+    // Background level: follows drops at once, creeps up slowly
+    if (level < ctx->agc_floor_db) {
+        ctx->agc_floor_db = level;
+    } else {
+        ctx->agc_floor_db += AGC_FLOOR_RISE_DB;
+    }
+
+    bool speech = level > AGC_SILENCE_DBFS && level > ctx->agc_floor_db + AGC_GATE_DB;
+    if (ctx->cfg.ns) speech = speech && ns_speech;
+    ctx->speech = speech;
+
+    float gain_db = ctx->agc_gain_db;
+
+    // Only adapt on speech so pauses and fan noise are not pumped up
+    if (speech) {
+        float k = level > ctx->agc_level_db ? AGC_ATTACK : AGC_RELEASE;
+        ctx->agc_level_db += (level - ctx->agc_level_db) * k;
+
+        float want = ctx->cfg.agc_target_dbfs - ctx->agc_level_db;
+        if (want > ctx->cfg.agc_max_gain_db) want = ctx->cfg.agc_max_gain_db;
+        if (want < AGC_MIN_GAIN_DB) want = AGC_MIN_GAIN_DB;
+
+        if (want > gain_db + AGC_UP_DB) want = gain_db + AGC_UP_DB;
+        if (want < gain_db - AGC_DOWN_DB) want = gain_db - AGC_DOWN_DB;
+        gain_db = want;
+    }
+
+    float g0 = db_to_lin(ctx->agc_gain_db);
+    float g1 = db_to_lin(gain_db);
+    dsp_gain_ramp(x, g0, (g1 - g0) / n, n);
+    ctx->agc_gain_db = gain_db;
+}
+
+// Block peak limiter: instant attack at block edges, smooth release,
+// so no sample of a block ever leaves above the ceiling
+static void limiter_process(capture_dsp_ctx_t *ctx, float *x, int n) {
+    for (int start = 0; start < n; start += LIMIT_BLOCK) {
+        int len = n - start < LIMIT_BLOCK ? n - start : LIMIT_BLOCK;
+        float *block = x + start;
+        float peak = dsp_peak(block, len);
+        float target = peak > ctx->limit_ceiling ? ctx->limit_ceiling / peak : 1.0f;
+
+        if (target <= ctx->limit_gain) {
+            ctx->limit_gain = target;
+            if (target < 1.0f) dsp_gain_ramp(block, target, 0.0f, len);
+        } else {
+            float g0 = ctx->limit_gain;
+            float g1 = g0 + (target - g0) * LIMIT_RELEASE;
+            if (g0 < 1.0f) dsp_gain_ramp(block, g0, (g1 - g0) / len, len);
+            ctx->limit_gain = g1 > 0.9999f ? 1.0f : g1;
+        }
+    }
+}
+
+void capture_dsp_process(capture_dsp_ctx_t *ctx, int16_t *pcm) {
+    const capture_dsp_config_t *cfg = &ctx->cfg;
+    float *x = ctx->work;
+    bool ns_speech = true;
+
+    if (!cfg->hpf && !cfg->ns && !cfg->agc && !cfg->limiter) return;
+
+    dsp_i16_to_f32(pcm, x, FRAME_SIZE);
+
+    if (cfg->hpf) hpf_process(ctx, x, FRAME_SIZE);
+    if (cfg->ns) ns_speech = ns_process(ctx, x);
+    ctx->speech = ns_speech;
+    if (cfg->agc) agc_process(ctx, x, FRAME_SIZE, ns_speech);
+    if (cfg->limiter) limiter_process(ctx, x, FRAME_SIZE);
+
+    dsp_f32_to_i16(x, pcm, FRAME_SIZE);
+}
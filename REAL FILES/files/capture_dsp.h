@@ -0,0 +1,80 @@
+#ifndef CAPTURE_DSP_H
+#define CAPTURE_DSP_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "opus_helper.h"
+#include "fft.h"
+
+// TX conditioning between capture and opus_encode_frame:
+// high-pass -> spectral noise suppression -> AGC -> peak limiter.
+// Runs in place on one FRAME_SIZE frame, no allocation after init.
+
+// Noise suppressor STFT: 220-sample sqrt-Hann windows, 50% overlap,
+// zero-padded to 256, so a frame is exactly 8 hops (2.5 ms latency)
+#define NS_HOP              110
+#define NS_WINDOW           (2 * NS_HOP)
+#define NS_FFT_SIZE         256
+#define NS_BINS             (NS_FFT_SIZE / 2 + 1)
+#define NS_HOPS_PER_FRAME   (FRAME_SIZE / NS_HOP)
+
+// Limiter works on the same sub-blocks
+#define LIMIT_BLOCK         NS_HOP
+
+typedef struct {
+    bool hpf;
+    float hpf_hz;               // High-pass corner (DC, rumble, mains hum)
+    bool ns;
+    float ns_max_atten_db;      // Deepest noise attenuation
+    bool agc;
+    float agc_target_dbfs;      // Speech RMS level the AGC aims for
+    float agc_max_gain_db;
+    bool limiter;
+    float limit_dbfs;           // Output peak ceiling
+} capture_dsp_config_t;
+
+typedef struct {
+    capture_dsp_config_t cfg;
+
+    // High-pass biquad (transposed direct form II)
+    float b0, b1, b2, a1, a2;
+    float z1, z2;
+
+    // Noise suppressor
+    fft_ctx_t fft;
+    float window[NS_WINDOW];
+    float in_prev[NS_HOP];
+    float ola[NS_HOP];
+    float smooth[NS_BINS];
+    float noise[NS_BINS];
+    float clean_prev[NS_BINS];  // |G * X|^2 of the previous hop (decision directed)
+    int ns_blocks;
+    float ns_gain_min;
+
+    // AGC
+    float agc_gain_db;
+    float agc_level_db;
+    float agc_floor_db;         // Tracked background level, speech gate
+
+    // Limiter
+    float limit_ceiling;
+    float limit_gain;
+
+    float work[FRAME_SIZE];
+    bool speech;                // Last frame judged to contain speech
+    bool initialized;
+} capture_dsp_ctx_t;
+
+void capture_dsp_config_default(capture_dsp_config_t *cfg);
+
+// Parse "hpf=100,ns=15,agc=-20,gain=20,limit=-1" ("off" disables a stage,
+// a bare "off" disables the chain)
+int capture_dsp_parse(capture_dsp_config_t *cfg, const char *spec);
+
+int capture_dsp_init(capture_dsp_ctx_t *ctx, const capture_dsp_config_t *cfg);
+
+// Condition one FRAME_SIZE frame in place
+void capture_dsp_process(capture_dsp_ctx_t *ctx, int16_t *pcm);
+
+#endif // CAPTURE_DSP_H
@@ -0,0 +1,280 @@
+#include "clocksync.h"
+#include "wtlog.h"
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+
+int clocksync_init(clocksync_ctx_t *ctx, network_ctx_t *net) {
+    memset(ctx, 0, sizeof(clocksync_ctx_t));
+
+    if (!net || !net->initialized) {
+        fprintf(stderr, "Clock sync needs the network\n");
+        return -1;
+    }
+    ctx->net = net;
+    ctx->board_id = net->my_board_id;
+
+    // Listen for a master for a timeout before claiming the role
+    ctx->master_heard_us = network_time_us();
+
+    pthread_mutex_init(&ctx->lock, NULL);
+    ctx->initialized = true;
+    printf("Clock sync initialised (board %u, SYNC every %d ms)\n", ctx->board_id,
+           CLOCKSYNC_INTERVAL_MS);
+    return 0;
+}
+
+void clocksync_set_skew(clocksync_ctx_t *ctx, int64_t skew_us, double skew_ppm) {
+    ctx->skew_us = skew_us;
+    ctx->skew_ppm = skew_ppm;
+}
+
+// This board's clock at a CLOCK_MONOTONIC time, and back (identity
+// unless a test skewed it)
+uint64_t clocksync_board_time(const clocksync_ctx_t *ctx, uint64_t mono_us) {
+    return mono_us + ctx->skew_us + (int64_t)((double)mono_us * ctx->skew_ppm * 1e-6);
+}
+
+static uint64_t mono_time(const clocksync_ctx_t *ctx, uint64_t board_us) {
+    return (uint64_t)llround((double)(int64_t)(board_us - ctx->skew_us) / (1.0 + ctx->skew_ppm * 1e-6));
+}
+
+static void send_msg(clocksync_ctx_t *ctx, uint8_t type, uint32_t target, uint32_t id, uint64_t t_us) {
+    clocksync_msg_t msg = {0};
+    msg.type = type;
+    msg.target = target;
+    msg.id = id;
+    msg.t_us = t_us;
+    if (network_send_sync(ctx->net, &msg, sizeof(msg)) < 0) {
+        WTLOG_WARN("Clock sync send failed");
+    }
+}
+
+// A new master (possibly us): what was measured against the old one is void
+static void set_master(clocksync_ctx_t *ctx, uint32_t master, uint64_t now_us) {
+    bool ours = master == ctx->board_id;
+
+    ctx->master = master;
+    ctx->master_heard_us = now_us;
+    ctx->pending = false;
+    ctx->n_samples = 0;
+    ctx->next_sample = 0;
+    ctx->stats.master_changes++;
+
+    pthread_mutex_lock(&ctx->lock);
+    ctx->locked = ours;
+    ctx->offset_us = 0;
+    ctx->drift = 0;
+    ctx->ref_us = 0;
+    pthread_mutex_unlock(&ctx->lock);
+
+    if (ours) {
+        ctx->next_sync_us = now_us;
+        WTLOG_INFO("Clock master: this board (%u)", master);
+    } else {
+        WTLOG_INFO("Clock master: board %u", master);
+    }
+}
+
+// Line through the exchanges with the shortest round trips
+static void fit(clocksync_ctx_t *ctx) {
+    uint32_t best = UINT32_MAX;
+    uint64_t ref = 0;
+    for (int i = 0; i < ctx->n_samples; i++) {
+        if (ctx->samples[i].rtt_us < best) best = ctx->samples[i].rtt_us;
+        if (ctx->samples[i].local_us > ref) ref = ctx->samples[i].local_us;
+    }
+
+    int n = 0;
+    double sx = 0, sy = 0, sxx = 0, sxy = 0;
+    for (int i = 0; i < ctx->n_samples; i++) {
+        const clocksync_sample_t *s = &ctx->samples[i];
+        if (s->rtt_us > best + CLOCKSYNC_RTT_SLACK_US) continue;
+        double x = (double)(int64_t)(s->local_us - ref);
+        double y = (double)s->offset_us;
+        sx += x;
+        sy += y;
+        sxx += x * x;
+        sxy += x * y;
+        n++;
+    }
+
+    // Centred so the slope does not lose precision to the offset
+    double mx = sx / n, my = sy / n;
+    double var = sxx - n * mx * mx;
+    double drift = n > 1 && var > 0 ? (sxy - n * mx * my) / var : 0;
+    if (fabs(drift) > CLOCKSYNC_MAX_DRIFT_PPM * 1e-6) drift = 0;
+    double offset = my - drift * mx;
+
+    pthread_mutex_lock(&ctx->lock);
+    ctx->offset_us = offset;
+    ctx->drift = drift;
+    ctx->ref_us = ref;
+    ctx->locked = n >= CLOCKSYNC_MIN_SAMPLES;
+    pthread_mutex_unlock(&ctx->lock);
+
+    ctx->stats.rtt_min_us = best;
+    ctx->stats.usable = n;
+}
+
+static void add_sample(clocksync_ctx_t *ctx, uint64_t t4) {
+    int64_t forward = (int64_t)(ctx->t2 - ctx->t1);
+    int64_t back = (int64_t)(t4 - ctx->t3);
+    int64_t rtt = forward + back;
+
+    // A clock stepped under us or a reply to something else
+    if (rtt < 0 || rtt > (int64_t)CLOCKSYNC_INTERVAL_MS * 1000) return;
+
+    clocksync_sample_t *s = &ctx->samples[ctx->next_sample];
+    s->local_us = ctx->t2;
+    s->offset_us = (forward - back) / 2;
+    s->rtt_us = (uint32_t)rtt;
+    ctx->next_sample = (ctx->next_sample + 1) % CLOCKSYNC_WINDOW;
+    if (ctx->n_samples < CLOCKSYNC_WINDOW) ctx->n_samples++;
+    ctx->stats.exchanges++;
+
+    bool was_locked = ctx->locked;
+    fit(ctx);
+    if (ctx->locked && !was_locked) {
+        WTLOG_INFO("Clock locked to board %u: offset %.0f us, drift %.1f ppm, rtt %u us",
+                   ctx->master, ctx->offset_us, ctx->drift * 1e6, ctx->stats.rtt_min_us);
+    }
+}
+
+void clocksync_receive(clocksync_ctx_t *ctx, const network_packet_t *packet, int len, uint64_t rx_us) {
+    if (!ctx->initialized || len < (int)(PACKET_HEADER_SIZE + sizeof(clocksync_msg_t)) ||
+        packet->opus_size < sizeof(clocksync_msg_t)) {
+        return;
+    }
+
+    // Multicast loops our own messages back
+    uint32_t from = packet->board_id;
+    if (from == ctx->board_id) return;
+
+    clocksync_msg_t msg;
+    memcpy(&msg, packet->opus_data, sizeof(msg));
+    uint64_t t_rx = clocksync_board_time(ctx, rx_us);
+
+    switch (msg.type) {
+    case CLOCKSYNC_SYNC:
+        // We outrank it: our own SYNCs will make it step down
+        if (from > ctx->board_id) return;
+        if (from != ctx->master) {
+            // A higher master than the one we follow, until ours goes quiet
+            bool ours_alive = ctx->master && ctx->master != ctx->board_id &&
+                              rx_us - ctx->master_heard_us < CLOCKSYNC_MASTER_TIMEOUT_MS * 1000ULL;
+            if (ours_alive && from > ctx->master) return;
+            set_master(ctx, from, rx_us);
+        }
+        ctx->master_heard_us = rx_us;
+        ctx->stats.syncs_received++;
+
+        // Start the exchange straight away, t3 as late as possible
+        ctx->t1 = msg.t_us;
+        ctx->t2 = t_rx;
+        ctx->pending_id = msg.id;
+        ctx->pending = true;
+        ctx->t3 = clocksync_board_time(ctx, network_time_us());
+        send_msg(ctx, CLOCKSYNC_DELAY_REQ, from, msg.id, 0);
+        break;
+
+    case CLOCKSYNC_DELAY_REQ:
+        if (msg.target != ctx->board_id || ctx->master != ctx->board_id) return;
+        send_msg(ctx, CLOCKSYNC_DELAY_RESP, from, msg.id, t_rx);
+        ctx->stats.requests_answered++;
+        break;
+
+    case CLOCKSYNC_DELAY_RESP:
+        if (msg.target != ctx->board_id || from != ctx->master || !ctx->pending ||
+            msg.id != ctx->pending_id) {
+            return;
+        }
+        ctx->pending = false;
+        add_sample(ctx, msg.t_us);
+        break;
+
+    default:
+        break;
+    }
+}
+
+void clocksync_poll(clocksync_ctx_t *ctx, uint64_t now_us) {
+    if (!ctx->initialized) return;
+
+    // No master heard (or it went away): claim the role. A lower ID that
+    // is already master will send us back with its next SYNC.
+    if (ctx->master != ctx->board_id &&
+        now_us - ctx->master_heard_us >= CLOCKSYNC_MASTER_TIMEOUT_MS * 1000ULL) {
+        if (ctx->master) {
+            WTLOG_WARN("Clock master %u silent for %d ms", ctx->master, CLOCKSYNC_MASTER_TIMEOUT_MS);
+        }
+        set_master(ctx, ctx->board_id, now_us);
+    }
+
+    if (ctx->master == ctx->board_id && now_us >= ctx->next_sync_us) {
+        ctx->next_sync_us = now_us + CLOCKSYNC_INTERVAL_MS * 1000ULL;
+        send_msg(ctx, CLOCKSYNC_SYNC, 0, ++ctx->sync_id, clocksync_board_time(ctx, network_time_us()));
+        ctx->stats.syncs_sent++;
+    }
+}
+
+bool clocksync_locked(clocksync_ctx_t *ctx) {
+    if (!ctx->initialized) return false;
+    pthread_mutex_lock(&ctx->lock);
+    bool locked = ctx->locked;
+    pthread_mutex_unlock(&ctx->lock);
+    return locked;
+}
+
+bool clocksync_is_master(const clocksync_ctx_t *ctx) {
+    return ctx->initialized && ctx->master == ctx->board_id;
+}
+
+uint64_t clocksync_to_master(clocksync_ctx_t *ctx, uint64_t local_us) {
+    uint64_t b = clocksync_board_time(ctx, local_us);
+
+    pthread_mutex_lock(&ctx->lock);
+    double offset = ctx->offset_us + ctx->drift * (double)(int64_t)(b - ctx->ref_us);
+    pthread_mutex_unlock(&ctx->lock);
+    return b - (int64_t)llround(offset);
+}
+
+uint64_t clocksync_to_local(clocksync_ctx_t *ctx, uint64_t master_us) {
+    pthread_mutex_lock(&ctx->lock);
+    uint64_t b = master_us + (int64_t)llround(ctx->offset_us);
+    b += (int64_t)llround(ctx->drift * (double)(int64_t)(b - ctx->ref_us));
+    pthread_mutex_unlock(&ctx->lock);
+    return mono_time(ctx, b);
+}
+
+uint64_t clocksync_now(void *arg) {
+    clocksync_ctx_t *ctx = arg;
+    if (!clocksync_locked(ctx)) return 0;
+    return clocksync_to_master(ctx, network_time_us());
+}
+
+double clocksync_offset_us(clocksync_ctx_t *ctx) {
+    pthread_mutex_lock(&ctx->lock);
+    double offset = ctx->offset_us;
+    pthread_mutex_unlock(&ctx->lock);
+    return offset;
+}
+
+double clocksync_drift_ppm(clocksync_ctx_t *ctx) {
+    pthread_mutex_lock(&ctx->lock);
+    double drift = ctx->drift * 1e6;
+    pthread_mutex_unlock(&ctx->lock);
+    return drift;
+}
+
+void clocksync_cleanup(clocksync_ctx_t *ctx) {
+    if (!ctx->initialized) return;
+
+    // Packets must not stamp from a clock that is going away
+    if (ctx->net->clock_arg == ctx) {
+        ctx->net->clock = NULL;
+        ctx->net->clock_arg = NULL;
+    }
+    pthread_mutex_destroy(&ctx->lock);
+    ctx->initialized = false;
+}
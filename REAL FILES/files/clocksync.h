@@ -0,0 +1,139 @@
+#ifndef CLOCKSYNC_H
+#define CLOCKSYNC_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <pthread.h>
+
+#include "network.h"
+
+// Shared time base for the boards on a talkgroup, PTP-lite over the
+// multicast socket the audio already uses (PKT_FLAG_SYNC packets, sealed
+// like audio when there is a keyring).
+//
+// The board with the lowest ID is the master and multicasts a SYNC with
+// its send time t1 every CLOCKSYNC_INTERVAL_MS. Every other board notes
+// the receive time t2 (kernel timestamp), answers with a DELAY_REQ sent
+// at t3, and the master returns the receive time t4 of that request:
+//
+//   offset = ((t2 - t1) - (t4 - t3)) / 2      our clock minus the master's
+//   rtt    =  (t2 - t1) + (t4 - t3)
+//
+// which assumes the path is symmetric. Exchanges that queued somewhere
+// show up as a longer rtt, so only those within CLOCKSYNC_RTT_SLACK_US of
+// the shortest in the window are used, and a straight line through them
+// (least squares) gives the offset now and the drift between the two
+// crystals. A master that goes quiet for CLOCKSYNC_MASTER_TIMEOUT_MS is
+// replaced by the next lowest ID; the estimate holds until then.
+//
+// Master time is the master's CLOCK_MONOTONIC in microseconds. Packets
+// carry it as their timestamp (see network_ctx_t.clock), which is what
+// synchronised playout (playout_write_at) schedules against.
+
+#define CLOCKSYNC_INTERVAL_MS       250
+#define CLOCKSYNC_MASTER_TIMEOUT_MS 1000
+#define CLOCKSYNC_WINDOW            32      // Exchanges kept (8 s)
+#define CLOCKSYNC_RTT_SLACK_US      100     // Usable: rtt within this of the best
+#define CLOCKSYNC_MIN_SAMPLES       4       // Usable exchanges before locked
+#define CLOCKSYNC_MAX_DRIFT_PPM     500     // Fits steeper than this are noise
+#define CLOCKSYNC_DEFAULT_DELAY_MS  120     // Synchronised playout: send to speaker
+#define CLOCKSYNC_MIN_DELAY_MS      40
+#define CLOCKSYNC_MAX_DELAY_MS      250     // Frames held must fit the jitter buffer
+
+enum {
+    CLOCKSYNC_SYNC = 1,                     // Master -> all: t1
+    CLOCKSYNC_DELAY_REQ,                    // Slave -> master
+    CLOCKSYNC_DELAY_RESP,                   // Master -> slave: t4
+};
+
+// In opus_data of a PKT_FLAG_SYNC packet
+typedef struct __attribute__((packed)) {
+    uint8_t type;
+    uint8_t reserved[3];
+    uint32_t target;                        // Board the request/response is for, 0 for SYNC
+    uint32_t id;                            // SYNC number, echoed by the exchange
+    uint64_t t_us;                          // t1 (SYNC) or t4 (DELAY_RESP)
+} clocksync_msg_t;
+
+typedef struct {
+    uint64_t local_us;                      // t2, our clock
+    int64_t offset_us;
+    uint32_t rtt_us;
+} clocksync_sample_t;
+
+typedef struct {
+    uint64_t syncs_sent;
+    uint64_t syncs_received;
+    uint64_t requests_answered;
+    uint64_t exchanges;                     // Complete t1..t4 sets
+    uint64_t master_changes;
+    uint32_t rtt_min_us;                    // Best rtt in the window
+    uint32_t usable;                        // Exchanges in the last fit
+} clocksync_stats_t;
+
+typedef struct {
+    network_ctx_t *net;
+    uint32_t board_id;
+
+    // Election
+    uint32_t master;                        // Its board ID, ours when we are it, 0 none yet
+    uint64_t master_heard_us;               // Or when we started listening
+    uint64_t next_sync_us;
+    uint32_t sync_id;
+
+    // Exchange in progress with the master
+    bool pending;
+    uint32_t pending_id;
+    uint64_t t1, t2, t3;
+
+    clocksync_sample_t samples[CLOCKSYNC_WINDOW];
+    int n_samples;
+    int next_sample;
+
+    // Estimate, read by other threads under the lock
+    pthread_mutex_t lock;
+    bool locked;
+    double offset_us;                       // Our clock minus master's at ref_us
+    double drift;                           // d(offset)/d(our clock)
+    uint64_t ref_us;
+
+    // Test only: this board's clock reads skew_us ahead and runs skew_ppm
+    // fast (so processes on one host can have different clocks)
+    int64_t skew_us;
+    double skew_ppm;
+
+    clocksync_stats_t stats;
+    bool initialized;
+} clocksync_ctx_t;
+
+int clocksync_init(clocksync_ctx_t *ctx, network_ctx_t *net);
+void clocksync_set_skew(clocksync_ctx_t *ctx, int64_t skew_us, double skew_ppm);
+
+// This board's (skewed) clock at a CLOCK_MONOTONIC time
+uint64_t clocksync_board_time(const clocksync_ctx_t *ctx, uint64_t mono_us);
+
+// A PKT_FLAG_SYNC packet from network_recv, rx_us its receive time
+// (network_rx_time_us). Answers requests straight away.
+void clocksync_receive(clocksync_ctx_t *ctx, const network_packet_t *packet, int len, uint64_t rx_us);
+
+// Send what is due (SYNC as master, election); call every few ms
+void clocksync_poll(clocksync_ctx_t *ctx, uint64_t now_us);
+
+bool clocksync_locked(clocksync_ctx_t *ctx);
+bool clocksync_is_master(const clocksync_ctx_t *ctx);
+
+// Master time for a local CLOCK_MONOTONIC time and back; only meaningful
+// when locked
+uint64_t clocksync_to_master(clocksync_ctx_t *ctx, uint64_t local_us);
+uint64_t clocksync_to_local(clocksync_ctx_t *ctx, uint64_t master_us);
+
+// Master time now, 0 when not locked (network_ctx_t.clock)
+uint64_t clocksync_now(void *ctx);
+
+// Current estimate: our clock minus the master's, and drift in ppm
+double clocksync_offset_us(clocksync_ctx_t *ctx);
+double clocksync_drift_ppm(clocksync_ctx_t *ctx);
+
+void clocksync_cleanup(clocksync_ctx_t *ctx);
+
+#endif // CLOCKSYNC_H
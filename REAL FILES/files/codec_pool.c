@@ -0,0 +1,131 @@
+#include "codec_pool.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static size_t align_up(size_t n) {
+    return (n + CODEC_POOL_ALIGN - 1) & ~(size_t)(CODEC_POOL_ALIGN - 1);
+}
+
+int codec_pool_init(codec_pool_t *pool, int encoders, int decoders, int bitrate) {
+    memset(pool, 0, sizeof(codec_pool_t));
+
+    if (encoders < 0 || encoders > CODEC_POOL_MAX ||
+        decoders < 0 || decoders > CODEC_POOL_MAX) {
+        fprintf(stderr, "codec_pool: %d encoders / %d decoders, max %d each\n",
+                encoders, decoders, CODEC_POOL_MAX);
+        return -1;
+    }
+
+    // States start on their own cache lines so two threads never share one
+    pool->enc_stride = align_up(opus_encoder_get_size(CHANNELS));
+    pool->dec_stride = align_up(opus_decoder_get_size(CHANNELS));
+    pool->arena_size = pool->enc_stride * encoders + pool->dec_stride * decoders;
+
+    if (posix_memalign((void **)&pool->arena, CODEC_POOL_ALIGN, pool->arena_size) != 0) {
+        fprintf(stderr, "codec_pool: cannot allocate %zu byte arena\n", pool->arena_size);
+        return -1;
+    }
+
+    uint8_t *mem = pool->arena;
+    for (int i = 0; i < encoders; i++, mem += pool->enc_stride) {
+        if (opus_enc_init_in(&pool->enc[i], mem, bitrate) < 0) {
+            free(pool->arena);
+            return -1;
+        }
+    }
+    for (int i = 0; i < decoders; i++, mem += pool->dec_stride) {
+        if (opus_dec_init_in(&pool->dec[i], mem) < 0) {
+            free(pool->arena);
+            return -1;
+        }
+    }
+    pool->n_enc = encoders;
+    pool->n_dec = decoders;
+
+    if (pthread_mutex_init(&pool->lock, NULL) != 0) {
+        free(pool->arena);
+        return -1;
+    }
+
+    pool->initialized = true;
+    printf("Codec pool: %d encoder(s) x %zu B, %d decoder(s) x %zu B in one %zu B arena\n",
+           encoders, pool->enc_stride, decoders, pool->dec_stride, pool->arena_size);
+    return 0;
+}
+
+static int take_slot(bool *used, int count, codec_pool_stats_t *stats) {
+    for (int i = 0; i < count; i++) {
+        if (!used[i]) {
+            used[i] = true;
+            stats->acquired++;
+            if (++stats->in_use > stats->high_water) stats->high_water = stats->in_use;
+            return i;
+        }
+    }
+    stats->exhausted++;
+    return -1;
+}
+
+opus_enc_ctx_t *codec_pool_acquire_enc(codec_pool_t *pool) {
+    if (!pool->initialized) return NULL;
+
+    pthread_mutex_lock(&pool->lock);
+    int i = take_slot(pool->enc_used, pool->n_enc, &pool->enc_stats);
+    pthread_mutex_unlock(&pool->lock);
+
+    return i < 0 ? NULL : &pool->enc[i];
+}
+
+opus_dec_ctx_t *codec_pool_acquire_dec(codec_pool_t *pool) {
+    if (!pool->initialized) return NULL;
+
+    pthread_mutex_lock(&pool->lock);
+    int i = take_slot(pool->dec_used, pool->n_dec, &pool->dec_stats);
+    pthread_mutex_unlock(&pool->lock);
+
+    return i < 0 ? NULL : &pool->dec[i];
+}
+
+void codec_pool_release_enc(codec_pool_t *pool, opus_enc_ctx_t *enc) {
+    int i = (int)(enc - pool->enc);
+    if (!pool->initialized || i < 0 || i >= pool->n_enc) return;
+
+    // Reset outside the lock, the state is still ours until marked free
+    opus_enc_reset(enc);
+
+    pthread_mutex_lock(&pool->lock);
+    if (pool->enc_used[i]) {
+        pool->enc_used[i] = false;
+        pool->enc_stats.released++;
+        pool->enc_stats.in_use--;
+    }
+    pthread_mutex_unlock(&pool->lock);
+}
+
+void codec_pool_release_dec(codec_pool_t *pool, opus_dec_ctx_t *dec) {
+    int i = (int)(dec - pool->dec);
+    if (!pool->initialized || i < 0 || i >= pool->n_dec) return;
+
+    opus_dec_reset(dec);
+
+    pthread_mutex_lock(&pool->lock);
+    if (pool->dec_used[i]) {
+        pool->dec_used[i] = false;
+        pool->dec_stats.released++;
+        pool->dec_stats.in_use--;
+    }
+    pthread_mutex_unlock(&pool->lock);
+}
+
+void codec_pool_cleanup(codec_pool_t *pool) {
+    if (!pool->initialized) return;
+
+    for (int i = 0; i < pool->n_enc; i++) opus_enc_cleanup(&pool->enc[i]);
+    for (int i = 0; i < pool->n_dec; i++) opus_dec_cleanup(&pool->dec[i]);
+
+    pthread_mutex_destroy(&pool->lock);
+    free(pool->arena);
+    pool->arena = NULL;
+    pool->initialized = false;
+}
@@ -0,0 +1,58 @@
+#ifndef CODEC_POOL_H
+#define CODEC_POOL_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <pthread.h>
+
+#include "opus_helper.h"
+
+// Fixed set of Opus encoder/decoder states carved out of one aligned
+// arena at startup. Acquire hands out an idle state, release resets it
+// with OPUS_RESET_STATE for the next talker; nothing is allocated or
+// freed after codec_pool_init.
+
+#define CODEC_POOL_MAX      16
+#define CODEC_POOL_ALIGN    64      // Cache line
+#define CODEC_POOL_DECODERS 4       // Talkers the board can decode at once
+
+typedef struct {
+    uint64_t acquired;
+    uint64_t released;
+    uint64_t exhausted;             // Acquire with every state in use
+    int in_use;
+    int high_water;
+} codec_pool_stats_t;
+
+typedef struct {
+    uint8_t *arena;
+    size_t arena_size;
+    size_t enc_stride;
+    size_t dec_stride;
+
+    opus_enc_ctx_t enc[CODEC_POOL_MAX];
+    opus_dec_ctx_t dec[CODEC_POOL_MAX];
+    bool enc_used[CODEC_POOL_MAX];
+    bool dec_used[CODEC_POOL_MAX];
+    int n_enc;
+    int n_dec;
+
+    pthread_mutex_t lock;
+    codec_pool_stats_t enc_stats;
+    codec_pool_stats_t dec_stats;
+    bool initialized;
+} codec_pool_t;
+
+int codec_pool_init(codec_pool_t *pool, int encoders, int decoders, int bitrate);
+
+// NULL when every state is taken
+opus_enc_ctx_t *codec_pool_acquire_enc(codec_pool_t *pool);
+opus_dec_ctx_t *codec_pool_acquire_dec(codec_pool_t *pool);
+
+void codec_pool_release_enc(codec_pool_t *pool, opus_enc_ctx_t *enc);
+void codec_pool_release_dec(codec_pool_t *pool, opus_dec_ctx_t *dec);
+
+void codec_pool_cleanup(codec_pool_t *pool);
+
+#endif // CODEC_POOL_H
@@ -0,0 +1,419 @@
+#include "config.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <ctype.h>
+#include <errno.h>
+#include <arpa/inet.h>
+
+#include "opus_helper.h"
+#include "network.h"
+#include "audio_dma.h"
+#include "rx_pipeline.h"
+#include "playout.h"
+#include "capture_dsp.h"
+#include "beamform.h"
+#include "playback_dsp.h"
+#include "netem.h"
+#include "tx_fanout.h"
+#include "red.h"
+#include "clocksync.h"
+#include "wtlog.h"
+#include "wttrace.h"
+
+#define CFG_INT     0
+#define CFG_BOOL    1
+#define CFG_HEX     2
+#define CFG_STR     3
+
+typedef struct {
+    const char *key;
+    const char *env;
+    int type;
+    size_t offset;
+    long min;
+    long max;                       // Strings: buffer size
+    bool reloadable;
+    const char *help;
+} config_key_t;
+
+#define INT_KEY(k, env, lo, hi, rl, help)   { #k, env, CFG_INT, offsetof(wt_config_t, k), lo, hi, rl, help }
+#define BOOL_KEY(k, env, rl, help)          { #k, env, CFG_BOOL, offsetof(wt_config_t, k), 0, 1, rl, help }
+#define HEX_KEY(k, env, help)               { #k, env, CFG_HEX, offsetof(wt_config_t, k), 0, 0, false, help }
+#define STR_KEY(k, env, help)               { #k, env, CFG_STR, offsetof(wt_config_t, k), 0, \
+                                              sizeof(((wt_config_t *)0)->k), false, help }
+
+static const config_key_t config_keys[] = {
+    INT_KEY(board_id, "BOARD_ID", 0, 0x7FFFFFFF, false, "Board ID, 0 = /etc/board_id"),
+    INT_KEY(talkgroup, "TALKGROUP", 0, CRYPTO_MAX_TALKGROUPS - 1, false, "Talkgroup to send and listen on"),
+    STR_KEY(group, "WT_GROUP", "Multicast group"),
+    INT_KEY(port, "WT_PORT", 1, 65535, false, "UDP port"),
+    STR_KEY(keyring, "WT_KEYRING", "Talkgroup keyring (no file: cleartext)"),
+    STR_KEY(session_file, "WT_SESSION_FILE", "Start count behind the session epoch (with a keyring)"),
+    STR_KEY(netem, "WT_NETEM", "Receive impairment for testing (netem.h)"),
+    BOOL_KEY(clock_sync, "WT_CLOCK_SYNC", false, "Shared time base with the other boards"),
+    INT_KEY(bitrate, "WT_BITRATE", 6000, 510000, true, "Opus bitrate, bps"),
+    INT_KEY(complexity, "WT_COMPLEXITY", 0, 10, true, "Opus complexity"),
+    BOOL_KEY(fec, "WT_FEC", true, "In-band FEC"),
+    INT_KEY(loss_perc, "WT_LOSS_PERC", 0, 100, true, "Expected loss, sizes the FEC"),
+    BOOL_KEY(dtx, "WT_DTX", true, "Discontinuous transmission"),
+    INT_KEY(encode_budget, "WT_ENCODE_BUDGET", 0, TX_FRAME_US / 1000, true,
+            "Encode ms per frame before complexity steps down, 0 = fixed"),
+    INT_KEY(redundancy, "WT_REDUNDANCY", 0, RED_MAX_DEPTH, true,
+            "Earlier frames carried in every packet, 0 = off"),
+    INT_KEY(redundancy_kbps, "WT_REDUNDANCY_KBPS", 0, 510, true,
+            "Cap on the bitrate the redundant frames add, 0 = none"),
+    STR_KEY(tx_streams, "WT_TX_STREAMS", "Extra talkgroup streams (tx_fanout.h)"),
+    INT_KEY(jitter_target, "WT_JITTER", 1, JITTER_SLOTS - 1, true, "Frames buffered before playout"),
+    INT_KEY(playout_frames, "WT_PLAYOUT_FRAMES", 1, PLAYOUT_MAX_FRAMES - 1, false,
+            "Decoded frames queued ahead of the speaker at most (latency bound)"),
+    INT_KEY(sync_playout, "WT_SYNC_PLAYOUT", 0, CLOCKSYNC_MAX_DELAY_MS, false,
+            "Play at send time + this many ms on every board, 0 = off (needs clock_sync)"),
+    STR_KEY(tx_dsp, "WT_TX_DSP", "Mic DSP (capture_dsp.h)"),
+    STR_KEY(mic_array, "WT_MIC_ARRAY", "Mic array and beamformer (beamform.h)"),
+    STR_KEY(rx_dsp, "WT_RX_DSP", "Speaker DSP (playback_dsp.h)"),
+    BOOL_KEY(full_duplex, "WT_FULL_DUPLEX", false, "Play while transmitting, with echo cancelling"),
+    STR_KEY(record, "WT_RECORD", "Record received packets to this file"),
+    STR_KEY(archive, "WT_ARCHIVE", "Archive every talk-burst as Ogg Opus here (archive.h)"),
+    INT_KEY(log_level, "WT_LOG_LEVEL", 0, 3, true, "Log level: 0 debug, 1 info, 2 warn, 3 error"),
+    BOOL_KEY(trace, "WT_TRACE", true, "Record pipeline spans (wttrace.h)"),
+    STR_KEY(trace_file, "WT_TRACE_FILE", "Chrome trace JSON written on SIGUSR1 and at exit"),
+    HEX_KEY(dma_base, "WT_DMA_BASE", "AXI DMA register base"),
+    HEX_KEY(dma_mem_base, "WT_DMA_MEM", "Audio buffer physical base (uncached buffers)"),
+    STR_KEY(dma_buf, "WT_DMA_BUF", "u-dma-buf device for cached audio buffers, off = /dev/mem"),
+    STR_KEY(gpio, "WT_GPIO", "GPIO backend and lines (gpio_ptt.h)"),
+};
+
+#define N_KEYS ((int)(sizeof(config_keys) / sizeof(config_keys[0])))
+
+void config_default(wt_config_t *cfg) {
+    opus_enc_params_t enc;
+    opus_enc_params_default(&enc, BITRATE);
+
+    memset(cfg, 0, sizeof(wt_config_t));
+    cfg->board_id = 0;
+    cfg->talkgroup = 0;
+    snprintf(cfg->group, sizeof(cfg->group), "%s", MULTICAST_ADDR);
+    cfg->port = MULTICAST_PORT;
+    snprintf(cfg->keyring, sizeof(cfg->keyring), "%s", CRYPTO_KEYRING_PATH);
+    snprintf(cfg->session_file, sizeof(cfg->session_file), "%s", CRYPTO_SESSION_PATH);
+    cfg->bitrate = enc.bitrate;
+    cfg->complexity = enc.complexity;
+    cfg->fec = enc.fec;
+    cfg->loss_perc = enc.loss_perc;
+    cfg->dtx = enc.dtx;
+    cfg->encode_budget = TX_ADAPT_BUDGET_US / 1000;
+    cfg->jitter_target = JITTER_DEFAULT_TARGET;
+    cfg->playout_frames = PLAYOUT_DEFAULT_FRAMES;
+    cfg->log_level = WTLOG_LVL_INFO;
+    snprintf(cfg->trace_file, sizeof(cfg->trace_file), "%s", WT_TRACE_FILE);
+    cfg->dma_base = DMA_BASE_ADDR;
+    cfg->dma_mem_base = DMA_MEM_BASE;
+}
+
+static const config_key_t *config_find(const char *key) {
+    for (int i = 0; i < N_KEYS; i++) {
+        if (strcmp(config_keys[i].key, key) == 0) return &config_keys[i];
+    }
+    return NULL;
+}
+
+int config_set(wt_config_t *cfg, const char *key, const char *value, const char *origin) {
+    const config_key_t *k = config_find(key);
+    if (!k) {
+        fprintf(stderr, "%s: unknown setting '%s'\n", origin, key);
+        return -1;
+    }
+
+    void *field = (uint8_t *)cfg + k->offset;
+    char *end;
+
+    switch (k->type) {
+    case CFG_INT: {
+        errno = 0;
+        long v = strtol(value, &end, 10);
+        if (errno || end == value || *end || v < k->min || v > k->max) {
+            fprintf(stderr, "%s: %s must be %ld-%ld, got '%s'\n", origin, key, k->min, k->max, value);
+            return -1;
+        }
+        *(int *)field = (int)v;
+        break;
+    }
+    case CFG_BOOL:
+        if (strcmp(value, "1") == 0 || strcmp(value, "on") == 0 ||
+            strcmp(value, "yes") == 0 || strcmp(value, "true") == 0) {
+            *(bool *)field = true;
+        } else if (strcmp(value, "0") == 0 || strcmp(value, "off") == 0 ||
+                   strcmp(value, "no") == 0 || strcmp(value, "false") == 0) {
+            *(bool *)field = false;
+        } else {
+            fprintf(stderr, "%s: %s must be on/off, got '%s'\n", origin, key, value);
+            return -1;
+        }
+        break;
+    case CFG_HEX: {
+        errno = 0;
+        unsigned long v = strtoul(value, &end, 0);
+        if (errno || end == value || *end || v > 0xFFFFFFFFUL) {
+            fprintf(stderr, "%s: %s must be a 32-bit address, got '%s'\n", origin, key, value);
+            return -1;
+        }
+        *(uint32_t *)field = (uint32_t)v;
+        break;
+    }
+    case CFG_STR: {
+        if (strlen(value) >= (size_t)k->max) {
+            fprintf(stderr, "%s: %s is too long\n", origin, key);
+            return -1;
+        }
+        snprintf((char *)field, k->max, "%s", value);
+        break;
+    }
+    }
+    return 0;
+}
+
+// Strip leading and trailing blanks in place
+static char *trim(char *s) {
+    while (isspace((unsigned char)*s)) s++;
+    char *end = s + strlen(s);
+    while (end > s && isspace((unsigned char)end[-1])) end--;
+    *end = '\0';
+    return s;
+}
+
+int config_load_file(wt_config_t *cfg, const char *path, bool required) {
+    FILE *f = fopen(path, "r");
+    if (!f) {
+        if (!required && errno == ENOENT) return 0;
+        perror(path);
+        return -1;
+    }
+
+    char line[256];
+    char origin[300];
+    int lineno = 0;
+    int errors = 0;
+
+    while (fgets(line, sizeof(line), f)) {
+        lineno++;
+        char *hash = strchr(line, '#');
+        if (hash) *hash = '\0';
+        char *s = trim(line);
+        if (!*s) continue;
+
+        snprintf(origin, sizeof(origin), "%s:%d", path, lineno);
+        char *eq = strchr(s, '=');
+        if (!eq) {
+            fprintf(stderr, "%s: expected key = value\n", origin);
+            errors++;
+            continue;
+        }
+        *eq = '\0';
+
+        // Quotes are optional around values
+        char *value = trim(eq + 1);
+        size_t len = strlen(value);
+        if (len >= 2 && value[0] == '"' && value[len - 1] == '"') {
+            value[len - 1] = '\0';
+            value++;
+        }
+        if (config_set(cfg, trim(s), value, origin) < 0) errors++;
+    }
+    fclose(f);
+    return errors ? -1 : 0;
+}
+
+int config_load_env(wt_config_t *cfg) {
+    int errors = 0;
+    for (int i = 0; i < N_KEYS; i++) {
+        const char *value = getenv(config_keys[i].env);
+        if (value && config_set(cfg, config_keys[i].key, value, config_keys[i].env) < 0) errors++;
+    }
+    return errors ? -1 : 0;
+}
+
+int config_validate(const wt_config_t *cfg) {
+    int errors = 0;
+
+    struct in_addr group;
+    if (inet_pton(AF_INET, cfg->group, &group) != 1 || !IN_MULTICAST(ntohl(group.s_addr))) {
+        fprintf(stderr, "config: group %s is not an IPv4 multicast address\n", cfg->group);
+        errors++;
+    }
+
+    // mmap offsets have to be page aligned
+    long page = 4096;
+    if (cfg->dma_base % page || cfg->dma_mem_base % page) {
+        fprintf(stderr, "config: DMA addresses must be 4 KB aligned\n");
+        errors++;
+    }
+    if (cfg->dma_base >= cfg->dma_mem_base && cfg->dma_base < cfg->dma_mem_base + DMA_MEM_SIZE) {
+        fprintf(stderr, "config: dma_base lies inside the audio buffer region\n");
+        errors++;
+    }
+
+    // The spec strings, through the parsers that will use them
+    capture_dsp_config_t tx_dsp;
+    capture_dsp_config_default(&tx_dsp);
+    if (cfg->tx_dsp[0] && capture_dsp_parse(&tx_dsp, cfg->tx_dsp) < 0) errors++;
+
+    // Every mic's slot of a frame has to fit the RX buffer
+    beam_config_t mics;
+    beam_config_default(&mics);
+    if (cfg->mic_array[0] && beam_parse(&mics, cfg->mic_array) < 0) {
+        errors++;
+    } else if (beam_frame_bytes(&mics) > DMA_RX_BYTES) {
+        fprintf(stderr, "config: %d mics need %zu bytes of RX buffer, there are %d\n",
+                mics.mics, beam_frame_bytes(&mics), DMA_RX_BYTES);
+        errors++;
+    }
+
+    playback_dsp_config_t rx_dsp;
+    playback_dsp_config_default(&rx_dsp);
+    if (cfg->rx_dsp[0] && playback_dsp_parse(&rx_dsp, cfg->rx_dsp) < 0) errors++;
+
+    netem_config_t netem;
+    netem_config_default(&netem);
+    if (cfg->netem[0] && netem_parse(&netem, cfg->netem) < 0) errors++;
+
+    tx_fanout_config_t streams;
+    tx_fanout_config_default(&streams, (uint8_t)cfg->talkgroup, NULL);
+    if (cfg->tx_streams[0] && tx_fanout_parse(&streams, cfg->tx_streams) < 0) errors++;
+
+    // Synchronised playout schedules against the shared clock, and needs
+    // time for the packet to get here and through the jitter buffer
+    if (cfg->sync_playout && !cfg->clock_sync) {
+        fprintf(stderr, "config: sync_playout needs clock_sync\n");
+        errors++;
+    }
+    if (cfg->sync_playout && cfg->sync_playout < CLOCKSYNC_MIN_DELAY_MS) {
+        fprintf(stderr, "config: sync_playout below %d ms leaves no time for the network\n",
+                CLOCKSYNC_MIN_DELAY_MS);
+        errors++;
+    }
+
+    return errors ? -1 : 0;
+}
+
+static void config_format(const wt_config_t *cfg, const config_key_t *k, char *buf, size_t size) {
+    const void *field = (const uint8_t *)cfg + k->offset;
+    switch (k->type) {
+    case CFG_INT:   snprintf(buf, size, "%d", *(const int *)field); break;
+    case CFG_BOOL:  snprintf(buf, size, "%s", *(const bool *)field ? "on" : "off"); break;
+    case CFG_HEX:   snprintf(buf, size, "0x%08X", *(const uint32_t *)field); break;
+    default:        snprintf(buf, size, "%s", (const char *)field); break;
+    }
+}
+
+void config_usage(const char *prog) {
+    wt_config_t defaults;
+    char value[CONFIG_STR_MAX];
+    config_default(&defaults);
+
+    printf("Usage: %s [-c config] [-p] [--key=value ...] [board_id]\n", prog);
+    printf("  -c FILE   config file (default %s, or WT_CONFIG)\n", CONFIG_PATH);
+    printf("  -p        print the resulting configuration and exit\n\n");
+    printf("  %-14s %-15s %-22s %s\n", "key", "environment", "default", "");
+    for (int i = 0; i < N_KEYS; i++) {
+        const config_key_t *k = &config_keys[i];
+        config_format(&defaults, k, value, sizeof(value));
+        printf("  %-14s %-15s %-22s %s%s\n", k->key, k->env, value[0] ? value : "-",
+               k->help, k->reloadable ? " [SIGHUP]" : "");
+    }
+}
+
+int config_load(wt_config_t *cfg, int argc, char *argv[]) {
+    const char *path = getenv("WT_CONFIG");
+    bool required = path != NULL;
+    bool print = false;
+
+    // First pass: where the file is, and the options that stop here
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-c") == 0 && i + 1 < argc) {
+            path = argv[++i];
+            required = true;
+        } else if (strcmp(argv[i], "-p") == 0) {
+            print = true;
+        } else if (strcmp(argv[i], "-h") == 0 || strcmp(argv[i], "--help") == 0) {
+            config_usage(argv[0]);
+            return 1;
+        }
+    }
+    if (!path) path = CONFIG_PATH;
+
+    config_default(cfg);
+    if (config_load_file(cfg, path, required) < 0 || config_load_env(cfg) < 0) {
+        return -1;
+    }
+
+    // Then the command line on top
+    for (int i = 1; i < argc; i++) {
+        const char *arg = argv[i];
+        if (strcmp(arg, "-c") == 0) {
+            i++;
+        } else if (strcmp(arg, "-p") == 0) {
+            continue;
+        } else if (strncmp(arg, "--", 2) == 0) {
+            char buf[CONFIG_STR_MAX + 32];
+            snprintf(buf, sizeof(buf), "%s", arg + 2);
+            char *eq = strchr(buf, '=');
+            if (!eq) {
+                fprintf(stderr, "Expected --key=value, got '%s'\n", arg);
+                return -1;
+            }
+            *eq = '\0';
+            if (config_set(cfg, buf, eq + 1, "command line") < 0) return -1;
+        } else if (isdigit((unsigned char)arg[0])) {
+            // Peer address from the old usage; boards find each other by multicast
+            struct in_addr peer;
+            if (inet_pton(AF_INET, arg, &peer) == 1) continue;
+
+            // Plain number: board ID, as it always was
+            if (config_set(cfg, "board_id", arg, "command line") < 0) return -1;
+        } else {
+            fprintf(stderr, "Unknown argument '%s' (-h for help)\n", arg);
+            return -1;
+        }
+    }
+
+    if (config_validate(cfg) < 0) {
+        return -1;
+    }
+
+    if (print) {
+        config_print(cfg, stdout);
+        return 1;
+    }
+    return 0;
+}
+
+int config_diff(const wt_config_t *old, const wt_config_t *cfg, bool *restart) {
+    char before[CONFIG_STR_MAX];
+    char after[CONFIG_STR_MAX];
+    int changes = 0;
+
+    *restart = false;
+    for (int i = 0; i < N_KEYS; i++) {
+        const config_key_t *k = &config_keys[i];
+        config_format(old, k, before, sizeof(before));
+        config_format(cfg, k, after, sizeof(after));
+        if (strcmp(before, after) == 0) continue;
+
+        changes++;
+        if (!k->reloadable) *restart = true;
+        printf("  %s: %s -> %s%s\n", k->key, before[0] ? before : "\"\"", after[0] ? after : "\"\"",
+               k->reloadable ? "" : " (after restart)");
+    }
+    return changes;
+}
+
+void config_print(const wt_config_t *cfg, FILE *out) {
+    char value[CONFIG_STR_MAX];
+    for (int i = 0; i < N_KEYS; i++) {
+        config_format(cfg, &config_keys[i], value, sizeof(value));
+        fprintf(out, "%-14s = %s%s%s\n", config_keys[i].key,
+                config_keys[i].type == CFG_STR ? "\"" : "", value,
+                config_keys[i].type == CFG_STR ? "\"" : "");
+    }
+}
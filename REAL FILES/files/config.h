@@ -0,0 +1,100 @@
+#ifndef CONFIG_H
+#define CONFIG_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+
+// Runtime configuration. Every setting has a built-in default, and is
+// then taken from (later wins):
+//   1. the config file, /etc/walkietalkie.conf or WT_CONFIG or -c <file>,
+//      "key = value" lines, '#' comments
+//   2. its environment variable (BOARD_ID, TALKGROUP, WT_*; as before)
+//   3. the command line, --key=value
+// Values are range checked as they are read and the whole set is checked
+// together before use; a bad file is an error, not a silent default.
+//
+// SIGHUP re-reads all of it. Settings marked reloadable (encoder bitrate,
+// complexity, FEC, expected loss, DTX, jitter target, log level) are
+// applied to the running pipeline; changes to the rest are reported and
+// wait for a restart. SAMPLE_RATE and FRAME_SIZE size the buffers and stay
+// compile-time.
+
+#define CONFIG_PATH         "/etc/walkietalkie.conf"
+#define CONFIG_STR_MAX      128
+
+typedef struct {
+    // Identity
+    int board_id;                   // 0 = /etc/board_id, else 1
+    int talkgroup;
+
+    // Network
+    char group[16];
+    int port;
+    char keyring[CONFIG_STR_MAX];
+    char session_file[CONFIG_STR_MAX];
+    char netem[CONFIG_STR_MAX];
+    bool clock_sync;                // Shared time base with the other boards (clocksync.h)
+
+    // Encoder (reloadable)
+    int bitrate;
+    int complexity;
+    bool fec;
+    int loss_perc;
+    bool dtx;
+    int encode_budget;              // ms per frame before complexity steps down, 0 = fixed
+    int redundancy;                 // Earlier frames in every packet (red.h), 0 = off
+    int redundancy_kbps;            // Most they may add, 0 = no cap
+    char tx_streams[CONFIG_STR_MAX];
+
+    // Receive (jitter target is reloadable)
+    int jitter_target;
+    int playout_frames;             // Decoded frames queued ahead of the speaker at most
+    int sync_playout;               // Play at send time + this many ms on every board, 0 = off
+    char tx_dsp[CONFIG_STR_MAX];
+    char mic_array[CONFIG_STR_MAX]; // Several mics, delay-and-sum to one (beamform.h)
+    char rx_dsp[CONFIG_STR_MAX];
+    bool full_duplex;
+    char record[CONFIG_STR_MAX];
+    char archive[CONFIG_STR_MAX];   // Talk-burst directory, empty = off
+
+    // Log messages from the audio threads at this level and up (reloadable)
+    int log_level;
+
+    // Pipeline spans (wttrace.h, reloadable), dumped on SIGUSR1 and at exit
+    bool trace;
+    char trace_file[CONFIG_STR_MAX];
+
+    // Hardware
+    uint32_t dma_base;
+    uint32_t dma_mem_base;
+    char dma_buf[CONFIG_STR_MAX];   // u-dma-buf device, "off" = /dev/mem
+    char gpio[CONFIG_STR_MAX];
+} wt_config_t;
+
+void config_default(wt_config_t *cfg);
+
+// Set one key from text; origin is only for messages (file:line, env, CLI)
+int config_set(wt_config_t *cfg, const char *key, const char *value, const char *origin);
+
+// Missing file is fine unless required (an explicit -c or WT_CONFIG)
+int config_load_file(wt_config_t *cfg, const char *path, bool required);
+int config_load_env(wt_config_t *cfg);
+
+// Cross-field checks, and the spec strings through their own parsers
+int config_validate(const wt_config_t *cfg);
+
+// All layers in order for this command line. Returns 0 to run, 1 when the
+// command line only asked for help or a config dump, -1 on error.
+int config_load(wt_config_t *cfg, int argc, char *argv[]);
+
+// Report every key that differs; returns how many do, and sets
+// *restart when one of them cannot be changed at runtime
+int config_diff(const wt_config_t *old, const wt_config_t *cfg, bool *restart);
+
+// "key = value" for every setting (a valid config file)
+void config_print(const wt_config_t *cfg, FILE *out);
+
+void config_usage(const char *prog);
+
+#endif // CONFIG_H
@@ -0,0 +1,548 @@
+#include "crypto.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/random.h>
+
+// ChaCha20-Poly1305 AEAD as specified in RFC 8439.
+// Both primitives are plain 32/64-bit integer code, which the A53 runs in
+// a few cycles per byte, so no vector unit or crypto extension is needed
+// for our ~60 byte voice frames.
+
+// Little-endian load/store helpers
+static inline uint32_t load32_le(const uint8_t *p) {
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) |
+           ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static inline uint64_t load64_le(const uint8_t *p) {
+    return (uint64_t)load32_le(p) | ((uint64_t)load32_le(p + 4) << 32);
+}
+
+static inline void store32_le(uint8_t *p, uint32_t v) {
+    p[0] = (uint8_t)v;
+    p[1] = (uint8_t)(v >> 8);
+    p[2] = (uint8_t)(v >> 16);
+    p[3] = (uint8_t)(v >> 24);
+}
+
+static inline void store64_le(uint8_t *p, uint64_t v) {
+    store32_le(p, (uint32_t)v);
+    store32_le(p + 4, (uint32_t)(v >> 32));
+}
+
+// ---------------------------------------------------------------------------
+// ChaCha20
+// ---------------------------------------------------------------------------
+
+#define ROTL32(v, n) (((v) << (n)) | ((v) >> (32 - (n))))
+
+#define QUARTER_ROUND(a, b, c, d) \
+    a += b; d ^= a; d = ROTL32(d, 16); \
+    c += d; b ^= c; b = ROTL32(b, 12); \
+    a += b; d ^= a; d = ROTL32(d, 8);  \
+    c += d; b ^= c; b = ROTL32(b, 7)
+
+// Produce one 64 byte keystream block
+static void chacha20_block(const uint8_t key[CRYPTO_KEY_BYTES], uint32_t counter,
+                           const uint8_t nonce[CRYPTO_NONCE_BYTES], uint8_t out[64]) {
+    uint32_t in[16];
+    uint32_t x[16];
+
+    // "expand 32-byte k"
+    in[0] = 0x61707865;
+    in[1] = 0x3320646e;
+    in[2] = 0x79622d32;
+    in[3] = 0x6b206574;
+    for (int i = 0; i < 8; i++) {
+        in[4 + i] = load32_le(key + 4 * i);
+    }
+    in[12] = counter;
+    in[13] = load32_le(nonce);
+    in[14] = load32_le(nonce + 4);
+    in[15] = load32_le(nonce + 8);
+
+    memcpy(x, in, sizeof(x));
+
+    // 20 rounds = 10 column + diagonal double rounds
+    for (int i = 0; i < 10; i++) {
+        QUARTER_ROUND(x[0], x[4], x[8],  x[12]);
+        QUARTER_ROUND(x[1], x[5], x[9],  x[13]);
+        QUARTER_ROUND(x[2], x[6], x[10], x[14]);
+        QUARTER_ROUND(x[3], x[7], x[11], x[15]);
+        QUARTER_ROUND(x[0], x[5], x[10], x[15]);
+        QUARTER_ROUND(x[1], x[6], x[11], x[12]);
+        QUARTER_ROUND(x[2], x[7], x[8],  x[13]);
+        QUARTER_ROUND(x[3], x[4], x[9],  x[14]);
+    }
+
+    for (int i = 0; i < 16; i++) {
+        store32_le(out + 4 * i, x[i] + in[i]);
+    }
+}
+
+// XOR data with the keystream starting at block 'counter'
+static void chacha20_xor(const uint8_t key[CRYPTO_KEY_BYTES], uint32_t counter,
+                         const uint8_t nonce[CRYPTO_NONCE_BYTES],
+                         uint8_t *data, size_t len) {
+    uint8_t block[64];
+
+    while (len > 0) {
+        size_t n = len < 64 ? len : 64;
+        chacha20_block(key, counter++, nonce, block);
+        for (size_t i = 0; i < n; i++) {
+            data[i] ^= block[i];
+        }
+        data += n;
+        len -= n;
+    }
+}
+
+// ---------------------------------------------------------------------------
+// Poly1305 (44/44/42-bit limbs, 64x64->128 multiplies map onto mul/umulh)
+// ---------------------------------------------------------------------------
+
+typedef unsigned __int128 u128;
+
+#define MASK44  0xfffffffffffULL
+#define MASK42  0x3ffffffffffULL
+
+typedef struct {
+    uint64_t r[3];
+    uint64_t h[3];
+    uint64_t pad[2];
+    uint8_t buf[16];
+    size_t buf_len;
+} poly1305_t;
+
+static void poly1305_init(poly1305_t *st, const uint8_t key[32]) {
+    uint64_t t0 = load64_le(key);
+    uint64_t t1 = load64_le(key + 8);
+
+    // Clamp r
+    st->r[0] = t0 & 0xffc0fffffffULL;
+    st->r[1] = ((t0 >> 44) | (t1 << 20)) & 0xfffffc0ffffULL;
+    st->r[2] = (t1 >> 24) & 0x00ffffffc0fULL;
+
+    st->h[0] = st->h[1] = st->h[2] = 0;
+    st->pad[0] = load64_le(key + 16);
+    st->pad[1] = load64_le(key + 24);
+    st->buf_len = 0;
+}
+
+static void poly1305_blocks(poly1305_t *st, const uint8_t *m, size_t bytes, uint64_t hibit) {
+    uint64_t r0 = st->r[0], r1 = st->r[1], r2 = st->r[2];
+    uint64_t h0 = st->h[0], h1 = st->h[1], h2 = st->h[2];
+    uint64_t s1 = r1 * (5 << 2);
+    uint64_t s2 = r2 * (5 << 2);
+
+    while (bytes >= 16) {
+        uint64_t t0 = load64_le(m);
+        uint64_t t1 = load64_le(m + 8);
+
+        h0 += t0 & MASK44;
+        h1 += ((t0 >> 44) | (t1 << 20)) & MASK44;
+        h2 += ((t1 >> 24) & MASK42) | hibit;
+
+        u128 d0 = (u128)h0 * r0 + (u128)h1 * s2 + (u128)h2 * s1;
+        u128 d1 = (u128)h0 * r1 + (u128)h1 * r0 + (u128)h2 * s2;
+        u128 d2 = (u128)h0 * r2 + (u128)h1 * r1 + (u128)h2 * r0;
+
+        uint64_t c = (uint64_t)(d0 >> 44); h0 = (uint64_t)d0 & MASK44;
+        d1 += c; c = (uint64_t)(d1 >> 44); h1 = (uint64_t)d1 & MASK44;
+        d2 += c; c = (uint64_t)(d2 >> 42); h2 = (uint64_t)d2 & MASK42;
+        h0 += c * 5; c = h0 >> 44; h0 &= MASK44;
+        h1 += c;
+
+        m += 16;
+        bytes -= 16;
+    }
+
+    st->h[0] = h0;
+    st->h[1] = h1;
+    st->h[2] = h2;
+}
+
+// Feed data, zero padded up to a multiple of 16 bytes (the AEAD layout
+// always pads each section, so no partial block is carried between calls)
+static void poly1305_update_padded(poly1305_t *st, const uint8_t *m, size_t bytes) {
+    size_t full = bytes & ~(size_t)15;
+
+    poly1305_blocks(st, m, full, 1ULL << 40);
+    if (bytes > full) {
+        uint8_t block[16] = {0};
+        memcpy(block, m + full, bytes - full);
+        poly1305_blocks(st, block, 16, 1ULL << 40);
+    }
+}
+
+static void poly1305_finish(poly1305_t *st, uint8_t mac[16]) {
+    uint64_t h0 = st->h[0], h1 = st->h[1], h2 = st->h[2];
+    uint64_t c;
+
+    // Fully carry h
+    c = h1 >> 44; h1 &= MASK44;
+    h2 += c; c = h2 >> 42; h2 &= MASK42;
+    h0 += c * 5; c = h0 >> 44; h0 &= MASK44;
+    h1 += c; c = h1 >> 44; h1 &= MASK44;
+    h2 += c; c = h2 >> 42; h2 &= MASK42;
+    h0 += c * 5; c = h0 >> 44; h0 &= MASK44;
+    h1 += c;
+
+    // Compute h - p and select it if h >= p (constant time)
+    uint64_t g0 = h0 + 5; c = g0 >> 44; g0 &= MASK44;
+    uint64_t g1 = h1 + c; c = g1 >> 44; g1 &= MASK44;
+    uint64_t g2 = h2 + c - (1ULL << 42);
+
+    c = (g2 >> 63) - 1;
+    g0 &= c; g1 &= c; g2 &= c;
+    c = ~c;
+    h0 = (h0 & c) | g0;
+    h1 = (h1 & c) | g1;
+    h2 = (h2 & c) | g2;
+
+    // h = (h + pad) mod 2^128
+    uint64_t t0 = st->pad[0];
+    uint64_t t1 = st->pad[1];
+    h0 += t0 & MASK44; c = h0 >> 44; h0 &= MASK44;
+    h1 += (((t0 >> 44) | (t1 << 20)) & MASK44) + c; c = h1 >> 44; h1 &= MASK44;
+    h2 += ((t1 >> 24) & MASK42) + c; h2 &= MASK42;
+
+    store64_le(mac, h0 | (h1 << 44));
+    store64_le(mac + 8, (h1 >> 20) | (h2 << 24));
+}
+
+// ---------------------------------------------------------------------------
+// AEAD
+// ---------------------------------------------------------------------------
+
+static void aead_tag(const uint8_t key[CRYPTO_KEY_BYTES],
+                     const uint8_t nonce[CRYPTO_NONCE_BYTES],
+                     const uint8_t *aad, size_t aad_len,
+                     const uint8_t *ct, size_t ct_len,
+                     uint8_t tag[CRYPTO_TAG_BYTES]) {
+    uint8_t block0[64];
+    uint8_t lengths[16];
+    poly1305_t st;
+
+    // One-time Poly1305 key is the first half of keystream block 0
+    chacha20_block(key, 0, nonce, block0);
+    poly1305_init(&st, block0);
+
+    poly1305_update_padded(&st, aad, aad_len);
+    poly1305_update_padded(&st, ct, ct_len);
+    store64_le(lengths, aad_len);
+    store64_le(lengths + 8, ct_len);
+    poly1305_blocks(&st, lengths, 16, 1ULL << 40);
+    poly1305_finish(&st, tag);
+
+    memset(block0, 0, sizeof(block0));
+}
+
+int crypto_seal(const crypto_ctx_t *ctx, uint8_t talkgroup,
+                const uint8_t nonce[CRYPTO_NONCE_BYTES],
+                const uint8_t *aad, size_t aad_len,
+                uint8_t *data, size_t len,
+                uint8_t tag[CRYPTO_TAG_BYTES]) {
+    if (talkgroup >= CRYPTO_MAX_TALKGROUPS || !ctx->keys[talkgroup].present) {
+        return -1;
+    }
+
+    const uint8_t *key = ctx->keys[talkgroup].key;
+
+    // Payload keystream starts at block 1
+    chacha20_xor(key, 1, nonce, data, len);
+    aead_tag(key, nonce, aad, aad_len, data, len, tag);
+    return 0;
+}
+
+int crypto_open(crypto_ctx_t *ctx, uint8_t talkgroup,
+                const uint8_t nonce[CRYPTO_NONCE_BYTES],
+                const uint8_t *aad, size_t aad_len,
+                uint8_t *data, size_t len,
+                const uint8_t tag[CRYPTO_TAG_BYTES]) {
+    if (talkgroup >= CRYPTO_MAX_TALKGROUPS || !ctx->keys[talkgroup].present) {
+        ctx->auth_failures++;
+        return -1;
+    }
+
+    const uint8_t *key = ctx->keys[talkgroup].key;
+    uint8_t expected[CRYPTO_TAG_BYTES];
+    aead_tag(key, nonce, aad, aad_len, data, len, expected);
+
+    // Constant time compare so the tag can't be guessed byte by byte
+    uint8_t diff = 0;
+    for (int i = 0; i < CRYPTO_TAG_BYTES; i++) {
+        diff |= expected[i] ^ tag[i];
+    }
+    if (diff != 0) {
+        ctx->auth_failures++;
+        return -1;
+    }
+
+    chacha20_xor(key, 1, nonce, data, len);
+    return 0;
+}
+
+const char *crypto_session_path(void) {
+    const char *env = getenv("WT_SESSION_FILE");
+    return env ? env : CRYPTO_SESSION_PATH;
+}
+
+int crypto_new_session(const char *path, uint32_t *session) {
+    if (!path || !path[0]) path = crypto_session_path();
+
+    int fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    if (fd < 0) {
+        perror(path);
+        return -1;
+    }
+
+    // Boards sharing a process (wt_soak) or a file take turns
+    if (flock(fd, LOCK_EX) < 0) {
+        perror(path);
+        close(fd);
+        return -1;
+    }
+
+    char buf[32];
+    ssize_t n = pread(fd, buf, sizeof(buf) - 1, 0);
+    unsigned long starts = 0;
+    if (n > 0) {
+        buf[n] = '\0';
+        char *end;
+        starts = strtoul(buf, &end, 10);
+        if (end == buf || (*end && *end != '\n')) {
+            fprintf(stderr, "%s: not a start count\n", path);
+            close(fd);
+            return -1;
+        }
+    } else if (n < 0) {
+        perror(path);
+        close(fd);
+        return -1;
+    }
+
+    starts++;
+    if (starts >= 1UL << (32 - CRYPTO_SESSION_RANDOM_BITS)) {
+        fprintf(stderr, "%s: session epochs used up (%lu starts)\n", path, starts - 1);
+        close(fd);
+        return -1;
+    }
+
+    // On disk before a packet goes out under it; the count only grows in
+    // digits, so writing over the old one is enough
+    int len = snprintf(buf, sizeof(buf), "%lu\n", starts);
+    if (pwrite(fd, buf, len, 0) != len || fsync(fd) < 0) {
+        perror(path);
+        close(fd);
+        return -1;
+    }
+    close(fd);
+
+    // Two starts off a copied file still differ. Blocks only until the
+    // kernel's pool is seeded, early in boot
+    uint32_t low;
+    if (getrandom(&low, sizeof(low), 0) != sizeof(low)) {
+        perror("getrandom");
+        return -1;
+    }
+    *session = (uint32_t)starts << CRYPTO_SESSION_RANDOM_BITS |
+               (low & ((1u << CRYPTO_SESSION_RANDOM_BITS) - 1));
+    return 0;
+}
+
+void crypto_make_nonce(uint8_t nonce[CRYPTO_NONCE_BYTES], uint32_t board_id,
+                       uint8_t talkgroup, uint32_t session, uint32_t seq_num) {
+    store32_le(nonce, board_id);
+    store32_le(nonce + 4, session ^ ((uint32_t)talkgroup << 24));
+    store32_le(nonce + 8, seq_num);
+}
+
+// ---------------------------------------------------------------------------
+// Replay protection
+// ---------------------------------------------------------------------------
+
+static const replay_entry_t *replay_find(const crypto_ctx_t *ctx, uint32_t board_id) {
+    for (int i = 0; i < REPLAY_MAX_SENDERS; i++) {
+        if (ctx->senders[i].valid && ctx->senders[i].board_id == board_id) {
+            return &ctx->senders[i];
+        }
+    }
+    return NULL;
+}
+
+static const replay_floor_t *replay_find_forgotten(const crypto_ctx_t *ctx, uint32_t board_id) {
+    for (int i = 0; i < REPLAY_FORGOTTEN; i++) {
+        if (ctx->forgotten[i].valid && ctx->forgotten[i].board_id == board_id) {
+            return &ctx->forgotten[i];
+        }
+    }
+    return NULL;
+}
+
+bool crypto_replay_check(const crypto_ctx_t *ctx, uint32_t board_id,
+                         uint32_t session, uint32_t seq_num) {
+    const replay_entry_t *e = replay_find(ctx, board_id);
+
+    // First packet from this sender, or the first since it was evicted:
+    // its window is gone, so only what is past the last seq_num counts
+    if (!e) {
+        const replay_floor_t *f = replay_find_forgotten(ctx, board_id);
+        if (!f) return true;
+        return session > f->session || (session == f->session && seq_num > f->max_seq);
+    }
+
+    // A restarted sender comes back with a higher session; a lower one is
+    // an old packet played back
+    if (session != e->session) return session > e->session;
+
+    if (seq_num > e->max_seq) return true;
+
+    uint32_t age = e->max_seq - seq_num;
+    if (age >= REPLAY_WINDOW) return false;
+
+    return !(e->window & (1ULL << age));
+}
+
+void crypto_replay_accept(crypto_ctx_t *ctx, uint32_t board_id,
+                          uint32_t session, uint32_t seq_num) {
+    replay_entry_t *e = (replay_entry_t *)replay_find(ctx, board_id);
+
+    if (!e) {
+        // Take a free slot, or evict the sender heard from least recently
+        e = &ctx->senders[0];
+        for (int i = 0; i < REPLAY_MAX_SENDERS; i++) {
+            if (!ctx->senders[i].valid) {
+                e = &ctx->senders[i];
+                break;
+            }
+            if (ctx->senders[i].last_used < e->last_used) {
+                e = &ctx->senders[i];
+            }
+        }
+
+        // The evicted sender keeps a floor, in its old place or the oldest
+        if (e->valid) {
+            replay_floor_t *f = (replay_floor_t *)replay_find_forgotten(ctx, e->board_id);
+            if (!f) {
+                f = &ctx->forgotten[ctx->next_forgotten];
+                ctx->next_forgotten = (ctx->next_forgotten + 1) % REPLAY_FORGOTTEN;
+            }
+            f->valid = true;
+            f->board_id = e->board_id;
+            f->session = e->session;
+            f->max_seq = e->max_seq;
+        }
+
+        e->valid = true;
+        e->board_id = board_id;
+        e->session = session;
+        e->max_seq = seq_num;
+        e->window = 1;
+    } else if (session != e->session) {
+        e->session = session;
+        e->max_seq = seq_num;
+        e->window = 1;
+    } else if (seq_num > e->max_seq) {
+        uint32_t shift = seq_num - e->max_seq;
+        e->window = shift >= REPLAY_WINDOW ? 1 : (e->window << shift) | 1;
+        e->max_seq = seq_num;
+    } else {
+        e->window |= 1ULL << (e->max_seq - seq_num);
+    }
+
+    e->last_used = ++ctx->use_counter;
+}
+
+// ---------------------------------------------------------------------------
+// Keyring
+// ---------------------------------------------------------------------------
+
+void crypto_init(crypto_ctx_t *ctx) {
+    memset(ctx, 0, sizeof(crypto_ctx_t));
+}
+
+int crypto_set_key(crypto_ctx_t *ctx, uint8_t talkgroup, const uint8_t key[CRYPTO_KEY_BYTES]) {
+    if (talkgroup >= CRYPTO_MAX_TALKGROUPS) return -1;
+
+    memcpy(ctx->keys[talkgroup].key, key, CRYPTO_KEY_BYTES);
+    ctx->keys[talkgroup].present = true;
+    ctx->enabled = true;
+    return 0;
+}
+
+static int hex_value(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    c = (char)tolower((unsigned char)c);
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    return -1;
+}
+
+// Load "<talkgroup> <64 hex chars>" lines, '#' starts a comment
+int crypto_load_keyring(crypto_ctx_t *ctx, const char *path) {
+    FILE *f = fopen(path, "r");
+    if (!f) return -1;
+
+    char line[256];
+    int line_no = 0;
+    int loaded = 0;
+
+    while (fgets(line, sizeof(line), f)) {
+        line_no++;
+
+        char *p = line;
+        while (isspace((unsigned char)*p)) p++;
+        if (*p == '\0' || *p == '#') continue;
+
+        char *end;
+        long talkgroup = strtol(p, &end, 10);
+        if (end == p || talkgroup < 0 || talkgroup >= CRYPTO_MAX_TALKGROUPS) {
+            fprintf(stderr, "%s:%d: bad talkgroup\n", path, line_no);
+            continue;
+        }
+
+        p = end;
+        while (isspace((unsigned char)*p)) p++;
+
+        uint8_t key[CRYPTO_KEY_BYTES];
+        int i;
+        for (i = 0; i < CRYPTO_KEY_BYTES; i++) {
+            int hi = hex_value(p[2 * i]);
+            int lo = hi < 0 ? -1 : hex_value(p[2 * i + 1]);
+            if (hi < 0 || lo < 0) break;
+            key[i] = (uint8_t)((hi << 4) | lo);
+        }
+        if (i != CRYPTO_KEY_BYTES) {
+            fprintf(stderr, "%s:%d: key must be %d hex characters\n",
+                    path, line_no, CRYPTO_KEY_BYTES * 2);
+            continue;
+        }
+
+        crypto_set_key(ctx, (uint8_t)talkgroup, key);
+        memset(key, 0, sizeof(key));
+        loaded++;
+    }
+
+    fclose(f);
+    memset(line, 0, sizeof(line));
+    return loaded > 0 ? loaded : -1;
+}
+
+// Keyring location (env or default)
+const char *crypto_keyring_path(void) {
+    const char *env = getenv("WT_KEYRING");
+    return env ? env : CRYPTO_KEYRING_PATH;
+}
+
+// Wipe keys
+void crypto_cleanup(crypto_ctx_t *ctx) {
+    volatile uint8_t *p = (volatile uint8_t *)ctx;
+    for (size_t i = 0; i < sizeof(crypto_ctx_t); i++) {
+        p[i] = 0;
+    }
+}
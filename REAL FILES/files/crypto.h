@@ -0,0 +1,114 @@
+#ifndef CRYPTO_H
+#define CRYPTO_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+// ChaCha20-Poly1305 (RFC 8439) packet protection
+#define CRYPTO_KEY_BYTES        32
+#define CRYPTO_NONCE_BYTES      12
+#define CRYPTO_TAG_BYTES        16
+
+// Every sealed packet carries a 4-byte session epoch followed by the tag
+#define CRYPTO_OVERHEAD         (4 + CRYPTO_TAG_BYTES)
+
+// Talkgroup IDs index the keyring directly
+#define CRYPTO_MAX_TALKGROUPS   16
+
+// Replay protection: sliding window of seq_nums per sender
+#define REPLAY_MAX_SENDERS      32
+#define REPLAY_WINDOW           64
+
+// Senders pushed out of the table, whose session and highest seq_num are
+// kept so their old packets stay replays when they come back
+#define REPLAY_FORGOTTEN        256
+
+// Default keyring file, one "<talkgroup> <64 hex chars>" entry per line
+#define CRYPTO_KEYRING_PATH     "/etc/walkietalkie.keys"
+
+// Session epoch: the sender's start count (kept in CRYPTO_SESSION_PATH,
+// or WT_SESSION_FILE) in the high bits, random low bits
+#define CRYPTO_SESSION_PATH     "/var/lib/walkietalkie/session"
+#define CRYPTO_SESSION_RANDOM_BITS 12
+
+typedef struct {
+    uint8_t key[CRYPTO_KEY_BYTES];
+    bool present;
+} crypto_key_t;
+
+// Replay state for one sender: highest seq_num seen and a bitmap of
+// the REPLAY_WINDOW seq_nums below it. Sessions only go up, so a higher
+// one is a restart and a lower one a replay
+typedef struct {
+    uint32_t board_id;
+    uint32_t session;
+    uint32_t max_seq;
+    uint64_t window;
+    uint64_t last_used;
+    bool valid;
+} replay_entry_t;
+
+// What is left of an evicted sender: nothing at or below this is taken
+typedef struct {
+    uint32_t board_id;
+    uint32_t session;
+    uint32_t max_seq;
+    bool valid;
+} replay_floor_t;
+
+typedef struct {
+    crypto_key_t keys[CRYPTO_MAX_TALKGROUPS];
+    replay_entry_t senders[REPLAY_MAX_SENDERS];
+    replay_floor_t forgotten[REPLAY_FORGOTTEN];
+    int next_forgotten;
+    uint64_t use_counter;
+
+    // Stats
+    uint64_t auth_failures;
+    uint64_t replays_rejected;
+
+    bool enabled;
+} crypto_ctx_t;
+
+// Keyring management
+void crypto_init(crypto_ctx_t *ctx);
+int crypto_set_key(crypto_ctx_t *ctx, uint8_t talkgroup, const uint8_t key[CRYPTO_KEY_BYTES]);
+int crypto_load_keyring(crypto_ctx_t *ctx, const char *path);
+const char *crypto_keyring_path(void);
+void crypto_cleanup(crypto_ctx_t *ctx);
+
+// Encrypt data in place and compute the tag over aad + ciphertext
+int crypto_seal(const crypto_ctx_t *ctx, uint8_t talkgroup,
+                const uint8_t nonce[CRYPTO_NONCE_BYTES],
+                const uint8_t *aad, size_t aad_len,
+                uint8_t *data, size_t len,
+                uint8_t tag[CRYPTO_TAG_BYTES]);
+
+// Verify the tag and decrypt data in place (returns -1 on auth failure)
+int crypto_open(crypto_ctx_t *ctx, uint8_t talkgroup,
+                const uint8_t nonce[CRYPTO_NONCE_BYTES],
+                const uint8_t *aad, size_t aad_len,
+                uint8_t *data, size_t len,
+                const uint8_t tag[CRYPTO_TAG_BYTES]);
+
+// Session epoch for a sender starting up: bumps the start count in path
+// (NULL: crypto_session_path()) and adds random low bits. -1 if the count
+// cannot be read or written back, since an epoch that goes backwards
+// makes every receiver take the sender for a replay.
+int crypto_new_session(const char *path, uint32_t *session);
+const char *crypto_session_path(void);
+
+// Build the per-packet nonce: board_id | session ^ talkgroup | seq_num.
+// Each talkgroup numbers its packets from 0, so the talkgroup keeps two
+// of them apart even when the keyring gives them the same key
+void crypto_make_nonce(uint8_t nonce[CRYPTO_NONCE_BYTES], uint32_t board_id,
+                       uint8_t talkgroup, uint32_t session, uint32_t seq_num);
+
+// Replay window (only call accept after the packet authenticated)
+bool crypto_replay_check(const crypto_ctx_t *ctx, uint32_t board_id,
+                         uint32_t session, uint32_t seq_num);
+void crypto_replay_accept(crypto_ctx_t *ctx, uint32_t board_id,
+                          uint32_t session, uint32_t seq_num);
+
+#endif // CRYPTO_H
@@ -0,0 +1,211 @@
+#include "dma_sim.h"
+#include "opus_helper.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+static uint64_t now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+int dma_sim_init(dma_sim_t *sim, double speed) {
+    memset(sim, 0, sizeof(dma_sim_t));
+
+    sim->buffers = aligned_alloc(64, DMA_TX_OFFSET + DMA_TX_BYTES);
+    if (!sim->buffers) {
+        perror("DMA simulator buffers");
+        return -1;
+    }
+    memset(sim->buffers, 0, DMA_TX_OFFSET + DMA_TX_BYTES);
+
+    sim->speed = speed > 0 ? speed : 1.0;
+    for (int c = 0; c < DMA_CHANNELS; c++) {
+        sim->ch[c].status = STAT_HALTED;
+    }
+    pthread_mutex_init(&sim->lock, NULL);
+    sim->initialized = true;
+    return 0;
+}
+
+// Register offset -> channel and register (offset within the channel)
+static dma_sim_channel_t *decode(dma_sim_t *sim, uint32_t offset, uint32_t *reg) {
+    dma_channel_t c = offset >= S2MM_CTRL ? DMA_CH_S2MM : DMA_CH_MM2S;
+    *reg = offset - (c == DMA_CH_S2MM ? S2MM_CTRL : MM2S_CTRL);
+    return &sim->ch[c];
+}
+
+// Bring the state up to now: finish transfers, apply faults, end a reset
+static void update(dma_sim_t *sim, uint64_t now) {
+    if (sim->reset_done_us) {
+        if (now < sim->reset_done_us) return;
+        for (int c = 0; c < DMA_CHANNELS; c++) {
+            sim->ch[c].ctrl = 0;
+            sim->ch[c].status = STAT_HALTED;
+        }
+        sim->reset_done_us = 0;
+    }
+
+    for (int c = 0; c < DMA_CHANNELS; c++) {
+        dma_sim_channel_t *ch = &sim->ch[c];
+        if (!ch->busy) continue;
+
+        switch (ch->fault) {
+        case DMA_FAULT_STALL:
+            break;
+        case DMA_FAULT_INTERNAL:
+        case DMA_FAULT_SLAVE:
+        case DMA_FAULT_DECODE:
+            // Fails halfway through and halts
+            if (now >= ch->start_us + (ch->done_us - ch->start_us) / 2) {
+                static const uint32_t bit[DMA_FAULTS] = {
+                    [DMA_FAULT_INTERNAL] = DMA_ERR_INTERNAL,
+                    [DMA_FAULT_SLAVE] = DMA_ERR_SLAVE,
+                    [DMA_FAULT_DECODE] = DMA_ERR_DECODE,
+                };
+                ch->status = (ch->status & ~STAT_IDLE) | bit[ch->fault] | STAT_HALTED;
+                ch->ctrl &= ~CTRL_RUN;
+                ch->busy = false;
+            }
+            break;
+        default:
+            if (now >= ch->done_us) {
+                ch->status |= STAT_IDLE | STAT_IOC;
+                ch->busy = false;
+                ch->completed++;
+            }
+            break;
+        }
+    }
+}
+
+static uint32_t sim_read(void *arg, uint32_t offset) {
+    dma_sim_t *sim = arg;
+    uint32_t reg, value;
+
+    pthread_mutex_lock(&sim->lock);
+    update(sim, now_us());
+    dma_sim_channel_t *ch = decode(sim, offset, &reg);
+    switch (reg) {
+    case MM2S_CTRL:   value = ch->ctrl | (sim->reset_done_us ? CTRL_RESET : 0); break;
+    case MM2S_STATUS: value = ch->status; break;
+    case MM2S_SA:     value = ch->addr; break;
+    case MM2S_LENGTH: value = ch->length; break;
+    default:          value = 0; break;
+    }
+    pthread_mutex_unlock(&sim->lock);
+    return value;
+}
+
+static void sim_write(void *arg, uint32_t offset, uint32_t value) {
+    dma_sim_t *sim = arg;
+    uint32_t reg;
+    uint64_t now = now_us();
+
+    pthread_mutex_lock(&sim->lock);
+    update(sim, now);
+    dma_sim_channel_t *ch = decode(sim, offset, &reg);
+
+    switch (reg) {
+    case MM2S_CTRL:
+        if (value & CTRL_RESET) {
+            // Both channels stop at once, read as zero, and come back halted
+            for (int c = 0; c < DMA_CHANNELS; c++) {
+                sim->ch[c].busy = false;
+                sim->ch[c].fault = DMA_FAULT_NONE;
+                sim->ch[c].status = 0;
+            }
+            sim->resets++;
+            sim->reset_done_us = sim->reset_hang ? UINT64_MAX : now + DMA_SIM_RESET_US;
+            sim->reset_hang = false;
+        } else if (!sim->reset_done_us) {
+            ch->ctrl = value;
+            if ((value & CTRL_RUN) && !(ch->status & DMA_ERR_MASK)) {
+                ch->status &= ~STAT_HALTED;
+            } else if (!(value & CTRL_RUN) && !ch->busy) {
+                ch->status |= STAT_HALTED;
+            }
+        }
+        break;
+    case MM2S_STATUS:
+        ch->status &= ~(value & STAT_IOC);          // Write 1 to clear
+        break;
+    case MM2S_SA:
+        ch->addr = value;
+        break;
+    case MM2S_LENGTH:
+        // Ignored unless running; a zero length is an internal error
+        if (sim->reset_done_us || !(ch->ctrl & CTRL_RUN) || (ch->status & STAT_HALTED)) break;
+        ch->length = value;
+        ch->transfers++;
+        if (value == 0) {
+            ch->status = (ch->status & ~STAT_IDLE) | DMA_ERR_INTERNAL | STAT_HALTED;
+            break;
+        }
+        ch->busy = true;
+        ch->status &= ~STAT_IDLE;
+        ch->start_us = now;
+        ch->done_us = now + (uint64_t)((double)value / BYTES_PER_SAMPLE * 1e6 / SAMPLE_RATE /
+                                       sim->speed);
+        ch->fault = ch->pending;
+        ch->pending = DMA_FAULT_NONE;
+        if (ch->fault) ch->faults[ch->fault]++;
+        break;
+    default:
+        break;
+    }
+    pthread_mutex_unlock(&sim->lock);
+}
+
+static const dma_regs_ops_t sim_ops = { sim_read, sim_write };
+
+int dma_sim_attach(dma_sim_t *sim, dma_ctx_t *ctx) {
+    if (!sim->initialized) {
+        fprintf(stderr, "DMA simulator not initialised\n");
+        return -1;
+    }
+    memset(ctx, 0, sizeof(dma_ctx_t));
+    ctx->mem_fd = -1;
+    ctx->buf_fd = -1;
+    ctx->regs_ops = &sim_ops;
+    ctx->regs_arg = sim;
+
+    ctx->buf_mode = DMA_BUF_SIM;
+    ctx->rx_buffer = sim->buffers;
+    ctx->tx_buffer = (uint8_t *)sim->buffers + DMA_TX_OFFSET;
+    ctx->regs_phys_addr = DMA_BASE_ADDR;
+    ctx->rx_phys_addr = DMA_MEM_BASE;
+    ctx->tx_phys_addr = DMA_MEM_BASE + DMA_TX_OFFSET;
+
+    pthread_mutex_init(&ctx->regs_lock, NULL);
+    ctx->initialized = true;
+    return 0;
+}
+
+void dma_sim_inject(dma_sim_t *sim, dma_channel_t ch, dma_fault_t fault) {
+    pthread_mutex_lock(&sim->lock);
+    if (fault == DMA_FAULT_RESET_HANG) {
+        sim->reset_hang = true;
+        sim->ch[ch].faults[fault]++;
+    } else {
+        sim->ch[ch].pending = fault;
+    }
+    pthread_mutex_unlock(&sim->lock);
+}
+
+const char *dma_fault_name(dma_fault_t fault) {
+    static const char *names[DMA_FAULTS] = {
+        "none", "DMAIntErr", "DMASlvErr", "DMADecErr", "stall", "reset hang"
+    };
+    return fault < DMA_FAULTS ? names[fault] : "?";
+}
+
+void dma_sim_cleanup(dma_sim_t *sim) {
+    if (!sim->initialized) return;
+
+    pthread_mutex_destroy(&sim->lock);
+    free(sim->buffers);
+    sim->initialized = false;
+}
@@ -0,0 +1,76 @@
+#ifndef DMA_SIM_H
+#define DMA_SIM_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <pthread.h>
+
+#include "audio_dma.h"
+
+// Simulated AXI DMA register file, for exercising the channel health code
+// without the board. dma_sim_attach gives a dma_ctx_t whose register reads
+// and writes land here instead of the mapping, and whose buffers are on
+// the heap; everything else in audio_dma.c runs unchanged.
+//
+// Behaviour follows PG021 in direct register mode: writing LENGTH to a
+// running channel starts a transfer that takes as long as the audio it
+// carries (bytes / BYTES_PER_SAMPLE / SAMPLE_RATE, divided by speed), then
+// sets Idle and IOC. A reset through either CTRL register stops both
+// channels and leaves them halted after reset_us.
+//
+// Faults are injected per channel and hit its next transfer: an error
+// sets the status bit and halts the channel halfway through, a stall
+// never completes, a hung reset never finishes (once).
+
+typedef enum {
+    DMA_FAULT_NONE = 0,
+    DMA_FAULT_INTERNAL,                     // DMAIntErr
+    DMA_FAULT_SLAVE,                        // DMASlvErr
+    DMA_FAULT_DECODE,                       // DMADecErr
+    DMA_FAULT_STALL,                        // Busy forever, no error bit
+    DMA_FAULT_RESET_HANG,                   // The next reset does not finish
+    DMA_FAULTS
+} dma_fault_t;
+
+#define DMA_SIM_RESET_US    20              // Soft reset time
+
+typedef struct {
+    uint32_t ctrl;
+    uint32_t status;
+    uint32_t addr;
+    uint32_t length;
+    bool busy;
+    uint64_t start_us;
+    uint64_t done_us;
+    dma_fault_t fault;                      // Of the transfer running
+    dma_fault_t pending;                    // Injected, hits the next transfer
+    uint64_t transfers;
+    uint64_t completed;
+    uint64_t faults[DMA_FAULTS];            // Applied
+} dma_sim_channel_t;
+
+typedef struct {
+    pthread_mutex_t lock;                   // The TX and playout threads share it
+    dma_sim_channel_t ch[DMA_CHANNELS];
+    double speed;                           // 1.0: real time
+    uint64_t reset_done_us;                 // Reset in progress until then, 0 if none
+    bool reset_hang;                        // Injected: next reset never finishes
+    uint64_t resets;
+    void *buffers;                          // RX at 0, TX at DMA_TX_OFFSET
+    bool initialized;
+} dma_sim_t;
+
+int dma_sim_init(dma_sim_t *sim, double speed);
+
+// Set up ctx like dma_init_buf does, on the simulated engine (halted,
+// as after dma_reset). dma_cleanup releases ctx; the buffers stay with sim.
+int dma_sim_attach(dma_sim_t *sim, dma_ctx_t *ctx);
+
+// Arm a fault for the channel's next transfer (DMA_FAULT_RESET_HANG: the
+// next reset of the engine, whichever channel asks)
+void dma_sim_inject(dma_sim_t *sim, dma_channel_t ch, dma_fault_t fault);
+
+const char *dma_fault_name(dma_fault_t fault);
+void dma_sim_cleanup(dma_sim_t *sim);
+
+#endif // DMA_SIM_H
@@ -0,0 +1,206 @@
+#ifndef DSP_SIMD_H
+#define DSP_SIMD_H
+
+#include <stdint.h>
+#include <math.h>
+
+// Small vector kernels shared by the capture and playback DSP stages.
+// NEON on the A53 (aarch64), plain loops elsewhere; every kernel handles
+// any length, with a scalar tail after the 4-wide body.
+
+#if defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#define DSP_NEON 1
+#endif
+
+// int16 -> float in [-1, 1)
+static inline void dsp_i16_to_f32(const int16_t *in, float *out, int n) {
+    const float scale = 1.0f / 32768.0f;
+    int i = 0;
+#ifdef DSP_NEON
+    float32x4_t vs = vdupq_n_f32(scale);
+    for (; i + 8 <= n; i += 8) {
+        int16x8_t v = vld1q_s16(in + i);
+        vst1q_f32(out + i, vmulq_f32(vcvtq_f32_s32(vmovl_s16(vget_low_s16(v))), vs));
+        vst1q_f32(out + i + 4, vmulq_f32(vcvtq_f32_s32(vmovl_s16(vget_high_s16(v))), vs));
+    }
+#endif
+    for (; i < n; i++) {
+        out[i] = in[i] * scale;
+    }
+}
+
+// float -> int16, rounded and saturated
+static inline void dsp_f32_to_i16(const float *in, int16_t *out, int n) {
+    int i = 0;
+#ifdef DSP_NEON
+    float32x4_t vs = vdupq_n_f32(32768.0f);
+    for (; i + 8 <= n; i += 8) {
+        int32x4_t lo = vcvtnq_s32_f32(vmulq_f32(vld1q_f32(in + i), vs));
+        int32x4_t hi = vcvtnq_s32_f32(vmulq_f32(vld1q_f32(in + i + 4), vs));
+        vst1q_s16(out + i, vcombine_s16(vqmovn_s32(lo), vqmovn_s32(hi)));
+    }
+#endif
+    for (; i < n; i++) {
+        float s = in[i] * 32768.0f;
+        if (s > 32767.0f) s = 32767.0f;
+        if (s < -32768.0f) s = -32768.0f;
+        out[i] = (int16_t)lrintf(s);
+    }
+}
+
+// out[i] = a[i] * b[i]
+static inline void dsp_mul(float *out, const float *a, const float *b, int n) {
+    int i = 0;
+#ifdef DSP_NEON
+    for (; i + 4 <= n; i += 4) {
+        vst1q_f32(out + i, vmulq_f32(vld1q_f32(a + i), vld1q_f32(b + i)));
+    }
+#endif
+    for (; i < n; i++) {
+        out[i] = a[i] * b[i];
+    }
+}
+
+// x[i] *= g0 + i * dg (linear gain ramp, avoids zipper noise)
+static inline void dsp_gain_ramp(float *x, float g0, float dg, int n) {
+    int i = 0;
+#ifdef DSP_NEON
+    float32x4_t g = {g0, g0 + dg, g0 + 2.0f * dg, g0 + 3.0f * dg};
+    float32x4_t step = vdupq_n_f32(4.0f * dg);
+    for (; i + 4 <= n; i += 4) {
+        vst1q_f32(x + i, vmulq_f32(vld1q_f32(x + i), g));
+        g = vaddq_f32(g, step);
+    }
+#endif
+    for (; i < n; i++) {
+        x[i] *= g0 + i * dg;
+    }
+}
+
+// x[i] += y[i] (mixing)
+static inline void dsp_add(float *x, const float *y, int n) {
+    int i = 0;
+#ifdef DSP_NEON
+    for (; i + 4 <= n; i += 4) {
+        vst1q_f32(x + i, vaddq_f32(vld1q_f32(x + i), vld1q_f32(y + i)));
+    }
+#endif
+    for (; i < n; i++) {
+        x[i] += y[i];
+    }
+}
+
+// out[k] = re[k]^2 + im[k]^2
+static inline void dsp_power(float *out, const float *re, const float *im, int n) {
+    int i = 0;
+#ifdef DSP_NEON
+    for (; i + 4 <= n; i += 4) {
+        float32x4_t r = vld1q_f32(re + i);
+        float32x4_t m = vld1q_f32(im + i);
+        vst1q_f32(out + i, vmlaq_f32(vmulq_f32(r, r), m, m));
+    }
+#endif
+    for (; i < n; i++) {
+        out[i] = re[i] * re[i] + im[i] * im[i];
+    }
+}
+
+// Largest |x[i]|
+static inline float dsp_peak(const float *x, int n) {
+    float peak = 0.0f;
+    int i = 0;
+#ifdef DSP_NEON
+    float32x4_t vp = vdupq_n_f32(0.0f);
+    for (; i + 4 <= n; i += 4) {
+        vp = vmaxq_f32(vp, vabsq_f32(vld1q_f32(x + i)));
+    }
+    peak = vmaxvq_f32(vp);
+#endif
+    for (; i < n; i++) {
+        float a = fabsf(x[i]);
+        if (a > peak) peak = a;
+    }
+    return peak;
+}
+
+// Split n frames of `channels` interleaved 32-bit samples (TDM slots, as
+// the DMA writes them) into one float buffer per channel, in [-1, 1)
+static inline void dsp_deinterleave_i32(const int32_t *in, int channels, float *const *out, int n) {
+    const float scale = 1.0f / 2147483648.0f;
+    int i = 0;
+#ifdef DSP_NEON
+    if (channels == 2) {
+        for (; i + 4 <= n; i += 4) {
+            int32x4x2_t v = vld2q_s32(in + 2 * i);
+            vst1q_f32(out[0] + i, vcvtq_n_f32_s32(v.val[0], 31));
+            vst1q_f32(out[1] + i, vcvtq_n_f32_s32(v.val[1], 31));
+        }
+    } else if (channels == 4) {
+        for (; i + 4 <= n; i += 4) {
+            int32x4x4_t v = vld4q_s32(in + 4 * i);
+            for (int c = 0; c < 4; c++) {
+                vst1q_f32(out[c] + i, vcvtq_n_f32_s32(v.val[c], 31));
+            }
+        }
+    } else if (channels == 8) {
+        // Each 4-way load holds channels c and c + 4 of two frames,
+        // unzipping two of them gives each its four frames
+        for (; i + 4 <= n; i += 4) {
+            int32x4x4_t a = vld4q_s32(in + 8 * i);
+            int32x4x4_t b = vld4q_s32(in + 8 * i + 16);
+            for (int c = 0; c < 4; c++) {
+                vst1q_f32(out[c] + i, vcvtq_n_f32_s32(vuzp1q_s32(a.val[c], b.val[c]), 31));
+                vst1q_f32(out[c + 4] + i, vcvtq_n_f32_s32(vuzp2q_s32(a.val[c], b.val[c]), 31));
+            }
+        }
+    }
+#endif
+    for (; i < n; i++) {
+        for (int c = 0; c < channels; c++) {
+            out[c][i] = in[channels * i + c] * scale;
+        }
+    }
+}
+
+// out[i] += sum over k of h[k] * x[i - k], for i in [0, n); x must have
+// taps - 1 samples of history in front of it
+static inline void dsp_fir_add(float *out, const float *x, const float *h, int taps, int n) {
+    int i = 0;
+#ifdef DSP_NEON
+    for (; i + 4 <= n; i += 4) {
+        float32x4_t acc = vld1q_f32(out + i);
+        for (int k = 0; k < taps; k++) {
+            acc = vfmaq_n_f32(acc, vld1q_f32(x + i - k), h[k]);
+        }
+        vst1q_f32(out + i, acc);
+    }
+#endif
+    for (; i < n; i++) {
+        float acc = out[i];
+        for (int k = 0; k < taps; k++) {
+            acc += h[k] * x[i - k];
+        }
+        out[i] = acc;
+    }
+}
+
+// Sum of x[i]^2
+static inline float dsp_energy(const float *x, int n) {
+    float sum = 0.0f;
+    int i = 0;
+#ifdef DSP_NEON
+    float32x4_t acc = vdupq_n_f32(0.0f);
+    for (; i + 4 <= n; i += 4) {
+        float32x4_t v = vld1q_f32(x + i);
+        acc = vmlaq_f32(acc, v, v);
+    }
+    sum = vaddvq_f32(acc);
+#endif
+    for (; i < n; i++) {
+        sum += x[i] * x[i];
+    }
+    return sum;
+}
+
+#endif // DSP_SIMD_H
@@ -0,0 +1,143 @@
+#include "fft.h"
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdbool.h>
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+int fft_init(fft_ctx_t *ctx, int n) {
+    memset(ctx, 0, sizeof(fft_ctx_t));
+
+    if (n < 4 || n > FFT_MAX_SIZE || (n & (n - 1)) != 0) {
+        fprintf(stderr, "fft: size %d is not a power of 2 in [4, %d]\n", n, FFT_MAX_SIZE);
+        return -1;
+    }
+
+    ctx->n = n;
+    ctx->half = n / 2;
+    int m = ctx->half;
+
+    int bits = 0;
+    while ((1 << bits) < m) bits++;
+    for (int i = 0; i < m; i++) {
+        int r = 0;
+        for (int b = 0; b < bits; b++) {
+            if (i & (1 << b)) r |= 1 << (bits - 1 - b);
+        }
+        ctx->bitrev[i] = r;
+    }
+
+    for (int i = 0; i < m / 2; i++) {
+        ctx->tw_re[i] = (float)cos(-2.0 * M_PI * i / m);
+        ctx->tw_im[i] = (float)sin(-2.0 * M_PI * i / m);
+    }
+    for (int k = 0; k < m; k++) {
+        ctx->split_re[k] = (float)cos(-2.0 * M_PI * k / n);
+        ctx->split_im[k] = (float)sin(-2.0 * M_PI * k / n);
+    }
+
+    return 0;
+}
+
+// In-place radix-2 complex FFT of ctx->work (interleaved re/im, n/2 points).
+// The inverse conjugates the twiddles and is left unscaled.
+static void fft_complex(fft_ctx_t *ctx, bool inverse) {
+    float *z = ctx->work;
+    int m = ctx->half;
+
+    for (int i = 0; i < m; i++) {
+        int r = ctx->bitrev[i];
+        if (r > i) {
+            float tr = z[2 * i], ti = z[2 * i + 1];
+            z[2 * i] = z[2 * r];
+            z[2 * i + 1] = z[2 * r + 1];
+            z[2 * r] = tr;
+            z[2 * r + 1] = ti;
+        }
+    }
+
+    float sign = inverse ? -1.0f : 1.0f;
+    for (int len = 2; len <= m; len <<= 1) {
+        int half = len >> 1;
+        int step = m / len;
+        for (int start = 0; start < m; start += len) {
+            for (int j = 0; j < half; j++) {
+                float wr = ctx->tw_re[j * step];
+                float wi = sign * ctx->tw_im[j * step];
+                float *a = &z[2 * (start + j)];
+                float *b = &z[2 * (start + j + half)];
+                float br = b[0] * wr - b[1] * wi;
+                float bi = b[0] * wi + b[1] * wr;
+                b[0] = a[0] - br;
+                b[1] = a[1] - bi;
+                a[0] += br;
+                a[1] += bi;
+            }
+        }
+    }
+}
+
+// Real transform via a half-size complex FFT of z[k] = x[2k] + i x[2k+1]:
+// X[k] = E[k] + W^k O[k], with E/O recovered from Z[k] and conj(Z[m-k])
+void fft_forward(fft_ctx_t *ctx, const float *in, float *re, float *im) {
+    int m = ctx->half;
+    float *z = ctx->work;
+
+    memcpy(z, in, ctx->n * sizeof(float));
+    fft_complex(ctx, false);
+
+    // DC and Nyquist only need the real parts
+    re[0] = z[0] + z[1];
+    im[0] = 0.0f;
+    re[m] = z[0] - z[1];
+    im[m] = 0.0f;
+
+    for (int k = 1; k < m; k++) {
+        float zr = z[2 * k], zi = z[2 * k + 1];
+        float cr = z[2 * (m - k)], ci = -z[2 * (m - k) + 1];
+
+        float er = 0.5f * (zr + cr);
+        float ei = 0.5f * (zi + ci);
+        // O = (Z - conj(Z[m-k])) / 2i
+        float or_ = 0.5f * (zi - ci);
+        float oi = -0.5f * (zr - cr);
+
+        float wr = ctx->split_re[k], wi = ctx->split_im[k];
+        re[k] = er + or_ * wr - oi * wi;
+        im[k] = ei + or_ * wi + oi * wr;
+    }
+}
+
+void fft_inverse(fft_ctx_t *ctx, const float *re, const float *im, float *out) {
+    int m = ctx->half;
+    float *z = ctx->work;
+
+    for (int k = 0; k < m; k++) {
+        float xr = re[k], xi = im[k];
+        float cr = re[m - k], ci = -im[m - k];
+
+        float er = 0.5f * (xr + cr);
+        float ei = 0.5f * (xi + ci);
+
+        // O = (X - conj(X[m-k])) * W^-k / 2
+        float dr = 0.5f * (xr - cr);
+        float di = 0.5f * (xi - ci);
+        float wr = ctx->split_re[k], wi = -ctx->split_im[k];
+        float or_ = dr * wr - di * wi;
+        float oi = dr * wi + di * wr;
+
+        // Z = E + i O
+        z[2 * k] = er - oi;
+        z[2 * k + 1] = ei + or_;
+    }
+
+    fft_complex(ctx, true);
+
+    float scale = 1.0f / m;
+    for (int i = 0; i < ctx->n; i++) {
+        out[i] = z[i] * scale;
+    }
+}
@@ -0,0 +1,29 @@
+#ifndef FFT_H
+#define FFT_H
+
+// Real FFT for the audio DSP stages (power-of-2 sizes only).
+// Spectra are kept as separate re/im arrays of n/2+1 bins so the
+// per-bin loops in the DSP code vectorise cleanly.
+
+#define FFT_MAX_SIZE    1024
+
+typedef struct {
+    int n;                              // Real transform length
+    int half;                           // Complex FFT length (n / 2)
+    int bitrev[FFT_MAX_SIZE / 2];
+    float tw_re[FFT_MAX_SIZE / 4];      // Twiddles for the half-size complex FFT
+    float tw_im[FFT_MAX_SIZE / 4];
+    float split_re[FFT_MAX_SIZE / 2];   // Twiddles for the real/complex split
+    float split_im[FFT_MAX_SIZE / 2];
+    float work[FFT_MAX_SIZE];           // Interleaved complex scratch
+} fft_ctx_t;
+
+int fft_init(fft_ctx_t *ctx, int n);
+
+// in[n] -> re[n/2+1], im[n/2+1]
+void fft_forward(fft_ctx_t *ctx, const float *in, float *re, float *im);
+
+// re[n/2+1], im[n/2+1] -> out[n], scaled so inverse(forward(x)) == x
+void fft_inverse(fft_ctx_t *ctx, const float *re, const float *im, float *out);
+
+#endif // FFT_H
@@ -1,13 +1,29 @@
 #include "gpio_ptt.h"
+#include "wtlog.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 #include <fcntl.h>
 #include <errno.h>
+#include <poll.h>
+#include <time.h>
+#include <sys/ioctl.h>
+#include <linux/gpio.h>
 
 #define GPIO_PATH "/sys/class/gpio"
 
+// How long sysfs gets to create (and udev to chmod) a freshly exported pin
+#define GPIO_EXPORT_WAIT_MS 100
+
+#define GPIO_CONSUMER       "walkietalkie"
+
+uint64_t gpio_time_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
 // Helper function to export a GPIO pin
 static int gpio_export(int pin) {
     char path[64];
@@ -38,8 +54,12 @@ static int gpio_export(int pin) {
     
     close(fd);
 
-    // Small delay to allow sysfs to create the gpio directory
-    usleep(100000);
+    // Wait for sysfs to create the value file rather than a fixed sleep
+    snprintf(path, sizeof(path), GPIO_PATH "/gpio%d/value", pin);
+    for (int waited = 0; waited < GPIO_EXPORT_WAIT_MS; waited++) {
+        if (access(path, W_OK) == 0) break;
+        usleep(1000);
+    }
     return 0;
 }
 
@@ -84,35 +104,34 @@ static int gpio_open_value(int pin) {
     return fd;
 }
 
-// Initialize GPIO
-int gpio_init(gpio_ctx_t *ctx) {
-    // Clear the context structure
-    memset(ctx, 0, sizeof(gpio_ctx_t));
+// sysfs backend
+static int sysfs_init(gpio_ctx_t *ctx, int ptt_pin, int tx_pin, int rx_pin) {
+    ctx->ptt_fd = ctx->led_tx_fd = ctx->led_rx_fd = -1;
     
     // Export pins
-    if (gpio_export(GPIO_PTT_PIN) < 0 ||
-        gpio_export(GPIO_LED_TX_PIN) < 0 ||
-        gpio_export(GPIO_LED_RX_PIN) < 0) {
+    if (gpio_export(ptt_pin) < 0 ||
+        gpio_export(tx_pin) < 0 ||
+        gpio_export(rx_pin) < 0) {
         fprintf(stderr, "Failed to export GPIO pins\n");
         return -1;
     }
     
     // Set directions
-    if (gpio_set_direction(GPIO_PTT_PIN, "in") < 0) {
+    if (gpio_set_direction(ptt_pin, "in") < 0) {
         fprintf(stderr, "Failed to set PTT direction\n");
         return -1;
     }
     
-    if (gpio_set_direction(GPIO_LED_TX_PIN, "out") < 0 ||
-        gpio_set_direction(GPIO_LED_RX_PIN, "out") < 0) {
+    if (gpio_set_direction(tx_pin, "out") < 0 ||
+        gpio_set_direction(rx_pin, "out") < 0) {
         fprintf(stderr, "Failed to set LED directions\n");
         return -1;
     }
     
     // Open value files
-    ctx->ptt_fd = gpio_open_value(GPIO_PTT_PIN);
-    ctx->led_tx_fd = gpio_open_value(GPIO_LED_TX_PIN);
-    ctx->led_rx_fd = gpio_open_value(GPIO_LED_RX_PIN);
+    ctx->ptt_fd = gpio_open_value(ptt_pin);
+    ctx->led_tx_fd = gpio_open_value(tx_pin);
+    ctx->led_rx_fd = gpio_open_value(rx_pin);
     
     if (ctx->ptt_fd < 0 || ctx->led_tx_fd < 0 || ctx->led_rx_fd < 0) {
         fprintf(stderr, "Failed to open GPIO value files\n");
@@ -122,25 +141,223 @@ int gpio_init(gpio_ctx_t *ctx) {
         return -1;
     }
     
-    // Turn off LEDs initially
-    gpio_leds_off(ctx);
+    ctx->backend = GPIO_BACKEND_SYSFS;
+    
+    printf("GPIO initialised (sysfs):\n");
+    printf("  PTT Button: GPIO %d\n", ptt_pin);
+    printf("  TX LED:     GPIO %d\n", tx_pin);
+    printf("  RX LED:     GPIO %d\n", rx_pin);
+    
+    return 0;
+}
+
+// Character device backend: one request for the PTT input with both edges,
+// one for the two LEDs so they can change in a single ioctl
+static int chardev_init(gpio_ctx_t *ctx, const char *chip, int ptt_line,
+                        int tx_line, int rx_line) {
+    int chip_fd = open(chip, O_RDWR | O_CLOEXEC);
+    if (chip_fd < 0) {
+        perror(chip);
+        return -1;
+    }
+    
+    struct gpio_v2_line_request req;
+    memset(&req, 0, sizeof(req));
+    req.offsets[0] = ptt_line;
+    req.num_lines = 1;
+    req.config.flags = GPIO_V2_LINE_FLAG_INPUT |
+                       GPIO_V2_LINE_FLAG_EDGE_RISING |
+                       GPIO_V2_LINE_FLAG_EDGE_FALLING;
+    req.event_buffer_size = 16;
+    snprintf(req.consumer, sizeof(req.consumer), GPIO_CONSUMER "-ptt");
+    
+    if (ioctl(chip_fd, GPIO_V2_GET_LINE_IOCTL, &req) < 0) {
+        perror("gpio PTT line request");
+        close(chip_fd);
+        return -1;
+    }
+    ctx->ptt_req_fd = req.fd;
+    
+    memset(&req, 0, sizeof(req));
+    req.offsets[0] = tx_line;
+    req.offsets[1] = rx_line;
+    req.num_lines = 2;
+    req.config.flags = GPIO_V2_LINE_FLAG_OUTPUT;
+    snprintf(req.consumer, sizeof(req.consumer), GPIO_CONSUMER "-led");
+    
+    if (ioctl(chip_fd, GPIO_V2_GET_LINE_IOCTL, &req) < 0) {
+        perror("gpio LED line request");
+        close(ctx->ptt_req_fd);
+        close(chip_fd);
+        return -1;
+    }
+    ctx->led_req_fd = req.fd;
+    
+    // The requests stay valid without the chip fd
+    close(chip_fd);
+    
+    fcntl(ctx->ptt_req_fd, F_SETFL, fcntl(ctx->ptt_req_fd, F_GETFL) | O_NONBLOCK);
+    
+    // Starting level, edges only report changes
+    struct gpio_v2_line_values values = { .bits = 0, .mask = 1 };
+    if (ioctl(ctx->ptt_req_fd, GPIO_V2_LINE_GET_VALUES_IOCTL, &values) == 0) {
+        ctx->ptt_raw = ctx->ptt_state = values.bits & 1;
+    }
+    
+    ctx->backend = GPIO_BACKEND_CHARDEV;
+    
+    printf("GPIO initialised (%s):\n", chip);
+    printf("  PTT Button: line %d (edge events, %lu ms debounce)\n", ptt_line,
+           (unsigned long)(ctx->debounce_ns / 1000000));
+    printf("  TX LED:     line %d\n", tx_line);
+    printf("  RX LED:     line %d\n", rx_line);
+    
+    return 0;
+}
+
+// Mock backend: a pipe carrying the same event records the kernel sends
+static int mock_init(gpio_ctx_t *ctx) {
+    int fds[2];
+    if (pipe(fds) < 0) {
+        perror("gpio mock pipe");
+        return -1;
+    }
+    fcntl(fds[0], F_SETFL, fcntl(fds[0], F_GETFL) | O_NONBLOCK);
+    ctx->ptt_req_fd = fds[0];
+    ctx->mock_fd = fds[1];
+    ctx->backend = GPIO_BACKEND_MOCK;
+    
+    printf("GPIO initialised (mock chip)\n");
+    return 0;
+}
+
+int gpio_init_spec(gpio_ctx_t *ctx, const char *spec) {
+    // Clear the context structure
+    memset(ctx, 0, sizeof(gpio_ctx_t));
+    ctx->ptt_fd = ctx->led_tx_fd = ctx->led_rx_fd = -1;
+    ctx->ptt_req_fd = ctx->led_req_fd = ctx->mock_fd = -1;
+    ctx->debounce_ns = (uint64_t)GPIO_DEBOUNCE_MS * 1000000;
+    
+    char chip[64] = GPIO_CHIP_PATH;
+    int ptt_line = GPIO_PTT_LINE;
+    int tx_line = GPIO_LED_TX_LINE;
+    int rx_line = GPIO_LED_RX_LINE;
+    bool chardev_only = false;
+    bool use_sysfs = false;
+    bool use_mock = false;
+    int result;
+    
+    // The line numbers double as sysfs pin numbers
+    if (spec) {
+        char buf[128];
+        char *save = NULL;
+        snprintf(buf, sizeof(buf), "%s", spec);
+        
+        for (char *tok = strtok_r(buf, ",", &save); tok; tok = strtok_r(NULL, ",", &save)) {
+            if (strcmp(tok, "sysfs") == 0) {
+                use_sysfs = true;
+                continue;
+            }
+            if (strcmp(tok, "mock") == 0) {
+                use_mock = true;
+                continue;
+            }
+            
+            char *eq = strchr(tok, '=');
+            if (!eq) {
+                fprintf(stderr, "WT_GPIO: expected key=value, got '%s'\n", tok);
+                return -1;
+            }
+            *eq = '\0';
+            if (strcmp(tok, "chip") == 0) {
+                snprintf(chip, sizeof(chip), "%s", eq + 1);
+                chardev_only = true;
+            } else if (strcmp(tok, "ptt") == 0) {
+                ptt_line = atoi(eq + 1);
+            } else if (strcmp(tok, "tx") == 0) {
+                tx_line = atoi(eq + 1);
+            } else if (strcmp(tok, "rx") == 0) {
+                rx_line = atoi(eq + 1);
+            } else if (strcmp(tok, "debounce") == 0) {
+                ctx->debounce_ns = (uint64_t)atoi(eq + 1) * 1000000;
+            } else {
+                fprintf(stderr, "WT_GPIO: unknown key '%s'\n", tok);
+                return -1;
+            }
+        }
+    }
+    
+    if (use_mock) {
+        result = mock_init(ctx);
+    } else if (use_sysfs) {
+        result = sysfs_init(ctx, ptt_line, tx_line, rx_line);
+    } else {
+        result = chardev_init(ctx, chip, ptt_line, tx_line, rx_line);
+        
+        // Kernels without the chardev (or a different chip layout) still have sysfs
+        if (result < 0 && !chardev_only) {
+            fprintf(stderr, "GPIO chardev unavailable, falling back to sysfs\n");
+            result = sysfs_init(ctx, ptt_line, tx_line, rx_line);
+        }
+    }
+    
+    if (result < 0) {
+        return -1;
+    }
     
     ctx->initialized = true;
     
-    printf("GPIO initialised:\n");
-    printf("  PTT Button: GPIO %d\n", GPIO_PTT_PIN);
-    printf("  TX LED:     GPIO %d\n", GPIO_LED_TX_PIN);
-    printf("  RX LED:     GPIO %d\n", GPIO_LED_RX_PIN);
+    // Turn off LEDs initially
+    gpio_leds_off(ctx);
     
     return 0;
 }
 
-// Read PTT button state
-bool gpio_read_ptt(gpio_ctx_t *ctx) {
-    if (!ctx->initialized || ctx->ptt_fd < 0) {
-        return false;
+int gpio_init(gpio_ctx_t *ctx) {
+    return gpio_init_spec(ctx, getenv("WT_GPIO"));
+}
+
+// Feed one raw PTT level into the debounce. The first edge is taken at
+// once (no added latency); edges within the debounce window after an
+// accepted change are bounce and only update the raw level.
+static void ptt_edge(gpio_ctx_t *ctx, bool level, uint64_t ts_ns) {
+    ctx->ptt_raw = level;
+    ctx->ptt_raw_ns = ts_ns;
+    
+    if (level == ctx->ptt_state) return;
+    
+    if (ts_ns - ctx->ptt_change_ns < ctx->debounce_ns) {
+        ctx->stats.bounces++;
+        return;
     }
     
+    ctx->ptt_state = level;
+    ctx->ptt_change_ns = ts_ns;
+    if (level) ctx->ptt_edge_ns = ts_ns;
+    ctx->stats.edges++;
+}
+
+// Drain queued edge events, then settle a level that outlasted the window
+static void ptt_update(gpio_ctx_t *ctx) {
+    struct gpio_v2_line_event events[16];
+    ssize_t n;
+    
+    while ((n = read(ctx->ptt_req_fd, events, sizeof(events))) > 0) {
+        for (size_t i = 0; i < n / sizeof(events[0]); i++) {
+            ptt_edge(ctx, events[i].id == GPIO_V2_LINE_EVENT_RISING_EDGE,
+                     events[i].timestamp_ns);
+        }
+    }
+    
+    if (ctx->ptt_raw != ctx->ptt_state) {
+        uint64_t now = gpio_time_ns();
+        if (now - ctx->ptt_change_ns >= ctx->debounce_ns) {
+            ptt_edge(ctx, ctx->ptt_raw, now);
+        }
+    }
+}
+
+static bool sysfs_read_ptt(gpio_ctx_t *ctx) {
     char buf[2];
     // Move the file pointer back to the start before reading because we didn't close the file
     lseek(ctx->ptt_fd, 0, SEEK_SET);
@@ -153,41 +370,135 @@ bool gpio_read_ptt(gpio_ctx_t *ctx) {
     return buf[0] == '1';
 }
 
+// Read PTT button state
+bool gpio_read_ptt(gpio_ctx_t *ctx) {
+    if (!ctx->initialized) {
+        return false;
+    }
+    
+    if (ctx->backend == GPIO_BACKEND_SYSFS) {
+        bool level = sysfs_read_ptt(ctx);
+        ptt_edge(ctx, level, gpio_time_ns());
+        return ctx->ptt_state;
+    }
+    
+    ptt_update(ctx);
+    return ctx->ptt_state;
+}
+
+bool gpio_wait_ptt(gpio_ctx_t *ctx, int timeout_ms) {
+    if (!ctx->initialized) {
+        usleep(timeout_ms * 1000);
+        return false;
+    }
+    
+    // sysfs has no usable edge wakeup here, plain polling
+    if (ctx->backend == GPIO_BACKEND_SYSFS) {
+        usleep(timeout_ms * 1000);
+        return gpio_read_ptt(ctx);
+    }
+    
+    // A bounced level still waiting to settle shortens the wait
+    if (ctx->ptt_raw != ctx->ptt_state) {
+        uint64_t now = gpio_time_ns();
+        uint64_t due = ctx->ptt_change_ns + ctx->debounce_ns;
+        int settle_ms = due > now ? (int)((due - now + 999999) / 1000000) : 0;
+        if (settle_ms < timeout_ms) timeout_ms = settle_ms;
+    }
+    
+    struct pollfd pfd = { .fd = ctx->ptt_req_fd, .events = POLLIN };
+    poll(&pfd, 1, timeout_ms);
+    
+    return gpio_read_ptt(ctx);
+}
+
+void gpio_mock_set_ptt(gpio_ctx_t *ctx, bool pressed) {
+    if (ctx->backend != GPIO_BACKEND_MOCK) return;
+    
+    struct gpio_v2_line_event event;
+    memset(&event, 0, sizeof(event));
+    event.timestamp_ns = gpio_time_ns();
+    event.id = pressed ? GPIO_V2_LINE_EVENT_RISING_EDGE : GPIO_V2_LINE_EVENT_FALLING_EDGE;
+    event.offset = GPIO_PTT_LINE;
+    
+    if (write(ctx->mock_fd, &event, sizeof(event)) != sizeof(event)) {
+        WTLOG_ERROR("gpio mock write: %s", strerror(errno));
+    }
+}
+
 // Write to the GPIO value file
 static int safe_write(int fd, const char *buf, size_t count) {
     ssize_t result = write(fd, buf, count);
     if (result < 0) {
-        perror("write failed");
+        WTLOG_ERROR("GPIO write: %s", strerror(errno));
         return -1;
     }
     return 0;
 }
 
+// Set LED lines in the chardev request, only those in mask (bit 0 TX, bit 1 RX)
+static void led_update(gpio_ctx_t *ctx, uint64_t bits, uint64_t mask) {
+    if (ctx->backend == GPIO_BACKEND_MOCK) {
+        if (mask & 1) ctx->mock_led_tx = bits & 1;
+        if (mask & 2) ctx->mock_led_rx = bits & 2;
+        ctx->stats.led_writes++;
+        return;
+    }
+    
+    struct gpio_v2_line_values values = { .bits = bits, .mask = mask };
+    if (ioctl(ctx->led_req_fd, GPIO_V2_LINE_SET_VALUES_IOCTL, &values) < 0) {
+        WTLOG_ERROR("gpio LED update: %s", strerror(errno));
+    }
+    ctx->stats.led_writes++;
+}
+
 // Control TX LED
 void gpio_set_tx_led(gpio_ctx_t *ctx, bool on) {
-    if (!ctx->initialized || ctx->led_tx_fd < 0) return;
+    if (!ctx->initialized) return;
+    
+    if (ctx->backend != GPIO_BACKEND_SYSFS) {
+        led_update(ctx, on ? 1 : 0, 1);
+        return;
+    }
+    if (ctx->led_tx_fd < 0) return;
     
     // Turn on and off the LED by writing '1' or '0' to the value file
     const char *value = on ? "1" : "0";
     if (safe_write(ctx->led_tx_fd, value, 1) < 0) {
-        fprintf(stderr, "Failed to set TX LED\n");
+        WTLOG_ERROR("Failed to set TX LED");
     }
 }
 
 // Same thing really for RX LED
 void gpio_set_rx_led(gpio_ctx_t *ctx, bool on) {
-    if (!ctx->initialized || ctx->led_rx_fd < 0) return;
+    if (!ctx->initialized) return;
+    
+    if (ctx->backend != GPIO_BACKEND_SYSFS) {
+        led_update(ctx, on ? 2 : 0, 2);
+        return;
+    }
+    if (ctx->led_rx_fd < 0) return;
     
     const char *value = on ? "1" : "0";
     if (safe_write(ctx->led_rx_fd, value, 1) < 0) {
-        fprintf(stderr, "Failed to set RX LED\n");
+        WTLOG_ERROR("Failed to set RX LED");
+    }
+}
+
+void gpio_set_leds(gpio_ctx_t *ctx, bool tx, bool rx) {
+    if (!ctx->initialized) return;
+    
+    if (ctx->backend != GPIO_BACKEND_SYSFS) {
+        led_update(ctx, (tx ? 1 : 0) | (rx ? 2 : 0), 3);
+        return;
     }
+    gpio_set_tx_led(ctx, tx);
+    gpio_set_rx_led(ctx, rx);
 }
 
 // Turn off all LEDs
 void gpio_leds_off(gpio_ctx_t *ctx) {
-    gpio_set_tx_led(ctx, false);
-    gpio_set_rx_led(ctx, false);
+    gpio_set_leds(ctx, false, false);
 }
 
 // Cleanup GPIO
@@ -198,6 +509,9 @@ void gpio_cleanup(gpio_ctx_t *ctx) {
         if (ctx->ptt_fd >= 0) close(ctx->ptt_fd);
         if (ctx->led_tx_fd >= 0) close(ctx->led_tx_fd);
         if (ctx->led_rx_fd >= 0) close(ctx->led_rx_fd);
+        if (ctx->ptt_req_fd >= 0) close(ctx->ptt_req_fd);
+        if (ctx->led_req_fd >= 0) close(ctx->led_req_fd);
+        if (ctx->mock_fd >= 0) close(ctx->mock_fd);
         
         ctx->initialized = false;
     }
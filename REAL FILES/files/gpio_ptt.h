@@ -1,29 +1,92 @@
 #ifndef GPIO_PTT_H
 #define GPIO_PTT_H
 
+#include <stdint.h>
 #include <stdbool.h>
 
+// Legacy sysfs pin numbers
 #define GPIO_PTT_PIN        78
 #define GPIO_LED_TX_PIN     79
 #define GPIO_LED_RX_PIN     80
 
+// Character device: chip and line offsets (the sysfs numbers on a chip
+// based at 0), override with WT_GPIO="chip=/dev/gpiochip1,ptt=0,tx=1,rx=2"
+#define GPIO_CHIP_PATH      "/dev/gpiochip0"
+#define GPIO_PTT_LINE       GPIO_PTT_PIN
+#define GPIO_LED_TX_LINE    GPIO_LED_TX_PIN
+#define GPIO_LED_RX_LINE    GPIO_LED_RX_PIN
+
+// PTT edges closer together than this are contact bounce
+#define GPIO_DEBOUNCE_MS    10
+
+typedef enum {
+    GPIO_BACKEND_CHARDEV,       // /dev/gpiochipN line requests with edge events
+    GPIO_BACKEND_SYSFS,         // Deprecated /sys/class/gpio, polled
+    GPIO_BACKEND_MOCK           // In-process fake chip for benches
+} gpio_backend_t;
+
+typedef struct {
+    uint64_t edges;             // PTT changes accepted
+    uint64_t bounces;           // PTT edges swallowed by the debounce
+    uint64_t led_writes;        // LED update syscalls
+} gpio_stats_t;
+
 typedef struct {
+    gpio_backend_t backend;
+
+    // sysfs value files
     int ptt_fd;
     int led_tx_fd;
     int led_rx_fd;
+
+    // chardev line requests (mock: ptt_req_fd is the read end of a pipe)
+    int ptt_req_fd;
+    int led_req_fd;
+    int mock_fd;
+
+    // Debounced PTT, timestamps are CLOCK_MONOTONIC ns (kernel event time)
+    bool ptt_state;
+    bool ptt_raw;
+    uint64_t ptt_raw_ns;
+    uint64_t ptt_change_ns;
+    uint64_t ptt_edge_ns;       // When the current press started
+    uint64_t debounce_ns;
+
+    // Mock LED levels
+    bool mock_led_tx;
+    bool mock_led_rx;
+
+    gpio_stats_t stats;
     bool initialized;
 } gpio_ctx_t;
 
+// Backend from WT_GPIO: "chip=...,ptt=N,tx=N,rx=N,debounce=ms", with
+// "sysfs" or "mock" in the list to force that backend (the pin numbers
+// apply to sysfs too); by default the chardev, falling back to sysfs
 int gpio_init(gpio_ctx_t *ctx);
 
+int gpio_init_spec(gpio_ctx_t *ctx, const char *spec);
+
 bool gpio_read_ptt(gpio_ctx_t *ctx);
 
+// Sleep until a PTT edge or timeout_ms, then return the PTT state
+bool gpio_wait_ptt(gpio_ctx_t *ctx, int timeout_ms);
+
+// Monotonic time in ns, same clock as the edge timestamps
+uint64_t gpio_time_ns(void);
+
 void gpio_set_tx_led(gpio_ctx_t *ctx, bool on);
 
 void gpio_set_rx_led(gpio_ctx_t *ctx, bool on);
 
+// Both LEDs in one update
+void gpio_set_leds(gpio_ctx_t *ctx, bool tx, bool rx);
+
 void gpio_leds_off(gpio_ctx_t *ctx);
 
+// Mock backend only: drive the fake PTT line
+void gpio_mock_set_ptt(gpio_ctx_t *ctx, bool pressed);
+
 void gpio_cleanup(gpio_ctx_t *ctx);
 
-#endif // GPIO_PTT_H
\ No newline at end of file
+#endif // GPIO_PTT_H
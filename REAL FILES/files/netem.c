@@ -0,0 +1,190 @@
+#include "netem.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// xorshift64* - deterministic for a given seed, no libc rand() state
+static uint64_t netem_rand(netem_ctx_t *ctx) {
+    ctx->rng ^= ctx->rng >> 12;
+    ctx->rng ^= ctx->rng << 25;
+    ctx->rng ^= ctx->rng >> 27;
+    return ctx->rng * 0x2545F4914F6CDD1DULL;
+}
+
+// Uniform in [0, 1)
+static double netem_uniform(netem_ctx_t *ctx) {
+    return (netem_rand(ctx) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static bool netem_chance(netem_ctx_t *ctx, double pct) {
+    return pct > 0.0 && netem_uniform(ctx) * 100.0 < pct;
+}
+
+void netem_config_default(netem_config_t *cfg) {
+    memset(cfg, 0, sizeof(netem_config_t));
+    cfg->burst_loss_pct = 100.0;
+    cfg->reorder_ms = 40;
+    cfg->seed = 1;
+}
+
+int netem_parse(netem_config_t *cfg, const char *spec) {
+    char buf[256];
+    snprintf(buf, sizeof(buf), "%s", spec);
+
+    char *save = NULL;
+    for (char *tok = strtok_r(buf, ", ", &save); tok; tok = strtok_r(NULL, ", ", &save)) {
+        char *eq = strchr(tok, '=');
+        if (!eq) {
+            fprintf(stderr, "netem: expected key=value, got '%s'\n", tok);
+            return -1;
+        }
+        *eq = '\0';
+        const char *key = tok;
+        const char *val = eq + 1;
+
+        if (strcmp(key, "loss") == 0) {
+            cfg->loss_pct = atof(val);
+        } else if (strcmp(key, "burst") == 0) {
+            // burst=<p>/<r>[/<loss%>]
+            if (sscanf(val, "%lf/%lf/%lf", &cfg->burst_p, &cfg->burst_r,
+                       &cfg->burst_loss_pct) < 2) {
+                fprintf(stderr, "netem: burst=<p>/<r>[/<loss%%>]\n");
+                return -1;
+            }
+        } else if (strcmp(key, "delay") == 0) {
+            cfg->delay_ms = atoi(val);
+        } else if (strcmp(key, "jitter") == 0) {
+            cfg->jitter_ms = atoi(val);
+        } else if (strcmp(key, "reorder") == 0) {
+            // reorder=<pct>[/<ms>]
+            if (sscanf(val, "%lf/%d", &cfg->reorder_pct, &cfg->reorder_ms) < 1) {
+                fprintf(stderr, "netem: reorder=<pct>[/<ms>]\n");
+                return -1;
+            }
+        } else if (strcmp(key, "dup") == 0) {
+            cfg->dup_pct = atof(val);
+        } else if (strcmp(key, "seed") == 0) {
+            cfg->seed = (uint32_t)strtoul(val, NULL, 0);
+        } else {
+            fprintf(stderr, "netem: unknown key '%s'\n", key);
+            return -1;
+        }
+    }
+
+    if (cfg->loss_pct < 0 || cfg->loss_pct > 100 ||
+        cfg->burst_p < 0 || cfg->burst_p > 1 ||
+        cfg->burst_r < 0 || cfg->burst_r > 1 ||
+        (cfg->burst_p > 0 && cfg->burst_r <= 0) ||
+        cfg->delay_ms < 0 || cfg->jitter_ms < 0 || cfg->reorder_ms < 0 ||
+        cfg->reorder_pct < 0 || cfg->dup_pct < 0) {
+        fprintf(stderr, "netem: parameter out of range in '%s'\n", spec);
+        return -1;
+    }
+    return 0;
+}
+
+void netem_describe(const netem_config_t *cfg, char *buf, int size) {
+    snprintf(buf, size, "loss=%.1f%% burst=%.3f/%.3f/%.0f%% delay=%dms jitter=%dms "
+             "reorder=%.1f%%/%dms dup=%.1f%% seed=%u",
+             cfg->loss_pct, cfg->burst_p, cfg->burst_r, cfg->burst_loss_pct,
+             cfg->delay_ms, cfg->jitter_ms, cfg->reorder_pct, cfg->reorder_ms,
+             cfg->dup_pct, cfg->seed);
+}
+
+void netem_init(netem_ctx_t *ctx, const netem_config_t *cfg) {
+    memset(ctx, 0, sizeof(netem_ctx_t));
+    ctx->cfg = *cfg;
+
+    // Spread the 32-bit seed over the 64-bit state (must not be zero)
+    ctx->rng = ((uint64_t)cfg->seed << 32) ^ 0x9E3779B97F4A7C15ULL;
+    for (int i = 0; i < 4; i++) netem_rand(ctx);
+}
+
+static void netem_enqueue(netem_ctx_t *ctx, const network_packet_t *packet,
+                          int len, uint64_t due_us) {
+    if (ctx->count == NETEM_QUEUE) {
+        ctx->stats.overflow++;
+        return;
+    }
+
+    netem_entry_t *e = &ctx->queue[ctx->count++];
+    memcpy(&e->packet, packet, len);
+    e->len = len;
+    e->due_us = due_us;
+    e->order = ctx->order++;
+}
+
+void netem_submit(netem_ctx_t *ctx, const network_packet_t *packet, int len, uint64_t now_us) {
+    const netem_config_t *cfg = &ctx->cfg;
+
+    if (len <= 0 || len > (int)sizeof(network_packet_t)) return;
+    ctx->stats.submitted++;
+
+    // Advance the Gilbert-Elliott channel once per packet
+    if (cfg->burst_p > 0) {
+        if (ctx->bad_state) {
+            if (netem_uniform(ctx) < cfg->burst_r) ctx->bad_state = false;
+        } else {
+            if (netem_uniform(ctx) < cfg->burst_p) ctx->bad_state = true;
+        }
+    }
+
+    if (ctx->bad_state && netem_chance(ctx, cfg->burst_loss_pct)) {
+        ctx->stats.lost++;
+        ctx->stats.lost_burst++;
+        return;
+    }
+    if (netem_chance(ctx, cfg->loss_pct)) {
+        ctx->stats.lost++;
+        return;
+    }
+
+    int copies = 1;
+    if (netem_chance(ctx, cfg->dup_pct)) {
+        copies = 2;
+        ctx->stats.duplicated++;
+    }
+
+    for (int i = 0; i < copies; i++) {
+        uint64_t delay_us = (uint64_t)cfg->delay_ms * 1000;
+        if (cfg->jitter_ms > 0) {
+            delay_us += netem_rand(ctx) % ((uint64_t)cfg->jitter_ms * 1000 + 1);
+        }
+        if (netem_chance(ctx, cfg->reorder_pct)) {
+            delay_us += (uint64_t)cfg->reorder_ms * 1000;
+            ctx->stats.reordered++;
+        }
+        netem_enqueue(ctx, packet, len, now_us + delay_us);
+    }
+}
+
+int netem_poll(netem_ctx_t *ctx, uint64_t now_us, network_packet_t *packet, int *len) {
+    int best = -1;
+
+    // Earliest due first, submission order breaks ties
+    for (int i = 0; i < ctx->count; i++) {
+        const netem_entry_t *e = &ctx->queue[i];
+        if (e->due_us > now_us) continue;
+        if (best < 0 || e->due_us < ctx->queue[best].due_us ||
+            (e->due_us == ctx->queue[best].due_us && e->order < ctx->queue[best].order)) {
+            best = i;
+        }
+    }
+    if (best < 0) return 0;
+
+    memcpy(packet, &ctx->queue[best].packet, ctx->queue[best].len);
+    *len = ctx->queue[best].len;
+
+    // Swap-remove, ordering is recovered from due_us/order
+    ctx->queue[best] = ctx->queue[--ctx->count];
+    ctx->stats.delivered++;
+    return 1;
+}
+
+uint64_t netem_next_due(const netem_ctx_t *ctx) {
+    uint64_t next = UINT64_MAX;
+    for (int i = 0; i < ctx->count; i++) {
+        if (ctx->queue[i].due_us < next) next = ctx->queue[i].due_us;
+    }
+    return next;
+}
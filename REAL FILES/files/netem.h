@@ -0,0 +1,83 @@
+#ifndef NETEM_H
+#define NETEM_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "network.h"
+
+// In-process network impairment (loss, jitter, reordering, duplication).
+// Enabled on the receive side of network_recv with WT_NETEM=<spec>, and
+// used directly by netem_sweep for offline runs.
+
+// Packets held back for delayed delivery
+#define NETEM_QUEUE         64
+
+typedef struct {
+    // Loss: independent random loss plus a Gilbert-Elliott burst model.
+    // The channel moves good->bad with probability burst_p and bad->good
+    // with burst_r per packet; packets in the bad state are lost with
+    // probability burst_loss_pct. Mean burst length is 1 / burst_r.
+    double loss_pct;
+    double burst_p;
+    double burst_r;
+    double burst_loss_pct;
+
+    // Delay: fixed base plus uniform jitter in [0, jitter_ms]
+    int delay_ms;
+    int jitter_ms;
+
+    // Reorder: packet held back an extra reorder_ms so later ones overtake it
+    double reorder_pct;
+    int reorder_ms;
+
+    double dup_pct;
+
+    uint32_t seed;
+} netem_config_t;
+
+typedef struct {
+    network_packet_t packet;
+    int len;
+    uint64_t due_us;
+    uint64_t order;
+} netem_entry_t;
+
+typedef struct {
+    uint64_t submitted;
+    uint64_t lost;
+    uint64_t lost_burst;
+    uint64_t duplicated;
+    uint64_t reordered;
+    uint64_t delivered;
+    uint64_t overflow;
+} netem_stats_t;
+
+typedef struct netem_ctx {
+    netem_config_t cfg;
+    netem_entry_t queue[NETEM_QUEUE];
+    int count;
+    uint64_t order;
+    uint64_t rng;
+    bool bad_state;
+    netem_stats_t stats;
+} netem_ctx_t;
+
+void netem_config_default(netem_config_t *cfg);
+
+// Parse "loss=5,burst=0.05/0.3,delay=10,jitter=30,reorder=2,dup=1,seed=7"
+int netem_parse(netem_config_t *cfg, const char *spec);
+void netem_describe(const netem_config_t *cfg, char *buf, int size);
+
+void netem_init(netem_ctx_t *ctx, const netem_config_t *cfg);
+
+// Offer a packet to the impaired link at time now_us
+void netem_submit(netem_ctx_t *ctx, const network_packet_t *packet, int len, uint64_t now_us);
+
+// Take the earliest packet due at or before now_us (returns 1), else 0
+int netem_poll(netem_ctx_t *ctx, uint64_t now_us, network_packet_t *packet, int *len);
+
+// Time the next queued packet becomes due (UINT64_MAX if empty)
+uint64_t netem_next_due(const netem_ctx_t *ctx);
+
+#endif // NETEM_H
@@ -0,0 +1,325 @@
+/*
+ * netem_sweep.c - Sweep network impairments through the RX pipeline
+ *
+ * Encodes a speech file (or a built-in speech-like signal) once, then
+ * sends the packets through the impairment emulator into the same jitter
+ * buffer/decoder the board uses, on a virtual 20 ms playout clock. Each
+ * output frame is matched to its seq_num and compared against a clean
+ * decode, giving SNR/segmental SNR as a quality proxy plus loss, late,
+ * concealment and FEC recovery rates. With -r the packets carry earlier
+ * frames as well (red.h), and the rows add the frames rebuilt from those
+ * copies against the bandwidth they cost. Output is CSV, one row per
+ * condition x jitter target x redundancy depth x seed.
+ *
+ * Usage: ./netem_sweep [options]
+ *   -i in.wav     Input speech (mono, 16-bit, SAMPLE_RATE)
+ *   -d seconds    Length of the built-in test signal (default 20)
+ *   -n spec       Run only this condition (netem spec, e.g. "burst=0.02/0.3")
+ *   -j list       Jitter buffer targets, comma separated (default 1,2,3)
+ *   -s seeds      Number of seeds per condition (default 1)
+ *   -r list       Redundancy depths, comma separated (default 0)
+ *   -k kbps       Cap on the bitrate redundancy adds (default 0, none)
+ *   -o out.csv    Write CSV here instead of stdout
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "opus_helper.h"
+#include "network.h"
+#include "netem.h"
+#include "rx_pipeline.h"
+#include "red.h"
+#include "audio_metrics.h"
+#include "wav.h"
+
+// Default conditions, from clean through the plant's Wi-Fi bridge bursts
+static const char *default_conditions[] = {
+    "loss=0",
+    "loss=1",
+    "loss=5",
+    "loss=10",
+    "burst=0.02/0.5",
+    "burst=0.02/0.25",
+    "burst=0.05/0.2",
+    "jitter=20",
+    "jitter=40",
+    "jitter=60",
+    "reorder=5/30",
+    "dup=5",
+    "loss=3,jitter=30,reorder=2/30",
+};
+
+typedef struct {
+    uint8_t data[MAX_PACKET_SIZE];
+    int size;
+} encoded_frame_t;
+
+typedef struct {
+    double lost_pct;
+    double late_pct;
+    double concealed_pct;
+    double recovered_pct;
+    double rebuilt_pct;
+    double added_bw_pct;
+    double missing_pct;
+    double snr;
+    double segsnr;
+    double delay_ms;
+} run_result_t;
+
+static int cmp_u32(const void *a, const void *b) {
+    uint32_t x = *(const uint32_t *)a;
+    uint32_t y = *(const uint32_t *)b;
+    return (x > y) - (x < y);
+}
+
+static void make_packet(network_packet_t *p, uint32_t seq, uint8_t flags,
+                        const encoded_frame_t *frame, red_encoder_t *red) {
+    memset(p, 0, PACKET_HEADER_SIZE);
+    p->board_id = 2;
+    p->seq_num = seq;
+    p->flags = flags;
+    if (frame && red->depth > 0) {
+        int size = red_pack(red, seq, frame->data, frame->size, p->opus_data, MAX_OPUS_PACKET);
+        p->opus_size = (uint16_t)(size > 0 ? size : 0);
+        p->flags |= PKT_FLAG_RED;
+    } else if (frame) {
+        p->opus_size = (uint16_t)frame->size;
+        memcpy(p->opus_data, frame->data, frame->size);
+    }
+}
+
+// One impaired transmission: START, frames 1..n, END.
+// START/END bypass the impairment so every run measures the audio path
+// rather than whether the burst was picked up at all.
+static void run_condition(const netem_config_t *cfg, int target, int depth, int cap_kbps,
+                          const encoded_frame_t *frames, int n,
+                          const int16_t *ref, int16_t *out,
+                          opus_dec_ctx_t *decoder, run_result_t *res) {
+    static network_packet_t packet;
+    static network_packet_t delivered;
+    netem_ctx_t *netem = malloc(sizeof(netem_ctx_t));
+    rx_pipeline_t *rx = malloc(sizeof(rx_pipeline_t));
+    red_encoder_t *red = malloc(sizeof(red_encoder_t));
+    uint32_t *delays = malloc(n * sizeof(uint32_t));
+    bool *got = calloc(n, sizeof(bool));
+    int16_t pcm[FRAME_SIZE];
+    int ndelays = 0;
+
+    netem_init(netem, cfg);
+    red_encoder_init(red, depth, cap_kbps);
+    opus_dec_reset(decoder);
+    rx_pipeline_init(rx, decoder, target);
+    memset(out, 0, (size_t)n * FRAME_SIZE * sizeof(int16_t));
+
+    uint32_t sent = 0;          // seq of the next packet to send (0 = START)
+    uint32_t last = n + 1;      // seq of END
+    uint64_t clock_us = 0;
+    uint64_t limit_us = (uint64_t)(n + 200) * FRAME_US;
+
+    while (clock_us < limit_us) {
+        // Sender: one packet per frame period
+        if (sent <= last) {
+            if (sent == 0 || sent == last) {
+                make_packet(&packet, sent, sent == 0 ? PKT_FLAG_START : PKT_FLAG_END, NULL, red);
+                rx_pipeline_push(rx, &packet, PACKET_HEADER_SIZE, clock_us);
+            } else {
+                make_packet(&packet, sent, 0, &frames[sent - 1], red);
+                netem_submit(netem, &packet, PACKET_HEADER_SIZE + packet.opus_size, clock_us);
+            }
+            sent++;
+        }
+
+        // Network: everything due by this tick reaches the receiver
+        int len;
+        while (netem_poll(netem, clock_us, &delivered, &len)) {
+            rx_pipeline_push(rx, &delivered, len, clock_us);
+        }
+
+        // Receiver: playout clock asks for one frame
+        uint32_t seq = rx->next_seq;
+        if (rx_pipeline_pull(rx, pcm, true) > 0 && seq >= 1 && seq <= (uint32_t)n) {
+            memcpy(out + (size_t)(seq - 1) * FRAME_SIZE, pcm, sizeof(pcm));
+            got[seq - 1] = true;
+            if (!rx->last_concealed) {
+                delays[ndelays++] = (uint32_t)(clock_us - rx->last_played_arrival_us);
+            }
+        }
+
+        clock_us += FRAME_US;
+
+        if (sent > last && netem->count == 0 && !rx_pipeline_active(rx)) break;
+    }
+
+    int missing = 0;
+    for (int i = 0; i < n; i++) {
+        if (!got[i]) missing++;
+    }
+
+    res->lost_pct = 100.0 * netem->stats.lost / netem->stats.submitted;
+    res->late_pct = 100.0 * rx->stats.frames_late / n;
+    res->concealed_pct = 100.0 * rx->stats.frames_concealed / n;
+    res->recovered_pct = 100.0 * rx->stats.frames_recovered / n;
+    res->rebuilt_pct = 100.0 * rx->stats.frames_redundant / n;
+    res->added_bw_pct = red->stats.bytes_primary ?
+                        100.0 * red->stats.bytes_redundant / red->stats.bytes_primary : 0.0;
+    res->missing_pct = 100.0 * missing / n;
+    res->snr = snr_db(ref, out, n * FRAME_SIZE);
+    res->segsnr = segsnr_db(ref, out, n * FRAME_SIZE, FRAME_SIZE);
+
+    if (ndelays > 0) {
+        qsort(delays, ndelays, sizeof(uint32_t), cmp_u32);
+        res->delay_ms = delays[ndelays / 2] / 1000.0;
+    } else {
+        res->delay_ms = 0.0;
+    }
+
+    free(got);
+    free(delays);
+    free(red);
+    free(rx);
+    free(netem);
+}
+
+int main(int argc, char *argv[]) {
+    const char *input = NULL;
+    const char *single = NULL;
+    const char *csv_path = NULL;
+    char targets_arg[64] = "1,2,3";
+    char depths_arg[64] = "0";
+    int cap_kbps = 0;
+    int seconds = 20;
+    int seeds = 1;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "i:d:n:j:s:o:r:k:")) != -1) {
+        switch (opt) {
+        case 'i': input = optarg; break;
+        case 'd': seconds = atoi(optarg); break;
+        case 'n': single = optarg; break;
+        case 'j': snprintf(targets_arg, sizeof(targets_arg), "%s", optarg); break;
+        case 's': seeds = atoi(optarg); break;
+        case 'o': csv_path = optarg; break;
+        case 'r': snprintf(depths_arg, sizeof(depths_arg), "%s", optarg); break;
+        case 'k': cap_kbps = atoi(optarg); break;
+        default:
+            fprintf(stderr, "Usage: %s [-i in.wav] [-d sec] [-n spec] [-j 1,2,3] [-s seeds] "
+                    "[-r 0,1,2] [-k kbps] [-o out.csv]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (seeds < 1) seeds = 1;
+
+    // Load or synthesize the source signal
+    int16_t *source;
+    int total;
+    if (input) {
+        int rate, channels;
+        source = wav_read(input, &rate, &channels, &total);
+        if (!source) return 1;
+        if (channels != 1 || rate != SAMPLE_RATE) {
+            fprintf(stderr, "%s: need mono %d Hz input (got %d ch, %d Hz)\n",
+                    input, SAMPLE_RATE, channels, rate);
+            free(source);
+            return 1;
+        }
+    } else {
+        total = seconds * SAMPLE_RATE;
+        source = malloc(total * sizeof(int16_t));
+        test_signal_speechlike(source, total, SAMPLE_RATE, 1);
+    }
+
+    int n = total / FRAME_SIZE;
+    if (n < 10) {
+        fprintf(stderr, "Input too short\n");
+        free(source);
+        return 1;
+    }
+
+    opus_enc_ctx_t encoder;
+    opus_dec_ctx_t decoder;
+    if (opus_enc_init(&encoder, BITRATE) < 0 || opus_dec_init(&decoder) < 0) {
+        free(source);
+        return 1;
+    }
+
+    // Encode once, and decode cleanly for the reference
+    encoded_frame_t *frames = malloc(n * sizeof(encoded_frame_t));
+    int16_t *ref = malloc((size_t)n * FRAME_SIZE * sizeof(int16_t));
+    int16_t *out = malloc((size_t)n * FRAME_SIZE * sizeof(int16_t));
+
+    for (int i = 0; i < n; i++) {
+        frames[i].size = opus_encode_frame(&encoder, source + (size_t)i * FRAME_SIZE,
+                                           FRAME_SIZE, frames[i].data, MAX_PACKET_SIZE);
+        if (frames[i].size <= 0) frames[i].size = 1;
+        if (opus_decode_frame(&decoder, frames[i].data, frames[i].size,
+                              ref + (size_t)i * FRAME_SIZE, FRAME_SIZE) != FRAME_SIZE) {
+            memset(ref + (size_t)i * FRAME_SIZE, 0, FRAME_SIZE * sizeof(int16_t));
+        }
+    }
+
+    FILE *csv = stdout;
+    if (csv_path) {
+        csv = fopen(csv_path, "w");
+        if (!csv) {
+            perror(csv_path);
+            return 1;
+        }
+    }
+
+    fprintf(csv, "condition,target_frames,redundancy,seed,lost_pct,late_pct,concealed_pct,"
+                 "fec_recovered_pct,red_rebuilt_pct,added_bw_pct,missing_pct,snr_db,segsnr_db,"
+                 "playout_delay_ms\n");
+
+    const char **conditions = default_conditions;
+    int nconditions = sizeof(default_conditions) / sizeof(default_conditions[0]);
+    if (single) {
+        conditions = &single;
+        nconditions = 1;
+    }
+
+    for (int c = 0; c < nconditions; c++) {
+        char targets[64];
+        snprintf(targets, sizeof(targets), "%s", targets_arg);
+
+        char *save_t = NULL;
+        for (char *t = strtok_r(targets, ",", &save_t); t; t = strtok_r(NULL, ",", &save_t)) {
+            int target = atoi(t);
+
+            char depths[64];
+            snprintf(depths, sizeof(depths), "%s", depths_arg);
+            char *save_d = NULL;
+            for (char *d = strtok_r(depths, ",", &save_d); d; d = strtok_r(NULL, ",", &save_d)) {
+                int depth = atoi(d);
+
+                for (int seed = 1; seed <= seeds; seed++) {
+                    netem_config_t cfg;
+                    netem_config_default(&cfg);
+                    if (netem_parse(&cfg, conditions[c]) < 0) return 1;
+                    cfg.seed = seed;
+
+                    run_result_t r;
+                    run_condition(&cfg, target, depth, cap_kbps, frames, n, ref, out, &decoder, &r);
+
+                    fprintf(csv, "\"%s\",%d,%d,%d,%.2f,%.2f,%.2f,%.2f,%.2f,%.1f,%.2f,%.2f,%.2f,%.1f\n",
+                            conditions[c], target, depth, seed, r.lost_pct, r.late_pct,
+                            r.concealed_pct, r.recovered_pct, r.rebuilt_pct, r.added_bw_pct,
+                            r.missing_pct, r.snr, r.segsnr, r.delay_ms);
+                    fflush(csv);
+                }
+            }
+        }
+    }
+
+    if (csv != stdout) fclose(csv);
+    free(out);
+    free(ref);
+    free(frames);
+    free(source);
+    opus_dec_cleanup(&decoder);
+    opus_enc_cleanup(&encoder);
+    return 0;
+}
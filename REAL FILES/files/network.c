@@ -1,5 +1,6 @@
 #define _GNU_SOURCE 
 #include "network.h"
+#include "netem.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -9,15 +10,40 @@
 #include <netinet/in.h> 
 #include <arpa/inet.h>
 #include <sys/time.h>
+#include <time.h>
+
+// Built-in group and port, talkgroup/keyring/impairment from the environment
+void network_config_default(network_config_t *cfg) {
+    memset(cfg, 0, sizeof(network_config_t));
+    snprintf(cfg->group, sizeof(cfg->group), "%s", MULTICAST_ADDR);
+    cfg->port = MULTICAST_PORT;
+    cfg->talkgroup = network_get_talkgroup();
+    cfg->keyring = crypto_keyring_path();
+    cfg->session_file = crypto_session_path();
+    cfg->netem = getenv("WT_NETEM");
+}
 
 // Initialize UDP multicast network
 int network_init(network_ctx_t *ctx, uint32_t board_id) {
+    network_config_t cfg;
+    network_config_default(&cfg);
+    return network_init_cfg(ctx, board_id, &cfg);
+}
+
+int network_init_cfg(network_ctx_t *ctx, uint32_t board_id, const network_config_t *cfg) {
 
     // Clear the context structure
     memset(ctx, 0, sizeof(network_ctx_t));
     ctx->my_board_id = board_id;
     ctx->tx_seq_num = 0;
 
+    // inet_pton converts the string IP address to binary form
+    if (inet_pton(AF_INET, cfg->group, &ctx->group) != 1 ||
+        !IN_MULTICAST(ntohl(ctx->group.s_addr))) {
+        fprintf(stderr, "Not a multicast group: %s\n", cfg->group);
+        return -1;
+    }
+
     // Create the UDP socket (SOCK_DGRAM is for UDP)
     ctx->sockfd = socket(AF_INET, SOCK_DGRAM, 0);
     if (ctx->sockfd < 0) return -1;
@@ -26,20 +52,27 @@ int network_init(network_ctx_t *ctx, uint32_t board_id) {
     int reuse = 1;
     setsockopt(ctx->sockfd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
 
+    // Kernel receive timestamps, so clock sync does not see our scheduling
+    int stamps = 1;
+    setsockopt(ctx->sockfd, SOL_SOCKET, SO_TIMESTAMPNS, &stamps, sizeof(stamps));
+
 
     // Bind to port so that the OS knows to deliver packets for this port to our socket
     struct sockaddr_in bind_addr = {0};
     bind_addr.sin_family = AF_INET;
-    bind_addr.sin_port = htons(MULTICAST_PORT);
+    bind_addr.sin_port = htons(cfg->port);
     bind_addr.sin_addr.s_addr = INADDR_ANY;
-    if (bind(ctx->sockfd, (struct sockaddr *)&bind_addr, sizeof(bind_addr)) < 0) return -1;
+    if (bind(ctx->sockfd, (struct sockaddr *)&bind_addr, sizeof(bind_addr)) < 0) {
+        close(ctx->sockfd);
+        return -1;
+    }
 
 
     // Join multicast group where MULTICAST_ADDR is the multicast address
     struct ip_mreq mreq;
 
-    // inet_addr takes a string IP address and converts it to binary form
-    mreq.imr_multiaddr.s_addr = inet_addr(MULTICAST_ADDR);
+    // The group address, already converted to binary form above
+    mreq.imr_multiaddr = ctx->group;
 
     // INADDR_ANY means to use the default network interface
     mreq.imr_interface.s_addr = INADDR_ANY;
@@ -55,51 +88,359 @@ int network_init(network_ctx_t *ctx, uint32_t board_id) {
     ctx->multicast_addr.sin_family = AF_INET;
 
     // htons converts from host byte order to network byte order (honestly no clue why this is needed)
-    ctx->multicast_addr.sin_port = htons(MULTICAST_PORT);
+    ctx->multicast_addr.sin_port = htons(cfg->port);
+    ctx->multicast_addr.sin_addr = ctx->group;
 
-    // inet_pton converts the string IP address to binary form
-    inet_pton(AF_INET, MULTICAST_ADDR, &ctx->multicast_addr.sin_addr);
+    // Load the talkgroup keys, without a keyring packets stay in cleartext
+    crypto_init(&ctx->crypto);
+    ctx->talkgroup = cfg->talkgroup;
+    if (crypto_load_keyring(&ctx->crypto, cfg->keyring) > 0) {
+        if (!ctx->crypto.keys[ctx->talkgroup].present) {
+            fprintf(stderr, "No key for talkgroup %u in %s\n",
+                    ctx->talkgroup, cfg->keyring);
+            crypto_cleanup(&ctx->crypto);
+            close(ctx->sockfd);
+            return -1;
+        }
+
+        // A persisted start count, not the clock: the KV260 has no RTC, so
+        // a reboot could repeat the epoch and with it every nonce of the
+        // last session, and receivers only take a higher one as a restart
+        if (crypto_new_session(cfg->session_file, &ctx->session) < 0) {
+            crypto_cleanup(&ctx->crypto);
+            close(ctx->sockfd);
+            return -1;
+        }
+    }
+
+    // Replay windows are per sender, and a sender numbers each of its
+    // talkgroups separately, so only cleartext can be taken from all of them
+    ctx->all_talkgroups = cfg->all_talkgroups;
+    if (ctx->all_talkgroups && ctx->crypto.enabled) {
+        fprintf(stderr, "Every talkgroup at once needs cleartext, run one receiver per talkgroup\n");
+        crypto_cleanup(&ctx->crypto);
+        close(ctx->sockfd);
+        return -1;
+    }
+
+    // A receiver for everyone hears hundreds of senders, give bursts room
+    if (ctx->all_talkgroups) {
+        int rcvbuf = 4 << 20;
+        setsockopt(ctx->sockfd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+    }
+
+    // Test loop only: impair received packets (see netem.h for the spec)
+    const char *netem_spec = cfg->netem;
+    if (netem_spec && netem_spec[0]) {
+        netem_config_t cfg;
+        netem_config_default(&cfg);
+        if (netem_parse(&cfg, netem_spec) < 0) {
+            crypto_cleanup(&ctx->crypto);
+            close(ctx->sockfd);
+            return -1;
+        }
+        ctx->netem = malloc(sizeof(netem_ctx_t));
+        if (!ctx->netem) {
+            crypto_cleanup(&ctx->crypto);
+            close(ctx->sockfd);
+            return -1;
+        }
+        netem_init(ctx->netem, &cfg);
+    }
 
     ctx->initialized = true;
-    printf("Network initialised: %s:%d (Board ID: %u)\n", MULTICAST_ADDR, MULTICAST_PORT, board_id);
+    printf("Network initialised: %s:%u (Board ID: %u)\n", cfg->group, cfg->port, board_id);
+    if (ctx->crypto.enabled) {
+        printf("  Encryption: ChaCha20-Poly1305, talkgroup %u\n", ctx->talkgroup);
+    }
+    if (ctx->netem) {
+        char desc[160];
+        netem_describe(&ctx->netem->cfg, desc, sizeof(desc));
+        printf("  Impairment: %s\n", desc);
+    }
     return 0;
 }
 
+// Fill in the header for talkgroup and seal the payload already in
+// packet->opus_data, returns the number of bytes to put on the wire
+int network_prepare(network_ctx_t *ctx, network_packet_t *packet, uint8_t talkgroup,
+                    uint32_t seq_num, uint16_t opus_size, uint8_t flags) {
+    if (opus_size > MAX_OPUS_PACKET) return -1;
+    if (ctx->crypto.enabled && opus_size > MAX_OPUS_PACKET - CRYPTO_OVERHEAD) return -1;
+
+    packet->board_id = ctx->my_board_id;
+    packet->seq_num = seq_num;
+    uint64_t stamp = ctx->clock ? ctx->clock(ctx->clock_arg) : 0;
+    packet->timestamp_sec = (uint32_t)(stamp / 1000000);
+    packet->timestamp_usec = (uint32_t)(stamp % 1000000);
+    packet->opus_size = opus_size;
+    packet->flags = flags;
+    packet->talkgroup = talkgroup;
+
+    size_t packet_size = PACKET_HEADER_SIZE + opus_size;
+
+    // Encrypt the payload in place and authenticate it together with the header
+    // Trailer after the payload: session epoch (4 bytes) + tag (16 bytes)
+    if (ctx->crypto.enabled) {
+        uint8_t nonce[CRYPTO_NONCE_BYTES];
+        uint8_t *trailer = packet->opus_data + opus_size;
+
+        packet->flags |= PKT_FLAG_SECURE;
+        memcpy(trailer, &ctx->session, 4);
+        crypto_make_nonce(nonce, packet->board_id, packet->talkgroup, ctx->session,
+                          packet->seq_num);
+
+        if (crypto_seal(&ctx->crypto, packet->talkgroup, nonce,
+                        (const uint8_t *)packet, PACKET_HEADER_SIZE,
+                        packet->opus_data, opus_size, trailer + 4) < 0) {
+            return -1;
+        }
+        packet_size += CRYPTO_OVERHEAD;
+    }
+    return (int)packet_size;
+}
+
 // Send Opus packet
 int network_send(network_ctx_t *ctx, const uint8_t *opus_data, uint16_t opus_size, uint8_t flags) {
     if (!ctx->initialized || opus_size > MAX_OPUS_PACKET) return -1;
 
     // Prepare the packet with header and Opus data
-    network_packet_t packet = {0};
-    packet.board_id = ctx->my_board_id;
-    packet.seq_num = ctx->tx_seq_num++;
-    packet.opus_size = opus_size;
-    packet.flags = flags;
+    network_packet_t packet;
 
     // Copy Opus data into packet
     if (opus_data && opus_size > 0)
         memcpy(packet.opus_data, opus_data, opus_size);
 
+    int packet_size = network_prepare(ctx, &packet, ctx->talkgroup, ctx->tx_seq_num,
+                                      opus_size, flags);
+    if (packet_size < 0) return -1;
+    ctx->tx_seq_num++;
+
     // Send the packet
-    size_t packet_size = sizeof(packet) - MAX_OPUS_PACKET + opus_size;
     return sendto(ctx->sockfd, &packet, packet_size, 0,
                   (struct sockaddr *)&ctx->multicast_addr, sizeof(ctx->multicast_addr));
 }
 
+// Clock sync message, sealed like audio but numbered from SYNC_SEQ_BASE
+int network_send_sync(network_ctx_t *ctx, const void *msg, uint16_t size) {
+    if (!ctx->initialized || size > MAX_OPUS_PACKET) return -1;
+
+    network_packet_t packet;
+    memcpy(packet.opus_data, msg, size);
+    uint32_t seq = SYNC_SEQ_BASE | (__atomic_fetch_add(&ctx->sync_seq, 1, __ATOMIC_RELAXED) &
+                                    ~SYNC_SEQ_BASE);
+
+    int packet_size = network_prepare(ctx, &packet, ctx->talkgroup, seq, size, PKT_FLAG_SYNC);
+    if (packet_size < 0) return -1;
+
+    return sendto(ctx->sockfd, &packet, packet_size, 0,
+                  (struct sockaddr *)&ctx->multicast_addr, sizeof(ctx->multicast_addr));
+}
+
+// Send prepared packets with one sendmmsg (one syscall for all of them)
+int network_send_batch(network_ctx_t *ctx, network_packet_t *const *packets,
+                       const int *lens, int count) {
+    struct mmsghdr msgs[NETWORK_BATCH_MAX];
+    struct iovec iov[NETWORK_BATCH_MAX];
+
+    if (!ctx->initialized || count > NETWORK_BATCH_MAX) return -1;
+    if (count == 0) return 0;
+
+    memset(msgs, 0, count * sizeof(struct mmsghdr));
+    for (int i = 0; i < count; i++) {
+        iov[i].iov_base = packets[i];
+        iov[i].iov_len = lens[i];
+        msgs[i].msg_hdr.msg_name = &ctx->multicast_addr;
+        msgs[i].msg_hdr.msg_namelen = sizeof(ctx->multicast_addr);
+        msgs[i].msg_hdr.msg_iov = &iov[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+
+    // A short count means the socket buffer filled up, retry the rest once
+    int sent = sendmmsg(ctx->sockfd, msgs, count, 0);
+    if (sent < 0) return -1;
+    if (sent < count) {
+        int more = sendmmsg(ctx->sockfd, msgs + sent, count - sent, 0);
+        if (more > 0) sent += more;
+    }
+    return sent;
+}
+
+// Verify, replay check and decrypt a received packet in place
+static int network_unseal(network_ctx_t *ctx, network_packet_t *packet, ssize_t len) {
+    // Cleartext or truncated packets are never accepted once keys are loaded
+    if (len < (ssize_t)(PACKET_HEADER_SIZE + CRYPTO_OVERHEAD) ||
+        !(packet->flags & PKT_FLAG_SECURE) ||
+        packet->opus_size > MAX_OPUS_PACKET - CRYPTO_OVERHEAD ||
+        len != (ssize_t)(PACKET_HEADER_SIZE + packet->opus_size + CRYPTO_OVERHEAD)) {
+        ctx->crypto.auth_failures++;
+        return -1;
+    }
+
+    uint8_t *trailer = packet->opus_data + packet->opus_size;
+    uint32_t session;
+    memcpy(&session, trailer, 4);
+
+    // SYNC packets have a window of their own (their seq_nums are another series)
+    uint32_t sender = packet->board_id;
+    if (packet->flags & PKT_FLAG_SYNC) {
+        if (!(packet->seq_num & SYNC_SEQ_BASE)) {
+            ctx->crypto.auth_failures++;
+            return -1;
+        }
+        sender |= SYNC_SEQ_BASE;
+    }
+
+    if (!crypto_replay_check(&ctx->crypto, sender, session, packet->seq_num)) {
+        ctx->crypto.replays_rejected++;
+        return -1;
+    }
+
+    uint8_t nonce[CRYPTO_NONCE_BYTES];
+    crypto_make_nonce(nonce, packet->board_id, packet->talkgroup, session, packet->seq_num);
+
+    if (crypto_open(&ctx->crypto, packet->talkgroup, nonce,
+                    (const uint8_t *)packet, PACKET_HEADER_SIZE,
+                    packet->opus_data, packet->opus_size, trailer + 4) < 0) {
+        return -1;
+    }
+
+    // Only authenticated packets may advance the replay window
+    crypto_replay_accept(&ctx->crypto, sender, session, packet->seq_num);
+    return 0;
+}
+
+// Receive one datagram straight from the socket
+static ssize_t network_recv_raw(network_ctx_t *ctx, network_packet_t *packet, int timeout_ms) {
+    // Set timeout for receiving
+    struct timeval tv = {timeout_ms / 1000, (timeout_ms % 1000) * 1000};
+    setsockopt(ctx->sockfd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+
+    // Receive packet and return number of bytes received, with the
+    // kernel's timestamp of its arrival alongside
+    struct iovec iov = { packet, sizeof(network_packet_t) };
+    union {
+        char buf[CMSG_SPACE(sizeof(struct timespec))];
+        struct cmsghdr align;
+    } control;
+    struct msghdr msg = {0};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buf;
+    msg.msg_controllen = sizeof(control.buf);
+
+    ssize_t r = recvmsg(ctx->sockfd, &msg, 0);
+    if (r < 0) {
+        if (errno == EAGAIN || errno == EWOULDBLOCK) return 0; // timeout
+        return -1;
+    }
+
+    // The stamp is wall clock; move it onto the monotonic clock by how
+    // long ago it was
+    ctx->rx_time_us = network_time_us();
+    for (struct cmsghdr *c = CMSG_FIRSTHDR(&msg); c; c = CMSG_NXTHDR(&msg, c)) {
+        if (c->cmsg_level == SOL_SOCKET && c->cmsg_type == SCM_TIMESTAMPNS) {
+            struct timespec stamp, wall;
+            memcpy(&stamp, CMSG_DATA(c), sizeof(stamp));
+            clock_gettime(CLOCK_REALTIME, &wall);
+            int64_t ago = ((int64_t)wall.tv_sec - stamp.tv_sec) * 1000000 +
+                          (wall.tv_nsec - stamp.tv_nsec) / 1000;
+            if (ago > 0 && (uint64_t)ago < ctx->rx_time_us) ctx->rx_time_us -= ago;
+        }
+    }
+    return r;
+}
+
+// Receive through the impairment emulator: datagrams go into the emulator
+// as they arrive and come out once their (possibly delayed) time is due
+static ssize_t network_recv_impaired(network_ctx_t *ctx, network_packet_t *packet, int timeout_ms) {
+    uint64_t deadline = network_time_us() + (uint64_t)timeout_ms * 1000;
+
+    for (;;) {
+        uint64_t now = network_time_us();
+        int len;
+
+        // A delayed packet arrives when it comes out
+        if (netem_poll(ctx->netem, now, packet, &len)) {
+            ctx->rx_time_us = now;
+            return len;
+        }
+        if (now >= deadline) return 0;
+
+        // Sleep in the socket until the next delayed packet or the deadline
+        uint64_t wake = netem_next_due(ctx->netem);
+        if (wake > deadline) wake = deadline;
+        int wait_ms = (int)((wake - now + 999) / 1000);
+        if (wait_ms < 1) wait_ms = 1;
+
+        ssize_t r = network_recv_raw(ctx, packet, wait_ms);
+        if (r < 0) return -1;
+        if (r > 0) netem_submit(ctx->netem, packet, (int)r, network_time_us());
+    }
+}
+
+// What a received datagram leaves for the caller, 0 if it is dropped
+static ssize_t network_accept(network_ctx_t *ctx, network_packet_t *packet, ssize_t r) {
+    // Other talkgroups share the group address, they are not for us (and
+    // must not reach the replay window, seq_nums are per talkgroup)
+    if (r >= (ssize_t)PACKET_HEADER_SIZE && !ctx->all_talkgroups &&
+        packet->talkgroup != ctx->talkgroup) {
+        return 0;
+    }
+
+    // Packets that fail authentication are dropped like a timeout
+    if (ctx->crypto.enabled) {
+        if (network_unseal(ctx, packet, r) < 0) return 0;
+        r -= CRYPTO_OVERHEAD;
+    }
+    return r;
+}
+
 // Receive packet with optional timeout (ms)
 int network_recv(network_ctx_t *ctx, network_packet_t *packet, int timeout_ms) {
     if (!ctx->initialized) return -1;
 
-    // Set timeout for receiving
+    ssize_t r = ctx->netem ? network_recv_impaired(ctx, packet, timeout_ms)
+                           : network_recv_raw(ctx, packet, timeout_ms);
+    if (r <= 0) return r;
+    return network_accept(ctx, packet, r);
+}
+
+int network_recv_batch(network_ctx_t *ctx, network_packet_t *packets, int *lens,
+                       int count, int timeout_ms) {
+    struct mmsghdr msgs[NETWORK_BATCH_MAX];
+    struct iovec iov[NETWORK_BATCH_MAX];
+
+    if (!ctx->initialized || count < 1) return -1;
+    if (count > NETWORK_BATCH_MAX) count = NETWORK_BATCH_MAX;
+
+    // The emulator hands packets out one at a time
+    if (ctx->netem) {
+        lens[0] = network_recv(ctx, &packets[0], timeout_ms);
+        return lens[0] < 0 ? -1 : lens[0] > 0;
+    }
+
     struct timeval tv = {timeout_ms / 1000, (timeout_ms % 1000) * 1000};
     setsockopt(ctx->sockfd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
 
-    // Receive packet and return number of bytes received
-    ssize_t r = recvfrom(ctx->sockfd, packet, sizeof(network_packet_t), 0, NULL, NULL);
+    memset(msgs, 0, count * sizeof(struct mmsghdr));
+    for (int i = 0; i < count; i++) {
+        iov[i].iov_base = &packets[i];
+        iov[i].iov_len = sizeof(network_packet_t);
+        msgs[i].msg_hdr.msg_iov = &iov[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+
+    int r = recvmmsg(ctx->sockfd, msgs, count, MSG_WAITFORONE, NULL);
     if (r < 0) {
-        if (errno == EAGAIN || errno == EWOULDBLOCK) return 0; // timeout
+        if (errno == EAGAIN || errno == EWOULDBLOCK) return 0;  // timeout
         return -1;
     }
+
+    ctx->rx_time_us = network_time_us();
+    for (int i = 0; i < r; i++) {
+        lens[i] = (int)network_accept(ctx, &packets[i], msgs[i].msg_len);
+    }
     return r;
 }
 
@@ -107,12 +448,15 @@ int network_recv(network_ctx_t *ctx, network_packet_t *packet, int timeout_ms) {
 void network_cleanup(network_ctx_t *ctx) {
     if (ctx->initialized) {
         struct ip_mreq mreq;
-        mreq.imr_multiaddr.s_addr = inet_addr(MULTICAST_ADDR);
+        mreq.imr_multiaddr = ctx->group;
         mreq.imr_interface.s_addr = INADDR_ANY;
 
         // IP_DROP_MEMBERSHIP to leave the multicast group
         setsockopt(ctx->sockfd, IPPROTO_IP, IP_DROP_MEMBERSHIP, &mreq, sizeof(mreq));
         close(ctx->sockfd);
+        crypto_cleanup(&ctx->crypto);
+        free(ctx->netem);
+        ctx->netem = NULL;
         ctx->initialized = false;
     }
 }
@@ -127,3 +471,25 @@ uint32_t network_get_board_id(void) {
 
     return 1; // default
 }
+
+// Talkgroup (env or default)
+uint8_t network_get_talkgroup(void) {
+    const char *env = getenv("TALKGROUP");
+    if (env) {
+        int tg = atoi(env);
+        if (tg >= 0 && tg < CRYPTO_MAX_TALKGROUPS) return (uint8_t)tg;
+        fprintf(stderr, "TALKGROUP must be 0-%d, using 0\n", CRYPTO_MAX_TALKGROUPS - 1);
+    }
+    return 0;
+}
+
+uint64_t network_rx_time_us(const network_ctx_t *ctx) {
+    return ctx->rx_time_us;
+}
+
+// Monotonic time (us), unaffected by wall clock changes
+uint64_t network_time_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
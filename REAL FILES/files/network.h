@@ -5,6 +5,7 @@
 #include <stdbool.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
+#include "crypto.h"
 
 #define MULTICAST_ADDR      "239.0.0.1"
 
@@ -14,6 +15,9 @@
 // Maximum Opus packet size
 #define MAX_OPUS_PACKET     4000
 
+// Most packets handed to network_send_batch at once
+#define NETWORK_BATCH_MAX   16
+
 typedef struct __attribute__((packed)) {
     uint32_t board_id;
 
@@ -21,11 +25,14 @@ typedef struct __attribute__((packed)) {
     uint32_t seq_num;
 
     // Timestamp for when the packet was sent and microsecond part is for higher resolution
+    // (shared master time from network_ctx_t.clock, both 0 when there is none)
     uint32_t timestamp_sec;
     uint32_t timestamp_usec;
     uint16_t opus_size;
     uint8_t  flags;
-    uint8_t  reserved;
+
+    // Talkgroup the packet belongs to (selects the AEAD key)
+    uint8_t  talkgroup;
     uint8_t  opus_data[MAX_OPUS_PACKET];
 } network_packet_t;
 
@@ -33,24 +40,70 @@ typedef struct __attribute__((packed)) {
 // START: First packet of a transmission
 // END: Last packet of a transmission
 // PRIORITY: High priority packet
+// SECURE: Payload is encrypted and followed by session epoch + auth tag
+// SYNC: Clock synchronisation message (clocksync.h), not audio
+// RED: Payload carries earlier frames ahead of its own (red.h)
 
 #define PKT_FLAG_START      0x01
 #define PKT_FLAG_END        0x02
 #define PKT_FLAG_PRIORITY   0x04
+#define PKT_FLAG_SECURE     0x08
+#define PKT_FLAG_SYNC       0x10
+#define PKT_FLAG_RED        0x20
+
+// SYNC packets number from here and replay-check as board_id | this, so
+// they never share a nonce or a replay window with the board's audio
+#define SYNC_SEQ_BASE       0x80000000u
+
+// Size of the packet header in front of opus_data
+#define PACKET_HEADER_SIZE  (sizeof(network_packet_t) - MAX_OPUS_PACKET)
+
+// Optional receive-side impairment (netem.h)
+struct netem_ctx;
 
 // Network context
 
 // tx_seq_num is the sequence number for transmitted packets
+// session is the epoch mixed into the AEAD nonce so seq_nums restarting
+// from 0 after a reboot never reuse a nonce; it grows with every start
+// clock, when set, gives the time network_prepare stamps into packets
+// (microseconds, 0 while it has none); rx_time_us is when the last packet
+// network_recv returned reached the socket (CLOCK_MONOTONIC)
 typedef struct {
     int sockfd;
+    struct in_addr group;
     struct sockaddr_in multicast_addr;
     uint32_t my_board_id;
     uint32_t tx_seq_num;
+    uint8_t talkgroup;
+    uint32_t session;
+    crypto_ctx_t crypto;
+    struct netem_ctx *netem;
+    uint64_t (*clock)(void *arg);
+    void *clock_arg;
+    uint32_t sync_seq;
+    uint64_t rx_time_us;
+    bool all_talkgroups;            // Keep every talkgroup's packets, not just ours
     bool initialized;
 } network_ctx_t;
 
+// Where and how to talk; network_config_default gives the built-in group
+// and port with TALKGROUP, WT_KEYRING and WT_NETEM from the environment
+typedef struct {
+    char group[16];             // Dotted quad, must be multicast
+    uint16_t port;
+    uint8_t talkgroup;
+    const char *keyring;
+    const char *session_file;   // Start count for the session epoch, NULL: crypto_session_path()
+    const char *netem;          // Impairment spec, NULL or "" for none
+    bool all_talkgroups;        // Receive every talkgroup (RTP gateway), cleartext only
+} network_config_t;
+
+void network_config_default(network_config_t *cfg);
+
 // Initialize network (create socket, join multicast)
 int network_init(network_ctx_t *ctx, uint32_t board_id);
+int network_init_cfg(network_ctx_t *ctx, uint32_t board_id, const network_config_t *cfg);
 
 // Send Opus packet
 int network_send(network_ctx_t *ctx,
@@ -58,14 +111,44 @@ int network_send(network_ctx_t *ctx,
                  uint16_t opus_size,
                  uint8_t flags);
 
-// Receive packet (non-blocking with timeout)
+// Fill in the header and seal a payload already in packet->opus_data
+// (returns the length to send or -1). Does not touch ctx, so several
+// threads can prepare packets at once.
+int network_prepare(network_ctx_t *ctx, network_packet_t *packet, uint8_t talkgroup,
+                    uint32_t seq_num, uint16_t opus_size, uint8_t flags);
+
+// Send prepared packets in one syscall (sendmmsg), returns how many went out
+int network_send_batch(network_ctx_t *ctx, network_packet_t *const *packets,
+                       const int *lens, int count);
+
+// Send a clock synchronisation message as a PKT_FLAG_SYNC packet (any
+// thread; it has its own sequence numbers)
+int network_send_sync(network_ctx_t *ctx, const void *msg, uint16_t size);
+
+// Receive packet on our talkgroup (non-blocking with timeout)
 int network_recv(network_ctx_t *ctx,
                  network_packet_t *packet,
                  int timeout_ms);
 
+// Receive up to count packets in one syscall (recvmmsg): waits up to
+// timeout_ms for the first, then takes whatever else is queued. Each is
+// filtered and unsealed like network_recv, lens[i] is 0 for one that was
+// dropped. Returns how many slots were filled, 0 on timeout, -1 on error.
+int network_recv_batch(network_ctx_t *ctx, network_packet_t *packets, int *lens,
+                       int count, int timeout_ms);
+
 // Cleanup network
 void network_cleanup(network_ctx_t *ctx);
 
 uint32_t network_get_board_id(void);
 
+uint8_t network_get_talkgroup(void);
+
+// Monotonic clock in microseconds for packet arrival times
+uint64_t network_time_us(void);
+
+// When the last packet from network_recv arrived, from the kernel's
+// receive timestamp where there is one (network_time_us clock)
+uint64_t network_rx_time_us(const network_ctx_t *ctx);
+
 #endif // NETWORK_H
\ No newline at end of file
@@ -1,8 +1,77 @@
 #include "opus_helper.h"
+#include "wtlog.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
+// Defaults for the board
+void opus_enc_params_default(opus_enc_params_t *params, int bitrate) {
+    params->bitrate = bitrate;
+    
+    // Complexity is the encoding effort that Opus will use
+    // Complexity 5 is a good trade-off between quality and CPU
+    params->complexity = 5;
+    params->bandwidth = OPUS_AUTO;
+    
+    // FEC (Forward Error Correction) allows recovery of lost packets
+    // loss_perc tells Opus the expected packet loss percentage
+    params->fec = true;
+    params->loss_perc = 5;
+    
+    // Opus DTX (Discontinuous Transmission) can be disabled for continuous audio
+    params->dtx = false;
+}
+
+// Apply tuning to a live encoder (bench_codec sweeps these)
+int opus_enc_apply(opus_enc_ctx_t *ctx, const opus_enc_params_t *params) {
+    if (!ctx->encoder) {
+        return -1;
+    }
+    
+    // MAX_BANDWIDTH only takes a real band, so "no cap" is fullband;
+    // setting it explicitly also lifts a cap applied earlier
+    int max_bandwidth = params->bandwidth == OPUS_AUTO ?
+                        OPUS_BANDWIDTH_FULLBAND : params->bandwidth;
+    
+    // opus_encoder_ctl is used to configure various parameters of the encoder
+    if (opus_encoder_ctl(ctx->encoder, OPUS_SET_BITRATE(params->bitrate)) != OPUS_OK ||
+        opus_encoder_ctl(ctx->encoder, OPUS_SET_COMPLEXITY(params->complexity)) != OPUS_OK ||
+        opus_encoder_ctl(ctx->encoder, OPUS_SET_MAX_BANDWIDTH(max_bandwidth)) != OPUS_OK ||
+        opus_encoder_ctl(ctx->encoder, OPUS_SET_INBAND_FEC(params->fec ? 1 : 0)) != OPUS_OK ||
+        opus_encoder_ctl(ctx->encoder, OPUS_SET_PACKET_LOSS_PERC(params->loss_perc)) != OPUS_OK ||
+        opus_encoder_ctl(ctx->encoder, OPUS_SET_DTX(params->dtx ? 1 : 0)) != OPUS_OK) {
+        fprintf(stderr, "Opus encoder rejected settings\n");
+        return -1;
+    }
+    ctx->bitrate = params->bitrate;
+    return 0;
+}
+
+int opus_enc_check(const opus_enc_params_t *params) {
+    int error;
+    opus_enc_ctx_t trial = {0};
+    
+    trial.encoder = opus_encoder_create(SAMPLE_RATE, CHANNELS, OPUS_APPLICATION_VOIP, &error);
+    if (error != OPUS_OK) {
+        fprintf(stderr, "Opus encoder create failed: %s\n", opus_strerror(error));
+        return -1;
+    }
+    int ret = opus_enc_apply(&trial, params);
+    opus_encoder_destroy(trial.encoder);
+    return ret;
+}
+
+// Encoder settings shared by both ways of creating one
+static int opus_enc_configure(opus_enc_ctx_t *ctx, int bitrate) {
+    opus_enc_params_t params;
+    
+    // OPUS_SIGNAL_VOICE indicates voice signal
+    opus_encoder_ctl(ctx->encoder, OPUS_SET_SIGNAL(OPUS_SIGNAL_VOICE));
+    
+    opus_enc_params_default(&params, bitrate);
+    return opus_enc_apply(ctx, &params);
+}
+
 // Initialize Opus encoder
 int opus_enc_init(opus_enc_ctx_t *ctx, int bitrate) {
     int error;
@@ -20,32 +89,38 @@ int opus_enc_init(opus_enc_ctx_t *ctx, int bitrate) {
         return -1;
     }
     
-    // Set bitrate
-    // opus_encoder_ctl is used to configure various parameters of the encoder
-    opus_encoder_ctl(ctx->encoder, OPUS_SET_BITRATE(bitrate));
-    ctx->bitrate = bitrate;
+    if (opus_enc_configure(ctx, bitrate) < 0) {
+        opus_encoder_destroy(ctx->encoder);
+        ctx->encoder = NULL;
+        return -1;
+    }
+    ctx->external = false;
+    ctx->initialized = true;
+    printf("Opus encoder initialised: %d Hz, %d ch, %d bps\n",
+           SAMPLE_RATE, CHANNELS, bitrate);
     
-    // Optimize for low latency
-    // OPUS_SIGNAL_VOICE indicates voice signal
-    // Complexity is the encoding effort that Opus will use
-    // Complexity 5 is a good trade-off between quality and CPU
-    // Opus DTX (Discontinuous Transmission) can be disabled for continuous audio
+    return 0;
+}
 
-    opus_encoder_ctl(ctx->encoder, OPUS_SET_SIGNAL(OPUS_SIGNAL_VOICE));
-    opus_encoder_ctl(ctx->encoder, OPUS_SET_COMPLEXITY(5));
-    opus_encoder_ctl(ctx->encoder, OPUS_SET_DTX(0));
+// Initialize an encoder in memory the caller owns (codec pools)
+int opus_enc_init_in(opus_enc_ctx_t *ctx, void *mem, int bitrate) {
+    ctx->encoder = (OpusEncoder *)mem;
     
-    // Enable FEC for packet loss resilience
-    // FEC (Forward Error Correction) allows recovery of lost packets
-    // OPUS_SET_PACKET_LOSS_PERC tells Opus the expected packet loss percentage
-
-    opus_encoder_ctl(ctx->encoder, OPUS_SET_INBAND_FEC(1));
-    opus_encoder_ctl(ctx->encoder, OPUS_SET_PACKET_LOSS_PERC(5));
+    int error = opus_encoder_init(ctx->encoder, SAMPLE_RATE, CHANNELS,
+                                  OPUS_APPLICATION_VOIP);
+    if (error != OPUS_OK) {
+        fprintf(stderr, "Opus encoder init failed: %s\n",
+                opus_strerror(error));
+        ctx->encoder = NULL;
+        return -1;
+    }
     
+    if (opus_enc_configure(ctx, bitrate) < 0) {
+        ctx->encoder = NULL;
+        return -1;
+    }
+    ctx->external = true;
     ctx->initialized = true;
-    printf("Opus encoder initialised: %d Hz, %d ch, %d bps\n",
-           SAMPLE_RATE, CHANNELS, bitrate);
-    
     return 0;
 }
 
@@ -60,7 +135,7 @@ int opus_encode_frame(opus_enc_ctx_t *ctx,
                       uint8_t *opus_out,
                       int max_bytes) {
     if (!ctx->initialized) {
-        fprintf(stderr, "Encoder not initialised\n");
+        WTLOG_ERROR("Encoder not initialised");
         return -1;
     }
     
@@ -68,8 +143,7 @@ int opus_encode_frame(opus_enc_ctx_t *ctx,
                                     opus_out, max_bytes);
     
     if (encoded_bytes < 0) {
-        fprintf(stderr, "Opus encode error: %s\n", 
-                opus_strerror(encoded_bytes));
+        WTLOG_WARN("Opus encode error: %s", opus_strerror(encoded_bytes));
         return -1;
     }
     
@@ -79,7 +153,7 @@ int opus_encode_frame(opus_enc_ctx_t *ctx,
 // Cleanup encoder
 void opus_enc_cleanup(opus_enc_ctx_t *ctx) {
     if (ctx->initialized && ctx->encoder) {
-        opus_encoder_destroy(ctx->encoder);
+        if (!ctx->external) opus_encoder_destroy(ctx->encoder);
         ctx->encoder = NULL;
         ctx->initialized = false;
     }
@@ -96,6 +170,7 @@ int opus_dec_init(opus_dec_ctx_t *ctx) {
         return -1;
     }
     
+    ctx->external = false;
     ctx->initialized = true;
     printf("Opus decoder initialised: %d Hz, %d ch\n",
            SAMPLE_RATE, CHANNELS);
@@ -103,6 +178,23 @@ int opus_dec_init(opus_dec_ctx_t *ctx) {
     return 0;
 }
 
+// Initialize a decoder in memory the caller owns (codec pools)
+int opus_dec_init_in(opus_dec_ctx_t *ctx, void *mem) {
+    ctx->decoder = (OpusDecoder *)mem;
+    
+    int error = opus_decoder_init(ctx->decoder, SAMPLE_RATE, CHANNELS);
+    if (error != OPUS_OK) {
+        fprintf(stderr, "Opus decoder init failed: %s\n",
+                opus_strerror(error));
+        ctx->decoder = NULL;
+        return -1;
+    }
+    
+    ctx->external = true;
+    ctx->initialized = true;
+    return 0;
+}
+
 // Decode Opus packet to PCM
 int opus_decode_frame(opus_dec_ctx_t *ctx,
                       const uint8_t *opus_in,
@@ -110,7 +202,7 @@ int opus_decode_frame(opus_dec_ctx_t *ctx,
                       int16_t *pcm_out,
                       int frame_size) {
     if (!ctx->initialized) {
-        fprintf(stderr, "Decoder not initialised\n");
+        WTLOG_ERROR("Decoder not initialised");
         return -1;
     }
     
@@ -119,8 +211,7 @@ int opus_decode_frame(opus_dec_ctx_t *ctx,
                                       pcm_out, frame_size, 0);
     
     if (decoded_samples < 0) {
-        fprintf(stderr, "Opus decode error: %s\n",
-                opus_strerror(decoded_samples));
+        WTLOG_WARN("Opus decode error: %s", opus_strerror(decoded_samples));
         return -1;
     }
     
@@ -132,7 +223,7 @@ int opus_decode_lost(opus_dec_ctx_t *ctx,
                      int16_t *pcm_out,
                      int frame_size) {
     if (!ctx->initialized) {
-        fprintf(stderr, "Decoder not initialised\n");
+        WTLOG_ERROR("Decoder not initialised");
         return -1;
     }
     
@@ -141,18 +232,54 @@ int opus_decode_lost(opus_dec_ctx_t *ctx,
                                       pcm_out, frame_size, 1);
     
     if (decoded_samples < 0) {
-        fprintf(stderr, "Opus FEC decode error: %s\n",
-                opus_strerror(decoded_samples));
+        WTLOG_WARN("Opus FEC decode error: %s", opus_strerror(decoded_samples));
         return -1;
     }
     
     return decoded_samples;
 }
 
+// Recover a lost frame from the in-band FEC carried by the packet after it
+int opus_decode_fec(opus_dec_ctx_t *ctx,
+                    const uint8_t *next_opus,
+                    int next_size,
+                    int16_t *pcm_out,
+                    int frame_size) {
+    if (!ctx->initialized) {
+        WTLOG_ERROR("Decoder not initialised");
+        return -1;
+    }
+
+    // decode_fec = 1 decodes the redundant copy of the previous frame
+    int decoded_samples = opus_decode(ctx->decoder, next_opus, next_size,
+                                      pcm_out, frame_size, 1);
+
+    if (decoded_samples < 0) {
+        WTLOG_WARN("Opus FEC decode error: %s", opus_strerror(decoded_samples));
+        return -1;
+    }
+
+    return decoded_samples;
+}
+
+// Forget all encoder history, settings are kept
+void opus_enc_reset(opus_enc_ctx_t *ctx) {
+    if (ctx->initialized) {
+        opus_encoder_ctl(ctx->encoder, OPUS_RESET_STATE);
+    }
+}
+
+// Forget all decoder history (new stream)
+void opus_dec_reset(opus_dec_ctx_t *ctx) {
+    if (ctx->initialized) {
+        opus_decoder_ctl(ctx->decoder, OPUS_RESET_STATE);
+    }
+}
+
 // Cleanup decoder
 void opus_dec_cleanup(opus_dec_ctx_t *ctx) {
     if (ctx->initialized && ctx->decoder) {
-        opus_decoder_destroy(ctx->decoder);
+        if (!ctx->external) opus_decoder_destroy(ctx->decoder);
         ctx->decoder = NULL;
         ctx->initialized = false;
     }
@@ -16,15 +16,38 @@
 typedef struct {
     OpusEncoder *encoder;
     int bitrate;
+    bool external;          // State lives in caller memory, not opus' own malloc
     bool initialized;
 } opus_enc_ctx_t;
 
 typedef struct {
     OpusDecoder *decoder;
+    bool external;
     bool initialized;
 } opus_dec_ctx_t;
 
+// Encoder tuning, opus_enc_init applies opus_enc_params_default
+typedef struct {
+    int bitrate;
+    int complexity;         // 0-10
+    int bandwidth;          // Max bandwidth, OPUS_BANDWIDTH_* or OPUS_AUTO (no cap)
+    bool fec;
+    int loss_perc;          // Expected loss, sizes the in-band FEC
+    bool dtx;
+} opus_enc_params_t;
+
+void opus_enc_params_default(opus_enc_params_t *params, int bitrate);
+int opus_enc_apply(opus_enc_ctx_t *ctx, const opus_enc_params_t *params);
+
+// Whether libopus takes params, tried on a throwaway encoder (allocates,
+// not for the audio threads)
+int opus_enc_check(const opus_enc_params_t *params);
+
 int opus_enc_init(opus_enc_ctx_t *ctx, int bitrate);
+
+// Same, but in caller-owned memory of at least opus_encoder_get_size(CHANNELS)
+// bytes (no allocation; cleanup leaves the memory alone)
+int opus_enc_init_in(opus_enc_ctx_t *ctx, void *mem, int bitrate);
 int opus_encode_frame(opus_enc_ctx_t *ctx, 
                       const int16_t *pcm_in,
                       int frame_size,
@@ -32,6 +55,7 @@ int opus_encode_frame(opus_enc_ctx_t *ctx,
                       int max_bytes);
 void opus_enc_cleanup(opus_enc_ctx_t *ctx);
 int opus_dec_init(opus_dec_ctx_t *ctx);
+int opus_dec_init_in(opus_dec_ctx_t *ctx, void *mem);
 int opus_decode_frame(opus_dec_ctx_t *ctx,
                       const uint8_t *opus_in,
                       int packet_size,
@@ -40,6 +64,13 @@ int opus_decode_frame(opus_dec_ctx_t *ctx,
 int opus_decode_lost(opus_dec_ctx_t *ctx,
                      int16_t *pcm_out,
                      int frame_size);
+int opus_decode_fec(opus_dec_ctx_t *ctx,
+                    const uint8_t *next_opus,
+                    int next_size,
+                    int16_t *pcm_out,
+                    int frame_size);
+void opus_enc_reset(opus_enc_ctx_t *ctx);
+void opus_dec_reset(opus_dec_ctx_t *ctx);
 void opus_dec_cleanup(opus_dec_ctx_t *ctx);
 void convert_i32_to_i16(const int32_t *in, int16_t *out, int samples);
 void convert_i16_to_i32(const int16_t *in, int32_t *out, int samples);
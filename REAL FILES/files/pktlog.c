@@ -0,0 +1,245 @@
+#include "pktlog.h"
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <time.h>
+
+#define PKTLOG_ALIGN(n)     (((n) + 7) & ~(size_t)7)
+
+// Stdio buffer so records hit the disk in large writes
+#define PKTLOG_BUFFER       (64 * 1024)
+
+// Writer wakes at least this often, and flushes after every batch
+#define PKTLOG_WAKE_MS      250
+
+// Writer thread: one record from the ring into the file
+static void pktlog_store(pktlog_writer_t *w, const pktlog_slot_t *slot) {
+    static const uint8_t zeros[8] = {0};
+
+    pktlog_record_t rec = {0};
+    rec.arrival_us = slot->arrival_us;
+    rec.length = (uint16_t)slot->length;
+
+    size_t len = slot->length;
+    size_t pad = PKTLOG_ALIGN(len) - len;
+    if (fwrite(&rec, sizeof(rec), 1, w->file) != 1 ||
+        fwrite(slot->data, 1, len, w->file) != len ||
+        (pad && fwrite(zeros, 1, pad, w->file) != pad)) {
+        w->write_errors++;
+        return;
+    }
+    w->records++;
+}
+
+static void *pktlog_writer(void *arg) {
+    pktlog_writer_t *w = arg;
+
+    for (;;) {
+        struct timespec ts;
+        clock_gettime(CLOCK_REALTIME, &ts);
+        ts.tv_nsec += PKTLOG_WAKE_MS * 1000000L;
+        if (ts.tv_nsec >= 1000000000L) {
+            ts.tv_sec++;
+            ts.tv_nsec -= 1000000000L;
+        }
+        sem_timedwait(&w->ready, &ts);
+
+        // Everything queued so far, then one flush for the batch
+        uint32_t head = __atomic_load_n(&w->head, __ATOMIC_ACQUIRE);
+        uint32_t tail = w->tail;
+        if (tail != head) {
+            while (tail != head) {
+                pktlog_store(w, &w->ring[tail & (PKTLOG_RING_SLOTS - 1)]);
+                tail++;
+                __atomic_store_n(&w->tail, tail, __ATOMIC_RELEASE);
+            }
+            if (fflush(w->file) != 0) w->write_errors++;
+        }
+
+        if (__atomic_load_n(&w->stop, __ATOMIC_ACQUIRE) &&
+            __atomic_load_n(&w->head, __ATOMIC_ACQUIRE) == tail) {
+            break;
+        }
+    }
+    return NULL;
+}
+
+int pktlog_open_write(pktlog_writer_t *w, const char *path, uint32_t board_id) {
+    memset(w, 0, sizeof(pktlog_writer_t));
+
+    w->file = fopen(path, "wb");
+    if (!w->file) {
+        perror("pktlog_open_write");
+        return -1;
+    }
+    setvbuf(w->file, NULL, _IOFBF, PKTLOG_BUFFER);
+
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+
+    pktlog_header_t h = {0};
+    h.magic = PKTLOG_MAGIC;
+    h.version = PKTLOG_VERSION;
+    h.header_size = sizeof(pktlog_header_t);
+    h.board_id = board_id;
+    h.start_realtime_us = (uint64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+
+    if (fwrite(&h, sizeof(h), 1, w->file) != 1) {
+        perror("pktlog header");
+        fclose(w->file);
+        w->file = NULL;
+        return -1;
+    }
+
+    // The whole ring up front, nothing is allocated while recording
+    w->ring = calloc(PKTLOG_RING_SLOTS, sizeof(pktlog_slot_t));
+    if (!w->ring) {
+        fprintf(stderr, "Packet log: out of memory\n");
+        fclose(w->file);
+        w->file = NULL;
+        return -1;
+    }
+
+    if (sem_init(&w->ready, 0, 0) < 0) {
+        perror("sem_init");
+        free(w->ring);
+        w->ring = NULL;
+        fclose(w->file);
+        w->file = NULL;
+        return -1;
+    }
+
+    if (pthread_create(&w->writer, NULL, pktlog_writer, w) != 0) {
+        fprintf(stderr, "Packet log: failed to start writer thread\n");
+        sem_destroy(&w->ready);
+        free(w->ring);
+        w->ring = NULL;
+        fclose(w->file);
+        w->file = NULL;
+        return -1;
+    }
+
+    printf("Packet log: recording to %s\n", path);
+    return 0;
+}
+
+int pktlog_write(pktlog_writer_t *w, const network_packet_t *packet, int len, uint64_t now_us) {
+    if (!w->file || len <= 0 || len > (int)sizeof(network_packet_t)) return -1;
+
+    if (!w->started) {
+        w->base_us = now_us;
+        w->started = true;
+    }
+
+    uint32_t head = w->head;
+    if (head - __atomic_load_n(&w->tail, __ATOMIC_ACQUIRE) >= PKTLOG_RING_SLOTS) {
+        w->ring_drops++;
+        return -1;
+    }
+
+    pktlog_slot_t *slot = &w->ring[head & (PKTLOG_RING_SLOTS - 1)];
+    slot->arrival_us = now_us - w->base_us;
+    slot->length = len;
+    memcpy(slot->data, packet, len);
+
+    __atomic_store_n(&w->head, head + 1, __ATOMIC_RELEASE);
+    sem_post(&w->ready);
+    return 0;
+}
+
+void pktlog_close(pktlog_writer_t *w) {
+    if (!w->file) return;
+
+    __atomic_store_n(&w->stop, true, __ATOMIC_RELEASE);
+    sem_post(&w->ready);
+    pthread_join(w->writer, NULL);
+
+    fclose(w->file);
+    w->file = NULL;
+    sem_destroy(&w->ready);
+    free(w->ring);
+    w->ring = NULL;
+    printf("Packet log: %lu packets recorded, %lu dropped, %lu write errors\n",
+           (unsigned long)w->records, (unsigned long)w->ring_drops,
+           (unsigned long)w->write_errors);
+}
+
+int pktlog_open_read(pktlog_reader_t *r, const char *path) {
+    memset(r, 0, sizeof(pktlog_reader_t));
+
+    r->fd = open(path, O_RDONLY);
+    if (r->fd < 0) {
+        perror("pktlog_open_read");
+        return -1;
+    }
+
+    struct stat st;
+    if (fstat(r->fd, &st) < 0 || st.st_size < (off_t)sizeof(pktlog_header_t)) {
+        fprintf(stderr, "%s: too short for a packet log\n", path);
+        close(r->fd);
+        return -1;
+    }
+
+    r->size = st.st_size;
+    r->map = mmap(NULL, r->size, PROT_READ, MAP_PRIVATE, r->fd, 0);
+    if (r->map == MAP_FAILED) {
+        perror("pktlog mmap");
+        close(r->fd);
+        return -1;
+    }
+
+    r->header = (const pktlog_header_t *)r->map;
+    if (r->header->magic != PKTLOG_MAGIC || r->header->version != PKTLOG_VERSION ||
+        r->header->header_size < sizeof(pktlog_header_t) ||
+        r->header->header_size > r->size) {
+        fprintf(stderr, "%s: not a packet log (or unsupported version)\n", path);
+        pktlog_close_read(r);
+        return -1;
+    }
+
+    // Replays stream through the file once, front to back
+    madvise((void *)r->map, r->size, MADV_SEQUENTIAL);
+
+    r->offset = r->header->header_size;
+    return 0;
+}
+
+int pktlog_next(pktlog_reader_t *r, const network_packet_t **packet,
+                int *len, uint64_t *arrival_us) {
+    if (r->offset + sizeof(pktlog_record_t) > r->size) return 0;
+
+    const pktlog_record_t *rec = (const pktlog_record_t *)(r->map + r->offset);
+    size_t payload = rec->length;
+
+    // Truncated tail (recorder killed mid-write)
+    if (r->offset + sizeof(pktlog_record_t) + payload > r->size) return 0;
+
+    *packet = (const network_packet_t *)(r->map + r->offset + sizeof(pktlog_record_t));
+    *len = (int)payload;
+    *arrival_us = rec->arrival_us;
+
+    r->offset += sizeof(pktlog_record_t) + PKTLOG_ALIGN(payload);
+    return 1;
+}
+
+void pktlog_rewind(pktlog_reader_t *r) {
+    if (r->header) {
+        r->offset = r->header->header_size;
+    }
+}
+
+void pktlog_close_read(pktlog_reader_t *r) {
+    if (r->map && r->map != MAP_FAILED) {
+        munmap((void *)r->map, r->size);
+    }
+    if (r->fd >= 0) {
+        close(r->fd);
+    }
+    r->map = NULL;
+    r->header = NULL;
+    r->fd = -1;
+}
@@ -0,0 +1,88 @@
+#ifndef PKTLOG_H
+#define PKTLOG_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stddef.h>
+#include <pthread.h>
+#include <semaphore.h>
+
+#include "network.h"
+
+// Packet log file layout:
+//   pktlog_header_t
+//   repeated { pktlog_record_t, packet bytes, zero padding to 8 bytes }
+// Records are 8 byte aligned so a reader can walk an mmap of the file
+// without copying.
+#define PKTLOG_MAGIC        0x4C505457      // "WTPL"
+#define PKTLOG_VERSION      1
+
+typedef struct __attribute__((packed)) {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t header_size;
+    uint32_t board_id;              // Board that recorded the log
+    uint32_t reserved;
+    uint64_t start_realtime_us;     // Wall clock when recording started
+} pktlog_header_t;
+
+typedef struct __attribute__((packed)) {
+    uint64_t arrival_us;            // Monotonic, relative to the first record
+    uint16_t length;                // Bytes returned by network_recv
+    uint16_t reserved;
+    uint32_t reserved2;
+} pktlog_record_t;
+
+// The RX thread only copies each packet into a ring (pktlog_write never
+// blocks or touches the disk); a writer thread empties it into the file,
+// so a stalled disk costs log records, not audio
+#define PKTLOG_RING_SLOTS   256             // ~5 s of four talkers, power of 2
+
+typedef struct {
+    uint64_t arrival_us;
+    int length;
+    uint8_t data[sizeof(network_packet_t)];
+} pktlog_slot_t;
+
+typedef struct {
+    FILE *file;
+    uint64_t base_us;
+    bool started;
+
+    // RX thread -> writer, single producer / single consumer
+    pktlog_slot_t *ring;
+    uint32_t head;                  // Written by pktlog_write
+    uint32_t tail;                  // Written by the writer
+    sem_t ready;
+    pthread_t writer;
+    bool stop;
+
+    uint64_t records;               // Written to the file
+    uint64_t ring_drops;            // Writer fell behind
+    uint64_t write_errors;
+} pktlog_writer_t;
+
+typedef struct {
+    int fd;
+    const uint8_t *map;
+    size_t size;
+    size_t offset;
+    const pktlog_header_t *header;
+} pktlog_reader_t;
+
+// Recorder: open starts the writer thread, close writes out what is
+// queued and stops it; pktlog_write returns -1 when the ring is full
+int pktlog_open_write(pktlog_writer_t *w, const char *path, uint32_t board_id);
+int pktlog_write(pktlog_writer_t *w, const network_packet_t *packet, int len, uint64_t now_us);
+void pktlog_close(pktlog_writer_t *w);
+
+// Reader (mmap)
+int pktlog_open_read(pktlog_reader_t *r, const char *path);
+// Returns 1 and fills the outputs for the next record, 0 at end of file
+int pktlog_next(pktlog_reader_t *r, const network_packet_t **packet,
+                int *len, uint64_t *arrival_us);
+void pktlog_rewind(pktlog_reader_t *r);
+void pktlog_close_read(pktlog_reader_t *r);
+
+#endif // PKTLOG_H
@@ -0,0 +1,295 @@
+#include "playback_dsp.h"
+#include "dsp_simd.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+// Loudness tracking, per 20 ms frame of speech
+#define PB_SILENCE_DBFS     -50.0f      // Quieter frames leave the talker's gain alone
+#define PB_LEARN_FRAMES     10          // First frames of a new talker converge fast
+#define PB_ATTACK           0.3f
+#define PB_RELEASE          0.05f
+#define PB_UP_DB            0.5f        // Gain slew limits (learning: x4)
+#define PB_DOWN_DB          2.0f
+
+// Limiter release, fraction of the way back to unity per block
+#define PB_LIMIT_RELEASE    0.02f
+
+// Raised-cosine fade on every beep edge, keeps the tones click free
+#define PB_TONE_FADE_MS     5
+
+typedef struct {
+    float hz;                   // 0 = gap
+    int ms;
+} tone_seg_t;
+
+static const tone_seg_t tone_talk_permit[] = { {1400.0f, 50}, {0.0f, 30}, {1400.0f, 50} };
+static const tone_seg_t tone_roger[] = { {1200.0f, 70}, {900.0f, 70} };
+
+static float db_to_lin(float db) {
+    return powf(10.0f, db / 20.0f);
+}
+
+void playback_dsp_config_default(playback_dsp_config_t *cfg) {
+    cfg->normalize = true;
+    cfg->target_dbfs = -20.0f;
+    cfg->max_gain_db = 15.0f;
+    cfg->tones = true;
+    cfg->tone_dbfs = -12.0f;
+    cfg->limiter = true;
+    cfg->limit_dbfs = -1.0f;
+}
+
+int playback_dsp_parse(playback_dsp_config_t *cfg, const char *spec) {
+    char buf[256];
+    snprintf(buf, sizeof(buf), "%s", spec);
+
+    char *save = NULL;
+    for (char *tok = strtok_r(buf, ", ", &save); tok; tok = strtok_r(NULL, ", ", &save)) {
+        if (strcmp(tok, "off") == 0) {
+            cfg->normalize = cfg->tones = cfg->limiter = false;
+            continue;
+        }
+
+        char *eq = strchr(tok, '=');
+        if (!eq) {
+            fprintf(stderr, "playback_dsp: expected key=value, got '%s'\n", tok);
+            return -1;
+        }
+        *eq = '\0';
+        const char *key = tok;
+        const char *val = eq + 1;
+        bool on = strcmp(val, "off") != 0;
+
+        if (strcmp(key, "norm") == 0) {
+            cfg->normalize = on;
+            if (on) cfg->target_dbfs = atof(val);
+        } else if (strcmp(key, "gain") == 0) {
+            cfg->max_gain_db = atof(val);
+        } else if (strcmp(key, "tones") == 0) {
+            cfg->tones = on;
+            if (on) cfg->tone_dbfs = atof(val);
+        } else if (strcmp(key, "limit") == 0) {
+            cfg->limiter = on;
+            if (on) cfg->limit_dbfs = atof(val);
+        } else {
+            fprintf(stderr, "playback_dsp: unknown key '%s'\n", key);
+            return -1;
+        }
+    }
+
+    if ((cfg->normalize && (cfg->target_dbfs > 0.0f || cfg->max_gain_db < 0.0f ||
+                            cfg->max_gain_db > 30.0f)) ||
+        (cfg->tones && cfg->tone_dbfs > 0.0f) ||
+        (cfg->limiter && cfg->limit_dbfs > 0.0f)) {
+        fprintf(stderr, "playback_dsp: parameter out of range in '%s'\n", spec);
+        return -1;
+    }
+    return 0;
+}
+
+// Render a beep sequence into a table, returns its length in samples
+static int build_tone(float *out, const tone_seg_t *seg, int count, float amp) {
+    int fade = SAMPLE_RATE * PB_TONE_FADE_MS / 1000;
+    int pos = 0;
+
+    for (int s = 0; s < count; s++) {
+        int n = SAMPLE_RATE * seg[s].ms / 1000;
+        if (pos + n > PB_TONE_MAX_SAMPLES) n = PB_TONE_MAX_SAMPLES - pos;
+
+        for (int i = 0; i < n; i++) {
+            double v = 0.0;
+            if (seg[s].hz > 0.0f) {
+                double env = 1.0;
+                if (i < fade) env = 0.5 - 0.5 * cos(M_PI * i / fade);
+                if (i >= n - fade) env = 0.5 - 0.5 * cos(M_PI * (n - 1 - i) / fade);
+                v = amp * env * sin(2.0 * M_PI * seg[s].hz * i / SAMPLE_RATE);
+            }
+            out[pos++] = (float)v;
+        }
+    }
+    return pos;
+}
+
+int playback_dsp_init(playback_dsp_ctx_t *ctx, const playback_dsp_config_t *cfg) {
+    memset(ctx, 0, sizeof(playback_dsp_ctx_t));
+    ctx->cfg = *cfg;
+
+    float amp = db_to_lin(cfg->tone_dbfs);
+    ctx->tone_len[PB_TONE_TALK_PERMIT] =
+        build_tone(ctx->tone_table[PB_TONE_TALK_PERMIT], tone_talk_permit,
+                   sizeof(tone_talk_permit) / sizeof(tone_talk_permit[0]), amp);
+    ctx->tone_len[PB_TONE_ROGER] =
+        build_tone(ctx->tone_table[PB_TONE_ROGER], tone_roger,
+                   sizeof(tone_roger) / sizeof(tone_roger[0]), amp);
+
+    ctx->limit_ceiling = db_to_lin(cfg->limit_dbfs);
+    ctx->limit_gain = 1.0f;
+
+    ctx->initialized = true;
+    return 0;
+}
+
+// Find the talker's slot, or recycle the one heard least recently
+static pb_sender_t *sender_lookup(playback_dsp_ctx_t *ctx, uint32_t board_id) {
+    pb_sender_t *slot = NULL;
+
+    for (int i = 0; i < PB_MAX_SENDERS; i++) {
+        pb_sender_t *s = &ctx->senders[i];
+        if (s->used && s->board_id == board_id) {
+            return s;
+        }
+        if (!slot || (slot->used && (!s->used || s->last_heard < slot->last_heard))) {
+            slot = s;
+        }
+    }
+
+    if (slot->used) {
+        ctx->stats.senders_evicted++;
+    }
+    memset(slot, 0, sizeof(pb_sender_t));
+    slot->used = true;
+    slot->board_id = board_id;
+    slot->level_db = ctx->cfg.target_dbfs;
+    return slot;
+}
+
+static void normalize_process(playback_dsp_ctx_t *ctx, float *x, int n, uint32_t board_id) {
+    const playback_dsp_config_t *cfg = &ctx->cfg;
+    pb_sender_t *s = sender_lookup(ctx, board_id);
+    s->last_heard = ++ctx->tick;
+
+    float rms = sqrtf(dsp_energy(x, n) / n);
+    float level = 20.0f * log10f(rms + 1e-9f);
+    float gain_db = s->gain_db;
+
+    // Pauses and concealment tails keep the gain where it is
+    if (level > PB_SILENCE_DBFS) {
+        bool learning = s->speech_frames < PB_LEARN_FRAMES;
+        if (s->speech_frames == 0) {
+            s->level_db = level;
+        } else {
+            float k = learning ? 0.5f : (level > s->level_db ? PB_ATTACK : PB_RELEASE);
+            s->level_db += (level - s->level_db) * k;
+        }
+        s->speech_frames++;
+
+        float want = cfg->target_dbfs - s->level_db;
+        if (want > cfg->max_gain_db) want = cfg->max_gain_db;
+        if (want < -cfg->max_gain_db) want = -cfg->max_gain_db;
+
+        float up = learning ? 4.0f * PB_UP_DB : PB_UP_DB;
+        float down = learning ? 4.0f * PB_DOWN_DB : PB_DOWN_DB;
+        if (want > gain_db + up) want = gain_db + up;
+        if (want < gain_db - down) want = gain_db - down;
+        gain_db = want;
+    }
+
+    float g0 = db_to_lin(s->gain_db);
+    float g1 = db_to_lin(gain_db);
+    dsp_gain_ramp(x, g0, (g1 - g0) / n, n);
+    s->gain_db = gain_db;
+}
+
+static void tone_mix(playback_dsp_ctx_t *ctx, float *x, int n) {
+    int request = __atomic_exchange_n(&ctx->tone_request, PB_TONE_NONE, __ATOMIC_ACQUIRE);
+    if (request != PB_TONE_NONE && ctx->cfg.tones) {
+        ctx->tone_active = request;
+        ctx->tone_pos = 0;
+        ctx->stats.tones++;
+    }
+    if (ctx->tone_active == PB_TONE_NONE) return;
+
+    int left = ctx->tone_len[ctx->tone_active] - ctx->tone_pos;
+    int len = left < n ? left : n;
+    dsp_add(x, ctx->tone_table[ctx->tone_active] + ctx->tone_pos, len);
+    ctx->tone_pos += len;
+    if (ctx->tone_pos >= ctx->tone_len[ctx->tone_active]) {
+        ctx->tone_active = PB_TONE_NONE;
+    }
+}
+
+static float limit_target(const playback_dsp_ctx_t *ctx, float peak) {
+    return peak > ctx->limit_ceiling ? ctx->limit_ceiling / peak : 1.0f;
+}
+
+// Look-ahead limiter. Output runs one block behind the input, so the gain
+// for each block already knows the peak of the block after it and ramps
+// down across the whole block instead of jumping. Both ends of every ramp
+// sit below the ceiling for the block they scale, so no sample clips.
+static void limiter_process(playback_dsp_ctx_t *ctx, float *x) {
+    float *la = ctx->la;
+    float peak_cur = ctx->la_peak;
+
+    memcpy(la + PB_BLOCK, x, FRAME_SIZE * sizeof(float));
+
+    for (int b = 0; b < PB_BLOCKS_PER_FRAME; b++) {
+        float *block = la + b * PB_BLOCK;
+        float peak_next = dsp_peak(block + PB_BLOCK, PB_BLOCK);
+
+        float target = limit_target(ctx, peak_cur);
+        float ahead = limit_target(ctx, peak_next);
+        if (ahead < target) target = ahead;
+
+        float g0 = ctx->limit_gain;
+        float g1 = g0 + (1.0f - g0) * PB_LIMIT_RELEASE;
+        if (g1 > target) g1 = target;
+        if (g1 > 0.9999f && target >= 1.0f) g1 = 1.0f;
+
+        if (g0 < 1.0f || g1 < 1.0f) {
+            dsp_gain_ramp(block, g0, (g1 - g0) / PB_BLOCK, PB_BLOCK);
+            ctx->stats.limited_blocks++;
+        }
+        ctx->limit_gain = g1;
+        peak_cur = peak_next;
+    }
+
+    memcpy(x, la, FRAME_SIZE * sizeof(float));
+    memcpy(la, la + FRAME_SIZE, PB_BLOCK * sizeof(float));
+    ctx->la_peak = peak_cur;
+}
+
+void playback_dsp_process(playback_dsp_ctx_t *ctx, int16_t *pcm, uint32_t sender) {
+    const playback_dsp_config_t *cfg = &ctx->cfg;
+    float *x = ctx->work;
+
+    if (!cfg->normalize && !cfg->tones && !cfg->limiter) return;
+
+    dsp_i16_to_f32(pcm, x, FRAME_SIZE);
+
+    if (cfg->normalize) normalize_process(ctx, x, FRAME_SIZE, sender);
+    tone_mix(ctx, x, FRAME_SIZE);
+    if (cfg->limiter) limiter_process(ctx, x);
+
+    dsp_f32_to_i16(x, pcm, FRAME_SIZE);
+    ctx->stats.frames++;
+}
+
+void playback_dsp_tone(playback_dsp_ctx_t *ctx, pb_tone_t tone) {
+    __atomic_store_n(&ctx->tone_request, (int)tone, __ATOMIC_RELEASE);
+}
+
+int playback_dsp_idle(playback_dsp_ctx_t *ctx, int16_t *pcm) {
+    const playback_dsp_config_t *cfg = &ctx->cfg;
+    float *x = ctx->work;
+
+    bool pending = cfg->tones &&
+                   __atomic_load_n(&ctx->tone_request, __ATOMIC_ACQUIRE) != PB_TONE_NONE;
+    bool tail = cfg->limiter && ctx->la_peak > 0.0f;
+    if (!pending && ctx->tone_active == PB_TONE_NONE && !tail) {
+        return 0;
+    }
+
+    memset(x, 0, FRAME_SIZE * sizeof(float));
+    tone_mix(ctx, x, FRAME_SIZE);
+    if (cfg->limiter) limiter_process(ctx, x);
+
+    dsp_f32_to_i16(x, pcm, FRAME_SIZE);
+    ctx->stats.idle_frames++;
+    return 1;
+}
@@ -0,0 +1,103 @@
+#ifndef PLAYBACK_DSP_H
+#define PLAYBACK_DSP_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "opus_helper.h"
+
+// RX conditioning between rx_pipeline_pull and the speaker:
+// per-sender loudness normalization -> tone mixing -> look-ahead limiter.
+// Runs in place on one FRAME_SIZE frame, no allocation after init.
+
+// Senders remembered at once (least recently heard is evicted)
+#define PB_MAX_SENDERS      16
+
+// Limiter block, also its look-ahead (2.5 ms of extra playback latency)
+#define PB_BLOCK            110
+#define PB_BLOCKS_PER_FRAME (FRAME_SIZE / PB_BLOCK)
+
+// Longest tone table (200 ms)
+#define PB_TONE_MAX_SAMPLES (SAMPLE_RATE / 5)
+
+typedef enum {
+    PB_TONE_NONE = 0,
+    PB_TONE_TALK_PERMIT,        // Local PTT press: two short high beeps
+    PB_TONE_ROGER,              // Remote talker finished: falling two-tone
+    PB_TONE_COUNT
+} pb_tone_t;
+
+typedef struct {
+    bool normalize;
+    float target_dbfs;          // Speech RMS level every talker is brought to
+    float max_gain_db;          // Boost/cut limit for a single talker
+    bool tones;
+    float tone_dbfs;            // Peak level of the beeps
+    bool limiter;
+    float limit_dbfs;           // Speaker peak ceiling
+} playback_dsp_config_t;
+
+// Loudness state of one talker, kept across bursts so the next
+// transmission from the same board starts at the right gain
+typedef struct {
+    uint32_t board_id;
+    bool used;
+    float level_db;
+    float gain_db;
+    uint32_t speech_frames;
+    uint64_t last_heard;
+} pb_sender_t;
+
+typedef struct {
+    uint64_t frames;
+    uint64_t idle_frames;       // Tone or limiter tail frames with no voice
+    uint64_t limited_blocks;    // Blocks played with limiter gain below unity
+    uint64_t tones;
+    uint64_t senders_evicted;
+} pb_stats_t;
+
+typedef struct {
+    playback_dsp_config_t cfg;
+
+    // Loudness normalization
+    pb_sender_t senders[PB_MAX_SENDERS];
+    uint64_t tick;
+
+    // Tone tables, built once at init with the level and fades baked in
+    float tone_table[PB_TONE_COUNT][PB_TONE_MAX_SAMPLES];
+    int tone_len[PB_TONE_COUNT];
+    int tone_request;           // Set from any thread, taken by the RX thread
+    int tone_active;
+    int tone_pos;
+
+    // Look-ahead limiter: one delayed block in front of the frame
+    float la[PB_BLOCK + FRAME_SIZE];
+    float la_peak;              // Peak of the delayed block
+    float limit_ceiling;
+    float limit_gain;
+
+    float work[FRAME_SIZE];
+    pb_stats_t stats;
+    bool initialized;
+} playback_dsp_ctx_t;
+
+void playback_dsp_config_default(playback_dsp_config_t *cfg);
+
+// Parse "norm=-20,gain=15,tones=-12,limit=-1" ("off" disables a stage,
+// a bare "off" disables the chain)
+int playback_dsp_parse(playback_dsp_config_t *cfg, const char *spec);
+
+int playback_dsp_init(playback_dsp_ctx_t *ctx, const playback_dsp_config_t *cfg);
+
+// Condition one decoded FRAME_SIZE frame from board 'sender' in place
+void playback_dsp_process(playback_dsp_ctx_t *ctx, int16_t *pcm, uint32_t sender);
+
+// Queue a tone; safe from any thread. It is mixed into the next frames
+// played, or into idle frames from playback_dsp_idle when nobody talks.
+void playback_dsp_tone(playback_dsp_ctx_t *ctx, pb_tone_t tone);
+
+// With no voice to play: fill pcm with the rest of a tone and the
+// limiter tail. Returns 1 when pcm holds a frame to play, 0 when idle.
+int playback_dsp_idle(playback_dsp_ctx_t *ctx, int16_t *pcm);
+
+#endif // PLAYBACK_DSP_H
@@ -0,0 +1,414 @@
+#include "playout.h"
+#include "wtlog.h"
+#include "wttrace.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sched.h>
+
+#define RING_MASK   (PLAYOUT_MAX_FRAMES - 1)
+
+// Playout thread priority when the process may use SCHED_FIFO
+#define PLAYOUT_RT_PRIORITY     50
+
+static uint64_t now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static void sleep_until(uint64_t us) {
+    struct timespec ts = { (time_t)(us / 1000000), (long)(us % 1000000) * 1000 };
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) != 0) {
+    }
+}
+
+int playout_init(playout_ctx_t *ctx, dma_ctx_t *dma, int max_frames) {
+    memset(ctx, 0, sizeof(playout_ctx_t));
+
+    if (max_frames < 1 || max_frames >= PLAYOUT_MAX_FRAMES) {
+        fprintf(stderr, "Playout: %d frames ahead out of range (1-%d)\n",
+                max_frames, PLAYOUT_MAX_FRAMES - 1);
+        return -1;
+    }
+    ctx->dma = dma;
+    ctx->max_frames = max_frames;
+    ctx->noise = 0x1234567;
+    ctx->trim_min = UINT32_MAX;
+
+    // Ping-pong periods in the DMA TX area, or on the heap without DMA
+    if (dma) {
+        int32_t *tx = dma_get_tx_buffer(dma);
+        if (!tx) {
+            fprintf(stderr, "Playout: DMA not initialised\n");
+            return -1;
+        }
+        ctx->period[0] = tx;
+        ctx->period[1] = tx + DMA_TX_BYTES / 2 / sizeof(int32_t);
+    } else {
+        ctx->period[0] = calloc(2, PLAYOUT_PERIOD_BYTES);
+        if (!ctx->period[0]) {
+            perror("Playout buffers");
+            return -1;
+        }
+        ctx->period[1] = ctx->period[0] + FRAME_SIZE;
+    }
+
+    ctx->initialized = true;
+    printf("Playout initialised: %d x %.0f ms periods, up to %d frames (%.0f ms) ahead%s\n",
+           2, PLAYOUT_PERIOD_US / 1000.0, max_frames, max_frames * PLAYOUT_PERIOD_US / 1000.0,
+           dma ? "" : ", timer clocked");
+    return 0;
+}
+
+void playout_set_tap(playout_ctx_t *ctx, playout_tap_fn tap, void *arg) {
+    ctx->tap = tap;
+    ctx->tap_arg = arg;
+}
+
+// Ring empty: comfort noise, faded in from wherever the last period ended
+static void fill_period(playout_ctx_t *ctx) {
+    int16_t *pcm = ctx->pcm;
+
+    for (int i = 0; i < FRAME_SIZE; i++) {
+        ctx->noise = ctx->noise * 1664525u + 1013904223u;
+        pcm[i] = (int16_t)((int32_t)(ctx->noise >> 16) % (PLAYOUT_COMFORT_PEAK + 1) *
+                           ((ctx->noise & 0x100) ? 1 : -1));
+    }
+    for (int i = 0; i < PLAYOUT_FADE_SAMPLES; i++) {
+        int32_t from = (int32_t)ctx->last_sample * (PLAYOUT_FADE_SAMPLES - i) / PLAYOUT_FADE_SAMPLES;
+        pcm[i] = (int16_t)(from + pcm[i] * i / PLAYOUT_FADE_SAMPLES);
+    }
+}
+
+// Next period into the idle DMA buffer: a queued frame, or fill
+static void prepare_period(playout_ctx_t *ctx) {
+    __atomic_store_n(&ctx->prepare_seq, ctx->prepare_seq + 1, __ATOMIC_RELEASE);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+    uint32_t head = __atomic_load_n(&ctx->head, __ATOMIC_ACQUIRE);
+    bool voice = head != ctx->tail;
+
+    if (voice) {
+        memcpy(ctx->pcm, ctx->ring[ctx->tail & RING_MASK], sizeof(ctx->pcm));
+        __atomic_store_n(&ctx->tail, ctx->tail + 1, __ATOMIC_RELEASE);
+
+        // Voice after fill (a dropout, or the first frame of a burst) fades
+        // in from the fill so it does not click
+        if (!ctx->last_voice) {
+            for (int i = 0; i < PLAYOUT_FADE_SAMPLES; i++) {
+                int32_t from = (int32_t)ctx->last_sample * (PLAYOUT_FADE_SAMPLES - i);
+                ctx->pcm[i] = (int16_t)((from + (int32_t)ctx->pcm[i] * i) / PLAYOUT_FADE_SAMPLES);
+            }
+            if (ctx->stats.voice_periods > 0 && ctx->fill_run <= PLAYOUT_UNDERRUN_RUN) {
+                ctx->stats.underruns++;
+                ctx->stats.underrun_periods += ctx->fill_run;
+            }
+        }
+        ctx->fill_run = 0;
+        ctx->stats.voice_periods++;
+    } else {
+        fill_period(ctx);
+        ctx->stats.fill_periods++;
+        ctx->fill_run++;
+    }
+
+    // Frames still queued after this one never went below one for a
+    // whole window: the queue holds latency it does not need
+    uint32_t left = head - ctx->tail;
+    if (left < ctx->trim_min) ctx->trim_min = left;
+    if (++ctx->trim_window >= PLAYOUT_TRIM_PERIODS) {
+        if (ctx->trim_min > 0) __atomic_store_n(&ctx->trim, true, __ATOMIC_RELEASE);
+        ctx->trim_window = 0;
+        ctx->trim_min = UINT32_MAX;
+    }
+
+    ctx->last_voice = voice;
+    ctx->last_sample = ctx->pcm[FRAME_SIZE - 1];
+    convert_i16_to_i32(ctx->pcm, ctx->period[ctx->cur], FRAME_SIZE);
+    __atomic_store_n(&ctx->prepare_seq, ctx->prepare_seq + 1, __ATOMIC_RELEASE);
+}
+
+static void start_period(playout_ctx_t *ctx, uint64_t start_us) {
+    if (ctx->dma) {
+        dma_start_playback(ctx->dma, ctx->period[ctx->cur], PLAYOUT_PERIOD_BYTES);
+    }
+
+    __atomic_store_n(&ctx->period_start_us, start_us, __ATOMIC_RELAXED);
+    __atomic_store_n(&ctx->periods_started, ctx->periods_started + 1, __ATOMIC_RELEASE);
+    ctx->stats.periods++;
+
+    // The speaker has it now; the echo canceller gets the same samples
+    if (ctx->tap) ctx->tap(ctx->tap_arg, ctx->pcm, FRAME_SIZE);
+}
+
+static void *playout_thread(void *arg) {
+    playout_ctx_t *ctx = arg;
+    wtlog_thread("play");
+
+    struct sched_param sp = { .sched_priority = PLAYOUT_RT_PRIORITY };
+    if (pthread_setschedparam(pthread_self(), SCHED_FIFO, &sp) != 0) {
+        WTLOG_DEBUG("No SCHED_FIFO for the playout thread, running at normal priority");
+    }
+
+    prepare_period(ctx);
+    start_period(ctx, now_us());
+
+    while (__atomic_load_n(&ctx->running, __ATOMIC_ACQUIRE)) {
+        uint64_t end_us = ctx->period_start_us + PLAYOUT_PERIOD_US;
+
+        // Next period ready just before the running one ends
+        sleep_until(end_us - PLAYOUT_PREPARE_US);
+        uint64_t t0 = WTTRACE_BEGIN();
+        ctx->cur ^= 1;
+        prepare_period(ctx);
+        WTTRACE_END("prepare", t0, 0, (uint32_t)ctx->periods_started + 1);
+        t0 = WTTRACE_BEGIN();
+
+        uint64_t idle_us;
+        if (ctx->dma) {
+            // Poll the channel; finished already means we were late. A
+            // channel that fails, or is still busy well past the end of its
+            // period, is recovered and the next period re-arms it.
+            uint64_t first = now_us();
+            bool late = !dma_playback_busy(ctx->dma);
+            while (dma_playback_busy(ctx->dma)) {
+                uint32_t errors = dma_channel_errors(ctx->dma, DMA_CH_MM2S);
+                if (errors || now_us() > end_us + PLAYOUT_STALL_US) {
+                    dma_recover(ctx->dma, DMA_CH_MM2S, errors);
+                    break;
+                }
+            }
+            idle_us = late ? (first > end_us ? end_us : first) : now_us();
+        } else {
+            sleep_until(end_us);
+            idle_us = end_us;
+        }
+
+        uint64_t start_us = now_us();
+        start_period(ctx, start_us);
+        WTTRACE_END("rearm", t0, 0, (uint32_t)ctx->periods_started);
+
+        uint32_t gap = (uint32_t)(start_us - idle_us);
+        if (gap > ctx->stats.gap_us_max) ctx->stats.gap_us_max = gap;
+        if (gap > PLAYOUT_PREPARE_US) ctx->stats.late_periods++;
+    }
+
+    if (ctx->dma) dma_wait_playback(ctx->dma, 100);
+    return NULL;
+}
+
+int playout_start(playout_ctx_t *ctx) {
+    if (!ctx->initialized) {
+        fprintf(stderr, "Playout not initialised\n");
+        return -1;
+    }
+    ctx->running = true;
+    if (pthread_create(&ctx->thread, NULL, playout_thread, ctx) != 0) {
+        perror("Failed to create playout thread");
+        ctx->running = false;
+        return -1;
+    }
+    return 0;
+}
+
+void playout_stop(playout_ctx_t *ctx) {
+    if (!ctx->running) return;
+    __atomic_store_n(&ctx->running, false, __ATOMIC_RELEASE);
+    pthread_join(ctx->thread, NULL);
+}
+
+static bool frame_quiet(const int16_t *pcm) {
+    for (int i = 0; i < FRAME_SIZE; i++) {
+        if (pcm[i] > PLAYOUT_TRIM_PEAK || pcm[i] < -PLAYOUT_TRIM_PEAK) return false;
+    }
+    return true;
+}
+
+// Into the ring, space already checked
+static void ring_put(playout_ctx_t *ctx, const int16_t *pcm, uint32_t queued) {
+    memcpy(ctx->ring[ctx->head & RING_MASK], pcm, sizeof(ctx->ring[0]));
+    __atomic_store_n(&ctx->head, ctx->head + 1, __ATOMIC_RELEASE);
+
+    ctx->stats.frames++;
+    if (queued + 1 > ctx->stats.fill_max) ctx->stats.fill_max = queued + 1;
+}
+
+int playout_write(playout_ctx_t *ctx, const int16_t *pcm) {
+    uint32_t tail = __atomic_load_n(&ctx->tail, __ATOMIC_ACQUIRE);
+    uint32_t queued = ctx->head - tail;
+
+    if (queued >= (uint32_t)ctx->max_frames) {
+        ctx->stats.overflows++;
+        return -1;
+    }
+
+    // Latency to give back: skip this frame if nobody will miss it
+    if (queued > 0 && __atomic_load_n(&ctx->trim, __ATOMIC_ACQUIRE) && frame_quiet(pcm)) {
+        __atomic_store_n(&ctx->trim, false, __ATOMIC_RELAXED);
+        ctx->stats.trimmed++;
+        return 0;
+    }
+
+    ring_put(ctx, pcm, queued);
+    return 0;
+}
+
+// When a frame written now starts playing, and how many are queued ahead
+// of it. The frame after the queued ones goes into the period after the
+// last one prepared; the play position only changes between periods, so
+// retry if the playout thread moved on while we looked.
+static uint64_t next_start_us(const playout_ctx_t *ctx, uint64_t now, uint32_t *queued) {
+    for (;;) {
+        uint64_t seq = __atomic_load_n(&ctx->prepare_seq, __ATOMIC_ACQUIRE);
+        uint64_t started = __atomic_load_n(&ctx->periods_started, __ATOMIC_ACQUIRE);
+        uint64_t start = __atomic_load_n(&ctx->period_start_us, __ATOMIC_RELAXED);
+        uint32_t tail = __atomic_load_n(&ctx->tail, __ATOMIC_ACQUIRE);
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+        if ((seq & 1) || seq != __atomic_load_n(&ctx->prepare_seq, __ATOMIC_ACQUIRE) ||
+            started != __atomic_load_n(&ctx->periods_started, __ATOMIC_ACQUIRE)) {
+            continue;
+        }
+
+        *queued = __atomic_load_n(&ctx->head, __ATOMIC_ACQUIRE) - tail;
+        if (started == 0) return now + *queued * PLAYOUT_PERIOD_US;
+
+        // Periods from the running one to ours; one that overran is
+        // still about to end
+        uint64_t ahead = seq / 2 - started + *queued + 1;
+        uint64_t at = start + ahead * PLAYOUT_PERIOD_US;
+        return at > now ? at : now;
+    }
+}
+
+// Samples into the stream; full frames go to the ring
+static void stage_samples(playout_ctx_t *ctx, const int16_t *pcm, int samples, uint32_t *queued) {
+    while (samples > 0) {
+        int n = FRAME_SIZE - ctx->staged;
+        if (n > samples) n = samples;
+        if (pcm) {
+            memcpy(ctx->stage + ctx->staged, pcm, n * sizeof(int16_t));
+            pcm += n;
+        } else {
+            memset(ctx->stage + ctx->staged, 0, n * sizeof(int16_t));
+        }
+        ctx->staged += n;
+        samples -= n;
+
+        if (ctx->staged == FRAME_SIZE) {
+            ring_put(ctx, ctx->stage, (*queued)++);
+            ctx->staged = 0;
+        }
+    }
+}
+
+int playout_write_at(playout_ctx_t *ctx, const int16_t *pcm, uint64_t at_us) {
+    uint32_t queued;
+    uint64_t next = next_start_us(ctx, now_us(), &queued);
+
+    // Where a sample staged now plays, against where it should
+    int64_t off_us = (int64_t)(at_us - next) - (int64_t)ctx->staged * 1000000 / SAMPLE_RATE;
+    int64_t off = off_us * SAMPLE_RATE / 1000000;
+    if (ctx->aligned && off_us < PLAYOUT_SLIP_US && off_us > -PLAYOUT_SLIP_US) off = 0;
+
+    // Late by more than the frame: nothing of it can play on time
+    int skip = 0;
+    if (off < 0) {
+        int drop = (int)(-off < ctx->staged ? -off : ctx->staged);
+        ctx->staged -= drop;
+        skip = (int)(-off - drop);
+        if (skip >= FRAME_SIZE) {
+            ctx->stats.late_frames++;
+            return -1;
+        }
+        off = 0;
+    }
+
+    // Silence up to it, then the frame; only once the ring has room for all
+    int64_t frames = (ctx->staged + off + FRAME_SIZE - skip) / FRAME_SIZE;
+    if (queued + frames > (uint32_t)ctx->max_frames) {
+        if (!ctx->aligned) return 1;
+        ctx->stats.overflows++;
+        return -1;
+    }
+
+    if (ctx->aligned && (off || skip)) {
+        ctx->stats.slips++;
+    } else if (!ctx->aligned) {
+        ctx->stats.aligned++;
+    }
+    ctx->aligned = true;
+
+    stage_samples(ctx, NULL, (int)off, &queued);
+    stage_samples(ctx, pcm + skip, FRAME_SIZE - skip, &queued);
+    return 0;
+}
+
+void playout_align_end(playout_ctx_t *ctx) {
+    if (ctx->staged > 0) {
+        uint32_t tail = __atomic_load_n(&ctx->tail, __ATOMIC_ACQUIRE);
+        uint32_t queued = ctx->head - tail;
+
+        if (queued < (uint32_t)ctx->max_frames) {
+            // Fade the tail out so the padding does not click
+            int fade = ctx->staged < PLAYOUT_FADE_SAMPLES ? ctx->staged : PLAYOUT_FADE_SAMPLES;
+            for (int i = 0; i < fade; i++) {
+                int16_t *x = &ctx->stage[ctx->staged - fade + i];
+                *x = (int16_t)((int32_t)*x * (fade - i) / fade);
+            }
+            stage_samples(ctx, NULL, FRAME_SIZE - ctx->staged, &queued);
+        }
+    }
+    ctx->staged = 0;
+    ctx->aligned = false;
+}
+
+int playout_space(const playout_ctx_t *ctx) {
+    uint32_t tail = __atomic_load_n(&ctx->tail, __ATOMIC_ACQUIRE);
+    return ctx->max_frames - (int)(ctx->head - tail);
+}
+
+// What is left of the running period, in microseconds
+static uint64_t period_left_us(const playout_ctx_t *ctx) {
+    if (__atomic_load_n(&ctx->periods_started, __ATOMIC_ACQUIRE) == 0) return 0;
+
+    uint64_t start = __atomic_load_n(&ctx->period_start_us, __ATOMIC_RELAXED);
+    uint64_t now = now_us();
+    return now - start >= PLAYOUT_PERIOD_US ? 0 : start + PLAYOUT_PERIOD_US - now;
+}
+
+uint64_t playout_position(const playout_ctx_t *ctx) {
+    uint64_t started = __atomic_load_n(&ctx->periods_started, __ATOMIC_ACQUIRE);
+    if (started == 0) return 0;
+
+    uint64_t played_us = PLAYOUT_PERIOD_US - period_left_us(ctx);
+    return (started - 1) * FRAME_SIZE + played_us * SAMPLE_RATE / 1000000;
+}
+
+uint32_t playout_latency_us(const playout_ctx_t *ctx) {
+    uint32_t queued;
+    uint64_t now = now_us();
+    return (uint32_t)(next_start_us(ctx, now, &queued) - now);
+}
+
+bool playout_needs_frame(const playout_ctx_t *ctx) {
+    return playout_latency_us(ctx) < PLAYOUT_GUARD_US;
+}
+
+int playout_wait_ms(const playout_ctx_t *ctx, int max_ms) {
+    uint32_t latency = playout_latency_us(ctx);
+    if (latency <= PLAYOUT_GUARD_US) return 0;
+
+    int ms = (int)((latency - PLAYOUT_GUARD_US) / 1000);
+    return ms < max_ms ? ms : max_ms;
+}
+
+void playout_cleanup(playout_ctx_t *ctx) {
+    if (!ctx->initialized) return;
+
+    playout_stop(ctx);
+    if (!ctx->dma) free(ctx->period[0]);
+    ctx->initialized = false;
+}
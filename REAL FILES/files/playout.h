@@ -0,0 +1,153 @@
+#ifndef PLAYOUT_H
+#define PLAYOUT_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <pthread.h>
+
+#include "audio_dma.h"
+#include "opus_helper.h"
+
+// Continuous speaker output. A playout thread keeps the MM2S channel
+// running period after period (one frame each, ping-ponging between two
+// DMA buffers), so the speaker never stops between packets. The RX thread
+// writes decoded frames ahead into a ring and never waits for the DMA.
+//
+// The AXI DMA is in simple (register) mode, so "cyclic" means the thread
+// sleeps until just before the running period ends, converts the next
+// frame into the idle buffer and re-arms the channel as soon as it goes
+// idle. When the ring is empty the next period is comfort noise (after a
+// 1 ms fade from the last sample); the RX thread is expected to top the
+// ring up with concealed frames (rx_pipeline_pull clocked) before that
+// happens during a transmission, see playout_needs_frame.
+//
+// Latency is bounded: at most max_frames frames are queued ahead, writes
+// beyond that are refused and counted. A queue that has not dropped below
+// one spare frame for a whole second (a stall the stream never caught up
+// on, or clock drift between sender and DAC) is trimmed by dropping the
+// next quiet frame written.
+//
+// Synchronised playout (playout_write_at) instead puts each frame at a
+// given time: silence and a sub-frame shift line the first one up, and the
+// stream slips by samples when it drifts more than PLAYOUT_SLIP_US off.
+
+#define PLAYOUT_MAX_FRAMES      8           // Ring slots, power of 2
+#define PLAYOUT_DEFAULT_FRAMES  3           // Write-ahead bound, 60 ms
+#define PLAYOUT_PERIOD_BYTES    (FRAME_SIZE * BYTES_PER_SAMPLE)
+#define PLAYOUT_PERIOD_US       ((uint64_t)FRAME_SIZE * 1000000 / SAMPLE_RATE)
+#define PLAYOUT_PREPARE_US      1000        // Wake this long before a period ends
+#define PLAYOUT_GUARD_US        5000        // Ask for a frame when less than this is queued
+#define PLAYOUT_COMFORT_PEAK    8           // Comfort noise, about -72 dBFS
+#define PLAYOUT_FADE_SAMPLES    (SAMPLE_RATE / 1000)
+#define PLAYOUT_UNDERRUN_RUN    10          // Voice back within this many fill periods: dropout
+#define PLAYOUT_TRIM_PERIODS    50          // Window for the spare-frame check
+#define PLAYOUT_TRIM_PEAK       1000        // Only frames quieter than this are trimmed
+#define PLAYOUT_STALL_US        10000       // Period still playing this late: channel stuck
+#define PLAYOUT_SLIP_US         500         // Aligned stream this far off its time: slip
+
+// Called with every period as it starts playing (echo canceller reference)
+typedef void (*playout_tap_fn)(void *arg, const int16_t *pcm, int samples);
+
+typedef struct {
+    uint64_t periods;                       // Played, voice or fill
+    uint64_t frames;                        // Voice frames written
+    uint64_t voice_periods;                 // Played from the ring
+    uint64_t fill_periods;                  // Ring empty: comfort noise
+    uint64_t underruns;                     // Fill runs inside voice (dropouts)
+    uint64_t underrun_periods;              // Fill periods in those runs
+    uint64_t overflows;                     // Writes refused, ring at max_frames
+    uint64_t trimmed;                       // Quiet frames dropped to cut latency
+    uint64_t aligned;                       // Streams lined up by playout_write_at
+    uint64_t slips;                         // Their corrections
+    uint64_t late_frames;                   // Frames whose time had passed
+    uint64_t late_periods;                  // Re-armed more than PLAYOUT_PREPARE_US late
+    uint32_t gap_us_max;                    // Longest idle time between two periods
+    uint32_t fill_max;                      // Most frames ever queued
+} playout_stats_t;
+
+typedef struct {
+    dma_ctx_t *dma;                         // NULL: clocked by a timer, nothing played
+    int max_frames;
+
+    // Decoder side -> playout thread, single producer / single consumer
+    int16_t ring[PLAYOUT_MAX_FRAMES][FRAME_SIZE];
+    uint32_t head;                          // Written by playout_write
+    uint32_t tail;                          // Written by the playout thread
+
+    int32_t *period[2];                     // DMA buffers (or heap without DMA)
+    int16_t pcm[FRAME_SIZE];                // Period being prepared
+    int cur;
+    int16_t last_sample;
+    bool last_voice;
+    int fill_run;
+    uint32_t noise;
+
+    // Latency trim: fewest frames left queued over the current window
+    int trim_window;
+    uint32_t trim_min;
+    bool trim;                              // Set by the playout thread, cleared by the writer
+
+    // Play position, published by the playout thread. prepare_seq is odd
+    // while a period is being prepared and counts two per period after.
+    uint64_t period_start_us;
+    uint64_t periods_started;
+    uint64_t prepare_seq;
+
+    // Synchronised playout: samples carried into the next frame
+    int16_t stage[FRAME_SIZE];
+    int staged;
+    bool aligned;
+
+    playout_tap_fn tap;
+    void *tap_arg;
+
+    pthread_t thread;
+    bool running;
+
+    playout_stats_t stats;
+    bool initialized;
+} playout_ctx_t;
+
+// max_frames: write-ahead bound, 1 .. PLAYOUT_MAX_FRAMES - 1
+int playout_init(playout_ctx_t *ctx, dma_ctx_t *dma, int max_frames);
+void playout_set_tap(playout_ctx_t *ctx, playout_tap_fn tap, void *arg);
+
+// Start and stop the playout thread (the speaker plays comfort noise
+// whenever nothing is queued)
+int playout_start(playout_ctx_t *ctx);
+void playout_stop(playout_ctx_t *ctx);
+
+// Queue one FRAME_SIZE frame; -1 when max_frames are already queued.
+// A frame dropped by the latency trim counts as written.
+int playout_write(playout_ctx_t *ctx, const int16_t *pcm);
+
+// Queue a frame so that its first sample plays at at_us (CLOCK_MONOTONIC).
+// The first call of a stream pads with silence to get there; later ones
+// follow on and only slip when more than PLAYOUT_SLIP_US off. Returns 0
+// when queued, 1 when at_us is too far ahead for the ring yet (call
+// again later), -1 when it has already passed (frame dropped).
+int playout_write_at(playout_ctx_t *ctx, const int16_t *pcm, uint64_t at_us);
+
+// End of a synchronised stream: queue what is carried over, faded out
+void playout_align_end(playout_ctx_t *ctx);
+
+// Frames that can be written now
+int playout_space(const playout_ctx_t *ctx);
+
+// Samples sent to the speaker so far, including the running period
+uint64_t playout_position(const playout_ctx_t *ctx);
+
+// How long a frame written now waits before it is heard: everything
+// queued plus what is left of the running period (and the next one if it
+// is already prepared)
+uint32_t playout_latency_us(const playout_ctx_t *ctx);
+
+// Less than PLAYOUT_GUARD_US of audio queued: write a frame (concealed if
+// need be) now. playout_wait_ms says how long until that is the case.
+bool playout_needs_frame(const playout_ctx_t *ctx);
+int playout_wait_ms(const playout_ctx_t *ctx, int max_ms);
+
+// Stops the thread if running and frees the buffers
+void playout_cleanup(playout_ctx_t *ctx);
+
+#endif // PLAYOUT_H
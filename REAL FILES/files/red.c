@@ -0,0 +1,126 @@
+#include "red.h"
+#include <string.h>
+
+void red_encoder_init(red_encoder_t *r, int depth, int cap_kbps) {
+    memset(r, 0, sizeof(red_encoder_t));
+    red_encoder_set(r, depth, cap_kbps);
+}
+
+void red_encoder_set(red_encoder_t *r, int depth, int cap_kbps) {
+    if (depth < 0) depth = 0;
+    if (depth > RED_MAX_DEPTH) depth = RED_MAX_DEPTH;
+    r->depth = depth;
+
+    // kbps over one frame
+    r->max_bytes = 0;
+    if (cap_kbps > 0) {
+        r->max_bytes = (int)((int64_t)cap_kbps * 1000 * FRAME_SIZE / (8 * SAMPLE_RATE));
+    }
+}
+
+void red_encoder_reset(red_encoder_t *r) {
+    for (int i = 0; i < RED_MAX_DEPTH; i++) {
+        r->history[i].valid = false;
+    }
+}
+
+int red_pack(red_encoder_t *r, uint32_t seq_num, const uint8_t *frame, int size,
+             uint8_t *payload, int max_size) {
+    if (size <= 0 || size > MAX_PACKET_SIZE) return -1;
+    if (max_size > RED_MAX_PAYLOAD) max_size = RED_MAX_PAYLOAD;
+
+    // Newest first until the cap (on the frames, not their headers); a
+    // frame that was never sent is skipped
+    const red_frame_t *blocks[RED_MAX_DEPTH];
+    int count = 0;
+    int extra = 1;
+    int carried = 0;
+    for (int back = 1; back <= r->depth; back++) {
+        const red_frame_t *h = &r->history[(seq_num - back) & (RED_MAX_DEPTH - 1)];
+        if (!h->valid || h->seq_num != seq_num - (uint32_t)back) continue;
+
+        int cost = RED_BLOCK_HEADER + h->size;
+        if ((r->max_bytes > 0 && carried + h->size > r->max_bytes) ||
+            extra + cost + size > max_size) {
+            r->stats.capped++;
+            continue;
+        }
+        blocks[count++] = h;
+        extra += cost;
+        carried += h->size;
+    }
+    if (extra + size > max_size) return -1;
+
+    // Headers oldest first, then the frames in the same order
+    uint8_t *p = payload;
+    for (int i = count - 1; i >= 0; i--) {
+        *p++ = (uint8_t)(RED_MORE | (seq_num - blocks[i]->seq_num));
+        *p++ = (uint8_t)(blocks[i]->size >> 8);
+        *p++ = (uint8_t)blocks[i]->size;
+    }
+    *p++ = 0;
+    for (int i = count - 1; i >= 0; i--) {
+        memcpy(p, blocks[i]->data, blocks[i]->size);
+        p += blocks[i]->size;
+    }
+    memcpy(p, frame, size);
+    p += size;
+
+    red_frame_t *h = &r->history[seq_num & (RED_MAX_DEPTH - 1)];
+    memcpy(h->data, frame, size);
+    h->size = (uint16_t)size;
+    h->seq_num = seq_num;
+    h->valid = true;
+
+    r->stats.packets++;
+    r->stats.blocks += count;
+    r->stats.bytes_primary += size;
+    r->stats.bytes_redundant += extra;
+    return (int)(p - payload);
+}
+
+int red_unpack(const uint8_t *payload, int size, red_block_t *blocks, red_block_t *primary) {
+    int count = 0;
+    int pos = 0;
+    int total = 0;
+
+    while (pos < size && (payload[pos] & RED_MORE)) {
+        if (count >= RED_MAX_DEPTH || pos + RED_BLOCK_HEADER > size) return -1;
+        blocks[count].back = payload[pos] & ~RED_MORE;
+        blocks[count].size = (uint16_t)(payload[pos + 1] << 8 | payload[pos + 2]);
+        if (blocks[count].back == 0 || blocks[count].size == 0 ||
+            blocks[count].size > MAX_PACKET_SIZE) {
+            return -1;
+        }
+        total += blocks[count].size;
+        count++;
+        pos += RED_BLOCK_HEADER;
+    }
+
+    // The primary's header, and at least a byte of it behind the blocks
+    if (pos >= size || payload[pos] != 0) return -1;
+    pos++;
+    if (pos + total >= size) return -1;
+
+    for (int i = 0; i < count; i++) {
+        blocks[i].data = payload + pos;
+        pos += blocks[i].size;
+    }
+    primary->back = 0;
+    primary->size = (uint16_t)(size - pos);
+    primary->data = payload + pos;
+    if (primary->size > MAX_PACKET_SIZE) return -1;
+    return count;
+}
+
+int red_primary(const network_packet_t *packet, const uint8_t **data) {
+    if (!(packet->flags & PKT_FLAG_RED)) {
+        *data = packet->opus_data;
+        return packet->opus_size;
+    }
+
+    red_block_t blocks[RED_MAX_DEPTH], primary;
+    if (red_unpack(packet->opus_data, packet->opus_size, blocks, &primary) < 0) return 0;
+    *data = primary.data;
+    return primary.size;
+}
@@ -0,0 +1,87 @@
+#ifndef RED_H
+#define RED_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "opus_helper.h"
+#include "network.h"
+
+// Packet-level redundancy after RFC 2198: each audio packet carries the
+// previous K encoded frames of its stream as well as its own, so a burst
+// of up to K lost packets comes back intact from the packet after it
+// (Opus in-band FEC only rebuilds one frame, at lower quality). Packets
+// with PKT_FLAG_RED have this payload in place of the bare Opus frame:
+//
+//   K x { 0x80 | back, length (2 bytes, big endian) }   oldest first
+//   0x00                                                primary follows
+//   K redundant frames, then the primary frame
+//
+// back is how many seq_nums before the packet's own the frame was sent.
+// The RFC's timestamp offset and payload type have no use here (20 ms
+// frames, always Opus), so a block header is 3 bytes instead of 4.
+
+#define RED_MAX_DEPTH       8       // Frames carried back at most, power of 2
+#define RED_MAX_PAYLOAD     1200    // Whole payload: about 1270 bytes on the wire over
+                                    // IPv4, so no path MTU fragments it
+#define RED_BLOCK_HEADER    3
+#define RED_MORE            0x80
+
+typedef struct {
+    uint8_t data[MAX_PACKET_SIZE];
+    uint16_t size;
+    uint32_t seq_num;
+    bool valid;
+} red_frame_t;
+
+typedef struct {
+    uint64_t packets;
+    uint64_t blocks;                // Redundant frames sent
+    uint64_t capped;                // Left out to stay under the cap
+    uint64_t bytes_primary;
+    uint64_t bytes_redundant;       // Redundant frames and every header
+} red_stats_t;
+
+// Sender side, one per stream
+typedef struct {
+    int depth;                      // K, 0 = off
+    int max_bytes;                  // Redundant bytes per packet at most, 0 = no cap
+    red_frame_t history[RED_MAX_DEPTH];
+    red_stats_t stats;
+} red_encoder_t;
+
+// One block of a received payload
+typedef struct {
+    uint8_t back;                   // 0 for the primary
+    uint16_t size;
+    const uint8_t *data;
+} red_block_t;
+
+// depth previous frames per packet, with a cap on the bitrate they add
+// (kbps, 0 = none)
+void red_encoder_init(red_encoder_t *r, int depth, int cap_kbps);
+
+// Change both on a running stream, the history and stats stay
+void red_encoder_set(red_encoder_t *r, int depth, int cap_kbps);
+
+// Forget the history (a new burst owes nothing to the last one)
+void red_encoder_reset(red_encoder_t *r);
+
+// Write the payload for frame seq_num (size bytes at frame) into payload:
+// the newest of the previous frames first, as many as depth, the cap and
+// RED_MAX_PAYLOAD allow, then the frame itself, which is remembered for
+// the next packets. Returns the payload size, or -1 if the frame alone
+// does not fit in max_size (or RED_MAX_PAYLOAD).
+int red_pack(red_encoder_t *r, uint32_t seq_num, const uint8_t *frame, int size,
+             uint8_t *payload, int max_size);
+
+// Split a PKT_FLAG_RED payload into its redundant blocks (at most
+// RED_MAX_DEPTH, oldest first) and the primary. Returns the number of
+// redundant blocks, or -1 if the payload is malformed.
+int red_unpack(const uint8_t *payload, int size, red_block_t *blocks, red_block_t *primary);
+
+// The Opus frame of a packet, whether it carries redundancy or not
+// (0 if malformed)
+int red_primary(const network_packet_t *packet, const uint8_t **data);
+
+#endif // RED_H
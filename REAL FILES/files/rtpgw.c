@@ -0,0 +1,397 @@
+#define _GNU_SOURCE
+#include "rtpgw.h"
+#include "red.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+
+#define SLOT_EMPTY      0
+#define SLOT_LIVE       1
+#define SLOT_DEAD       2           // Closed, lookups go on past it
+
+#define RTCP_SR         200
+#define RTCP_RR         201
+#define RTCP_SDES       202
+#define RTCP_BYE        203
+#define NTP_UNIX_OFFSET 2208988800ULL
+
+// How far back a straggler may be and still belong to the current
+// mapping (it is dropped, see rtpgw_input) rather than start a new one
+#define REORDER_FRAMES  50
+
+static inline int32_t seq_diff(uint32_t a, uint32_t b) {
+    return (int32_t)(a - b);
+}
+
+// Murmur3 finaliser: well-spread SSRCs and hash slots from small IDs
+static uint32_t mix32(uint32_t h) {
+    h ^= h >> 16;
+    h *= 0x85ebca6b;
+    h ^= h >> 13;
+    h *= 0xc2b2ae35;
+    h ^= h >> 16;
+    return h;
+}
+
+static uint32_t rtpgw_rand(rtpgw_t *gw) {
+    gw->rng ^= gw->rng << 13;
+    gw->rng ^= gw->rng >> 17;
+    gw->rng ^= gw->rng << 5;
+    return gw->rng;
+}
+
+static void put16(uint8_t *p, uint16_t v) {
+    p[0] = (uint8_t)(v >> 8);
+    p[1] = (uint8_t)v;
+}
+
+static void put32(uint8_t *p, uint32_t v) {
+    p[0] = (uint8_t)(v >> 24);
+    p[1] = (uint8_t)(v >> 16);
+    p[2] = (uint8_t)(v >> 8);
+    p[3] = (uint8_t)v;
+}
+
+// The stream's RTP clock at a point on the network_time_us clock
+static uint32_t rtp_time(const rtpgw_t *gw, const rtpgw_stream_t *s, uint64_t mono_us) {
+    return s->ts_base + (uint32_t)((mono_us - gw->start_us) * (RTPGW_CLOCK / 1000) / 1000);
+}
+
+void rtpgw_config_default(rtpgw_config_t *cfg) {
+    memset(cfg, 0, sizeof(rtpgw_config_t));
+    cfg->dest.sin_family = AF_INET;
+    cfg->dest.sin_port = htons(5004);
+    cfg->dest.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    cfg->payload_type = RTPGW_DEFAULT_PT;
+}
+
+int rtpgw_parse_dest(rtpgw_config_t *cfg, const char *spec) {
+    char host[64];
+    int port;
+    if (sscanf(spec, "%63[^:]:%d", host, &port) != 2 || port < 1 || port > 65534 ||
+        inet_pton(AF_INET, host, &cfg->dest.sin_addr) != 1) {
+        fprintf(stderr, "rtpgw: expected host:port, got '%s'\n", spec);
+        return -1;
+    }
+    cfg->dest.sin_port = htons((uint16_t)port);
+    return 0;
+}
+
+int rtpgw_init(rtpgw_t *gw, const rtpgw_config_t *cfg) {
+    memset(gw, 0, sizeof(rtpgw_t));
+    gw->cfg = *cfg;
+
+    gw->sockfd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (gw->sockfd < 0) {
+        perror("rtpgw: socket");
+        return -1;
+    }
+
+    // Hundreds of streams leave in bursts, give the kernel room for them
+    int sndbuf = 1 << 20;
+    setsockopt(gw->sockfd, SOL_SOCKET, SO_SNDBUF, &sndbuf, sizeof(sndbuf));
+
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    gw->rng = (uint32_t)ts.tv_nsec ^ (uint32_t)getpid() ^ 0x9e3779b9u;
+    if (gw->rng == 0) gw->rng = 1;
+    gw->start_us = network_time_us();
+
+    gw->initialized = true;
+    printf("RTP gateway: to %s:%u%s, payload type %d\n", inet_ntoa(cfg->dest.sin_addr),
+           ntohs(cfg->dest.sin_port), cfg->port_per_stream ? " (+2 per stream)" : "",
+           cfg->payload_type);
+    return 0;
+}
+
+void rtpgw_flush(rtpgw_t *gw) {
+    struct mmsghdr msgs[RTPGW_BATCH];
+    struct iovec iov[RTPGW_BATCH];
+    if (gw->n_out == 0) return;
+
+    memset(msgs, 0, gw->n_out * sizeof(struct mmsghdr));
+    for (int i = 0; i < gw->n_out; i++) {
+        iov[i].iov_base = gw->out[i];
+        iov[i].iov_len = gw->out_len[i];
+        msgs[i].msg_hdr.msg_name = (void *)gw->out_addr[i];
+        msgs[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_in);
+        msgs[i].msg_hdr.msg_iov = &iov[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+
+    int sent = sendmmsg(gw->sockfd, msgs, gw->n_out, 0);
+    if (sent < gw->n_out) {
+        gw->stats.send_errors += gw->n_out - (sent > 0 ? sent : 0);
+    }
+    gw->n_out = 0;
+}
+
+// A slot in the output batch, flushing first when it is full
+static uint8_t *out_slot(rtpgw_t *gw, const struct sockaddr_in *addr) {
+    if (gw->n_out == RTPGW_BATCH) rtpgw_flush(gw);
+    gw->out_addr[gw->n_out] = addr;
+    return gw->out[gw->n_out];
+}
+
+// SDP for ffmpeg/VLC: "ffmpeg -protocol_whitelist file,udp,rtp -i <file>"
+static void write_sdp(rtpgw_t *gw, const rtpgw_stream_t *s) {
+    char path[512];
+    snprintf(path, sizeof(path), "%s/wt-%u-tg%u.sdp", gw->cfg.sdp_dir, s->board_id,
+             s->talkgroup);
+    FILE *f = fopen(path, "w");
+    if (!f) {
+        perror(path);
+        return;
+    }
+
+    int pt = gw->cfg.payload_type;
+    fprintf(f, "v=0\r\n");
+    fprintf(f, "o=- %u 0 IN IP4 127.0.0.1\r\n", s->ssrc);
+    fprintf(f, "s=Board %u talkgroup %u\r\n", s->board_id, s->talkgroup);
+    fprintf(f, "c=IN IP4 %s\r\n", inet_ntoa(s->rtp_addr.sin_addr));
+    fprintf(f, "t=0 0\r\n");
+    fprintf(f, "m=audio %u RTP/AVP %d\r\n", ntohs(s->rtp_addr.sin_port), pt);
+    fprintf(f, "a=rtpmap:%d opus/48000/2\r\n", pt);
+    fprintf(f, "a=fmtp:%d sprop-maxcapturerate=%d;stereo=0;sprop-stereo=0;useinbandfec=1\r\n",
+            pt, SAMPLE_RATE);
+    fprintf(f, "a=ptime:20\r\n");
+    fprintf(f, "a=ssrc:%u cname:wt-%u-tg%u\r\n", s->ssrc, s->board_id, s->talkgroup);
+    fprintf(f, "a=recvonly\r\n");
+    fclose(f);
+}
+
+static rtpgw_stream_t *find_stream(rtpgw_t *gw, uint32_t board_id, uint8_t talkgroup,
+                                   uint64_t now_us) {
+    uint32_t key = mix32(board_id ^ ((uint32_t)talkgroup * 0x9e3779b9u));
+    uint32_t i = key & (RTPGW_TABLE_SIZE - 1);
+    rtpgw_stream_t *reuse = NULL;
+
+    for (int n = 0; n < RTPGW_TABLE_SIZE; n++, i = (i + 1) & (RTPGW_TABLE_SIZE - 1)) {
+        rtpgw_stream_t *s = &gw->table[i];
+        if (s->state == SLOT_LIVE && s->board_id == board_id && s->talkgroup == talkgroup) {
+            return s;
+        }
+        if (s->state == SLOT_DEAD && !reuse) reuse = s;
+        if (s->state == SLOT_EMPTY) {
+            if (!reuse) reuse = s;
+            break;
+        }
+    }
+
+    if (!reuse || gw->stats.streams >= RTPGW_MAX_STREAMS) {
+        gw->stats.no_stream++;
+        return NULL;
+    }
+
+    rtpgw_stream_t *s = reuse;
+    memset(s, 0, sizeof(rtpgw_stream_t));
+    s->state = SLOT_LIVE;
+    s->board_id = board_id;
+    s->talkgroup = talkgroup;
+    s->ssrc = key;
+    s->ts_base = rtpgw_rand(gw);
+    s->rtp_seq_next = (uint16_t)rtpgw_rand(gw);
+    s->marker = true;
+
+    int port = ntohs(gw->cfg.dest.sin_port);
+    if (gw->cfg.port_per_stream && port + 2 * (s - gw->table) < 65535) {
+        port += 2 * (int)(s - gw->table);
+    }
+    s->rtp_addr = gw->cfg.dest;
+    s->rtp_addr.sin_port = htons((uint16_t)port);
+    s->rtcp_addr = gw->cfg.dest;
+    s->rtcp_addr.sin_port = htons((uint16_t)(port + 1));
+
+    // Reports spread over the interval instead of all at once
+    s->next_sr_us = now_us + rtpgw_rand(gw) % ((uint64_t)RTPGW_SR_MS * 1000);
+
+    gw->stats.streams++;
+    gw->stats.streams_opened++;
+    if (gw->cfg.sdp_dir) write_sdp(gw, s);
+    printf("RTP gateway: board %u talkgroup %u is SSRC %08x on port %d\n", board_id, talkgroup,
+           s->ssrc, port);
+    return s;
+}
+
+void rtpgw_input(rtpgw_t *gw, const network_packet_t *packet, int len, uint64_t now_us) {
+    gw->stats.packets_in++;
+    if (len < (int)PACKET_HEADER_SIZE || len < (int)(PACKET_HEADER_SIZE + packet->opus_size) ||
+        (packet->flags & PKT_FLAG_SYNC)) {
+        gw->stats.ignored++;
+        return;
+    }
+
+    rtpgw_stream_t *s = find_stream(gw, packet->board_id, packet->talkgroup, now_us);
+    if (!s) return;
+    s->last_us = now_us;
+
+    // START opens a talkspurt, END and other control packets carry no audio.
+    // A START overtaken by later packets of its burst keeps their mapping,
+    // and the marker if it still goes out
+    if (packet->flags & PKT_FLAG_START) {
+        int32_t d = seq_diff(packet->seq_num, s->seq0);
+        bool straggler = s->anchored && d >= -REORDER_FRAMES &&
+                         seq_diff(packet->seq_num, s->seq_hi) < 0 &&
+                         now_us - s->last_rtp_us <= (uint64_t)RTPGW_GAP_MS * 1000;
+        if (!straggler) s->anchored = false;
+        if (!straggler || d >= 0) s->marker = true;
+    }
+    const uint8_t *data;
+    int size = red_primary(packet, &data);
+    if (size <= 0 || size > MAX_PACKET_SIZE) {
+        gw->stats.ignored++;
+        return;
+    }
+
+    // A burst whose START we missed, a sender restarting its numbering, or
+    // one far out of step starts a new mapping here
+    if (s->anchored) {
+        int32_t d = seq_diff(packet->seq_num, s->seq0);
+        if (d < -REORDER_FRAMES || d > 0xffff ||
+            now_us - s->last_rtp_us > (uint64_t)RTPGW_GAP_MS * 1000) {
+            s->anchored = false;
+            s->marker = true;
+        }
+    }
+    if (!s->anchored) {
+        s->anchored = true;
+        s->seq0 = packet->seq_num;
+        s->seq_hi = packet->seq_num;
+        s->ts0 = rtp_time(gw, s, now_us);
+        s->rtp_seq0 = s->rtp_seq_next;
+    }
+
+    // Below the burst's first packet the RTP numbers and timestamps are
+    // the last burst's: too late to go out in order
+    int32_t d = seq_diff(packet->seq_num, s->seq0);
+    if (d < 0) {
+        gw->stats.late++;
+        return;
+    }
+    s->last_rtp_us = now_us;
+
+    if (seq_diff(packet->seq_num, s->seq_hi) > 0) s->seq_hi = packet->seq_num;
+    s->rtp_seq_next = (uint16_t)(s->rtp_seq0 + seq_diff(s->seq_hi, s->seq0) + 1);
+
+    uint8_t *p = out_slot(gw, &s->rtp_addr);
+    p[0] = 0x80;                                    // V=2, no padding, extension or CSRC
+    p[1] = (uint8_t)((s->marker ? 0x80 : 0) | (gw->cfg.payload_type & 0x7f));
+    put16(p + 2, (uint16_t)(s->rtp_seq0 + d));
+    put32(p + 4, s->ts0 + (uint32_t)(d * RTPGW_FRAME_TS));
+    put32(p + 8, s->ssrc);
+    memcpy(p + RTPGW_HEADER, data, size);
+    gw->out_len[gw->n_out++] = RTPGW_HEADER + size;
+
+    s->marker = false;
+    s->packets++;
+    s->octets += size;
+    gw->stats.rtp_out++;
+}
+
+// SDES with the CNAME, which every compound RTCP packet needs
+static int put_sdes(uint8_t *p, const rtpgw_stream_t *s) {
+    char cname[48];
+    int n = snprintf(cname, sizeof(cname), "wt-%u-tg%u", s->board_id, s->talkgroup);
+
+    // Chunk: SSRC, CNAME item, end of list, padded to 32 bits
+    int chunk = 4 + 2 + n + 1;
+    chunk = (chunk + 3) & ~3;
+    memset(p, 0, 4 + chunk);
+    p[0] = 0x81;                                    // V=2, one chunk
+    p[1] = RTCP_SDES;
+    put16(p + 2, (uint16_t)(chunk / 4));
+    put32(p + 4, s->ssrc);
+    p[8] = 1;                                       // CNAME
+    p[9] = (uint8_t)n;
+    memcpy(p + 10, cname, n);
+    return 4 + chunk;
+}
+
+// SR + SDES, or RR + SDES + BYE when the stream is closing
+static void send_rtcp(rtpgw_t *gw, rtpgw_stream_t *s, uint64_t now_us, bool bye) {
+    uint8_t *p = out_slot(gw, &s->rtcp_addr);
+    int len = 0;
+
+    if (!bye) {
+        struct timespec wall;
+        clock_gettime(CLOCK_REALTIME, &wall);
+        uint64_t frac = ((uint64_t)wall.tv_nsec << 32) / 1000000000ULL;
+
+        p[0] = 0x80;                                // V=2, no report blocks
+        p[1] = RTCP_SR;
+        put16(p + 2, 6);
+        put32(p + 4, s->ssrc);
+        put32(p + 8, (uint32_t)(wall.tv_sec + NTP_UNIX_OFFSET));
+        put32(p + 12, (uint32_t)frac);
+        put32(p + 16, rtp_time(gw, s, now_us));
+        put32(p + 20, s->packets);
+        put32(p + 24, s->octets);
+        len = 28;
+    } else {
+        // A compound packet opens with a report, an empty one will do
+        p[0] = 0x80;
+        p[1] = RTCP_RR;
+        put16(p + 2, 1);
+        put32(p + 4, s->ssrc);
+        len = 8;
+    }
+
+    len += put_sdes(p + len, s);
+
+    if (bye) {
+        p[len] = 0x81;                              // V=2, one SSRC
+        p[len + 1] = RTCP_BYE;
+        put16(p + len + 2, 1);
+        put32(p + len + 4, s->ssrc);
+        len += 8;
+    }
+
+    gw->out_len[gw->n_out++] = len;
+    gw->stats.rtcp_out++;
+}
+
+static void close_stream(rtpgw_t *gw, rtpgw_stream_t *s, uint64_t now_us) {
+    send_rtcp(gw, s, now_us, true);
+    s->state = SLOT_DEAD;
+    gw->stats.streams--;
+    gw->stats.streams_closed++;
+}
+
+void rtpgw_poll(rtpgw_t *gw, uint64_t now_us) {
+    for (int i = 0; i < RTPGW_TABLE_SIZE; i++) {
+        rtpgw_stream_t *s = &gw->table[i];
+        if (s->state != SLOT_LIVE) continue;
+
+        if (now_us - s->last_us > (uint64_t)RTPGW_TIMEOUT_MS * 1000) {
+            close_stream(gw, s, now_us);
+            continue;
+        }
+        if (now_us >= s->next_sr_us) {
+            if (s->packets > 0) send_rtcp(gw, s, now_us, false);
+            s->next_sr_us += (uint64_t)RTPGW_SR_MS * 1000;
+            if (s->next_sr_us <= now_us) s->next_sr_us = now_us + (uint64_t)RTPGW_SR_MS * 1000;
+        }
+    }
+    rtpgw_flush(gw);
+}
+
+void rtpgw_cleanup(rtpgw_t *gw) {
+    if (!gw->initialized) return;
+
+    uint64_t now = network_time_us();
+    for (int i = 0; i < RTPGW_TABLE_SIZE; i++) {
+        if (gw->table[i].state == SLOT_LIVE) close_stream(gw, &gw->table[i], now);
+    }
+    rtpgw_flush(gw);
+
+    close(gw->sockfd);
+    gw->initialized = false;
+    printf("RTP gateway: %lu packets in, %lu RTP and %lu RTCP out, %lu streams, %lu send errors\n",
+           (unsigned long)gw->stats.packets_in, (unsigned long)gw->stats.rtp_out,
+           (unsigned long)gw->stats.rtcp_out, (unsigned long)gw->stats.streams_opened,
+           (unsigned long)gw->stats.send_errors);
+}
@@ -0,0 +1,127 @@
+#ifndef RTPGW_H
+#define RTPGW_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <netinet/in.h>
+
+#include "opus_helper.h"
+#include "network.h"
+
+// RTP export: every sender (board + talkgroup) heard on the group becomes
+// an RTP stream (RFC 3550, Opus payload per RFC 7587) with its own SSRC,
+// plus RTCP sender reports, so Wireshark's RTP analysis, ffmpeg or a SIP
+// gateway can take the audio without knowing network_packet_t.
+//
+//   RTP seq_num     our seq_num plus a per-burst offset, so gaps inside a
+//                   burst are real loss and bursts follow on without one
+//   RTP timestamp   48 kHz (RFC 7587 fixes the clock whatever the codec
+//                   rate), 960 per 20 ms frame from the burst's first
+//                   packet, which lands at its arrival time
+//   marker          first packet of every burst (talkspurt)
+//   reordering      a packet that arrives after a later one of its burst
+//                   keeps its place in the numbering; one from before the
+//                   burst's first forwarded packet is dropped, since the
+//                   numbers below that one went to the previous burst
+//   payload         the Opus frame only, redundant copies (red.h) dropped
+//
+// Packets are queued and go out with one sendmmsg per batch. Each stream
+// gets a sender report with its CNAME every RTPGW_SR_MS and a BYE when it
+// has been silent RTPGW_TIMEOUT_MS.
+
+#define RTPGW_MAX_STREAMS       1024
+#define RTPGW_TABLE_SIZE        2048        // Hash slots, power of 2
+#define RTPGW_BATCH             32          // Datagrams per sendmmsg
+#define RTPGW_HEADER            12
+#define RTPGW_CLOCK             48000
+#define RTPGW_FRAME_TS          (RTPGW_CLOCK / 50)      // 20 ms
+#define RTPGW_DEFAULT_PT        111
+#define RTPGW_SR_MS             5000
+#define RTPGW_TIMEOUT_MS        30000
+#define RTPGW_GAP_MS            1000        // Silence that starts a new burst without START
+
+typedef struct {
+    struct sockaddr_in dest;        // RTP; RTCP goes to the port above it
+    bool port_per_stream;           // Own port pair per stream, dest port + 2 * table slot
+    int payload_type;
+    const char *sdp_dir;            // One SDP file per stream here, NULL for none
+} rtpgw_config_t;
+
+typedef struct {
+    uint8_t state;                  // Hash slot: empty, live or dead
+    uint32_t board_id;
+    uint8_t talkgroup;
+    uint32_t ssrc;
+    struct sockaddr_in rtp_addr;
+    struct sockaddr_in rtcp_addr;
+
+    // seq_num and timestamp mapping of the current burst
+    bool anchored;
+    bool marker;
+    uint32_t seq0;
+    uint32_t seq_hi;
+    uint32_t ts0;
+    uint16_t rtp_seq0;
+    uint16_t rtp_seq_next;          // Where the next burst carries on
+    uint32_t ts_base;               // Random RTP time origin
+
+    uint64_t last_us;               // Last packet of any kind
+    uint64_t last_rtp_us;           // Last one forwarded
+    uint64_t next_sr_us;
+    uint32_t packets;               // For the sender reports (RFC 3550 counts wrap)
+    uint32_t octets;
+} rtpgw_stream_t;
+
+typedef struct {
+    uint64_t packets_in;
+    uint64_t rtp_out;
+    uint64_t rtcp_out;
+    uint64_t ignored;               // START/END, clock sync, malformed
+    uint64_t late;                  // From before their burst's first packet
+    uint64_t streams_opened;
+    uint64_t streams_closed;
+    uint64_t no_stream;             // Senders refused, table full
+    uint64_t send_errors;
+    int streams;
+} rtpgw_stats_t;
+
+typedef struct {
+    rtpgw_config_t cfg;
+    int sockfd;
+    uint64_t start_us;
+    uint32_t rng;
+
+    rtpgw_stream_t table[RTPGW_TABLE_SIZE];
+
+    // Output batch
+    uint8_t out[RTPGW_BATCH][RTPGW_HEADER + MAX_PACKET_SIZE];
+    int out_len[RTPGW_BATCH];
+    const struct sockaddr_in *out_addr[RTPGW_BATCH];
+    int n_out;
+
+    rtpgw_stats_t stats;
+    bool initialized;
+} rtpgw_t;
+
+void rtpgw_config_default(rtpgw_config_t *cfg);
+
+// Parse "host:port" into cfg->dest
+int rtpgw_parse_dest(rtpgw_config_t *cfg, const char *spec);
+
+// Opens the output socket
+int rtpgw_init(rtpgw_t *gw, const rtpgw_config_t *cfg);
+
+// One packet from network_recv(_batch), arrived at now_us
+// (network_time_us clock). Queued, sent by rtpgw_flush or a full batch.
+void rtpgw_input(rtpgw_t *gw, const network_packet_t *packet, int len, uint64_t now_us);
+
+// Sender reports that are due and BYEs for silent senders, then flush
+void rtpgw_poll(rtpgw_t *gw, uint64_t now_us);
+
+// Send what is queued
+void rtpgw_flush(rtpgw_t *gw);
+
+// BYE for every stream, then the socket
+void rtpgw_cleanup(rtpgw_t *gw);
+
+#endif // RTPGW_H
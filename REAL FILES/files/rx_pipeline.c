@@ -0,0 +1,375 @@
+#include "rx_pipeline.h"
+#include "red.h"
+#include <stdio.h>
+#include <string.h>
+
+// Signed distance between sequence numbers (handles wrap around)
+static inline int32_t seq_diff(uint32_t a, uint32_t b) {
+    return (int32_t)(a - b);
+}
+
+static void jitter_flush(rx_pipeline_t *p) {
+    for (int i = 0; i < JITTER_SLOTS; i++) {
+        p->slots[i].valid = false;
+    }
+    p->buffered = 0;
+}
+
+static int clamp_target(int target_depth) {
+    if (target_depth < 1) target_depth = 1;
+    if (target_depth > JITTER_SLOTS - 1) target_depth = JITTER_SLOTS - 1;
+    return target_depth;
+}
+
+void rx_pipeline_init(rx_pipeline_t *p, opus_dec_ctx_t *decoder, int target_depth) {
+    memset(p, 0, sizeof(rx_pipeline_t));
+    p->decoder = decoder;
+    p->target_depth = clamp_target(target_depth);
+    p->late_join = true;
+}
+
+void rx_pipeline_set_target(rx_pipeline_t *p, int target_depth) {
+    __atomic_store_n(&p->pending_target, clamp_target(target_depth), __ATOMIC_RELEASE);
+}
+
+void rx_pipeline_use_pool(rx_pipeline_t *p, codec_pool_t *pool) {
+    p->pool = pool;
+    p->decoder = NULL;
+}
+
+static void release_decoder(rx_pipeline_t *p) {
+    if (p->pool && p->decoder) {
+        codec_pool_release_dec(p->pool, p->decoder);
+        p->decoder = NULL;
+    }
+}
+
+// RFC 3550 style jitter: deviation of the arrival spacing from the send spacing
+static void update_jitter(rx_pipeline_t *p, uint32_t seq_num, uint64_t now_us) {
+    if (p->have_last) {
+        int64_t arrival = (int64_t)(now_us - p->last_arrival_us);
+        int64_t sent = (int64_t)seq_diff(seq_num, p->last_seq) * (int64_t)FRAME_US;
+        int64_t d = arrival - sent;
+        if (d < 0) d = -d;
+        p->stats.jitter_us += (int32_t)((d - (int64_t)p->stats.jitter_us) / 16);
+    }
+    p->last_arrival_us = now_us;
+    p->last_seq = seq_num;
+    p->have_last = true;
+}
+
+static void end_burst(rx_pipeline_t *p, uint64_t now_us) {
+    p->closed_sender = p->sender;
+    p->closed_seq = p->ending ? p->end_seq : p->next_seq - 1;
+    p->closed_us = now_us;
+    p->closed_valid = true;
+
+    jitter_flush(p);
+    release_decoder(p);
+    p->receiving = false;
+    p->playing = false;
+    p->ending = false;
+}
+
+// Open a burst for sender, playout starting at next_seq
+static int start_burst(rx_pipeline_t *p, uint32_t sender, uint32_t next_seq, uint64_t now_us) {
+    jitter_flush(p);
+
+    // A new jitter target only takes effect between bursts
+    int target = __atomic_exchange_n(&p->pending_target, 0, __ATOMIC_ACQUIRE);
+    if (target > 0) p->target_depth = target;
+
+    if (p->pool) {
+        release_decoder(p);
+        p->decoder = codec_pool_acquire_dec(p->pool);
+        if (!p->decoder) {
+            p->receiving = false;
+            p->stats.no_decoder++;
+            return RX_EVENT_NONE;
+        }
+    }
+
+    p->receiving = true;
+    p->playing = false;
+    p->ending = false;
+    p->conceal_run = 0;
+    p->sender = sender;
+    p->next_seq = next_seq;
+    p->last_packet_us = now_us;
+    p->fade_pos = RX_FADE_IN_SAMPLES;
+    p->have_last = false;
+    p->stats.bursts++;
+    return RX_EVENT_START;
+}
+
+// Audio from a sender without an open burst: take it from here, unless
+// it is a straggler of the burst that just ended
+static int join_burst(rx_pipeline_t *p, const network_packet_t *packet,
+                      const uint8_t *data, int size, uint64_t now_us) {
+    if (p->closed_valid && packet->board_id == p->closed_sender &&
+        now_us - p->closed_us < (uint64_t)RX_CLOSED_GUARD_MS * 1000 &&
+        seq_diff(packet->seq_num, p->closed_seq) <= 0) {
+        p->stats.frames_late++;
+        return RX_EVENT_NONE;
+    }
+
+    if (start_burst(p, packet->board_id, packet->seq_num, now_us) != RX_EVENT_START) {
+        return RX_EVENT_NONE;
+    }
+    p->stats.late_joins++;
+
+    // Warm the decoder up on the redundant copy of the frame before this
+    // one (plain PLC if the packet has none), so it does not start from
+    // silence in the middle of a word; the output is thrown away
+    int16_t scratch[FRAME_SIZE];
+    opus_decode_fec(p->decoder, data, size, scratch, FRAME_SIZE);
+
+    // Ramp the first frames in
+    p->fade_pos = 0;
+    return RX_EVENT_START;
+}
+
+static void store_frame(rx_pipeline_t *p, uint32_t seq_num, const uint8_t *data, int size,
+                        uint64_t arrival_us, uint64_t media_us) {
+    jitter_slot_t *slot = &p->slots[seq_num & (JITTER_SLOTS - 1)];
+    memcpy(slot->data, data, size);
+    slot->size = (uint16_t)size;
+    slot->seq_num = seq_num;
+    slot->arrival_us = arrival_us;
+    slot->media_us = media_us;
+    if (!slot->valid) p->buffered++;
+    slot->valid = true;
+}
+
+// Earlier frames a packet carries: any the buffer is still waiting for
+// go in as if they had arrived themselves, the rest are dropped
+static void store_redundant(rx_pipeline_t *p, const network_packet_t *packet,
+                            const red_block_t *blocks, int count, uint64_t now_us,
+                            uint64_t media_us) {
+    for (int i = 0; i < count; i++) {
+        uint32_t seq_num = packet->seq_num - blocks[i].back;
+        int32_t ahead = seq_diff(seq_num, p->next_seq);
+        p->stats.red_blocks++;
+        if (ahead < 0 || ahead >= JITTER_SLOTS) continue;
+
+        jitter_slot_t *slot = &p->slots[seq_num & (JITTER_SLOTS - 1)];
+        if (slot->valid && slot->seq_num == seq_num) continue;
+
+        store_frame(p, seq_num, blocks[i].data, blocks[i].size, now_us,
+                    media_us ? media_us - blocks[i].back * FRAME_US : 0);
+        p->stats.frames_redundant++;
+    }
+}
+
+int rx_pipeline_push(rx_pipeline_t *p, const network_packet_t *packet,
+                     int len, uint64_t now_us) {
+    // Ignore anything shorter than its header claims, and clock sync
+    if (len < (int)PACKET_HEADER_SIZE ||
+        len < (int)(PACKET_HEADER_SIZE + packet->opus_size) ||
+        (packet->flags & PKT_FLAG_SYNC)) {
+        return RX_EVENT_NONE;
+    }
+
+    bool ours = p->receiving && packet->board_id == p->sender;
+
+    // The current talker went quiet without an END: let the next one in
+    if (p->receiving && !ours &&
+        now_us - p->last_packet_us > (uint64_t)RX_SENDER_TIMEOUT_MS * 1000) {
+        p->stats.timeouts++;
+        end_burst(p, now_us);
+    }
+
+    // Handle START packet (a stale one, behind a burst we joined late, is not a restart)
+    if (packet->flags & PKT_FLAG_START) {
+        if (ours && seq_diff(packet->seq_num, p->next_seq) < 0) {
+            return RX_EVENT_NONE;
+        }
+        return start_burst(p, packet->board_id, packet->seq_num + 1, now_us);
+    }
+
+    // With redundancy the packet's own frame comes last
+    const uint8_t *data = packet->opus_data;
+    int size = packet->opus_size;
+    red_block_t blocks[RED_MAX_DEPTH], primary;
+    int red = 0;
+    if (packet->flags & PKT_FLAG_RED) {
+        red = red_unpack(packet->opus_data, packet->opus_size, blocks, &primary);
+        if (red < 0) return RX_EVENT_NONE;
+        data = primary.data;
+        size = primary.size;
+    }
+
+    if (size > MAX_PACKET_SIZE || (size == 0 && !(packet->flags & PKT_FLAG_END))) {
+        return RX_EVENT_NONE;
+    }
+
+    // Only the sender that opened the burst is played; anyone else's
+    // audio opens one if nobody is talking
+    int event = RX_EVENT_NONE;
+    if (!ours) {
+        if (p->receiving || !p->late_join || (packet->flags & PKT_FLAG_END)) {
+            return RX_EVENT_NONE;
+        }
+        event = join_burst(p, packet, data, size, now_us);
+        if (event != RX_EVENT_START) return event;
+    }
+
+    p->last_packet_us = now_us;
+
+    // Handle END packet, buffered frames still drain up to end_seq
+    if (packet->flags & PKT_FLAG_END) {
+        p->ending = true;
+        p->end_seq = packet->seq_num;
+        return RX_EVENT_END;
+    }
+
+    p->stats.packets++;
+    update_jitter(p, packet->seq_num, now_us);
+
+    int32_t ahead = seq_diff(packet->seq_num, p->next_seq);
+
+    // Its playout slot has already gone
+    if (ahead < 0) {
+        p->stats.frames_late++;
+        return RX_EVENT_NONE;
+    }
+
+    // Too far ahead to buffer (long outage), restart playout from here
+    if (ahead >= JITTER_SLOTS) {
+        jitter_flush(p);
+        p->playing = false;
+        p->next_seq = packet->seq_num;
+    }
+
+    // Already here, from its first copy or a later packet's redundancy;
+    // the frames it carries may still fill a gap
+    jitter_slot_t *slot = &p->slots[packet->seq_num & (JITTER_SLOTS - 1)];
+    if (slot->valid && slot->seq_num == packet->seq_num) {
+        p->stats.frames_duplicate++;
+        if (red > 0) store_redundant(p, packet, blocks, red, now_us, slot->media_us);
+        return RX_EVENT_NONE;
+    }
+
+    uint64_t media_us = (uint64_t)packet->timestamp_sec * 1000000 + packet->timestamp_usec;
+    store_frame(p, packet->seq_num, data, size, now_us, media_us);
+    if (red > 0) store_redundant(p, packet, blocks, red, now_us, media_us);
+
+    return event;
+}
+
+// Fill a missing frame: FEC from the following packet if we have it, else PLC
+static int conceal_frame(rx_pipeline_t *p, int16_t *pcm) {
+    jitter_slot_t *next = &p->slots[(p->next_seq + 1) & (JITTER_SLOTS - 1)];
+    int samples;
+
+    if (next->valid && next->seq_num == p->next_seq + 1) {
+        samples = opus_decode_fec(p->decoder, next->data, next->size, pcm, FRAME_SIZE);
+        if (samples == FRAME_SIZE) {
+            p->stats.frames_recovered++;
+        }
+    } else {
+        samples = opus_decode_lost(p->decoder, pcm, FRAME_SIZE);
+    }
+
+    if (samples != FRAME_SIZE) {
+        memset(pcm, 0, FRAME_SIZE * sizeof(int16_t));
+    }
+
+    p->stats.frames_concealed++;
+    p->conceal_run++;
+    p->last_concealed = true;
+    p->next_seq++;
+    return FRAME_SIZE;
+}
+
+// Linear ramp over the first RX_FADE_IN_SAMPLES of a joined burst
+static void fade_in(rx_pipeline_t *p, int16_t *pcm) {
+    for (int i = 0; i < FRAME_SIZE && p->fade_pos < RX_FADE_IN_SAMPLES; i++, p->fade_pos++) {
+        pcm[i] = (int16_t)((int32_t)pcm[i] * p->fade_pos / RX_FADE_IN_SAMPLES);
+    }
+}
+
+static int pull_frame(rx_pipeline_t *p, int16_t *pcm, bool clocked) {
+    if (!p->receiving) return 0;
+
+    // Transmission finished and everything before END was played
+    if (p->ending && seq_diff(p->end_seq, p->next_seq) <= 0) {
+        end_burst(p, p->last_packet_us);
+        return 0;
+    }
+
+    // Prebuffer until the target depth is reached (or the burst is ending)
+    if (!p->playing) {
+        if (p->buffered < p->target_depth && !(p->ending && p->buffered > 0)) {
+            return 0;
+        }
+        p->playing = true;
+        p->conceal_run = 0;
+    }
+
+    jitter_slot_t *slot = &p->slots[p->next_seq & (JITTER_SLOTS - 1)];
+
+    if (slot->valid && slot->seq_num == p->next_seq) {
+        int samples = opus_decode_frame(p->decoder, slot->data, slot->size, pcm, FRAME_SIZE);
+
+        slot->valid = false;
+        p->buffered--;
+
+        if (samples != FRAME_SIZE) {
+            p->stats.frames_dropped++;
+            return conceal_frame(p, pcm);
+        }
+
+        p->stats.frames_played++;
+        p->conceal_run = 0;
+        p->last_played_arrival_us = slot->arrival_us;
+        p->last_played_media_us = slot->media_us;
+        p->last_concealed = false;
+        p->next_seq++;
+        return FRAME_SIZE;
+    }
+
+    // A later frame is buffered, so this one was lost
+    if (p->buffered > 0) {
+        return conceal_frame(p, pcm);
+    }
+
+    // Nothing buffered: wait unless the playout clock demands a frame
+    if (!clocked) return 0;
+
+    if (p->ending) {
+        end_burst(p, p->last_packet_us);
+        return 0;
+    }
+
+    p->stats.underruns++;
+
+    // Sender went quiet without an END, stop concealing and rebuffer
+    if (p->conceal_run >= JITTER_MAX_CONCEAL) {
+        p->playing = false;
+        return 0;
+    }
+
+    return conceal_frame(p, pcm);
+}
+
+int rx_pipeline_pull(rx_pipeline_t *p, int16_t *pcm, bool clocked) {
+    int samples = pull_frame(p, pcm, clocked);
+    if (samples > 0 && p->fade_pos < RX_FADE_IN_SAMPLES) {
+        fade_in(p, pcm);
+    }
+    return samples;
+}
+
+int rx_pipeline_poll(rx_pipeline_t *p, uint64_t now_us) {
+    if (!p->receiving || now_us - p->last_packet_us <= (uint64_t)RX_SENDER_TIMEOUT_MS * 1000) {
+        return RX_EVENT_NONE;
+    }
+    p->stats.timeouts++;
+    end_burst(p, now_us);
+    return RX_EVENT_END;
+}
+
+bool rx_pipeline_active(const rx_pipeline_t *p) {
+    return p->receiving;
+}
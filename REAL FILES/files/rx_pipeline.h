@@ -0,0 +1,127 @@
+#ifndef RX_PIPELINE_H
+#define RX_PIPELINE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "opus_helper.h"
+#include "network.h"
+#include "codec_pool.h"
+
+// Jitter buffer configuration
+#define JITTER_SLOTS            16      // Must be a power of 2
+#define JITTER_DEFAULT_TARGET   1       // Frames buffered before playout starts
+#define JITTER_MAX_CONCEAL      10      // Concealed frames in a row before rebuffering
+
+// Late join: audio from a sender with no open burst (START lost, or this
+// board came up mid-transmission) opens one. The decoder is primed with
+// the packet's FEC data first and playout fades in, so the join does not
+// click. A sender silent this long has its burst closed without an END.
+#define RX_SENDER_TIMEOUT_MS    500
+#define RX_FADE_IN_SAMPLES      (SAMPLE_RATE / 100)     // 10 ms
+#define RX_CLOSED_GUARD_MS      1000    // Stray packets of a closed burst don't reopen it
+
+// Frame duration in microseconds (20ms)
+#define FRAME_US                ((uint64_t)FRAME_SIZE * 1000000 / SAMPLE_RATE)
+
+// Events returned by rx_pipeline_push
+#define RX_EVENT_NONE           0
+#define RX_EVENT_START          1
+#define RX_EVENT_END            2
+
+// One buffered Opus frame
+typedef struct {
+    uint8_t data[MAX_PACKET_SIZE];
+    uint16_t size;
+    uint32_t seq_num;
+    uint64_t arrival_us;
+    uint64_t media_us;              // Sender's timestamp (shared clock), 0 if none
+    bool valid;
+} jitter_slot_t;
+
+typedef struct {
+    uint64_t bursts;
+    uint64_t packets;
+    uint64_t frames_played;
+    uint64_t frames_concealed;
+    uint64_t frames_recovered;      // Rebuilt from FEC of the next packet
+    uint64_t frames_redundant;      // Missing ones filled in from a later packet's copy (red.h)
+    uint64_t red_blocks;            // Redundant copies received
+    uint64_t frames_late;
+    uint64_t frames_duplicate;
+    uint64_t frames_dropped;        // Decoder errors
+    uint64_t underruns;
+    uint64_t no_decoder;            // Bursts refused, codec pool exhausted
+    uint64_t late_joins;            // Bursts opened by an audio packet
+    uint64_t timeouts;              // Bursts closed by sender silence
+    uint32_t jitter_us;             // RFC 3550 interarrival jitter estimate
+} rx_stats_t;
+
+// Decode + jitter stage of the receive path.
+// Packets go in with rx_pipeline_push, PCM frames come out with
+// rx_pipeline_pull; the caller owns the actual playout (DMA or file).
+typedef struct {
+    opus_dec_ctx_t *decoder;
+    codec_pool_t *pool;             // Decoder per burst from here, when set
+    jitter_slot_t slots[JITTER_SLOTS];
+    int target_depth;
+    int pending_target;             // From rx_pipeline_set_target, 0 = none
+    int buffered;
+    int conceal_run;
+
+    // Burst state
+    bool receiving;
+    bool playing;
+    bool ending;
+    uint32_t sender;
+    uint32_t next_seq;
+    uint32_t end_seq;
+    uint64_t last_packet_us;        // Last packet of the current sender
+    bool late_join;                 // Open bursts without START (default on)
+    int fade_pos;                   // Fade-in progress of a joined burst
+
+    // The burst that ended last, so its late packets are not a new one
+    uint32_t closed_sender;
+    uint32_t closed_seq;
+    uint64_t closed_us;
+    bool closed_valid;
+
+    // Interarrival jitter tracking
+    uint64_t last_arrival_us;
+    uint32_t last_seq;
+    bool have_last;
+
+    // Arrival time and timestamp of the packet behind the last pulled frame
+    uint64_t last_played_arrival_us;
+    uint64_t last_played_media_us;
+    bool last_concealed;
+
+    rx_stats_t stats;
+} rx_pipeline_t;
+
+void rx_pipeline_init(rx_pipeline_t *p, opus_dec_ctx_t *decoder, int target_depth);
+
+// Take a fresh decoder from the pool at every burst start and hand it
+// back (reset) when the burst ends, instead of one fixed decoder
+void rx_pipeline_use_pool(rx_pipeline_t *p, codec_pool_t *pool);
+
+// Change the jitter target from any thread, applied at the next burst start
+void rx_pipeline_set_target(rx_pipeline_t *p, int target_depth);
+
+// Feed one received packet (len = bytes returned by network_recv)
+int rx_pipeline_push(rx_pipeline_t *p, const network_packet_t *packet,
+                     int len, uint64_t now_us);
+
+// Produce the next playout frame into pcm (FRAME_SIZE samples).
+// clocked: the caller is a playout clock, so an empty buffer is an
+// underrun to conceal rather than a reason to wait.
+// Returns samples written, or 0 when there is nothing to play.
+int rx_pipeline_pull(rx_pipeline_t *p, int16_t *pcm, bool clocked);
+
+// Close a burst whose sender went silent (no END). Call while no packets
+// arrive; returns RX_EVENT_END when it closed one.
+int rx_pipeline_poll(rx_pipeline_t *p, uint64_t now_us);
+
+bool rx_pipeline_active(const rx_pipeline_t *p);
+
+#endif // RX_PIPELINE_H
@@ -0,0 +1,173 @@
+#include "startup.h"
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+static uint64_t now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+int startup_init(startup_ctx_t *ctx) {
+    memset(ctx, 0, sizeof(startup_ctx_t));
+    ctx->t0_us = now_us();
+
+    if (pthread_mutex_init(&ctx->lock, NULL) != 0 ||
+        pthread_cond_init(&ctx->changed, NULL) != 0) {
+        fprintf(stderr, "startup: mutex/cond init failed\n");
+        return -1;
+    }
+
+    ctx->initialized = true;
+    return 0;
+}
+
+int startup_add(startup_ctx_t *ctx, const char *name, startup_init_fn init,
+                startup_cleanup_fn cleanup, void *arg, uint32_t deps, bool optional) {
+    if (ctx->count >= STARTUP_MAX_STEPS) {
+        fprintf(stderr, "startup: too many steps\n");
+        return -1;
+    }
+
+    // Dependencies can only point backwards, so there are no cycles
+    if (deps >> ctx->count) {
+        fprintf(stderr, "startup: %s depends on a later step\n", name);
+        return -1;
+    }
+
+    startup_step_t *s = &ctx->steps[ctx->count];
+    memset(s, 0, sizeof(startup_step_t));
+    s->name = name;
+    s->init = init;
+    s->cleanup = cleanup;
+    s->arg = arg;
+    s->deps = deps;
+    s->optional = optional;
+    s->done_order = -1;
+    return ctx->count++;
+}
+
+// 1 = all deps done, 0 = still waiting, -1 = a dep will never be done
+static int deps_ready(const startup_ctx_t *ctx, const startup_step_t *s) {
+    int ready = 1;
+    for (int i = 0; i < ctx->count; i++) {
+        if (!(s->deps & (1u << i))) continue;
+        int state = ctx->steps[i].state;
+        if (state == STARTUP_FAILED || state == STARTUP_SKIPPED) return -1;
+        if (state != STARTUP_DONE) ready = 0;
+    }
+    return ready;
+}
+
+typedef struct {
+    startup_ctx_t *ctx;
+    startup_step_t *step;
+} startup_worker_t;
+
+static void *startup_worker(void *arg) {
+    startup_worker_t *w = arg;
+    startup_ctx_t *ctx = w->ctx;
+    startup_step_t *s = w->step;
+
+    pthread_mutex_lock(&ctx->lock);
+    int ready = 0;
+    while (!ctx->abort && (ready = deps_ready(ctx, s)) == 0) {
+        pthread_cond_wait(&ctx->changed, &ctx->lock);
+    }
+    if (ctx->abort || ready < 0) {
+        s->state = STARTUP_SKIPPED;
+        pthread_cond_broadcast(&ctx->changed);
+        pthread_mutex_unlock(&ctx->lock);
+        return NULL;
+    }
+    s->state = STARTUP_RUNNING;
+    s->start_us = now_us() - ctx->t0_us;
+    pthread_mutex_unlock(&ctx->lock);
+
+    int result = s->init(s->arg);
+
+    pthread_mutex_lock(&ctx->lock);
+    s->end_us = now_us() - ctx->t0_us;
+    s->result = result;
+    if (result < 0) {
+        s->state = STARTUP_FAILED;
+        fprintf(stderr, "startup: %s failed%s\n", s->name, s->optional ? " (optional)" : "");
+        if (!s->optional) ctx->abort = true;
+    } else {
+        s->state = STARTUP_DONE;
+        s->done_order = ctx->completed++;
+    }
+    pthread_cond_broadcast(&ctx->changed);
+    pthread_mutex_unlock(&ctx->lock);
+    return NULL;
+}
+
+int startup_run(startup_ctx_t *ctx) {
+    startup_worker_t workers[STARTUP_MAX_STEPS];
+    bool threaded[STARTUP_MAX_STEPS] = {false};
+
+    for (int i = 0; i < ctx->count; i++) {
+        workers[i].ctx = ctx;
+        workers[i].step = &ctx->steps[i];
+        if (pthread_create(&ctx->steps[i].thread, NULL, startup_worker, &workers[i]) == 0) {
+            threaded[i] = true;
+        } else {
+            // Deps only point backwards, so running it here cannot deadlock
+            startup_worker(&workers[i]);
+        }
+    }
+
+    for (int i = 0; i < ctx->count; i++) {
+        if (threaded[i]) pthread_join(ctx->steps[i].thread, NULL);
+    }
+
+    ctx->ready_us = now_us() - ctx->t0_us;
+
+    for (int i = 0; i < ctx->count; i++) {
+        const startup_step_t *s = &ctx->steps[i];
+        if (!s->optional && s->state != STARTUP_DONE) {
+            startup_report(ctx);
+            startup_shutdown(ctx);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+bool startup_ok(const startup_ctx_t *ctx, int step) {
+    return step >= 0 && step < ctx->count && ctx->steps[step].state == STARTUP_DONE;
+}
+
+void startup_shutdown(startup_ctx_t *ctx) {
+    for (int order = ctx->completed - 1; order >= 0; order--) {
+        for (int i = 0; i < ctx->count; i++) {
+            startup_step_t *s = &ctx->steps[i];
+            if (s->state != STARTUP_DONE || s->done_order != order) continue;
+            if (s->cleanup) s->cleanup(s->arg);
+            s->state = STARTUP_PENDING;
+        }
+    }
+    ctx->completed = 0;
+}
+
+void startup_report(const startup_ctx_t *ctx) {
+    static const char *state_names[] = { "pending", "running", "ok", "FAILED", "skipped" };
+    uint64_t total = 0;
+
+    printf("Startup:\n");
+    for (int i = 0; i < ctx->count; i++) {
+        const startup_step_t *s = &ctx->steps[i];
+        if (s->state == STARTUP_SKIPPED) {
+            printf("  %-10s skipped\n", s->name);
+            continue;
+        }
+        uint64_t took = s->end_us - s->start_us;
+        total += took;
+        printf("  %-10s start %6.1f ms  ready %6.1f ms  (%5.1f ms) %s\n",
+               s->name, s->start_us / 1000.0, s->end_us / 1000.0, took / 1000.0,
+               state_names[s->state]);
+    }
+    printf("  Ready after %.1f ms (%.1f ms if run one after another)\n\n",
+           ctx->ready_us / 1000.0, total / 1000.0);
+}
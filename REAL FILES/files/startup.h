@@ -0,0 +1,75 @@
+#ifndef STARTUP_H
+#define STARTUP_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <pthread.h>
+
+// Startup orchestrator: subsystems register an init/cleanup pair and the
+// steps they depend on, startup_run brings up everything that is ready in
+// parallel, and on failure (or at shutdown) the completed steps are torn
+// down in reverse order of completion.
+
+#define STARTUP_MAX_STEPS   16
+
+#define STARTUP_PENDING     0
+#define STARTUP_RUNNING     1
+#define STARTUP_DONE        2
+#define STARTUP_FAILED      3
+#define STARTUP_SKIPPED     4   // A dependency failed (or startup aborted)
+
+typedef int (*startup_init_fn)(void *arg);
+typedef void (*startup_cleanup_fn)(void *arg);
+
+typedef struct {
+    const char *name;
+    startup_init_fn init;
+    startup_cleanup_fn cleanup;     // May be NULL
+    void *arg;
+    uint32_t deps;                  // Bit i = step i must be done first
+    bool optional;                  // Failure is reported but not fatal
+
+    int state;
+    int result;
+    int done_order;
+    uint64_t start_us;              // Relative to startup_init
+    uint64_t end_us;
+    pthread_t thread;
+} startup_step_t;
+
+typedef struct {
+    startup_step_t steps[STARTUP_MAX_STEPS];
+    int count;
+    int completed;                  // Steps in done_order so far
+    bool abort;
+
+    uint64_t t0_us;
+    uint64_t ready_us;
+
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+    bool initialized;
+} startup_ctx_t;
+
+int startup_init(startup_ctx_t *ctx);
+
+// Register a step, returns its index (for use in deps) or -1
+int startup_add(startup_ctx_t *ctx, const char *name, startup_init_fn init,
+                startup_cleanup_fn cleanup, void *arg, uint32_t deps, bool optional);
+
+// Run every step; returns 0 when all required steps succeeded. On failure
+// the steps that did come up are already rolled back.
+int startup_run(startup_ctx_t *ctx);
+
+// Was this step brought up (optional steps may not have been)?
+bool startup_ok(const startup_ctx_t *ctx, int step);
+
+// Tear down completed steps, newest first
+void startup_shutdown(startup_ctx_t *ctx);
+
+// Per-step start/ready times and the critical path
+void startup_report(const startup_ctx_t *ctx);
+
+#define STARTUP_DEP(i)      ((i) >= 0 ? 1u << (i) : 0u)
+
+#endif // STARTUP_H
@@ -0,0 +1,505 @@
+#include "tx_fanout.h"
+#include "wtlog.h"
+#include "wttrace.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+
+static uint64_t now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+void tx_fanout_config_default(tx_fanout_config_t *cfg, uint8_t talkgroup,
+                              const opus_enc_params_t *params) {
+    memset(cfg, 0, sizeof(tx_fanout_config_t));
+    cfg->streams[0].talkgroup = talkgroup;
+    if (params) {
+        cfg->streams[0].params = *params;
+    } else {
+        opus_enc_params_default(&cfg->streams[0].params, BITRATE);
+    }
+    cfg->count = 1;
+    cfg->workers = -1;
+    cfg->budget_us = TX_ADAPT_BUDGET_US;
+}
+
+int tx_fanout_parse(tx_fanout_config_t *cfg, const char *spec) {
+    char buf[256];
+    snprintf(buf, sizeof(buf), "%s", spec);
+
+    // An explicit list replaces the default stream, and takes the
+    // settings it does not name from it
+    opus_enc_params_t base = cfg->streams[0].params;
+    int count = 0;
+    char *save = NULL;
+    for (char *tok = strtok_r(buf, ", ", &save); tok; tok = strtok_r(NULL, ", ", &save)) {
+        if (strncmp(tok, "workers=", 8) == 0) {
+            cfg->workers = atoi(tok + 8);
+            if (cfg->workers < 0 || cfg->workers > TX_FANOUT_MAX_WORKERS) {
+                fprintf(stderr, "tx_fanout: workers must be 0-%d\n", TX_FANOUT_MAX_WORKERS);
+                return -1;
+            }
+            continue;
+        }
+
+        if (count >= TX_FANOUT_MAX_STREAMS) {
+            fprintf(stderr, "tx_fanout: at most %d streams\n", TX_FANOUT_MAX_STREAMS);
+            return -1;
+        }
+
+        int tg, bitrate, complexity = 0;
+        int n = sscanf(tok, "%d:%d:%d", &tg, &bitrate, &complexity);
+        if (n < 2) {
+            fprintf(stderr, "tx_fanout: expected talkgroup:bitrate, got '%s'\n", tok);
+            return -1;
+        }
+        if (tg < 0 || tg >= CRYPTO_MAX_TALKGROUPS || bitrate < 6000 || bitrate > 510000 ||
+            (n == 3 && (complexity < 0 || complexity > 10))) {
+            fprintf(stderr, "tx_fanout: parameter out of range in '%s'\n", tok);
+            return -1;
+        }
+        for (int i = 0; i < count; i++) {
+            if (cfg->streams[i].talkgroup == tg) {
+                fprintf(stderr, "tx_fanout: talkgroup %d listed twice\n", tg);
+                return -1;
+            }
+        }
+
+        tx_stream_config_t *s = &cfg->streams[count];
+        memset(s, 0, sizeof(tx_stream_config_t));
+        s->talkgroup = (uint8_t)tg;
+        s->params = base;
+        s->params.bitrate = bitrate;
+        if (n == 3) {
+            s->params.complexity = complexity;
+            s->own_complexity = true;
+        }
+        count++;
+    }
+
+    if (count > 0) cfg->count = count;
+    return 0;
+}
+
+// A stream's settings at a deadline control level: complexity first,
+// then bandwidth
+static void tx_fanout_level_params(const opus_enc_params_t *base, int level,
+                                   opus_enc_params_t *out) {
+    *out = *base;
+    int steps = (base->complexity + 1) / 2;
+    if (level <= steps) {
+        out->complexity = base->complexity - 2 * level;
+        if (out->complexity < 0) out->complexity = 0;
+        return;
+    }
+
+    out->complexity = 0;
+    int cap = level - steps == 1 ? OPUS_BANDWIDTH_WIDEBAND : OPUS_BANDWIDTH_NARROWBAND;
+    if (out->bandwidth == OPUS_AUTO || out->bandwidth > cap) out->bandwidth = cap;
+}
+
+// Levels until every stream is at complexity 0 and narrowband
+static int tx_fanout_levels(tx_fanout_t *ctx) {
+    int levels = 0;
+    for (int i = 0; i < ctx->n_streams; i++) {
+        int n = (ctx->streams[i].cfg.params.complexity + 1) / 2 + 2;
+        if (n > levels) levels = n;
+    }
+    return levels;
+}
+
+// Encode one stream's frame straight into its packet and seal it
+static void tx_fanout_encode(tx_fanout_t *ctx, tx_stream_t *s) {
+    const int16_t *pcm = ctx->sources[s->cfg.source];
+    int max_bytes = MAX_PACKET_SIZE;
+    if (max_bytes > MAX_OPUS_PACKET - CRYPTO_OVERHEAD) max_bytes = MAX_OPUS_PACKET - CRYPTO_OVERHEAD;
+
+    s->len = 0;
+    uint64_t t0 = WTTRACE_BEGIN();
+    int size;
+    uint8_t flags = 0;
+    if (s->red.depth > 0) {
+        size = opus_encode_frame(s->encoder, pcm, FRAME_SIZE, s->frame, max_bytes);
+        if (size > 0) {
+            size = red_pack(&s->red, s->seq_num, s->frame, size, s->packet.opus_data,
+                            MAX_OPUS_PACKET - CRYPTO_OVERHEAD);
+            flags = PKT_FLAG_RED;
+        }
+    } else {
+        size = opus_encode_frame(s->encoder, pcm, FRAME_SIZE, s->packet.opus_data, max_bytes);
+    }
+    WTTRACE_END("encode", t0, ctx->net->my_board_id, s->seq_num);
+    if (size > 0) {
+        int len = network_prepare(ctx->net, &s->packet, s->cfg.talkgroup, s->seq_num,
+                                  (uint16_t)size, flags);
+        if (len > 0) {
+            s->seq_num++;
+            s->len = len;
+        }
+    }
+    if (s->len > 0) {
+        s->frames++;
+    } else {
+        s->failures++;
+    }
+}
+
+// Claim streams until every one of this frame is taken (caller holds the lock)
+static void tx_fanout_drain(tx_fanout_t *ctx) {
+    while (ctx->next < ctx->n_streams) {
+        tx_stream_t *s = &ctx->streams[ctx->next++];
+        pthread_mutex_unlock(&ctx->lock);
+
+        tx_fanout_encode(ctx, s);
+
+        pthread_mutex_lock(&ctx->lock);
+        if (++ctx->done == ctx->n_streams) {
+            pthread_cond_signal(&ctx->finished);
+        }
+    }
+}
+
+static void *tx_fanout_worker(void *arg) {
+    tx_fanout_t *ctx = arg;
+    uint32_t seen = 0;
+    wtlog_thread("encode");
+
+    pthread_mutex_lock(&ctx->lock);
+    for (;;) {
+        while (!ctx->stop && ctx->generation == seen) {
+            pthread_cond_wait(&ctx->work, &ctx->lock);
+        }
+        if (ctx->stop) break;
+        seen = ctx->generation;
+        tx_fanout_drain(ctx);
+    }
+    pthread_mutex_unlock(&ctx->lock);
+    return NULL;
+}
+
+static void tx_fanout_stop_workers(tx_fanout_t *ctx) {
+    pthread_mutex_lock(&ctx->lock);
+    ctx->stop = true;
+    pthread_cond_broadcast(&ctx->work);
+    pthread_mutex_unlock(&ctx->lock);
+
+    for (int i = 0; i < ctx->n_workers; i++) {
+        pthread_join(ctx->workers[i], NULL);
+    }
+    ctx->n_workers = 0;
+}
+
+static void tx_fanout_release(tx_fanout_t *ctx) {
+    // Settings outlive OPUS_RESET_STATE, hand the encoders back at the defaults
+    opus_enc_params_t defaults;
+    opus_enc_params_default(&defaults, BITRATE);
+
+    for (int i = 0; i < ctx->n_streams; i++) {
+        tx_stream_t *s = &ctx->streams[i];
+        if (!s->encoder) continue;
+        opus_enc_apply(s->encoder, &defaults);
+        codec_pool_release_enc(ctx->pool, s->encoder);
+        s->encoder = NULL;
+    }
+}
+
+int tx_fanout_init(tx_fanout_t *ctx, const tx_fanout_config_t *cfg,
+                   network_ctx_t *net, codec_pool_t *pool) {
+    memset(ctx, 0, sizeof(tx_fanout_t));
+    ctx->net = net;
+    ctx->pool = pool;
+
+    if (cfg->count < 1 || cfg->count > TX_FANOUT_MAX_STREAMS) {
+        fprintf(stderr, "tx_fanout: need 1-%d streams\n", TX_FANOUT_MAX_STREAMS);
+        return -1;
+    }
+
+    // A stream numbers its packets itself: two on one talkgroup would
+    // seal different frames under the same key and nonce
+    for (int i = 0; i < cfg->count; i++) {
+        for (int j = 0; j < i; j++) {
+            if (cfg->streams[i].talkgroup == cfg->streams[j].talkgroup) {
+                fprintf(stderr, "tx_fanout: talkgroup %u has two streams\n",
+                        cfg->streams[i].talkgroup);
+                return -1;
+            }
+        }
+    }
+
+    for (int i = 0; i < cfg->count; i++) {
+        tx_stream_t *s = &ctx->streams[i];
+        s->cfg = cfg->streams[i];
+
+        // Every talkgroup we send on needs its key once encryption is on
+        if (net->crypto.enabled && !net->crypto.keys[s->cfg.talkgroup].present) {
+            fprintf(stderr, "tx_fanout: no key for talkgroup %u\n", s->cfg.talkgroup);
+            tx_fanout_release(ctx);
+            return -1;
+        }
+
+        red_encoder_init(&s->red, cfg->red_depth, cfg->red_kbps);
+        s->encoder = codec_pool_acquire_enc(pool);
+        ctx->n_streams = i + 1;
+        if (!s->encoder || opus_enc_apply(s->encoder, &s->cfg.params) < 0) {
+            fprintf(stderr, "tx_fanout: no encoder for stream %d (talkgroup %u)\n",
+                    i, s->cfg.talkgroup);
+            tx_fanout_release(ctx);
+            return -1;
+        }
+    }
+
+    if (pthread_mutex_init(&ctx->lock, NULL) != 0 ||
+        pthread_cond_init(&ctx->work, NULL) != 0 ||
+        pthread_cond_init(&ctx->finished, NULL) != 0) {
+        fprintf(stderr, "tx_fanout: mutex/cond init failed\n");
+        tx_fanout_release(ctx);
+        return -1;
+    }
+
+    // The calling (TX) thread encodes too, so one core's worth of streams
+    // needs no helpers at all
+    int workers = cfg->workers;
+    if (workers < 0) {
+        long cores = sysconf(_SC_NPROCESSORS_ONLN);
+        workers = (cores > 1 ? (int)cores : 1) - 1;
+    }
+    if (workers > ctx->n_streams - 1) workers = ctx->n_streams - 1;
+    if (workers > TX_FANOUT_MAX_WORKERS) workers = TX_FANOUT_MAX_WORKERS;
+
+    for (int i = 0; i < workers; i++) {
+        if (pthread_create(&ctx->workers[i], NULL, tx_fanout_worker, ctx) != 0) {
+            perror("tx_fanout: worker thread");
+            break;
+        }
+        ctx->n_workers++;
+    }
+
+    ctx->budget_us = cfg->budget_us > 0 ? (uint32_t)cfg->budget_us : 0;
+    ctx->levels = tx_fanout_levels(ctx);
+    ctx->initialized = true;
+    return 0;
+}
+
+// Hand every prepared packet to the socket in one go
+static int tx_fanout_flush(tx_fanout_t *ctx) {
+    network_packet_t *packets[TX_FANOUT_MAX_STREAMS];
+    int lens[TX_FANOUT_MAX_STREAMS];
+    int count = 0;
+
+    for (int i = 0; i < ctx->n_streams; i++) {
+        if (ctx->streams[i].len <= 0) continue;
+        packets[count] = &ctx->streams[i].packet;
+        lens[count] = ctx->streams[i].len;
+        count++;
+    }
+    if (count == 0) return -1;
+
+    uint64_t t0 = WTTRACE_BEGIN();
+    int sent = network_send_batch(ctx->net, packets, lens, count);
+    WTTRACE_END("send", t0, ctx->net->my_board_id, packets[0]->seq_num);
+    ctx->stats.batches++;
+    if (sent < count) ctx->stats.send_errors++;
+    if (sent <= 0) return -1;
+    ctx->stats.packets += sent;
+    return sent;
+}
+
+int tx_fanout_update(tx_fanout_t *ctx, int stream, const opus_enc_params_t *params) {
+    if (!ctx->initialized || stream < 0 || stream >= ctx->n_streams) return -1;
+
+    pthread_mutex_lock(&ctx->lock);
+    ctx->streams[stream].pending = *params;
+    ctx->streams[stream].update = true;
+    __atomic_store_n(&ctx->update_pending, true, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&ctx->lock);
+    return 0;
+}
+
+// New settings go in on the TX thread, between frames, so no encoder is
+// ever reconfigured while a worker is using it
+static void tx_fanout_apply_updates(tx_fanout_t *ctx) {
+    pthread_mutex_lock(&ctx->lock);
+    __atomic_store_n(&ctx->update_pending, false, __ATOMIC_RELAXED);
+    for (int i = 0; i < ctx->n_streams; i++) {
+        tx_stream_t *s = &ctx->streams[i];
+        if (!s->update) continue;
+        s->update = false;
+
+        // The configured settings change, the level on top of them stays
+        opus_enc_params_t p;
+        tx_fanout_level_params(&s->pending, ctx->level, &p);
+        if (opus_enc_apply(s->encoder, &p) == 0) {
+            s->cfg.params = s->pending;
+        } else {
+            ctx->stats.update_failures++;
+            WTLOG_WARN("TX stream %d (talkgroup %u) refused new encoder settings, keeping its own",
+                       i, s->cfg.talkgroup);
+            tx_fanout_level_params(&s->cfg.params, ctx->level, &p);
+            opus_enc_apply(s->encoder, &p);
+        }
+    }
+    ctx->levels = tx_fanout_levels(ctx);
+
+    if (ctx->red_update) {
+        ctx->red_update = false;
+        for (int i = 0; i < ctx->n_streams; i++) {
+            red_encoder_set(&ctx->streams[i].red, ctx->red_depth, ctx->red_kbps);
+        }
+    }
+    pthread_mutex_unlock(&ctx->lock);
+}
+
+int tx_fanout_set_redundancy(tx_fanout_t *ctx, int depth, int cap_kbps) {
+    if (!ctx->initialized) return -1;
+
+    pthread_mutex_lock(&ctx->lock);
+    ctx->red_depth = depth;
+    ctx->red_kbps = cap_kbps;
+    ctx->red_update = true;
+    __atomic_store_n(&ctx->update_pending, true, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&ctx->lock);
+    return 0;
+}
+
+void tx_fanout_set_budget(tx_fanout_t *ctx, int budget_us) {
+    __atomic_store_n(&ctx->budget_us, budget_us > 0 ? (uint32_t)budget_us : 0,
+                     __ATOMIC_RELAXED);
+}
+
+// Every stream to a new level, between frames like the updates
+static void tx_fanout_set_level(tx_fanout_t *ctx, int level) {
+    for (int i = 0; i < ctx->n_streams; i++) {
+        tx_stream_t *s = &ctx->streams[i];
+        opus_enc_params_t p;
+        tx_fanout_level_params(&s->cfg.params, level, &p);
+        if (opus_enc_apply(s->encoder, &p) < 0) {
+            ctx->stats.update_failures++;
+            WTLOG_WARN("TX stream %d (talkgroup %u) refused the level %d encoder settings",
+                       i, s->cfg.talkgroup, level);
+        }
+    }
+
+    if (level > ctx->level) ctx->stats.steps_down++;
+    if (level < ctx->level) ctx->stats.steps_up++;
+    ctx->level = level;
+    ctx->stats.level = level;
+    if (level > ctx->stats.level_max) ctx->stats.level_max = level;
+
+    ctx->win_frames = 0;
+    ctx->win_over = 0;
+    ctx->win_us = 0;
+    ctx->quiet = 0;
+    ctx->hold = TX_ADAPT_HOLD;
+}
+
+// One frame's time against the frame and the budget
+static void tx_fanout_adapt(tx_fanout_t *ctx, uint64_t took) {
+    uint32_t budget = __atomic_load_n(&ctx->budget_us, __ATOMIC_RELAXED);
+    if (took > TX_FRAME_US) ctx->stats.deadline_misses++;
+    if (budget == 0) {
+        if (ctx->level > 0) {
+            tx_fanout_set_level(ctx, 0);
+            WTLOG_INFO("TX deadline control off, configured encoder settings back");
+        }
+        return;
+    }
+    if (took > budget) ctx->stats.over_budget++;
+
+    // The frames right after a step still carry what came before it
+    if (ctx->hold > 0) {
+        ctx->hold--;
+        return;
+    }
+
+    if (took > TX_FRAME_US && ctx->level < ctx->levels) {
+        tx_fanout_set_level(ctx, ctx->level + 1);
+        WTLOG_WARN("TX deadline missed (%lu us), encoder down to level %d",
+                   (unsigned long)took, ctx->level);
+        return;
+    }
+
+    ctx->win_frames++;
+    if (took > budget) ctx->win_over++;
+    ctx->win_us += took;
+    if (ctx->win_over >= TX_ADAPT_PRESSURE && ctx->level < ctx->levels) {
+        tx_fanout_set_level(ctx, ctx->level + 1);
+        WTLOG_WARN("TX encode over budget (%d frames past %u us), encoder down to level %d",
+                   TX_ADAPT_PRESSURE, budget, ctx->level);
+        return;
+    }
+    if (ctx->win_frames < TX_ADAPT_WINDOW) return;
+
+    bool headroom = ctx->win_over == 0 && ctx->win_us < (uint64_t)budget / 2 * TX_ADAPT_WINDOW;
+    ctx->quiet = headroom ? ctx->quiet + 1 : 0;
+    ctx->win_frames = 0;
+    ctx->win_over = 0;
+    ctx->win_us = 0;
+    if (ctx->quiet >= TX_ADAPT_RECOVER && ctx->level > 0) {
+        tx_fanout_set_level(ctx, ctx->level - 1);
+        WTLOG_INFO("TX encode has headroom, encoder up to level %d", ctx->level);
+    }
+}
+
+int tx_fanout_send(tx_fanout_t *ctx, const int16_t *const *sources) {
+    if (!ctx->initialized) return -1;
+    uint64_t t0 = now_us();
+
+    if (__atomic_load_n(&ctx->update_pending, __ATOMIC_ACQUIRE)) {
+        tx_fanout_apply_updates(ctx);
+    }
+
+    ctx->sources = sources;
+    if (ctx->n_workers == 0) {
+        // Single stream (or no helpers): encode inline, no locking
+        for (int i = 0; i < ctx->n_streams; i++) {
+            tx_fanout_encode(ctx, &ctx->streams[i]);
+        }
+    } else {
+        pthread_mutex_lock(&ctx->lock);
+        ctx->next = 0;
+        ctx->done = 0;
+        ctx->generation++;
+        pthread_cond_broadcast(&ctx->work);
+
+        tx_fanout_drain(ctx);
+        while (ctx->done < ctx->n_streams) {
+            pthread_cond_wait(&ctx->finished, &ctx->lock);
+        }
+        pthread_mutex_unlock(&ctx->lock);
+    }
+
+    int sent = tx_fanout_flush(ctx);
+
+    uint64_t took = now_us() - t0;
+    if (took > ctx->stats.encode_us_max) ctx->stats.encode_us_max = took;
+    ctx->stats.frames++;
+    tx_fanout_adapt(ctx, took);
+    return sent;
+}
+
+int tx_fanout_control(tx_fanout_t *ctx, uint8_t flags) {
+    if (!ctx->initialized) return -1;
+
+    for (int i = 0; i < ctx->n_streams; i++) {
+        tx_stream_t *s = &ctx->streams[i];
+        if (flags & PKT_FLAG_START) red_encoder_reset(&s->red);
+        s->len = network_prepare(ctx->net, &s->packet, s->cfg.talkgroup, s->seq_num, 0, flags);
+        if (s->len > 0) s->seq_num++;
+    }
+    return tx_fanout_flush(ctx);
+}
+
+void tx_fanout_cleanup(tx_fanout_t *ctx) {
+    if (!ctx->initialized) return;
+
+    tx_fanout_stop_workers(ctx);
+    tx_fanout_release(ctx);
+    pthread_cond_destroy(&ctx->finished);
+    pthread_cond_destroy(&ctx->work);
+    pthread_mutex_destroy(&ctx->lock);
+    ctx->initialized = false;
+}
@@ -0,0 +1,164 @@
+#ifndef TX_FANOUT_H
+#define TX_FANOUT_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <pthread.h>
+
+#include "opus_helper.h"
+#include "network.h"
+#include "codec_pool.h"
+#include "red.h"
+
+// TX fan-out: one captured frame is encoded once per stream (talkgroup +
+// encoder settings), the streams spread over a small pool of worker
+// threads, and all resulting packets leave in a single sendmmsg. With one
+// stream it is exactly the old encode-and-send path, no threads involved.
+//
+// Spec (WT_TX_STREAMS), comma separated:
+//   "<talkgroup>:<bitrate>[:<complexity>]"  one stream per entry, one per talkgroup
+//   "workers=<n>"                           helper threads (default: cores - 1)
+// e.g. "1:24000,2:12000:3,7:32000"
+//
+// With redundancy (red.h) every stream's packets also carry its previous
+// frames, same depth and cap for all of them.
+
+#define TX_FANOUT_MAX_STREAMS   NETWORK_BATCH_MAX
+#define TX_FANOUT_MAX_WORKERS   8
+
+// Deadline control: every frame's encode-and-send time is held against
+// the frame it has to fit in. A frame longer than the frame itself is a
+// deadline miss (the TX loop falls behind the mic) and steps every stream
+// down a level at once; TX_ADAPT_PRESSURE frames over the budget within a
+// window of TX_ADAPT_WINDOW do the same. A level is complexity - 2 down
+// to 0, then the max bandwidth capped at wideband, then narrowband.
+// TX_ADAPT_RECOVER windows in a row with none over the budget and half of
+// it to spare on average step back up.
+#define TX_FRAME_US             (FRAME_SIZE * 1000000 / SAMPLE_RATE)
+#define TX_ADAPT_BUDGET_US      8000    // Default, 40% of the frame
+#define TX_ADAPT_WINDOW         25      // Frames (0.5 s)
+#define TX_ADAPT_PRESSURE       3       // Frames over budget in a window
+#define TX_ADAPT_RECOVER        4       // Quiet windows before a step up (2 s)
+#define TX_ADAPT_HOLD           5       // Frames after a step for it to show
+
+typedef struct {
+    uint8_t talkgroup;
+    opus_enc_params_t params;
+    bool own_complexity;            // Given in the stream list, not the board's
+    int source;                     // Which input of tx_fanout_send (0 = mic)
+} tx_stream_config_t;
+
+typedef struct {
+    tx_stream_config_t streams[TX_FANOUT_MAX_STREAMS];
+    int count;
+    int workers;                    // -1 = one per core beside the caller
+    int budget_us;                  // Deadline control, 0 = fixed settings
+    int red_depth;                  // Earlier frames per packet, 0 = off
+    int red_kbps;                   // Cap on what they add, 0 = none
+} tx_fanout_config_t;
+
+typedef struct {
+    tx_stream_config_t cfg;
+    opus_enc_ctx_t *encoder;        // From the codec pool
+    uint32_t seq_num;               // Per talkgroup, receivers track them separately
+
+    network_packet_t packet;        // This frame's packet, built by whoever claims it
+    int len;                        // Bytes to send, 0 = encode failed
+
+    // Redundancy: the frame is encoded here and packed with its history
+    red_encoder_t red;
+    uint8_t frame[MAX_PACKET_SIZE];
+
+    opus_enc_params_t pending;      // From tx_fanout_update, applied by the TX thread
+    bool update;
+
+    uint64_t frames;
+    uint64_t failures;
+} tx_stream_t;
+
+typedef struct {
+    uint64_t frames;                // tx_fanout_send calls
+    uint64_t packets;               // Packets handed to the socket
+    uint64_t batches;               // sendmmsg calls
+    uint64_t send_errors;
+    uint64_t update_failures;       // Settings the encoder refused (updates, levels)
+    uint64_t encode_us_max;         // Slowest frame, capture to batch sent
+    uint64_t deadline_misses;       // Frames that took longer than a frame
+    uint64_t over_budget;           // Frames over the budget
+    uint64_t steps_down;
+    uint64_t steps_up;
+    int level;                      // 0 = the configured settings
+    int level_max;                  // Lowest it went
+} tx_fanout_stats_t;
+
+typedef struct {
+    network_ctx_t *net;
+    codec_pool_t *pool;
+    tx_stream_t streams[TX_FANOUT_MAX_STREAMS];
+    int n_streams;
+
+    // Worker pool: each frame bumps the generation, workers and the
+    // caller claim streams until none are left
+    pthread_t workers[TX_FANOUT_MAX_WORKERS];
+    int n_workers;
+    const int16_t *const *sources;
+    uint32_t generation;
+    int next;
+    int done;
+    bool stop;
+    pthread_mutex_t lock;
+    pthread_cond_t work;
+    pthread_cond_t finished;
+    bool update_pending;
+    bool red_update;
+    int red_depth;
+    int red_kbps;
+
+    // Deadline control, TX thread only (budget_us from any thread)
+    uint32_t budget_us;
+    int level;
+    int levels;                     // Level at which nothing is left to give
+    int win_frames;
+    int win_over;
+    uint64_t win_us;                // Time in the window so far
+    int quiet;                      // Windows in a row with headroom
+    int hold;
+
+    tx_fanout_stats_t stats;
+    bool initialized;
+} tx_fanout_t;
+
+// One stream on talkgroup with params (NULL: the board defaults); streams
+// from tx_fanout_parse start from the same params
+void tx_fanout_config_default(tx_fanout_config_t *cfg, uint8_t talkgroup,
+                              const opus_enc_params_t *params);
+int tx_fanout_parse(tx_fanout_config_t *cfg, const char *spec);
+
+// Takes cfg->count encoders from the pool and starts the workers
+int tx_fanout_init(tx_fanout_t *ctx, const tx_fanout_config_t *cfg,
+                   network_ctx_t *net, codec_pool_t *pool);
+
+// Encode one frame (FRAME_SIZE samples) for every stream and send the
+// packets in one batch. sources[i] is the audio for streams with source i.
+// Returns the number of packets sent, -1 if none went out.
+int tx_fanout_send(tx_fanout_t *ctx, const int16_t *const *sources);
+
+// Change a stream's encoder settings from any thread; they take effect
+// at the start of the next frame. Settings the encoder then refuses are
+// logged and counted, and the stream keeps its old ones (check them
+// first with opus_enc_check)
+int tx_fanout_update(tx_fanout_t *ctx, int stream, const opus_enc_params_t *params);
+
+// Redundancy depth and cap from any thread, applied like an update
+int tx_fanout_set_redundancy(tx_fanout_t *ctx, int depth, int cap_kbps);
+
+// Deadline control budget from any thread; 0 turns it off and puts the
+// configured settings back on the next frame
+void tx_fanout_set_budget(tx_fanout_t *ctx, int budget_us);
+
+// START/END (no audio) on every stream's talkgroup, also batched
+int tx_fanout_control(tx_fanout_t *ctx, uint8_t flags);
+
+void tx_fanout_cleanup(tx_fanout_t *ctx);
+
+#endif // TX_FANOUT_H
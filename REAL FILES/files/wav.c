@@ -0,0 +1,143 @@
+#include "wav.h"
+#include <stdlib.h>
+#include <string.h>
+
+// WAV files are little endian, as is the A53
+static void put_u16(uint8_t *p, uint16_t v) {
+    p[0] = (uint8_t)v;
+    p[1] = (uint8_t)(v >> 8);
+}
+
+static void put_u32(uint8_t *p, uint32_t v) {
+    put_u16(p, (uint16_t)v);
+    put_u16(p + 2, (uint16_t)(v >> 16));
+}
+
+static uint16_t get_u16(const uint8_t *p) {
+    return (uint16_t)(p[0] | (p[1] << 8));
+}
+
+static uint32_t get_u32(const uint8_t *p) {
+    return (uint32_t)get_u16(p) | ((uint32_t)get_u16(p + 2) << 16);
+}
+
+// Write the 44 byte RIFF header for the current data size
+static int wav_write_header(wav_writer_t *w) {
+    uint8_t h[44];
+    uint16_t block_align = (uint16_t)(w->channels * 2);
+
+    memcpy(h, "RIFF", 4);
+    put_u32(h + 4, 36 + w->data_bytes);
+    memcpy(h + 8, "WAVEfmt ", 8);
+    put_u32(h + 16, 16);
+    put_u16(h + 20, 1);                     // PCM
+    put_u16(h + 22, (uint16_t)w->channels);
+    put_u32(h + 24, (uint32_t)w->sample_rate);
+    put_u32(h + 28, (uint32_t)w->sample_rate * block_align);
+    put_u16(h + 32, block_align);
+    put_u16(h + 34, 16);
+    memcpy(h + 36, "data", 4);
+    put_u32(h + 40, w->data_bytes);
+
+    if (fseek(w->file, 0, SEEK_SET) != 0) return -1;
+    return fwrite(h, sizeof(h), 1, w->file) == 1 ? 0 : -1;
+}
+
+int wav_open_write(wav_writer_t *w, const char *path, int sample_rate, int channels) {
+    memset(w, 0, sizeof(wav_writer_t));
+    w->sample_rate = sample_rate;
+    w->channels = channels;
+
+    w->file = fopen(path, "wb");
+    if (!w->file) {
+        perror("wav_open_write");
+        return -1;
+    }
+
+    // Placeholder header, sizes are patched in wav_close
+    if (wav_write_header(w) < 0) {
+        fclose(w->file);
+        w->file = NULL;
+        return -1;
+    }
+    return 0;
+}
+
+int wav_write(wav_writer_t *w, const int16_t *samples, int frames) {
+    if (!w->file) return -1;
+
+    size_t count = (size_t)frames * w->channels;
+    if (fwrite(samples, sizeof(int16_t), count, w->file) != count) {
+        return -1;
+    }
+    w->data_bytes += count * sizeof(int16_t);
+    return 0;
+}
+
+void wav_close(wav_writer_t *w) {
+    if (w->file) {
+        wav_write_header(w);
+        fclose(w->file);
+        w->file = NULL;
+    }
+}
+
+int16_t *wav_read(const char *path, int *sample_rate, int *channels, int *frames) {
+    FILE *f = fopen(path, "rb");
+    if (!f) {
+        perror("wav_read");
+        return NULL;
+    }
+
+    uint8_t riff[12];
+    if (fread(riff, 1, 12, f) != 12 ||
+        memcmp(riff, "RIFF", 4) != 0 || memcmp(riff + 8, "WAVE", 4) != 0) {
+        fprintf(stderr, "%s: not a WAV file\n", path);
+        fclose(f);
+        return NULL;
+    }
+
+    int rate = 0, ch = 0, bits = 0;
+    int16_t *data = NULL;
+
+    // Walk the chunks until we have both fmt and data
+    uint8_t chunk[8];
+    while (fread(chunk, 1, 8, f) == 8) {
+        uint32_t size = get_u32(chunk + 4);
+
+        if (memcmp(chunk, "fmt ", 4) == 0) {
+            uint8_t fmt[16];
+            if (size < 16 || fread(fmt, 1, 16, f) != 16) break;
+            if (get_u16(fmt) != 1) {
+                fprintf(stderr, "%s: only PCM WAV is supported\n", path);
+                break;
+            }
+            ch = get_u16(fmt + 2);
+            rate = (int)get_u32(fmt + 4);
+            bits = get_u16(fmt + 14);
+            fseek(f, (long)(size - 16 + (size & 1)), SEEK_CUR);
+        } else if (memcmp(chunk, "data", 4) == 0) {
+            if (bits != 16 || ch <= 0) {
+                fprintf(stderr, "%s: only 16-bit PCM WAV is supported\n", path);
+                break;
+            }
+            data = malloc(size ? size : 2);
+            if (!data) break;
+            size_t got = fread(data, 1, size, f);
+            *frames = (int)(got / (2 * ch));
+            break;
+        } else {
+            fseek(f, (long)(size + (size & 1)), SEEK_CUR);
+        }
+    }
+
+    fclose(f);
+    if (!data) {
+        if (bits == 16) fprintf(stderr, "%s: no data chunk\n", path);
+        return NULL;
+    }
+
+    *sample_rate = rate;
+    *channels = ch;
+    return data;
+}
@@ -0,0 +1,22 @@
+#ifndef WAV_H
+#define WAV_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+// 16-bit PCM WAV writer
+typedef struct {
+    FILE *file;
+    int sample_rate;
+    int channels;
+    uint32_t data_bytes;
+} wav_writer_t;
+
+int wav_open_write(wav_writer_t *w, const char *path, int sample_rate, int channels);
+int wav_write(wav_writer_t *w, const int16_t *samples, int frames);
+void wav_close(wav_writer_t *w);
+
+// Load a whole 16-bit PCM WAV file (interleaved), caller frees the buffer
+int16_t *wav_read(const char *path, int *sample_rate, int *channels, int *frames);
+
+#endif // WAV_H
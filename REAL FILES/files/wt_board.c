@@ -0,0 +1,937 @@
+#include "wt_board.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "wtlog.h"
+#include "wttrace.h"
+
+// Encoder settings from the configuration
+static void config_enc_params(const wt_config_t *cfg, opus_enc_params_t *params) {
+    opus_enc_params_default(params, cfg->bitrate);
+    params->complexity = cfg->complexity;
+    params->fec = cfg->fec;
+    params->loss_perc = cfg->loss_perc;
+    params->dtx = cfg->dtx;
+}
+
+// Virtual mic: one frame every FRAME_US, handed over when it would have
+// finished recording. A new press (or a frame we fell behind on) starts
+// the clock again.
+static void virtual_capture(wt_board_t *b, int16_t *pcm_i16) {
+    uint64_t now = network_time_us();
+    if (b->mic_next_us + FRAME_US < now) b->mic_next_us = now;
+    
+    uint64_t start_us = b->mic_next_us;
+    b->mic_next_us += FRAME_US;
+    struct timespec ts = { (time_t)(b->mic_next_us / 1000000), (long)(b->mic_next_us % 1000000) * 1000 };
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) != 0) {
+    }
+    
+    if (b->audio.mic) {
+        b->audio.mic(b->audio.arg, pcm_i16, start_us);
+    } else {
+        memset(pcm_i16, 0, FRAME_SIZE * sizeof(int16_t));
+    }
+}
+
+// Transmitter thread
+static void *tx_thread_func(void *arg) {
+    wt_board_t *b = arg;
+    wtlog_thread("tx");
+    WTLOG_INFO("TX thread started");
+    
+    bool last_ptt = false;
+    bool first_packet = false;
+    int32_t *dma_buffer = dma_get_rx_buffer(&b->dma);
+    int16_t pcm_i16[FRAME_SIZE];
+    const int16_t *sources[1] = { pcm_i16 };
+    
+    while (b->running) {
+        bool ptt = gpio_read_ptt(&b->gpio);
+        
+        // PTT pressed - start transmission
+        if (ptt && !last_ptt) {
+            b->transmitting = true;
+            gpio_set_tx_led(&b->gpio, true);
+            playback_dsp_tone(&b->rx_dsp, PB_TONE_TALK_PERMIT);
+            first_packet = true;
+            if (b->beamform) beam_reset(&b->beam);
+            WTLOG_PLAIN("\n[TX START]\n");
+            
+            // Send START packet on every talkgroup
+            tx_fanout_control(&b->tx, PKT_FLAG_START);
+        }
+        
+        // PTT released - end transmission
+        if (!ptt && last_ptt) {
+            WTLOG_PLAIN("[TX END]\n\n");
+            
+            // Send END packet on every talkgroup
+            tx_fanout_control(&b->tx, PKT_FLAG_END);
+            
+            b->transmitting = false;
+            gpio_set_tx_led(&b->gpio, false);
+        }
+        
+        // Transmit audio while PTT held
+        if (b->transmitting && ptt) {
+            uint32_t seq = b->tx.streams[0].seq_num;
+            uint64_t t0 = WTTRACE_BEGIN();
+            
+            if (b->audio.backend == WT_AUDIO_VIRTUAL) {
+                virtual_capture(b, pcm_i16);
+                WTTRACE_END("capture", t0, b->board_id, seq);
+                t0 = WTTRACE_BEGIN();
+            } else {
+                // Capture audio from microphone (every mic's slot with an array)
+                size_t bytes = b->beamform ? beam_frame_bytes(&b->beam.cfg) : FRAME_BYTES;
+                if (dma_start_capture(&b->dma, dma_buffer, bytes) < 0) {
+                    usleep(10000);
+                    continue;
+                }
+                
+                // Wait for DMA completion. A failed or stuck channel has been
+                // reset by then: lose this frame and capture the next at once
+                if (dma_wait_capture(&b->dma, DMA_STALL_MS) < 0) {
+                    last_ptt = ptt;
+                    continue;
+                }
+                
+                WTTRACE_END("capture", t0, b->board_id, seq);
+                t0 = WTTRACE_BEGIN();
+                
+                // Convert 32-bit DMA samples to 16-bit for Opus, steering
+                // the array down to one channel on the way
+                if (b->beamform) {
+                    beam_process(&b->beam, dma_buffer, pcm_i16);
+                } else {
+                    convert_i32_to_i16(dma_buffer, pcm_i16, FRAME_SIZE);
+                }
+            }
+            
+            // Remove what the speaker put back into the mic
+            if (b->full_duplex) {
+                aec_capture(&b->aec, pcm_i16, pcm_i16);
+            }
+            
+            // High-pass, noise suppression, AGC and limiter
+            capture_dsp_process(&b->tx_dsp, pcm_i16);
+            WTTRACE_END("mic dsp", t0, b->board_id, seq);
+            
+            // Encode for every stream (in parallel) and send them as one batch
+            if (tx_fanout_send(&b->tx, sources) > 0) {
+                b->frames_sent++;
+                
+                // Press-to-air latency, from the kernel's edge timestamp
+                if (first_packet) {
+                    b->ptt_latency_us = (gpio_time_ns() - b->gpio.ptt_edge_ns) / 1000;
+                    if (b->ptt_latency_us > b->ptt_latency_max_us) {
+                        b->ptt_latency_max_us = b->ptt_latency_us;
+                    }
+                    first_packet = false;
+                }
+                
+                if (b->frames_sent % 50 == 0) {
+                    WTLOG_PLAIN(".");
+                }
+            }
+            
+            // Maintain the ~20ms frame timing (virtual capture keeps its own)
+            if (b->audio.backend == WT_AUDIO_DMA) {
+                usleep(18000);
+            }
+        } else {
+            // Not transmitting, sleep until the PTT edge (or 10ms)
+            gpio_wait_ptt(&b->gpio, 10);
+        }
+        
+        last_ptt = ptt;
+    }
+    
+    WTLOG_INFO("TX thread stopped");
+    return NULL;
+}
+
+// Synchronised playout state of the current burst
+enum {
+    SYNC_IDLE,                      // Not decided yet
+    SYNC_HOLD,                      // First frame waiting for its time
+    SYNC_ON,                        // Frames follow on at their times
+    SYNC_OFF,                       // Played as it comes (no timestamp or no lock)
+};
+
+// Echo canceller reference is exactly what goes to the speaker, taken by
+// the playout thread as each period starts
+static void speaker_tap(void *arg, const int16_t *pcm, int samples) {
+    wt_board_t *b = arg;
+    if (b->full_duplex) {
+        aec_playback(&b->aec, pcm, samples);
+    }
+    if (b->audio.speaker) {
+        b->audio.speaker(b->audio.arg, pcm, samples, b->playout.period_start_us);
+    }
+}
+
+// Next frame from the jitter buffer, traced as decoded or concealed
+static int pull_frame(wt_board_t *b, int16_t *pcm_i16, bool conceal) {
+    uint32_t board = b->rx.sender, seq = b->rx.next_seq;
+    uint64_t t0 = WTTRACE_BEGIN();
+    int r = rx_pipeline_pull(&b->rx, pcm_i16, conceal);
+    if (r > 0) {
+        WTTRACE_END(b->rx.last_concealed ? "conceal" : "decode", t0, board, seq);
+    }
+    return r;
+}
+
+// Level this talker, mix beeps, limit
+static void speaker_dsp(wt_board_t *b, int16_t *pcm_i16) {
+    uint64_t t0 = WTTRACE_BEGIN();
+    playback_dsp_process(&b->rx_dsp, pcm_i16, b->rx.sender);
+    WTTRACE_END("speaker dsp", t0, b->rx.sender, b->rx.next_seq - 1);
+}
+
+// Synchronised playout: the first frame of a burst is held until the ring
+// reaches its time (timestamp + delay, in local time), the rest follow
+// every FRAME_US after it, concealed ones included. A burst without
+// timestamps, or while the clock is not locked, plays as it comes.
+static void queue_synced(wt_board_t *b, int16_t *pcm_i16, bool clocked) {
+    if (b->sync_state == SYNC_HOLD) {
+        uint64_t at = clocksync_to_local(&b->clock, b->sync_t0 + b->sync_delay_us);
+        int r = playout_write_at(&b->playout, b->sync_pcm, at);
+        if (r > 0) return;
+        if (r < 0) {
+            WTLOG_WARN("Synchronised playout: first frame %lu us late, playing unsynchronised",
+                       (unsigned long)(network_time_us() - at));
+            b->sync_state = SYNC_OFF;
+        } else {
+            b->sync_state = SYNC_ON;
+            b->sync_frames = 1;
+            b->frames_received++;
+        }
+    }
+    
+    // Ahead of time only as far as the ring goes
+    while ((clocked || playout_space(&b->playout) > 1) &&
+           pull_frame(b, pcm_i16, clocked && b->sync_state != SYNC_IDLE) > 0) {
+        speaker_dsp(b, pcm_i16);
+        
+        if (b->sync_state == SYNC_IDLE) {
+            uint64_t media = b->rx.last_played_media_us;
+            if (media == 0 || !clocksync_locked(&b->clock)) {
+                b->sync_state = SYNC_OFF;
+            } else {
+                memcpy(b->sync_pcm, pcm_i16, sizeof(b->sync_pcm));
+                b->sync_t0 = media;
+                b->sync_state = SYNC_HOLD;
+                queue_synced(b, pcm_i16, false);
+                return;
+            }
+        }
+        
+        if (b->sync_state == SYNC_ON) {
+            uint64_t at = clocksync_to_local(&b->clock, b->sync_t0 + b->sync_delay_us +
+                                             b->sync_frames * FRAME_US);
+            b->sync_frames++;
+            if (playout_write_at(&b->playout, pcm_i16, at) < 0) continue;
+        } else {
+            playout_write(&b->playout, pcm_i16);
+        }
+        b->frames_received++;
+        
+        if (b->frames_received % 50 == 0) {
+            WTLOG_PLAIN(":");
+        }
+        if (clocked) break;
+    }
+}
+
+// Queue decoded frames for the speaker. A full playout ring drops the
+// frame (counted), so a stall never turns into lasting latency.
+// clocked: the ring is about to run dry, so one frame is due now and a
+// missing one is concealed
+static void queue_frames(wt_board_t *b, int16_t *pcm_i16, bool clocked) {
+    if (b->sync_delay_us) {
+        queue_synced(b, pcm_i16, clocked);
+        return;
+    }
+    
+    while (pull_frame(b, pcm_i16, clocked) > 0) {
+        speaker_dsp(b, pcm_i16);
+        playout_write(&b->playout, pcm_i16);
+        b->frames_received++;
+        
+        if (b->frames_received % 50 == 0) {
+            WTLOG_PLAIN(":");
+        }
+        if (clocked) break;
+    }
+}
+
+// One received packet into the jitter buffer, ready frames to the speaker
+static void rx_packet(wt_board_t *b, network_packet_t *packet, int recv_size, int16_t *pcm_i16) {
+    uint64_t now_us = network_time_us();
+    
+    // Time in the socket queue, from the kernel's receive timestamp
+    if (WTTRACE_BEGIN() && recv_size >= (int)PACKET_HEADER_SIZE) {
+        wttrace_span("recv", network_rx_time_us(&b->net) * 1000, packet->board_id, packet->seq_num);
+    }
+    
+    // Record exactly what network_recv returned, before any filtering
+    if (b->recording) {
+        pktlog_write(&b->pktlog, packet, recv_size, now_us);
+    }
+    
+    // Clock sync messages go no further
+    if (recv_size >= (int)PACKET_HEADER_SIZE && (packet->flags & PKT_FLAG_SYNC)) {
+        if (b->clock_sync) {
+            clocksync_receive(&b->clock, packet, recv_size, network_rx_time_us(&b->net));
+        }
+        return;
+    }
+    
+    // Archive every transmission, ours included and while we talk;
+    // only a copy into the writer's queue happens here
+    archive_tap(&b->archive, packet, recv_size, now_us);
+    
+    // Self-mute: ignore our own packets
+    if (packet->board_id == b->board_id) {
+        return;
+    }
+    
+    // Don't play while transmitting (half duplex)
+    if (b->transmitting && !b->full_duplex) {
+        return;
+    }
+    
+    // Jitter buffer handles START/END and reorders audio packets
+    int event = rx_pipeline_push(&b->rx, packet, recv_size, now_us);
+    
+    if (event == RX_EVENT_START) {
+        gpio_set_rx_led(&b->gpio, true);
+        if (packet->flags & PKT_FLAG_START) {
+            WTLOG_PLAIN("\n[RX START - Board %u]\n", packet->board_id);
+        } else {
+            WTLOG_PLAIN("\n[RX START - Board %u, joined at seq %u]\n", packet->board_id,
+                        packet->seq_num);
+        }
+    } else if (event == RX_EVENT_END) {
+        gpio_set_rx_led(&b->gpio, false);
+        WTLOG_PLAIN("[RX END - Board %u]\n\n", b->rx.sender);
+    }
+    
+    // Queue every frame that is ready (lost ones come back concealed)
+    queue_frames(b, pcm_i16, false);
+}
+
+// Receiver thread. Decoded frames go into the playout ring, which the
+// playout thread keeps streaming to the speaker; this thread never waits
+// on the DMA.
+static void *rx_thread_func(void *arg) {
+    wt_board_t *b = arg;
+    wtlog_thread("rx");
+    WTLOG_INFO("RX thread started");
+    
+    network_packet_t packet;
+    int16_t pcm_i16[FRAME_SIZE];
+    
+    while (b->running) {
+        bool was_active = rx_pipeline_active(&b->rx);
+        
+        // Nobody talking: queue a beep and the limiter tail, as far as the
+        // ring takes them
+        if (!was_active) {
+            while (b->running && playout_space(&b->playout) > 0 &&
+                   playback_dsp_idle(&b->rx_dsp, pcm_i16)) {
+                playout_write(&b->playout, pcm_i16);
+            }
+        }
+        
+        // A frame held for synchronised playout goes in once the ring
+        // reaches its time
+        if (b->sync_state == SYNC_HOLD) {
+            queue_frames(b, pcm_i16, false);
+        }
+        
+        // Speaker about to run dry mid-transmission: conceal the late frame
+        // now rather than let the gap become comfort noise
+        if (was_active && playout_needs_frame(&b->playout)) {
+            queue_frames(b, pcm_i16, true);
+        }
+        
+        // SYNC when due, mastership
+        if (b->clock_sync) {
+            clocksync_poll(&b->clock, network_time_us());
+        }
+        
+        // Receive packet: 20 ms at most, so a queued beep starts within a
+        // frame, and no longer than the ring lasts during a transmission
+        // (a frame held for synchronised playout is retried every few ms)
+        int timeout = was_active ? playout_wait_ms(&b->playout, 20) : 20;
+        if (b->sync_state == SYNC_HOLD && timeout > 2) timeout = 2;
+        int recv_size = network_recv(&b->net, &packet, timeout > 0 ? timeout : 1);
+        
+        if (recv_size > 0) {
+            rx_packet(b, &packet, recv_size, pcm_i16);
+        } else {
+            // No packet received; a talker silent for too long lost its END
+            if (rx_pipeline_poll(&b->rx, network_time_us()) == RX_EVENT_END) {
+                gpio_set_rx_led(&b->gpio, false);
+                WTLOG_PLAIN("[RX END - Board %u, timed out]\n\n", b->rx.sender);
+            }
+            if (recv_size < 0) usleep(1000);
+        }
+        
+        // Last frame of the burst has been queued, roger beep after it
+        if (was_active && !rx_pipeline_active(&b->rx)) {
+            if (b->sync_state == SYNC_ON) {
+                playout_align_end(&b->playout);
+            }
+            b->sync_state = SYNC_IDLE;
+            playback_dsp_tone(&b->rx_dsp, PB_TONE_ROGER);
+        }
+        
+        // Frames that could not be played as sent
+        b->frames_dropped = b->rx.stats.frames_concealed + b->rx.stats.frames_late;
+    }
+    
+    WTLOG_INFO("RX thread stopped");
+    return NULL;
+}
+
+// Startup steps, run in parallel by the orchestrator where they don't depend on each other
+
+static int init_gpio(void *arg) {
+    wt_board_t *b = arg;
+    if (gpio_init_spec(&b->gpio, b->cfg.gpio[0] ? b->cfg.gpio : NULL) < 0) {
+        fprintf(stderr, "GPIO initialisation failed\n");
+        return -1;
+    }
+    printf("✓ GPIO ready\n");
+    return 0;
+}
+
+static void cleanup_gpio(void *arg) {
+    wt_board_t *b = arg;
+    gpio_cleanup(&b->gpio);
+}
+
+static int init_dma(void *arg) {
+    wt_board_t *b = arg;
+    if (b->audio.backend == WT_AUDIO_VIRTUAL) {
+        printf("✓ Virtual audio ready\n");
+        return 0;
+    }
+    if (dma_init_buf(&b->dma, b->cfg.dma_base, b->cfg.dma_mem_base, b->cfg.dma_buf) < 0) {
+        fprintf(stderr, "DMA initialisation failed\n");
+        return -1;
+    }
+    if (dma_reset(&b->dma) < 0) {
+        fprintf(stderr, "DMA reset failed\n");
+        dma_cleanup(&b->dma);
+        return -1;
+    }
+    printf("✓ DMA ready\n");
+    return 0;
+}
+
+static void cleanup_dma(void *arg) {
+    wt_board_t *b = arg;
+    dma_cleanup(&b->dma);
+}
+
+static int init_playout(void *arg) {
+    wt_board_t *b = arg;
+    // Virtual audio: the playout thread keeps time itself
+    dma_ctx_t *dma = b->audio.backend == WT_AUDIO_DMA ? &b->dma : NULL;
+    if (playout_init(&b->playout, dma, b->cfg.playout_frames) < 0) {
+        fprintf(stderr, "Playout initialisation failed\n");
+        return -1;
+    }
+    playout_set_tap(&b->playout, speaker_tap, b);
+    return 0;
+}
+
+static void cleanup_playout(void *arg) {
+    wt_board_t *b = arg;
+    playout_cleanup(&b->playout);
+}
+
+static int init_codecs(void *arg) {
+    wt_board_t *b = arg;
+    if (codec_pool_init(&b->codecs, b->tx_cfg.count, CODEC_POOL_DECODERS, b->cfg.bitrate) < 0) {
+        fprintf(stderr, "Opus codec initialisation failed\n");
+        return -1;
+    }
+    return 0;
+}
+
+static void cleanup_codecs(void *arg) {
+    wt_board_t *b = arg;
+    codec_pool_cleanup(&b->codecs);
+}
+
+static int init_encoder(void *arg) {
+    wt_board_t *b = arg;
+    if (tx_fanout_init(&b->tx, &b->tx_cfg, &b->net, &b->codecs) < 0) {
+        fprintf(stderr, "Opus encoder initialisation failed\n");
+        return -1;
+    }
+    
+    // The spec was already checked by config_validate
+    capture_dsp_config_t dsp_cfg;
+    capture_dsp_config_default(&dsp_cfg);
+    if (b->cfg.tx_dsp[0]) {
+        capture_dsp_parse(&dsp_cfg, b->cfg.tx_dsp);
+    }
+    if (capture_dsp_init(&b->tx_dsp, &dsp_cfg) < 0) {
+        fprintf(stderr, "Capture DSP initialisation failed\n");
+        tx_fanout_cleanup(&b->tx);
+        return -1;
+    }
+    printf("✓ Encoder ready (mic DSP: hpf %s, ns %s, agc %s, limiter %s)\n",
+           dsp_cfg.hpf ? "on" : "off", dsp_cfg.ns ? "on" : "off",
+           dsp_cfg.agc ? "on" : "off", dsp_cfg.limiter ? "on" : "off");
+
+    // Mic array, also checked by config_validate; virtual audio is one
+    // channel already
+    beam_config_t beam_cfg;
+    beam_config_default(&beam_cfg);
+    if (b->cfg.mic_array[0]) {
+        beam_parse(&beam_cfg, b->cfg.mic_array);
+    }
+    b->beamform = beam_cfg.mics > 1 && b->audio.backend == WT_AUDIO_DMA;
+    if (b->beamform) {
+        if (beam_init(&b->beam, &beam_cfg) < 0) {
+            tx_fanout_cleanup(&b->tx);
+            return -1;
+        }
+        printf("  Mic array: %d mics %.0f mm apart, steered %.0f degrees, %.2f ms delay\n",
+               beam_cfg.mics, beam_cfg.spacing_mm, beam_cfg.steer_deg,
+               b->beam.latency * 1000.0 / SAMPLE_RATE);
+    } else if (beam_cfg.mics > 1) {
+        printf("  Mic array ignored: virtual audio has one channel\n");
+    }
+    if (b->tx.n_streams > 1) {
+        printf("  %d TX streams on %d worker(s) + TX thread\n", b->tx.n_streams, b->tx.n_workers);
+        for (int i = 0; i < b->tx.n_streams; i++) {
+            printf("    talkgroup %u at %d bps, complexity %d\n", b->tx.streams[i].cfg.talkgroup,
+                   b->tx.streams[i].cfg.params.bitrate, b->tx.streams[i].cfg.params.complexity);
+        }
+    }
+    return 0;
+}
+
+static void cleanup_encoder(void *arg) {
+    wt_board_t *b = arg;
+    tx_fanout_cleanup(&b->tx);
+}
+
+static int init_decoder(void *arg) {
+    wt_board_t *b = arg;
+    // Each received burst borrows a decoder from the pool
+    rx_pipeline_init(&b->rx, NULL, b->cfg.jitter_target);
+    rx_pipeline_use_pool(&b->rx, &b->codecs);
+    
+    playback_dsp_config_t pb_cfg;
+    playback_dsp_config_default(&pb_cfg);
+    if (b->cfg.rx_dsp[0]) {
+        playback_dsp_parse(&pb_cfg, b->cfg.rx_dsp);
+    }
+    playback_dsp_init(&b->rx_dsp, &pb_cfg);
+    printf("✓ Decoder ready (speaker DSP: normalize %s, tones %s, limiter %s)\n",
+           pb_cfg.normalize ? "on" : "off", pb_cfg.tones ? "on" : "off",
+           pb_cfg.limiter ? "on" : "off");
+    return 0;
+}
+
+static int init_net(void *arg) {
+    wt_board_t *b = arg;
+    network_config_t net_cfg;
+    memset(&net_cfg, 0, sizeof(net_cfg));
+    snprintf(net_cfg.group, sizeof(net_cfg.group), "%s", b->cfg.group);
+    net_cfg.port = (uint16_t)b->cfg.port;
+    net_cfg.talkgroup = (uint8_t)b->cfg.talkgroup;
+    net_cfg.keyring = b->cfg.keyring;
+    net_cfg.session_file = b->cfg.session_file;
+    net_cfg.netem = b->cfg.netem;
+    
+    if (network_init_cfg(&b->net, b->board_id, &net_cfg) < 0) {
+        fprintf(stderr, "Network initialisation failed\n");
+        return -1;
+    }
+    printf("✓ Network ready\n");
+    return 0;
+}
+
+static void cleanup_net(void *arg) {
+    wt_board_t *b = arg;
+    network_cleanup(&b->net);
+}
+
+// Optional shared time base: stamps our packets with master time
+static int init_clock(void *arg) {
+    wt_board_t *b = arg;
+    if (!b->cfg.clock_sync) return 0;
+    if (clocksync_init(&b->clock, &b->net) < 0) {
+        return -1;
+    }
+    b->net.clock = clocksync_now;
+    b->net.clock_arg = &b->clock;
+    b->clock_sync = true;
+    
+    b->sync_delay_us = (uint64_t)b->cfg.sync_playout * 1000;
+    if (b->sync_delay_us) {
+        printf("✓ Clock sync on, playout %d ms after sending\n", b->cfg.sync_playout);
+    } else {
+        printf("✓ Clock sync on\n");
+    }
+    return 0;
+}
+
+static void cleanup_clock(void *arg) {
+    wt_board_t *b = arg;
+    if (b->clock_sync) {
+        b->clock_sync = false;
+        b->sync_delay_us = 0;
+        clocksync_cleanup(&b->clock);
+    }
+}
+
+// Optional packet recorder for offline replay (wt_replay)
+static int init_recorder(void *arg) {
+    wt_board_t *b = arg;
+    if (!b->cfg.record[0]) return 0;
+    if (pktlog_open_write(&b->pktlog, b->cfg.record, b->board_id) < 0) {
+        return -1;
+    }
+    b->recording = true;
+    return 0;
+}
+
+static void cleanup_recorder(void *arg) {
+    wt_board_t *b = arg;
+    if (b->recording) {
+        b->recording = false;
+        pktlog_close(&b->pktlog);
+    }
+}
+
+// Optional talk-burst archive
+static int init_archive(void *arg) {
+    wt_board_t *b = arg;
+    if (!b->cfg.archive[0]) return 0;
+    return archive_init(&b->archive, b->cfg.archive);
+}
+
+static void cleanup_archive(void *arg) {
+    wt_board_t *b = arg;
+    archive_cleanup(&b->archive);
+}
+
+// Optional full duplex with echo cancellation
+static int init_duplex(void *arg) {
+    wt_board_t *b = arg;
+    if (!b->cfg.full_duplex) return 0;
+    if (aec_init(&b->aec, AEC_DEFAULT_TAIL_MS) < 0) {
+        fprintf(stderr, "Echo canceller unavailable, staying half duplex\n");
+        return -1;
+    }
+    b->full_duplex = true;
+    printf("✓ Full duplex enabled\n");
+    return 0;
+}
+
+static void cleanup_duplex(void *arg) {
+    wt_board_t *b = arg;
+    if (b->full_duplex) {
+        b->full_duplex = false;
+        aec_cleanup(&b->aec);
+    }
+}
+
+// Initialize all subsystems
+int wt_board_init(wt_board_t *b, const wt_config_t *cfg, const wt_audio_config_t *audio) {
+    memset(b, 0, sizeof(wt_board_t));
+    b->cfg = *cfg;
+    if (audio) {
+        b->audio = *audio;
+    }
+    
+    printf("Initializing walkie-talkie system...\n\n");
+    
+    if (startup_init(&b->startup) < 0) {
+        return -1;
+    }
+    
+    // Get board ID (configured, else /etc/board_id)
+    b->board_id = b->cfg.board_id ? (uint32_t)b->cfg.board_id : network_get_board_id();
+    printf("Board ID: %u\n\n", b->board_id);
+    
+    // Outgoing streams decide how many encoders the pool needs
+    opus_enc_params_t enc;
+    config_enc_params(&b->cfg, &enc);
+    tx_fanout_config_default(&b->tx_cfg, (uint8_t)b->cfg.talkgroup, &enc);
+    b->tx_cfg.budget_us = b->cfg.encode_budget * 1000;
+    b->tx_cfg.red_depth = b->cfg.redundancy;
+    b->tx_cfg.red_kbps = b->cfg.redundancy_kbps;
+    if (b->cfg.tx_streams[0]) {
+        tx_fanout_parse(&b->tx_cfg, b->cfg.tx_streams);
+    }
+    
+    startup_ctx_t *s = &b->startup;
+    startup_add(s, "gpio", init_gpio, cleanup_gpio, b, 0, false);
+    int dma = startup_add(s, "dma", init_dma, cleanup_dma, b, 0, false);
+    int codecs = startup_add(s, "codecs", init_codecs, cleanup_codecs, b, 0, false);
+    int net = startup_add(s, "network", init_net, cleanup_net, b, 0, false);
+    
+    // The encoders check the keyring for every talkgroup they send on
+    startup_add(s, "encoder", init_encoder, cleanup_encoder, b,
+                STARTUP_DEP(codecs) | STARTUP_DEP(net), false);
+    startup_add(s, "decoder", init_decoder, NULL, b, STARTUP_DEP(codecs), false);
+    startup_add(s, "playout", init_playout, cleanup_playout, b, STARTUP_DEP(dma), false);
+    
+    // No recording file unless the socket it records from came up,
+    // no echo canceller without audio I/O
+    startup_add(s, "recorder", init_recorder, cleanup_recorder, b, STARTUP_DEP(net), true);
+    startup_add(s, "archive", init_archive, cleanup_archive, b, STARTUP_DEP(net), true);
+    
+    // Without a clock everyone plays as packets come, as before
+    startup_add(s, "clock", init_clock, cleanup_clock, b, STARTUP_DEP(net), true);
+    startup_add(s, "duplex", init_duplex, cleanup_duplex, b, STARTUP_DEP(dma), true);
+    
+    if (startup_run(s) < 0) {
+        return -1;
+    }
+    
+    printf("\n");
+    startup_report(s);
+    b->initialized = true;
+    return 0;
+}
+
+int wt_board_start(wt_board_t *b) {
+    if (!b->initialized) return -1;
+    
+    // The speaker stream first, so it is running before anything is
+    // queued for it
+    b->running = true;
+    b->transmitting = false;
+    
+    if (playout_start(&b->playout) < 0) {
+        b->running = false;
+        return -1;
+    }
+    
+    if (pthread_create(&b->tx_thread, NULL, tx_thread_func, b) != 0) {
+        perror("Failed to create TX thread");
+        b->running = false;
+        playout_stop(&b->playout);
+        return -1;
+    }
+    
+    if (pthread_create(&b->rx_thread, NULL, rx_thread_func, b) != 0) {
+        perror("Failed to create RX thread");
+        b->running = false;
+        pthread_join(b->tx_thread, NULL);
+        playout_stop(&b->playout);
+        return -1;
+    }
+    return 0;
+}
+
+void wt_board_stop(wt_board_t *b) {
+    if (!b->running) return;
+    b->running = false;
+    pthread_join(b->tx_thread, NULL);
+    pthread_join(b->rx_thread, NULL);
+    playout_stop(&b->playout);
+}
+
+void wt_board_set_ptt(wt_board_t *b, bool pressed) {
+    gpio_mock_set_ptt(&b->gpio, pressed);
+}
+
+// Cleanup all subsystems
+void wt_board_cleanup(wt_board_t *b) {
+    if (!b->initialized) return;
+    wt_board_stop(b);
+    
+    printf("\nCleaning up...\n");
+    
+    // Reverse order of bring-up (GPIO cleanup switches the LEDs off)
+    startup_shutdown(&b->startup);
+    b->initialized = false;
+    
+    printf("Cleanup complete\n");
+}
+
+// SIGHUP: apply what can change under a running pipeline, report the rest
+void wt_board_reload(wt_board_t *b, const wt_config_t *next) {
+    bool restart;
+    
+    if (config_diff(&b->cfg, next, &restart) == 0) {
+        printf("  No changes\n");
+        return;
+    }
+    
+    // Encoder settings go to every stream; bitrate and complexity only
+    // where the stream list does not give them. Nothing is taken unless
+    // the encoder takes it for every stream
+    wt_config_t *cur = &b->cfg;
+    if (next->bitrate != cur->bitrate || next->complexity != cur->complexity ||
+        next->fec != cur->fec || next->loss_perc != cur->loss_perc || next->dtx != cur->dtx) {
+        opus_enc_params_t params[TX_FANOUT_MAX_STREAMS];
+        bool ok = true;
+        for (int i = 0; i < b->tx_cfg.count; i++) {
+            const tx_stream_config_t *s = &b->tx_cfg.streams[i];
+            opus_enc_params_t *p = &params[i];
+            *p = s->params;
+            if (!next->tx_streams[0]) p->bitrate = next->bitrate;
+            if (!s->own_complexity) p->complexity = next->complexity;
+            p->fec = next->fec;
+            p->loss_perc = next->loss_perc;
+            p->dtx = next->dtx;
+            if (opus_enc_check(p) < 0) ok = false;
+        }
+        for (int i = 0; ok && i < b->tx_cfg.count; i++) {
+            if (tx_fanout_update(&b->tx, i, &params[i]) < 0) ok = false;
+        }
+        
+        if (ok) {
+            for (int i = 0; i < b->tx_cfg.count; i++) {
+                b->tx_cfg.streams[i].params = params[i];
+            }
+            cur->bitrate = next->bitrate;
+            cur->complexity = next->complexity;
+            cur->fec = next->fec;
+            cur->loss_perc = next->loss_perc;
+            cur->dtx = next->dtx;
+            printf("  Encoder settings from the next frame\n");
+        } else {
+            printf("  Encoder settings not taken, keeping the current ones\n");
+        }
+    }
+    
+    if (next->encode_budget != cur->encode_budget) {
+        tx_fanout_set_budget(&b->tx, next->encode_budget * 1000);
+        cur->encode_budget = next->encode_budget;
+    }
+    
+    if (next->redundancy != cur->redundancy || next->redundancy_kbps != cur->redundancy_kbps) {
+        tx_fanout_set_redundancy(&b->tx, next->redundancy, next->redundancy_kbps);
+        cur->redundancy = next->redundancy;
+        cur->redundancy_kbps = next->redundancy_kbps;
+    }
+    
+    if (next->jitter_target != cur->jitter_target) {
+        rx_pipeline_set_target(&b->rx, next->jitter_target);
+    }
+    
+    // Only the reloadable settings are now in effect
+    cur->jitter_target = next->jitter_target;
+    
+    if (next->log_level != cur->log_level) {
+        wtlog_set_level(next->log_level);
+        cur->log_level = next->log_level;
+    }
+    
+    if (next->trace != cur->trace) {
+        wttrace_enable(next->trace);
+        cur->trace = next->trace;
+        printf("  Tracing %s\n", next->trace ? "on" : "off");
+    }
+    
+    if (restart) {
+        printf("  Some changes take effect after a restart\n");
+    }
+}
+
+// Print statistics
+void wt_board_print_stats(wt_board_t *b) {
+    printf("\n╔═══════════════════════════════════════╗\n");
+    printf("║         System Statistics            ║\n");
+    printf("╚═══════════════════════════════════════╝\n");
+    printf("  Frames sent:     %lu\n", b->frames_sent);
+    printf("  Frames received: %lu\n", b->frames_received);
+    printf("  Frames dropped:  %lu\n", b->frames_dropped);
+    
+    if (b->frames_received > 0) {
+        double drop_rate = (double)b->frames_dropped / 
+                          (b->frames_received + b->frames_dropped) * 100.0;
+        printf("  Drop rate:       %.2f%%\n", drop_rate);
+    }
+    printf("  FEC recovered:   %lu\n", b->rx.stats.frames_recovered);
+    uint64_t red_primary = 0, red_extra = 0;
+    for (int i = 0; i < b->tx.n_streams; i++) {
+        red_primary += b->tx.streams[i].red.stats.bytes_primary;
+        red_extra += b->tx.streams[i].red.stats.bytes_redundant;
+    }
+    printf("  Redundancy:      %lu frames rebuilt (%lu copies heard), sending +%.0f%%\n",
+           b->rx.stats.frames_redundant, b->rx.stats.red_blocks,
+           red_primary ? 100.0 * red_extra / red_primary : 0.0);
+    printf("  Late packets:    %lu\n", b->rx.stats.frames_late);
+    printf("  Late joins:      %lu (%lu timed out)\n", b->rx.stats.late_joins,
+           b->rx.stats.timeouts);
+    printf("  Jitter:          %u us\n", b->rx.stats.jitter_us);
+    if (b->full_duplex) {
+        printf("  Echo ERLE:       %.1f dB\n", aec_erle_db(&b->aec));
+        printf("  AEC double talk: %lu blocks\n", b->aec.stats.blocks_doubletalk);
+    }
+    printf("  Speaker limiting: %lu blocks\n", b->rx_dsp.stats.limited_blocks);
+    printf("  Speaker dropouts: %lu (%lu comfort noise periods, %lu writes refused)\n",
+           b->playout.stats.underruns, b->playout.stats.fill_periods,
+           b->playout.stats.overflows);
+    printf("  Speaker restart: %u us worst gap (%lu late periods)\n",
+           b->playout.stats.gap_us_max, b->playout.stats.late_periods);
+    if (b->ptt_latency_max_us > 0) {
+        printf("  PTT to air:      %.1f ms (worst %.1f ms)\n",
+               b->ptt_latency_us / 1000.0, b->ptt_latency_max_us / 1000.0);
+    }
+    printf("  PTT bounces:     %lu\n", b->gpio.stats.bounces);
+    const dma_health_t *cap = &b->dma.health[DMA_CH_S2MM];
+    const dma_health_t *play = &b->dma.health[DMA_CH_MM2S];
+    printf("  DMA recoveries:  %lu capture, %lu playback (%lu failed, worst %u us)\n",
+           cap->recoveries, play->recoveries, cap->failed + play->failed,
+           cap->recover_us_max > play->recover_us_max ? cap->recover_us_max : play->recover_us_max);
+    if (b->tx.n_streams > 1) {
+        printf("  TX streams:      %d (%lu packets, worst frame %.1f ms)\n", b->tx.n_streams,
+               b->tx.stats.packets, b->tx.stats.encode_us_max / 1000.0);
+    }
+    printf("  Encode deadline: %lu missed, %lu over budget, level %d (worst %d, %lu down, %lu up)\n",
+           b->tx.stats.deadline_misses, b->tx.stats.over_budget, b->tx.stats.level,
+           b->tx.stats.level_max, b->tx.stats.steps_down, b->tx.stats.steps_up);
+    if (b->tx.stats.update_failures > 0) {
+        printf("  Encoder updates: %lu refused\n", b->tx.stats.update_failures);
+    }
+    if (b->clock_sync) {
+        bool locked = clocksync_locked(&b->clock);
+        if (clocksync_is_master(&b->clock)) {
+            printf("  Clock:           master (%lu SYNCs, %lu requests answered)\n",
+                   b->clock.stats.syncs_sent, b->clock.stats.requests_answered);
+        } else {
+            printf("  Clock:           %s to board %u, offset %.0f us, drift %.1f ppm, rtt %u us\n",
+                   locked ? "locked" : "unlocked", b->clock.master,
+                   clocksync_offset_us(&b->clock), clocksync_drift_ppm(&b->clock),
+                   b->clock.stats.rtt_min_us);
+        }
+        if (b->sync_delay_us) {
+            printf("  Synced playout:  %lu bursts, %lu slips, %lu late frames\n",
+                   b->playout.stats.aligned, b->playout.stats.slips,
+                   b->playout.stats.late_frames);
+        }
+    }
+    uint64_t spans, no_ring;
+    wttrace_get_stats(&spans, &no_ring);
+    if (spans > 0) {
+        printf("  Trace spans:     %lu (%lu from threads without a ring)\n", spans, no_ring);
+    }
+    if (b->archive.initialized) {
+        printf("  Archived:        %lu bursts (%lu queue drops, %lu write errors)\n",
+               b->archive.stats.bursts, b->archive.stats.ring_drops,
+               b->archive.stats.write_errors);
+    }
+    printf("\n");
+}
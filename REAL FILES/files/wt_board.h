@@ -0,0 +1,153 @@
+#ifndef WT_BOARD_H
+#define WT_BOARD_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <pthread.h>
+
+#include "config.h"
+#include "opus_helper.h"
+#include "network.h"
+#include "audio_dma.h"
+#include "gpio_ptt.h"
+#include "rx_pipeline.h"
+#include "pktlog.h"
+#include "aec.h"
+#include "capture_dsp.h"
+#include "beamform.h"
+#include "playback_dsp.h"
+#include "startup.h"
+#include "codec_pool.h"
+#include "tx_fanout.h"
+#include "archive.h"
+#include "playout.h"
+#include "clocksync.h"
+
+// One walkie-talkie: everything a board runs (GPIO, audio, codecs,
+// network, TX/RX/playout threads) behind a handle, so a process can run
+// one board on the hardware or many simulated ones side by side
+// (wt_soak). Nothing in here is shared between boards; only the log
+// drain (wtlog) and the trace rings (wttrace) are per process.
+//
+//   wt_board_init(&b, &cfg, NULL);      // NULL: the AXI DMA at cfg.dma_base
+//   wt_board_start(&b);
+//   ...
+//   wt_board_stop(&b);
+//   wt_board_cleanup(&b);
+//
+// Virtual audio replaces the DMA with callbacks: the TX thread asks for
+// each mic frame on a 20 ms clock of its own, and the playout thread runs
+// timer-clocked and hands over every speaker period as it starts. With
+// gpio = "mock" in the configuration, wt_board_set_ptt is the PTT button.
+
+typedef enum {
+    WT_AUDIO_DMA,                   // Codec through the AXI DMA
+    WT_AUDIO_VIRTUAL,               // Mic and speaker are callbacks
+} wt_audio_t;
+
+typedef struct {
+    wt_audio_t backend;
+
+    // The mic frame that started at start_us (NULL: silence), and each
+    // speaker period as it starts playing at at_us (both backends)
+    void (*mic)(void *arg, int16_t *pcm, uint64_t start_us);
+    void (*speaker)(void *arg, const int16_t *pcm, int samples, uint64_t at_us);
+    void *arg;
+} wt_audio_config_t;
+
+typedef struct {
+    // Settings in effect (config file, environment, command line)
+    wt_config_t cfg;
+    wt_audio_config_t audio;
+
+    // Component contexts
+    dma_ctx_t dma;
+    network_ctx_t net;
+    gpio_ctx_t gpio;
+    codec_pool_t codecs;            // All Opus state, allocated once at startup
+
+    // One encoder per outgoing talkgroup stream (WT_TX_STREAMS=<spec>)
+    tx_fanout_config_t tx_cfg;
+    tx_fanout_t tx;
+
+    rx_pipeline_t rx;
+
+    // Speaker stream, fed by the RX thread and played by its own thread
+    playout_ctx_t playout;
+
+    // Shared time base (WT_CLOCK_SYNC=1); with WT_SYNC_PLAYOUT=<ms> every
+    // board plays a frame that long after it was sent
+    clocksync_ctx_t clock;
+    bool clock_sync;
+    uint64_t sync_delay_us;
+    int sync_state;                 // SYNC_* for the burst playing
+    int16_t sync_pcm[FRAME_SIZE];   // First frame, held until its time
+    uint64_t sync_t0;               // Its timestamp
+    uint64_t sync_frames;           // Frames played since
+
+    // Packet recorder (enabled with WT_RECORD=<file>)
+    pktlog_writer_t pktlog;
+    bool recording;
+
+    // Every talk-burst to its own Ogg Opus file (WT_ARCHIVE=<dir>)
+    archive_ctx_t archive;
+
+    // Full duplex (WT_FULL_DUPLEX=1): keep playing while transmitting,
+    // with the echo canceller between speaker and mic
+    aec_ctx_t aec;
+    bool full_duplex;
+
+    // Mic conditioning before the encoder (WT_TX_DSP=<spec>, "off" disables)
+    capture_dsp_ctx_t tx_dsp;
+
+    // Several mics in the DMA frame, beamformed to one (WT_MIC_ARRAY=<spec>)
+    beam_ctx_t beam;
+    bool beamform;
+
+    // Speaker side: talker levelling, beeps and limiter (WT_RX_DSP=<spec>)
+    playback_dsp_ctx_t rx_dsp;
+
+    // State
+    bool running;
+    bool transmitting;
+    uint32_t board_id;
+    uint64_t mic_next_us;           // Virtual audio: end of the next mic frame
+
+    // Threads
+    pthread_t tx_thread;
+    pthread_t rx_thread;
+
+    // Subsystem bring-up and teardown
+    startup_ctx_t startup;
+
+    // Stats and that
+    uint64_t frames_sent;
+    uint64_t frames_received;
+    uint64_t frames_dropped;
+    uint64_t ptt_latency_us;        // PTT edge to first audio packet sent
+    uint64_t ptt_latency_max_us;
+
+    bool initialized;
+} wt_board_t;
+
+// Bring every subsystem up from cfg (startup.h); audio NULL is the DMA.
+// On failure what did come up is torn down again.
+int wt_board_init(wt_board_t *b, const wt_config_t *cfg, const wt_audio_config_t *audio);
+
+// Speaker stream first, then the TX and RX threads
+int wt_board_start(wt_board_t *b);
+
+// Threads down; the subsystems stay up until wt_board_cleanup
+void wt_board_stop(wt_board_t *b);
+
+// Apply what can change under a running board (SIGHUP), report the rest
+void wt_board_reload(wt_board_t *b, const wt_config_t *next);
+
+// Mock GPIO only: press or release the PTT button
+void wt_board_set_ptt(wt_board_t *b, bool pressed);
+
+void wt_board_print_stats(wt_board_t *b);
+
+void wt_board_cleanup(wt_board_t *b);
+
+#endif // WT_BOARD_H
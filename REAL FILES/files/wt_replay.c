@@ -0,0 +1,216 @@
+/*
+ * wt_replay.c - Replay a recorded packet log through the RX pipeline
+ *
+ * Feeds packets captured with WT_RECORD=<file> into the same jitter
+ * buffer + decoder the board uses, driven by a playout clock ticking
+ * once per frame. The output is written to a WAV file together with
+ * timing statistics, so decoder and jitter buffer changes can be
+ * compared on real traces.
+ *
+ * Usage: ./wt_replay [options] <log.wtpl> <out.wav>
+ *   -r        Real time (sleep between frames), default is as fast as possible
+ *   -j N      Jitter buffer target depth in frames (default JITTER_DEFAULT_TARGET)
+ *   -b ID     Board ID treated as "self" (default: the recording board)
+ *   -c        Compact output: skip idle frames instead of writing silence
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "opus_helper.h"
+#include "network.h"
+#include "rx_pipeline.h"
+#include "pktlog.h"
+#include "wav.h"
+
+static int cmp_u32(const void *a, const void *b) {
+    uint32_t x = *(const uint32_t *)a;
+    uint32_t y = *(const uint32_t *)b;
+    return (x > y) - (x < y);
+}
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr, "Usage: %s [-r] [-j frames] [-b board_id] [-c] <log.wtpl> <out.wav>\n", prog);
+}
+
+int main(int argc, char *argv[]) {
+    bool realtime = false;
+    bool compact = false;
+    int target = JITTER_DEFAULT_TARGET;
+    long self_id = -1;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "rj:b:c")) != -1) {
+        switch (opt) {
+        case 'r': realtime = true; break;
+        case 'j': target = atoi(optarg); break;
+        case 'b': self_id = atol(optarg); break;
+        case 'c': compact = true; break;
+        default: usage(argv[0]); return 1;
+        }
+    }
+    if (argc - optind != 2) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    pktlog_reader_t log;
+    if (pktlog_open_read(&log, argv[optind]) < 0) return 1;
+    if (self_id < 0) self_id = log.header->board_id;
+
+    opus_dec_ctx_t decoder;
+    if (opus_dec_init(&decoder) < 0) {
+        pktlog_close_read(&log);
+        return 1;
+    }
+
+    wav_writer_t wav;
+    if (wav_open_write(&wav, argv[optind + 1], SAMPLE_RATE, CHANNELS) < 0) {
+        opus_dec_cleanup(&decoder);
+        pktlog_close_read(&log);
+        return 1;
+    }
+
+    rx_pipeline_t rx;
+    rx_pipeline_init(&rx, &decoder, target);
+
+    // Per played frame: arrival-to-playout delay and pull (decode) cost
+    size_t capacity = 4096, count = 0;
+    bool stats_full = false;
+    int32_t *delay_us = malloc(capacity * sizeof(int32_t));
+    uint32_t *decode_ns = malloc(capacity * sizeof(uint32_t));
+    if (!delay_us || !decode_ns) {
+        fprintf(stderr, "Out of memory\n");
+        free(delay_us);
+        free(decode_ns);
+        wav_close(&wav);
+        opus_dec_cleanup(&decoder);
+        pktlog_close_read(&log);
+        return 1;
+    }
+    uint64_t total_frames = 0, idle_frames = 0, skipped_self = 0;
+
+    int16_t pcm[FRAME_SIZE];
+    static const int16_t silence[FRAME_SIZE];
+
+    const network_packet_t *packet = NULL;
+    int len = 0;
+    uint64_t arrival = 0;
+    bool have_packet = pktlog_next(&log, &packet, &len, &arrival) == 1;
+
+    // Virtual playout clock, one tick per frame
+    uint64_t clock_us = 0;
+    uint64_t wall_start = now_ns();
+
+    while (have_packet || rx_pipeline_active(&rx)) {
+        // Deliver everything that arrived before this tick
+        while (have_packet && arrival <= clock_us) {
+            if (packet->board_id != (uint32_t)self_id) {
+                rx_pipeline_push(&rx, packet, len, arrival);
+            } else {
+                skipped_self++;
+            }
+            have_packet = pktlog_next(&log, &packet, &len, &arrival) == 1;
+        }
+        rx_pipeline_poll(&rx, clock_us);
+
+        uint64_t t0 = now_ns();
+        int samples = rx_pipeline_pull(&rx, pcm, true);
+        uint64_t t1 = now_ns();
+
+        if (samples > 0) {
+            wav_write(&wav, pcm, FRAME_SIZE);
+
+            // Out of memory only ends the timing statistics, not the replay
+            if (count == capacity && !stats_full) {
+                int32_t *more_delay = realloc(delay_us, capacity * 2 * sizeof(int32_t));
+                if (more_delay) delay_us = more_delay;
+                uint32_t *more_decode = realloc(decode_ns, capacity * 2 * sizeof(uint32_t));
+                if (more_decode) decode_ns = more_decode;
+                if (more_delay && more_decode) {
+                    capacity *= 2;
+                } else {
+                    fprintf(stderr, "Out of memory, timing from the first %zu frames only\n",
+                            count);
+                    stats_full = true;
+                }
+            }
+            if (count < capacity) {
+                decode_ns[count] = (uint32_t)(t1 - t0);
+                delay_us[count] = rx.last_concealed ?
+                                  -1 : (int32_t)(clock_us - rx.last_played_arrival_us);
+                count++;
+            }
+        } else {
+            // Log exhausted and nothing left to drain
+            if (!have_packet) break;
+
+            idle_frames++;
+            if (!compact) wav_write(&wav, silence, FRAME_SIZE);
+        }
+
+        total_frames++;
+        clock_us += FRAME_US;
+
+        if (realtime) {
+            uint64_t due = wall_start + clock_us * 1000;
+            struct timespec ts = { (time_t)(due / 1000000000ULL), (long)(due % 1000000000ULL) };
+            clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+        }
+    }
+
+    double wall_s = (now_ns() - wall_start) / 1e9;
+    double trace_s = clock_us / 1e6;
+
+    wav_close(&wav);
+
+    printf("Replay of %s\n", argv[optind]);
+    printf("  Trace length:      %.2f s (%lu frames, %lu idle)\n",
+           trace_s, total_frames, idle_frames);
+    printf("  Replay time:       %.3f s (%.1fx real time)\n",
+           wall_s, wall_s > 0 ? trace_s / wall_s : 0.0);
+    printf("  Self packets:      %lu skipped\n", skipped_self);
+    printf("  Bursts:            %lu (%lu joined late, %lu timed out)\n", rx.stats.bursts,
+           rx.stats.late_joins, rx.stats.timeouts);
+    printf("  Audio packets:     %lu\n", rx.stats.packets);
+    printf("  Frames played:     %lu\n", rx.stats.frames_played);
+    printf("  Frames concealed:  %lu (%lu via FEC)\n",
+           rx.stats.frames_concealed, rx.stats.frames_recovered);
+    printf("  Late / duplicate:  %lu / %lu\n",
+           rx.stats.frames_late, rx.stats.frames_duplicate);
+    printf("  Underruns:         %lu\n", rx.stats.underruns);
+    printf("  Jitter (RFC 3550): %u us\n", rx.stats.jitter_us);
+
+    if (count > 0) {
+        // Only frames that came from a real packet have a playout delay
+        size_t real = 0;
+        for (size_t i = 0; i < count; i++) {
+            if (delay_us[i] >= 0) delay_us[real++] = delay_us[i];
+        }
+        qsort(decode_ns, count, sizeof(uint32_t), cmp_u32);
+        if (real > 0) {
+            qsort(delay_us, real, sizeof(int32_t), cmp_u32);
+            printf("  Playout delay:     median %.1f ms  p95 %.1f ms  max %.1f ms\n",
+                   delay_us[real / 2] / 1000.0, delay_us[real * 95 / 100] / 1000.0,
+                   delay_us[real - 1] / 1000.0);
+        }
+        printf("  Decode per frame:  median %.1f us  p99 %.1f us  max %.1f us\n",
+               decode_ns[count / 2] / 1000.0, decode_ns[count * 99 / 100] / 1000.0,
+               decode_ns[count - 1] / 1000.0);
+    }
+
+    free(delay_us);
+    free(decode_ns);
+    opus_dec_cleanup(&decoder);
+    pktlog_close_read(&log);
+    return 0;
+}
@@ -0,0 +1,141 @@
+/*
+ * wt_rtpgw.c - RTP/RTCP export gateway
+ *
+ * Listens on the walkie-talkie multicast group and re-sends every
+ * sender's Opus frames as a standard RTP stream (RFC 3550/7587), one
+ * SSRC per board and talkgroup, with RTCP sender reports (rtpgw.h).
+ * Packets come in with recvmmsg and go out with sendmmsg, a batch at a
+ * time, so one core keeps up with hundreds of talkers.
+ *
+ * Usage: ./wt_rtpgw [options]
+ *   -g group      Multicast group to listen on (default MULTICAST_ADDR)
+ *   -p port       Its port (default MULTICAST_PORT)
+ *   -t tg|all     Talkgroup to export, "all" (the default) needs cleartext
+ *   -k keyring    Talkgroup keys (default WT_KEYRING or /etc/walkietalkie.keys)
+ *   -o host:port  Where the RTP goes, RTCP to port + 1 (default 127.0.0.1:5004)
+ *   -m            A port pair per stream above port (logged, and in its SDP)
+ *   -P type       RTP payload type (default 111)
+ *   -s dir        Write an SDP file per stream into dir, for ffmpeg/VLC
+ *   -d seconds    Stop after this long (default: until SIGINT)
+ *
+ * With -m -s /tmp, a stream plays with
+ *   ffmpeg -protocol_whitelist file,udp,rtp -i /tmp/wt-<board>-tg<tg>.sdp out.wav
+ * and Wireshark decodes it with "Decode As... RTP" on the port.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+
+#include "network.h"
+#include "rtpgw.h"
+
+#define STATUS_MS   10000
+#define POLL_MS     20
+
+static volatile sig_atomic_t quit;
+
+static void signal_handler(int sig) {
+    (void)sig;
+    quit = 1;
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr, "Usage: %s [-g group] [-p port] [-t talkgroup|all] [-k keyring] "
+            "[-o host:port] [-m] [-P type] [-s sdp_dir] [-d seconds]\n", prog);
+}
+
+int main(int argc, char *argv[]) {
+    network_config_t net_cfg;
+    network_config_default(&net_cfg);
+    net_cfg.all_talkgroups = true;
+    net_cfg.netem = NULL;
+
+    rtpgw_config_t gw_cfg;
+    rtpgw_config_default(&gw_cfg);
+    int seconds = 0;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "g:p:t:k:o:mP:s:d:")) != -1) {
+        switch (opt) {
+        case 'g': snprintf(net_cfg.group, sizeof(net_cfg.group), "%s", optarg); break;
+        case 'p': net_cfg.port = (uint16_t)atoi(optarg); break;
+        case 't':
+            if (strcmp(optarg, "all") == 0) {
+                net_cfg.all_talkgroups = true;
+            } else {
+                int tg = atoi(optarg);
+                if (tg < 0 || tg >= CRYPTO_MAX_TALKGROUPS) {
+                    fprintf(stderr, "Talkgroup must be 0-%d or all\n", CRYPTO_MAX_TALKGROUPS - 1);
+                    return 1;
+                }
+                net_cfg.talkgroup = (uint8_t)tg;
+                net_cfg.all_talkgroups = false;
+            }
+            break;
+        case 'k': net_cfg.keyring = optarg; break;
+        case 'o': if (rtpgw_parse_dest(&gw_cfg, optarg) < 0) return 1; break;
+        case 'm': gw_cfg.port_per_stream = true; break;
+        case 'P':
+            gw_cfg.payload_type = atoi(optarg);
+            if (gw_cfg.payload_type < 96 || gw_cfg.payload_type > 127) {
+                fprintf(stderr, "Payload type must be dynamic, 96-127\n");
+                return 1;
+            }
+            break;
+        case 's': gw_cfg.sdp_dir = optarg; break;
+        case 'd': seconds = atoi(optarg); break;
+        default: usage(argv[0]); return 1;
+        }
+    }
+
+    signal(SIGINT, signal_handler);
+    signal(SIGTERM, signal_handler);
+
+    network_ctx_t net;
+    if (network_init_cfg(&net, 0, &net_cfg) < 0) return 1;
+
+    static rtpgw_t gw;
+    if (rtpgw_init(&gw, &gw_cfg) < 0) {
+        network_cleanup(&net);
+        return 1;
+    }
+
+    static network_packet_t packets[NETWORK_BATCH_MAX];
+    int lens[NETWORK_BATCH_MAX];
+    uint64_t start = network_time_us();
+    uint64_t next_poll = start, next_status = start + STATUS_MS * 1000ULL;
+
+    while (!quit) {
+        int n = network_recv_batch(&net, packets, lens, NETWORK_BATCH_MAX, POLL_MS);
+        if (n < 0) {
+            perror("recvmmsg");
+            break;
+        }
+
+        uint64_t now = network_time_us();
+        for (int i = 0; i < n; i++) {
+            if (lens[i] > 0) rtpgw_input(&gw, &packets[i], lens[i], now);
+        }
+        rtpgw_flush(&gw);
+
+        if (now >= next_poll) {
+            rtpgw_poll(&gw, now);
+            next_poll = now + POLL_MS * 1000;
+        }
+        if (now >= next_status) {
+            printf("%d streams, %lu packets in, %lu RTP and %lu RTCP out, %lu refused, "
+                   "%lu send errors\n", gw.stats.streams, (unsigned long)gw.stats.packets_in,
+                   (unsigned long)gw.stats.rtp_out, (unsigned long)gw.stats.rtcp_out,
+                   (unsigned long)gw.stats.no_stream, (unsigned long)gw.stats.send_errors);
+            next_status = now + STATUS_MS * 1000ULL;
+        }
+        if (seconds > 0 && now - start >= (uint64_t)seconds * 1000000) break;
+    }
+
+    rtpgw_cleanup(&gw);
+    network_cleanup(&net);
+    return 0;
+}
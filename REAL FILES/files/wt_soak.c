@@ -0,0 +1,353 @@
+/*
+ * wt_soak.c - Many simulated boards in one process, for scale testing
+ *
+ * Runs N complete boards (wt_board.h) side by side with virtual audio and
+ * mock GPIO, all on one multicast group over loopback, split across
+ * talkgroups. In every talkgroup the boards take turns: a PTT press, a
+ * little silence, then a tone until release, and a pause before the next
+ * talker. Each press goes through the whole pipeline: mic DSP, encoder,
+ * socket, every other board's jitter buffer, decoder, speaker DSP and
+ * playout thread.
+ *
+ * The tone starts at a known instant in the talker's mic; every listener
+ * notes when its speaker first plays it, which gives mouth-to-ear latency
+ * per listener per burst. Reported: latency percentiles over all of them
+ * (and bursts a listener never heard), CPU for the whole process and per
+ * board, resident memory per board, and the pipeline counters summed
+ * over the boards.
+ *
+ * Settings come from the WT_* environment as for the application (e.g.
+ * WT_BITRATE, WT_JITTER, WT_RX_DSP); group, port, board IDs, talkgroups,
+ * keyring and GPIO are the soak's own.
+ *
+ * Usage: ./wt_soak [-n boards] [-g talkgroups] [-d seconds] [-b burst_ms] [-v]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+
+#include "wt_board.h"
+#include "wtlog.h"
+
+#define SOAK_GROUP      "239.0.0.97"
+#define SOAK_PORT       5096
+#define MAX_BOARDS      1000
+#define MAX_GROUPS      64
+#define GAP_MS          500             // Between one talker's release and the next press
+#define ONSET_FRAMES    10              // Silence after the press before the tone
+#define TONE_HZ         700
+#define TONE_LEVEL      8000
+#define HEARD_LEVEL     2000            // Speaker sample that counts as the tone
+#define HIST_US         100             // Latency histogram bucket
+#define HIST_BUCKETS    20000           // Up to 2 s
+
+typedef struct {
+    uint32_t id;                        // Burst number, 0 before the first
+    int talker;
+    uint64_t onset_us;                  // Tone start in the talker's mic, 0 not yet
+    uint64_t next_us;                   // Next press or release
+    bool talking;
+} soak_group_t;
+
+typedef struct {
+    int index;
+    int group;
+    uint32_t mic_frames;                // Since the press
+    uint32_t heard_id;                  // Last burst whose tone reached our speaker
+} soak_board_t;
+
+static wt_board_t *boards;
+static soak_board_t *soak;
+static soak_group_t groups[MAX_GROUPS];
+static int n_boards = 16;
+static int n_groups = 1;
+
+static uint32_t hist[HIST_BUCKETS + 1];
+static uint64_t heard;
+static uint64_t missed;
+
+static uint64_t now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+// Talker's mic: silence, then the tone from the start of frame ONSET_FRAMES
+static void mic(void *arg, int16_t *pcm, uint64_t start_us) {
+    soak_board_t *s = arg;
+    soak_group_t *g = &groups[s->group];
+    uint32_t frame = __atomic_fetch_add(&s->mic_frames, 1, __ATOMIC_RELAXED);
+
+    if (frame < ONSET_FRAMES) {
+        memset(pcm, 0, FRAME_SIZE * sizeof(int16_t));
+        return;
+    }
+    if (frame == ONSET_FRAMES && __atomic_load_n(&g->talker, __ATOMIC_ACQUIRE) == s->index) {
+        __atomic_store_n(&g->onset_us, start_us, __ATOMIC_RELEASE);
+    }
+    for (int i = 0; i < FRAME_SIZE; i++) {
+        uint64_t n = (uint64_t)(frame - ONSET_FRAMES) * FRAME_SIZE + i;
+        pcm[i] = (int16_t)(TONE_LEVEL * sin(2 * M_PI * TONE_HZ * (double)n / SAMPLE_RATE));
+    }
+}
+
+// Listener's speaker: first tone sample of the burst, as it plays
+static void speaker(void *arg, const int16_t *pcm, int samples, uint64_t at_us) {
+    soak_board_t *s = arg;
+    soak_group_t *g = &groups[s->group];
+
+    uint32_t id = __atomic_load_n(&g->id, __ATOMIC_ACQUIRE);
+    if (id == __atomic_load_n(&s->heard_id, __ATOMIC_RELAXED) ||
+        __atomic_load_n(&g->talker, __ATOMIC_RELAXED) == s->index) {
+        return;
+    }
+    uint64_t onset = __atomic_load_n(&g->onset_us, __ATOMIC_ACQUIRE);
+    if (!onset) return;
+
+    for (int i = 0; i < samples; i++) {
+        if (abs(pcm[i]) < HEARD_LEVEL) continue;
+        uint64_t t = at_us + (uint64_t)i * 1000000 / SAMPLE_RATE;
+        if (t < onset) return;
+
+        uint64_t bucket = (t - onset) / HIST_US;
+        __atomic_add_fetch(&hist[bucket < HIST_BUCKETS ? bucket : HIST_BUCKETS], 1, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&heard, 1, __ATOMIC_RELAXED);
+        __atomic_store_n(&s->heard_id, id, __ATOMIC_RELEASE);
+        return;
+    }
+}
+
+// Listeners that never heard the burst that just ended
+static void close_burst(soak_group_t *g, int group) {
+    if (!g->id) return;
+    for (int i = 0; i < n_boards; i++) {
+        if (soak[i].group == group && i != g->talker &&
+            __atomic_load_n(&soak[i].heard_id, __ATOMIC_ACQUIRE) != g->id) {
+            missed++;
+        }
+    }
+}
+
+// Presses and releases due; round robin within each talkgroup
+static void schedule(uint64_t now, int burst_ms) {
+    for (int gi = 0; gi < n_groups; gi++) {
+        soak_group_t *g = &groups[gi];
+        if (now < g->next_us) continue;
+
+        if (g->talking) {
+            wt_board_set_ptt(&boards[g->talker], false);
+            g->talking = false;
+            g->next_us = now + GAP_MS * 1000;
+            continue;
+        }
+
+        close_burst(g, gi);
+        int next = g->id ? g->talker + n_groups : gi;
+        if (next >= n_boards) next = gi;
+
+        // The talker's frame count before it is the talker, so its mic
+        // never marks the onset off the old count; onset before the id, so
+        // a speaker never pairs the new burst with the old onset
+        __atomic_store_n(&soak[next].mic_frames, 0, __ATOMIC_RELAXED);
+        __atomic_store_n(&g->onset_us, 0, __ATOMIC_RELEASE);
+        __atomic_store_n(&g->talker, next, __ATOMIC_RELEASE);
+        __atomic_store_n(&g->id, g->id + 1, __ATOMIC_RELEASE);
+        wt_board_set_ptt(&boards[next], true);
+        g->talking = true;
+        g->next_us = now + (uint64_t)burst_ms * 1000;
+    }
+}
+
+// Resident set size of the process, kB
+static long rss_kb(void) {
+    FILE *f = fopen("/proc/self/status", "r");
+    if (!f) return 0;
+    char line[128];
+    long kb = 0;
+    while (fgets(line, sizeof(line), f)) {
+        if (sscanf(line, "VmRSS: %ld", &kb) == 1) break;
+    }
+    fclose(f);
+    return kb;
+}
+
+static double cpu_s(void) {
+    struct rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+    return ru.ru_utime.tv_sec + ru.ru_stime.tv_sec +
+           (ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) / 1e6;
+}
+
+static double percentile(double p) {
+    uint64_t want = (uint64_t)ceil(heard * p);
+    uint64_t seen = 0;
+    for (int i = 0; i <= HIST_BUCKETS; i++) {
+        seen += hist[i];
+        if (seen >= want && seen > 0) return (i + 0.5) * HIST_US / 1000.0;
+    }
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    int seconds = 20, burst_ms = 1500;
+    bool verbose = false;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:g:d:b:v")) != -1) {
+        switch (opt) {
+        case 'n': n_boards = atoi(optarg); break;
+        case 'g': n_groups = atoi(optarg); break;
+        case 'd': seconds = atoi(optarg); break;
+        case 'b': burst_ms = atoi(optarg); break;
+        case 'v': verbose = true; break;
+        default:
+            fprintf(stderr, "Usage: %s [-n boards] [-g talkgroups] [-d seconds] [-b burst_ms] [-v]\n",
+                    argv[0]);
+            return 1;
+        }
+    }
+    if (n_boards < 2) n_boards = 2;
+    if (n_boards > MAX_BOARDS) n_boards = MAX_BOARDS;
+    if (n_groups < 1) n_groups = 1;
+    if (n_groups > MAX_GROUPS) n_groups = MAX_GROUPS;
+    if (n_groups > n_boards / 2) n_groups = n_boards / 2;
+    if (n_groups > CRYPTO_MAX_TALKGROUPS) n_groups = CRYPTO_MAX_TALKGROUPS;
+    if (burst_ms < (ONSET_FRAMES + 10) * 20) burst_ms = (ONSET_FRAMES + 10) * 20;
+    if (seconds < 5) seconds = 5;
+
+    wt_config_t base;
+    config_default(&base);
+    if (config_load_env(&base) < 0) return 1;
+    snprintf(base.group, sizeof(base.group), "%s", SOAK_GROUP);
+    base.port = SOAK_PORT;
+    base.keyring[0] = '\0';
+    base.netem[0] = '\0';
+    base.record[0] = '\0';
+    base.archive[0] = '\0';
+    snprintf(base.gpio, sizeof(base.gpio), "mock");
+
+    boards = calloc(n_boards, sizeof(wt_board_t));
+    soak = calloc(n_boards, sizeof(soak_board_t));
+    if (!boards || !soak) {
+        perror("calloc");
+        return 1;
+    }
+
+    // The boards' own messages would bury the report
+    FILE *report = stdout;
+    if (!verbose) {
+        report = fdopen(dup(STDOUT_FILENO), "w");
+        if (!report || !freopen("/dev/null", "w", stdout)) return 1;
+    }
+    setvbuf(report, NULL, _IOLBF, 0);
+
+    fprintf(report, "\n%d boards in %d talkgroup(s), %d ms bursts, %d s (%zu bytes of state per board)\n",
+            n_boards, n_groups, burst_ms, seconds, sizeof(wt_board_t));
+
+    long rss0 = rss_kb();
+    wtlog_init(WTLOG_LVL_WARN);
+
+    uint64_t t0 = now_us();
+    int up = 0;
+    for (int i = 0; i < n_boards; i++) {
+        wt_config_t cfg = base;
+        cfg.board_id = i + 1;
+        cfg.talkgroup = i % n_groups;
+        soak[i].index = i;
+        soak[i].group = i % n_groups;
+
+        wt_audio_config_t audio = { WT_AUDIO_VIRTUAL, mic, speaker, &soak[i] };
+        if (wt_board_init(&boards[i], &cfg, &audio) < 0 || wt_board_start(&boards[i]) < 0) {
+            fprintf(report, "board %d failed to come up\n", i + 1);
+            break;
+        }
+        up++;
+    }
+    if (up < n_boards) {
+        for (int i = 0; i < up; i++) wt_board_cleanup(&boards[i]);
+        wtlog_cleanup();
+        return 1;
+    }
+    fprintf(report, "  all up in %.0f ms\n", (now_us() - t0) / 1000.0);
+
+    // Settle, then talkgroups start a fraction of a cycle apart
+    sleep(1);
+    long rss1 = rss_kb();
+    uint64_t start = now_us();
+    uint64_t cycle = (uint64_t)(burst_ms + GAP_MS) * 1000;
+    for (int gi = 0; gi < n_groups; gi++) {
+        groups[gi].next_us = start + cycle * gi / n_groups;
+    }
+
+    double cpu0 = cpu_s();
+    uint64_t end = start + (uint64_t)seconds * 1000000;
+    while (now_us() < end) {
+        schedule(now_us(), burst_ms);
+        usleep(5000);
+    }
+
+    // Let the last bursts play out
+    for (int gi = 0; gi < n_groups; gi++) {
+        if (groups[gi].talking) {
+            wt_board_set_ptt(&boards[groups[gi].talker], false);
+            groups[gi].talking = false;
+        }
+    }
+    usleep(GAP_MS * 1000);
+    for (int gi = 0; gi < n_groups; gi++) close_burst(&groups[gi], gi);
+    double cpu1 = cpu_s();
+    double wall = (now_us() - start) / 1e6;
+    long rss2 = rss_kb();
+
+    for (int i = 0; i < n_boards; i++) wt_board_stop(&boards[i]);
+
+    uint64_t sent = 0, received = 0, concealed = 0, late = 0, underruns = 0, late_periods = 0;
+    uint64_t rebuilt = 0;
+    uint64_t bursts = 0, misses = 0, steps = 0;
+    int level_max = 0;
+    for (int gi = 0; gi < n_groups; gi++) bursts += groups[gi].id;
+    for (int i = 0; i < n_boards; i++) {
+        wt_board_t *b = &boards[i];
+        sent += b->frames_sent;
+        received += b->frames_received;
+        concealed += b->rx.stats.frames_concealed;
+        rebuilt += b->rx.stats.frames_redundant;
+        late += b->rx.stats.frames_late;
+        underruns += b->playout.stats.underruns;
+        late_periods += b->playout.stats.late_periods;
+        misses += b->tx.stats.deadline_misses;
+        steps += b->tx.stats.steps_down;
+        if (b->tx.stats.level_max > level_max) level_max = b->tx.stats.level_max;
+    }
+
+    double cpu = cpu1 - cpu0;
+    fprintf(report, "\n  CPU:      %.2f cores in all, %.2f%% of a core per board\n", cpu / wall,
+            cpu / wall / n_boards * 100);
+    fprintf(report, "  Memory:   %.0f kB resident per board (%ld kB before the boards, %ld kB after %.0f s)\n",
+            (double)(rss1 - rss0) / n_boards, rss0, rss2, wall);
+    fprintf(report, "  Bursts:   %lu talked, %lu heard by listeners, %lu missed\n",
+            (unsigned long)bursts, (unsigned long)heard, (unsigned long)missed);
+    if (heard) {
+        fprintf(report, "  Latency:  mouth to ear p50 %.1f ms, p90 %.1f, p99 %.1f, p99.9 %.1f, max %.1f\n",
+                percentile(0.5), percentile(0.9), percentile(0.99), percentile(0.999),
+                percentile(1.0));
+    }
+    fprintf(report, "  Frames:   %lu sent, %lu played, %lu concealed, %lu late, %lu rebuilt from redundancy\n",
+            (unsigned long)sent, (unsigned long)received, (unsigned long)concealed,
+            (unsigned long)late, (unsigned long)rebuilt);
+    fprintf(report, "  Encoder:  %lu deadline misses, %lu steps down (lowest level %d)\n",
+            (unsigned long)misses, (unsigned long)steps, level_max);
+    fprintf(report, "  Speaker:  %lu dropouts, %lu late periods\n\n", (unsigned long)underruns,
+            (unsigned long)late_periods);
+
+    for (int i = 0; i < n_boards; i++) wt_board_cleanup(&boards[i]);
+    wtlog_cleanup();
+    free(boards);
+    free(soak);
+    return missed > heard / 100 ? 1 : 0;
+}
@@ -0,0 +1,527 @@
+#define _GNU_SOURCE
+#include "wtlog.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+
+// Drain thread runs below the audio threads
+#define WTLOG_NICE          10
+
+typedef union {
+    int64_t i;
+    uint64_t u;
+    double d;
+    const void *p;
+} wtlog_arg_t;
+
+// One message, 128 bytes: two per cache line pair, nothing to allocate
+typedef struct {
+    uint64_t ts_ns;
+    const char *fmt;                        // Must outlive the call (a literal)
+    uint32_t suppressed;                    // Skipped at this site since the last one
+    uint8_t level;
+    uint8_t nargs;
+    uint8_t str_len;
+    uint8_t reserved;
+    wtlog_arg_t args[WTLOG_MAX_ARGS];
+    char strings[WTLOG_STR_BYTES];          // %s arguments, NUL separated
+} wtlog_rec_t;
+
+typedef struct wtlog_ring {
+    wtlog_rec_t recs[WTLOG_RING_SLOTS];
+    uint32_t head;                          // Written by the owning thread
+    uint32_t tail;                          // Written by the drain thread
+    uint64_t dropped;
+    char name[16];
+    int index;
+    bool used;
+    bool exited;                            // Owner gone, free once drained
+    struct wtlog_ring *next_free;
+} wtlog_ring_t;
+
+// Conversion classes, decided from the length modifier and conversion
+enum {
+    CONV_NONE,
+    CONV_INT,
+    CONV_LONG,
+    CONV_LLONG,
+    CONV_SIZE,
+    CONV_DOUBLE,
+    CONV_LDOUBLE,
+    CONV_STR,
+    CONV_PTR,
+};
+
+int wtlog_level = WTLOG_LVL_INFO;
+
+// Rings allocated so far; a slot keeps its ring for good, and the ring
+// passes from thread to thread through free_rings
+static wtlog_ring_t *rings[WTLOG_MAX_THREADS];
+static int n_rings;
+static wtlog_ring_t *free_rings;
+static pthread_mutex_t ring_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_key_t ring_key;
+static pthread_once_t ring_key_once = PTHREAD_ONCE_INIT;
+static bool ring_warned;
+static __thread wtlog_ring_t *my_ring;
+static __thread bool my_ring_failed;        // Do not take the lock on every call
+
+static pthread_t drain_thread;
+static bool running;
+static bool stop;
+static uint64_t base_ns;
+static uint64_t stat_records;
+static uint64_t stat_suppressed;
+static uint64_t stat_no_ring;
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// Parse one conversion after a '%'. spec gets it back without the length
+// modifier (the drain adds the one that matches how the argument was
+// stored); returns the character after it.
+static const char *parse_conv(const char *p, char *spec, size_t spec_size, int *cls, char *conv) {
+    size_t n = 0;
+    int len = 0;                            // 0 none, 1 l, 2 ll, 3 z, 4 L
+
+    spec[n++] = '%';
+    while (*p && strchr("-+ #0", *p)) {
+        if (n < spec_size - 4) spec[n++] = *p;
+        p++;
+    }
+    while (*p && ((*p >= '0' && *p <= '9') || *p == '.')) {
+        if (n < spec_size - 4) spec[n++] = *p;
+        p++;
+    }
+    for (;;) {
+        if (*p == 'h') { p++; continue; }
+        if (*p == 'l') { len = len == 1 ? 2 : 1; p++; continue; }
+        if (*p == 'z' || *p == 'j' || *p == 't') { len = 3; p++; continue; }
+        if (*p == 'L') { len = 4; p++; continue; }
+        break;
+    }
+    spec[n] = '\0';
+
+    *conv = *p;
+    switch (*p) {
+    case 'd': case 'i': case 'u': case 'x': case 'X': case 'o': case 'c':
+        *cls = len == 1 ? CONV_LONG : len == 2 ? CONV_LLONG : len == 3 ? CONV_SIZE : CONV_INT;
+        break;
+    case 'f': case 'F': case 'e': case 'E': case 'g': case 'G': case 'a': case 'A':
+        *cls = len == 4 ? CONV_LDOUBLE : CONV_DOUBLE;
+        break;
+    case 's':
+        *cls = CONV_STR;
+        break;
+    case 'p':
+        *cls = CONV_PTR;
+        break;
+    default:
+        *cls = CONV_NONE;                   // '%%', '*' widths, %n: nothing consumed
+        break;
+    }
+    return *p ? p + 1 : p;
+}
+
+// Format one record into out (NUL terminated, truncated to size)
+static void format_rec(const wtlog_rec_t *rec, char *out, size_t size) {
+    const char *p = rec->fmt;
+    size_t n = 0;
+    int arg = 0;
+
+    while (*p && n < size - 1) {
+        if (*p != '%') {
+            out[n++] = *p++;
+            continue;
+        }
+        if (p[1] == '%') {
+            out[n++] = '%';
+            p += 2;
+            continue;
+        }
+
+        char spec[24];
+        int cls;
+        char conv;
+        p = parse_conv(p + 1, spec, sizeof(spec) - 4, &cls, &conv);
+        if (cls == CONV_NONE || arg >= rec->nargs) continue;
+
+        size_t sl = strlen(spec);
+        const wtlog_arg_t *a = &rec->args[arg++];
+        int w;
+        switch (cls) {
+        case CONV_DOUBLE:
+        case CONV_LDOUBLE:
+            spec[sl] = conv;
+            spec[sl + 1] = '\0';
+            w = snprintf(out + n, size - n, spec, a->d);
+            break;
+        case CONV_STR:
+            spec[sl] = 's';
+            spec[sl + 1] = '\0';
+            w = snprintf(out + n, size - n, spec,
+                         a->u < rec->str_len ? rec->strings + a->u : "?");
+            break;
+        case CONV_PTR:
+            spec[sl] = 'p';
+            spec[sl + 1] = '\0';
+            w = snprintf(out + n, size - n, spec, a->p);
+            break;
+        default:
+            // Every integer was widened to 64 bits when it was logged
+            spec[sl] = 'l';
+            spec[sl + 1] = 'l';
+            spec[sl + 2] = conv;
+            spec[sl + 3] = '\0';
+            if (conv == 'c') {
+                w = snprintf(out + n, size - n, "%c", (int)a->i);
+            } else if (conv == 'd' || conv == 'i') {
+                w = snprintf(out + n, size - n, spec, (long long)a->i);
+            } else {
+                w = snprintf(out + n, size - n, spec, (unsigned long long)a->u);
+            }
+            break;
+        }
+        if (w > 0) n += (size_t)w < size - n ? (size_t)w : size - n - 1;
+    }
+    out[n] = '\0';
+}
+
+static void print_rec(const wtlog_rec_t *rec, const char *thread) {
+    static const char levels[] = "DIWE";
+    char text[256];
+
+    format_rec(rec, text, sizeof(text));
+
+    if (rec->level == WTLOG_LVL_PLAIN) {
+        fputs(text, stdout);
+        return;
+    }
+
+    FILE *out = rec->level >= WTLOG_LVL_WARN ? stderr : stdout;
+    double t = base_ns && rec->ts_ns > base_ns ? (rec->ts_ns - base_ns) / 1e9 : 0.0;
+    if (rec->suppressed) {
+        fprintf(out, "[%10.6f] %c %-6s %s (%u more suppressed)\n", t, levels[rec->level],
+                thread, text, rec->suppressed);
+    } else {
+        fprintf(out, "[%10.6f] %c %-6s %s\n", t, levels[rec->level], thread, text);
+    }
+}
+
+// Back on the free list: right away if nothing can be queued in it,
+// otherwise the drain does it once it has printed the rest
+static void ring_release(void *arg) {
+    wtlog_ring_t *r = arg;
+
+    // Runs on the exiting thread, which has no ring from here on
+    my_ring = NULL;
+    my_ring_failed = true;
+
+    pthread_mutex_lock(&ring_lock);
+    if (__atomic_load_n(&running, __ATOMIC_ACQUIRE) ||
+        __atomic_load_n(&r->head, __ATOMIC_ACQUIRE) != r->tail) {
+        __atomic_store_n(&r->exited, true, __ATOMIC_RELEASE);
+    } else {
+        __atomic_store_n(&r->used, false, __ATOMIC_RELEASE);
+        r->next_free = free_rings;
+        free_rings = r;
+    }
+    pthread_mutex_unlock(&ring_lock);
+}
+
+static void ring_key_create(void) {
+    pthread_key_create(&ring_key, ring_release);
+}
+
+// First log call of a thread claims a ring for it: a free one, else a
+// new one (never from an audio frame, threads name themselves first)
+static wtlog_ring_t *ring_claim(void) {
+    pthread_once(&ring_key_once, ring_key_create);
+
+    pthread_mutex_lock(&ring_lock);
+    wtlog_ring_t *r = free_rings;
+    if (r) {
+        free_rings = r->next_free;
+        r->exited = false;
+    } else if (n_rings < WTLOG_MAX_THREADS && (r = calloc(1, sizeof(wtlog_ring_t)))) {
+        r->index = n_rings;
+        rings[r->index] = r;
+        __atomic_store_n(&n_rings, r->index + 1, __ATOMIC_RELEASE);
+    }
+    bool warn = !r && !ring_warned;
+    if (warn) ring_warned = true;
+    pthread_mutex_unlock(&ring_lock);
+
+    if (!r) {
+        // Said once, then only counted
+        if (warn) {
+            fprintf(stderr, "wtlog: no log ring for another thread (%d in use), "
+                    "its messages are dropped\n", WTLOG_MAX_THREADS);
+        }
+        return NULL;
+    }
+
+    snprintf(r->name, sizeof(r->name), "t%d", r->index);
+    __atomic_store_n(&r->used, true, __ATOMIC_RELEASE);
+    pthread_setspecific(ring_key, r);
+    return r;
+}
+
+void wtlog_thread(const char *name) {
+    if (!my_ring) my_ring = ring_claim();
+    my_ring_failed = !my_ring;
+    if (my_ring) snprintf(my_ring->name, sizeof(my_ring->name), "%s", name);
+
+    // And for the kernel (top -H, gdb, trace tracks); 15 characters at most
+    char comm[16];
+    snprintf(comm, sizeof(comm), "%s", name);
+    pthread_setname_np(pthread_self(), comm);
+}
+
+// Token bucket kept as one timestamp (GCRA): each message moves it a
+// message's worth of time on, and it may run at most the burst ahead of
+// now. One compare-and-swap, so threads sharing a site never tear it
+static bool rate_ok(wtlog_site_t *site, uint64_t now) {
+    const uint64_t cost = 1000000000ULL / WTLOG_RATE;
+    const uint64_t cap = cost * WTLOG_BURST;
+
+    uint64_t tat = __atomic_load_n(&site->tat_ns, __ATOMIC_RELAXED);
+    for (;;) {
+        uint64_t next = (tat > now ? tat : now) + cost;
+        if (next - now > cap) return false;
+        if (__atomic_compare_exchange_n(&site->tat_ns, &tat, next, true,
+                                        __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+            return true;
+        }
+    }
+}
+
+void wtlog_write(wtlog_site_t *site, int level, const char *fmt, ...) {
+    uint64_t now = now_ns();
+
+    if (level != WTLOG_LVL_PLAIN && !rate_ok(site, now)) {
+        __atomic_add_fetch(&site->suppressed, 1, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&stat_suppressed, 1, __ATOMIC_RELAXED);
+        return;
+    }
+
+    if (!my_ring && !my_ring_failed) {
+        my_ring = ring_claim();
+        my_ring_failed = !my_ring;
+    }
+    wtlog_ring_t *r = my_ring;
+    bool queued = __atomic_load_n(&running, __ATOMIC_ACQUIRE) && r;
+
+    wtlog_rec_t local;
+    wtlog_rec_t *rec = &local;
+    uint32_t head = 0;
+    if (queued) {
+        head = r->head;
+        if (head - __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE) >= WTLOG_RING_SLOTS) {
+            r->dropped++;
+            return;
+        }
+        rec = &r->recs[head & (WTLOG_RING_SLOTS - 1)];
+    } else if (__atomic_load_n(&running, __ATOMIC_ACQUIRE)) {
+        __atomic_add_fetch(&stat_no_ring, 1, __ATOMIC_RELAXED);
+        return;
+    }
+
+    rec->ts_ns = now;
+    rec->fmt = fmt;
+    rec->level = (uint8_t)level;
+    rec->suppressed = __atomic_exchange_n(&site->suppressed, 0, __ATOMIC_RELAXED);
+    rec->nargs = 0;
+    rec->str_len = 0;
+
+    // Copy the arguments the format asks for, widened to 64 bits
+    va_list ap;
+    va_start(ap, fmt);
+    for (const char *p = fmt; *p && rec->nargs < WTLOG_MAX_ARGS; ) {
+        if (*p++ != '%') continue;
+        if (*p == '%') {
+            p++;
+            continue;
+        }
+
+        char spec[24];
+        int cls;
+        char conv;
+        p = parse_conv(p, spec, sizeof(spec), &cls, &conv);
+
+        wtlog_arg_t *a = &rec->args[rec->nargs];
+        bool is_signed = conv == 'd' || conv == 'i' || conv == 'c';
+        switch (cls) {
+        case CONV_INT:
+            if (is_signed) a->i = va_arg(ap, int);
+            else a->u = va_arg(ap, unsigned int);
+            break;
+        case CONV_LONG:
+            if (is_signed) a->i = va_arg(ap, long);
+            else a->u = va_arg(ap, unsigned long);
+            break;
+        case CONV_LLONG:
+            if (is_signed) a->i = va_arg(ap, long long);
+            else a->u = va_arg(ap, unsigned long long);
+            break;
+        case CONV_SIZE:
+            a->u = va_arg(ap, size_t);
+            break;
+        case CONV_DOUBLE:
+            a->d = va_arg(ap, double);
+            break;
+        case CONV_LDOUBLE:
+            a->d = (double)va_arg(ap, long double);
+            break;
+        case CONV_STR: {
+            const char *s = va_arg(ap, const char *);
+            size_t room = WTLOG_STR_BYTES - rec->str_len;
+            size_t len = s ? strnlen(s, room ? room - 1 : 0) : 0;
+            if (room == 0) {
+                a->u = WTLOG_STR_BYTES;     // Out of room: printed as "?"
+                break;
+            }
+            a->u = rec->str_len;
+            if (s) memcpy(rec->strings + rec->str_len, s, len);
+            rec->strings[rec->str_len + len] = '\0';
+            rec->str_len += (uint8_t)(len + 1);
+            break;
+        }
+        case CONV_PTR:
+            a->p = va_arg(ap, const void *);
+            break;
+        default:
+            continue;
+        }
+        rec->nargs++;
+    }
+    va_end(ap);
+
+    if (!queued) {
+        // No drain thread: print here, the caller is not real time
+        print_rec(rec, r ? r->name : "-");
+        if (level == WTLOG_LVL_PLAIN) fflush(stdout);
+        return;
+    }
+
+    __atomic_store_n(&r->head, head + 1, __ATOMIC_RELEASE);
+}
+
+// Print everything queued so far, oldest first across all threads
+static void drain_all(void) {
+    int n = __atomic_load_n(&n_rings, __ATOMIC_ACQUIRE);
+
+    static uint32_t heads[WTLOG_MAX_THREADS];
+    for (int i = 0; i < n; i++) {
+        heads[i] = __atomic_load_n(&rings[i]->used, __ATOMIC_ACQUIRE) ?
+                   __atomic_load_n(&rings[i]->head, __ATOMIC_ACQUIRE) : rings[i]->tail;
+    }
+
+    for (;;) {
+        wtlog_ring_t *next = NULL;
+        for (int i = 0; i < n; i++) {
+            wtlog_ring_t *r = rings[i];
+            if (r->tail == heads[i]) continue;
+            if (!next || r->recs[r->tail & (WTLOG_RING_SLOTS - 1)].ts_ns <
+                         next->recs[next->tail & (WTLOG_RING_SLOTS - 1)].ts_ns) {
+                next = r;
+            }
+        }
+        if (!next) break;
+
+        print_rec(&next->recs[next->tail & (WTLOG_RING_SLOTS - 1)], next->name);
+        stat_records++;
+        __atomic_store_n(&next->tail, next->tail + 1, __ATOMIC_RELEASE);
+    }
+
+    // Rings of exited threads, now empty, for the next thread to claim
+    pthread_mutex_lock(&ring_lock);
+    for (int i = 0; i < n; i++) {
+        wtlog_ring_t *r = rings[i];
+        if (!__atomic_load_n(&r->exited, __ATOMIC_ACQUIRE) ||
+            __atomic_load_n(&r->head, __ATOMIC_ACQUIRE) != r->tail) {
+            continue;
+        }
+        r->exited = false;
+        __atomic_store_n(&r->used, false, __ATOMIC_RELEASE);
+        r->next_free = free_rings;
+        free_rings = r;
+    }
+    pthread_mutex_unlock(&ring_lock);
+
+    fflush(stdout);
+    fflush(stderr);
+}
+
+static void *wtlog_drain(void *arg) {
+    (void)arg;
+
+    setpriority(PRIO_PROCESS, (id_t)syscall(SYS_gettid), WTLOG_NICE);
+
+    while (!__atomic_load_n(&stop, __ATOMIC_ACQUIRE)) {
+        usleep(WTLOG_DRAIN_MS * 1000);
+        drain_all();
+    }
+    return NULL;
+}
+
+int wtlog_init(int level) {
+    if (running) return 0;
+
+    wtlog_level = level;
+    base_ns = now_ns();
+    stop = false;
+
+    // Set before the thread starts so nothing logged from here on is printed
+    // out of order by the calling thread
+    __atomic_store_n(&running, true, __ATOMIC_RELEASE);
+    if (pthread_create(&drain_thread, NULL, wtlog_drain, NULL) != 0) {
+        __atomic_store_n(&running, false, __ATOMIC_RELEASE);
+        fprintf(stderr, "Log drain thread failed to start, logging directly\n");
+        return -1;
+    }
+    return 0;
+}
+
+void wtlog_set_level(int level) {
+    __atomic_store_n(&wtlog_level, level, __ATOMIC_RELAXED);
+}
+
+void wtlog_get_stats(wtlog_stats_t *stats) {
+    memset(stats, 0, sizeof(wtlog_stats_t));
+    stats->records = stat_records;
+    stats->suppressed = __atomic_load_n(&stat_suppressed, __ATOMIC_RELAXED);
+    stats->dropped = __atomic_load_n(&stat_no_ring, __ATOMIC_RELAXED);
+    int n = __atomic_load_n(&n_rings, __ATOMIC_ACQUIRE);
+    for (int i = 0; i < n; i++) {
+        stats->dropped += rings[i]->dropped;
+    }
+}
+
+void wtlog_cleanup(void) {
+    if (!running) return;
+
+    __atomic_store_n(&stop, true, __ATOMIC_RELEASE);
+    pthread_join(drain_thread, NULL);
+
+    // Whatever came in after the drain's last pass, then direct printing
+    __atomic_store_n(&running, false, __ATOMIC_RELEASE);
+    drain_all();
+
+    wtlog_stats_t st;
+    wtlog_get_stats(&st);
+    if (st.dropped > 0 || st.suppressed > 0) {
+        fprintf(stderr, "Log: %lu dropped, %lu rate limited\n",
+                (unsigned long)st.dropped, (unsigned long)st.suppressed);
+    }
+}
@@ -0,0 +1,91 @@
+#ifndef WTLOG_H
+#define WTLOG_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Logging for the real-time threads. A log call formats nothing and never
+// blocks: it copies the format pointer, its arguments and a timestamp into
+// a fixed-size record in the calling thread's own ring (single producer,
+// lock-free). A low-priority drain thread formats the records and writes
+// them to stdout (stderr for warnings and errors) every few milliseconds,
+// so a slow serial console can only cost the drain thread time.
+//
+//   WTLOG_WARN("DMA capture timeout (%d ms)", ms);
+//
+// The format is a printf format with at most WTLOG_MAX_ARGS conversions;
+// %s strings are copied (WTLOG_STR_BYTES per record, then truncated), '*'
+// widths are not supported. Each call site allows WTLOG_BURST messages and
+// then WTLOG_RATE per second; the rest are counted and the next message
+// that gets through says how many were suppressed. A full ring drops the
+// record and counts it.
+//
+// Before wtlog_init (and after wtlog_cleanup) calls print directly, so
+// tools and benchmarks that share the modules need no drain thread.
+//
+// A ring is allocated when a thread first names itself or logs, and goes
+// back on a free list for the next thread once its owner has exited and
+// the drain has emptied it; WTLOG_MAX_THREADS bounds the threads alive
+// at once (wt_soak runs several per board).
+
+#define WTLOG_MAX_THREADS   4096
+#define WTLOG_RING_SLOTS    256             // Per thread, power of 2
+#define WTLOG_MAX_ARGS      6
+#define WTLOG_STR_BYTES     48
+#define WTLOG_RATE          10              // Messages per second per call site
+#define WTLOG_BURST         10
+#define WTLOG_DRAIN_MS      20
+
+// Severity, WT_LOG_LEVEL / "log_level" picks the lowest one shown
+enum {
+    WTLOG_LVL_DEBUG = 0,
+    WTLOG_LVL_INFO,
+    WTLOG_LVL_WARN,
+    WTLOG_LVL_ERROR,
+    WTLOG_LVL_PLAIN,                        // Console text as is: no prefix, newline or limit
+};
+
+// Rate limit state, one per call site (the macros declare it). Every
+// thread that logs there shares it, so it is only touched atomically;
+// all zero is a full burst
+typedef struct {
+    uint64_t tat_ns;                        // When the bucket is full again, plus one message
+    uint32_t suppressed;
+} wtlog_site_t;
+
+typedef struct {
+    uint64_t records;                       // Formatted by the drain thread
+    uint64_t dropped;                       // Ring full or no ring to be had
+    uint64_t suppressed;                    // Rate limited
+} wtlog_stats_t;
+
+extern int wtlog_level;
+
+// Starts the drain thread
+int wtlog_init(int level);
+void wtlog_set_level(int level);
+
+// Name the calling thread in log lines ("tx", "rx", ...) and for the
+// kernel; otherwise it is numbered when it first logs
+void wtlog_thread(const char *name);
+
+void wtlog_write(wtlog_site_t *site, int level, const char *fmt, ...)
+    __attribute__((format(printf, 3, 4)));
+
+void wtlog_get_stats(wtlog_stats_t *stats);
+
+// Formats everything still queued and stops the drain thread
+void wtlog_cleanup(void);
+
+#define WTLOG(level, fmt, ...) do { \
+        static wtlog_site_t wtlog_site_; \
+        if ((level) >= wtlog_level) wtlog_write(&wtlog_site_, (level), fmt, ##__VA_ARGS__); \
+    } while (0)
+
+#define WTLOG_DEBUG(fmt, ...)   WTLOG(WTLOG_LVL_DEBUG, fmt, ##__VA_ARGS__)
+#define WTLOG_INFO(fmt, ...)    WTLOG(WTLOG_LVL_INFO, fmt, ##__VA_ARGS__)
+#define WTLOG_WARN(fmt, ...)    WTLOG(WTLOG_LVL_WARN, fmt, ##__VA_ARGS__)
+#define WTLOG_ERROR(fmt, ...)   WTLOG(WTLOG_LVL_ERROR, fmt, ##__VA_ARGS__)
+#define WTLOG_PLAIN(fmt, ...)   WTLOG(WTLOG_LVL_PLAIN, fmt, ##__VA_ARGS__)
+
+#endif // WTLOG_H
@@ -0,0 +1,232 @@
+#define _GNU_SOURCE
+#include "wttrace.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+// One span, 32 bytes
+typedef struct {
+    uint64_t begin_ns;
+    const char *name;                       // A literal
+    uint32_t dur_ns;
+    uint32_t board;
+    uint32_t seq;
+    uint32_t reserved;
+} wttrace_rec_t;
+
+typedef struct wttrace_ring {
+    wttrace_rec_t recs[WTTRACE_RING_SLOTS];
+    uint64_t head;                          // Written by the owning thread only
+    char name[16];
+    int index;
+    bool used;
+    struct wttrace_ring *next_free;
+} wttrace_ring_t;
+
+bool wttrace_enabled;
+
+// Rings allocated so far. The ring of an exited thread goes on free_rings
+// but keeps its spans for the dumps until another thread claims it;
+// ring_lock covers the free list, and a dump holds it so that no ring is
+// reset under it.
+static wttrace_ring_t *rings[WTTRACE_MAX_THREADS];
+static int n_rings;
+static wttrace_ring_t *free_rings;
+static pthread_mutex_t ring_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_key_t ring_key;
+static pthread_once_t ring_key_once = PTHREAD_ONCE_INIT;
+static bool ring_warned;
+static __thread wttrace_ring_t *my_ring;
+static __thread bool my_ring_failed;
+static uint64_t stat_no_ring;
+static uint64_t stat_recycled;              // Spans of rings that were claimed again
+
+void wttrace_enable(bool on) {
+    __atomic_store_n(&wttrace_enabled, on, __ATOMIC_RELAXED);
+}
+
+uint64_t wttrace_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// On thread exit: the spans stay readable until the ring is claimed again
+static void ring_release(void *arg) {
+    wttrace_ring_t *r = arg;
+
+    my_ring = NULL;
+    my_ring_failed = true;
+
+    pthread_mutex_lock(&ring_lock);
+    r->next_free = free_rings;
+    free_rings = r;
+    pthread_mutex_unlock(&ring_lock);
+}
+
+static void ring_key_create(void) {
+    pthread_key_create(&ring_key, ring_release);
+}
+
+// First span of a thread claims a ring, named after the thread: a free
+// one, else a new one. Once per thread; it may wait for a dump to finish.
+static wttrace_ring_t *ring_claim(void) {
+    pthread_once(&ring_key_once, ring_key_create);
+
+    pthread_mutex_lock(&ring_lock);
+    wttrace_ring_t *r = free_rings;
+    if (r) {
+        free_rings = r->next_free;
+        stat_recycled += r->head;
+        __atomic_store_n(&r->head, 0, __ATOMIC_RELEASE);
+    } else if (n_rings < WTTRACE_MAX_THREADS && (r = calloc(1, sizeof(wttrace_ring_t)))) {
+        r->index = n_rings;
+        rings[r->index] = r;
+        __atomic_store_n(&n_rings, r->index + 1, __ATOMIC_RELEASE);
+    }
+    bool warn = !r && !ring_warned;
+    if (warn) ring_warned = true;
+
+    if (r) {
+        if (pthread_getname_np(pthread_self(), r->name, sizeof(r->name)) != 0 || !r->name[0]) {
+            snprintf(r->name, sizeof(r->name), "t%d", r->index);
+        }
+        __atomic_store_n(&r->used, true, __ATOMIC_RELEASE);
+    }
+    pthread_mutex_unlock(&ring_lock);
+
+    if (!r) {
+        if (warn) {
+            fprintf(stderr, "wttrace: no trace ring for another thread (%d in use), "
+                    "its spans are dropped\n", WTTRACE_MAX_THREADS);
+        }
+        return NULL;
+    }
+    pthread_setspecific(ring_key, r);
+    return r;
+}
+
+void wttrace_span(const char *name, uint64_t begin_ns, uint32_t board, uint32_t seq) {
+    uint64_t end_ns = wttrace_now_ns();
+
+    if (!my_ring && !my_ring_failed) {
+        my_ring = ring_claim();
+        my_ring_failed = !my_ring;
+    }
+    wttrace_ring_t *r = my_ring;
+    if (!r) {
+        __atomic_add_fetch(&stat_no_ring, 1, __ATOMIC_RELAXED);
+        return;
+    }
+
+    // Oldest slot is overwritten; a dump reading it sees head move on
+    wttrace_rec_t *rec = &r->recs[r->head & (WTTRACE_RING_SLOTS - 1)];
+    rec->begin_ns = begin_ns;
+    rec->name = name;
+    uint64_t dur = end_ns > begin_ns ? end_ns - begin_ns : 0;
+    rec->dur_ns = dur > UINT32_MAX ? UINT32_MAX : (uint32_t)dur;
+    rec->board = board;
+    rec->seq = seq;
+    __atomic_store_n(&r->head, r->head + 1, __ATOMIC_RELEASE);
+}
+
+// Copy a ring's spans out; the ones the writer may have overwritten while
+// we copied are dropped. Returns how many are in out.
+static int ring_snapshot(wttrace_ring_t *r, wttrace_rec_t *out) {
+    uint64_t head = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+    uint64_t first = head > WTTRACE_RING_SLOTS ? head - WTTRACE_RING_SLOTS : 0;
+
+    for (uint64_t i = first; i < head; i++) {
+        out[i - first] = r->recs[i & (WTTRACE_RING_SLOTS - 1)];
+    }
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+
+    // The writer may be filling slot `now` (the slot of now - SLOTS) before
+    // it publishes it, so only the ones after that are whole
+    uint64_t now = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+    uint64_t valid = now >= WTTRACE_RING_SLOTS ? now - WTTRACE_RING_SLOTS + 1 : 0;
+    if (valid <= first) return (int)(head - first);
+    if (valid >= head) return 0;
+
+    int skip = (int)(valid - first);
+    memmove(out, out + skip, (size_t)(head - valid) * sizeof(wttrace_rec_t));
+    return (int)(head - valid);
+}
+
+// Thread names are ours, but keep the JSON valid whatever they hold
+static void put_name(FILE *f, const char *s) {
+    for (; *s; s++) {
+        fputc(*s == '"' || *s == '\\' || (unsigned char)*s < 0x20 ? '_' : *s, f);
+    }
+}
+
+int wttrace_dump(const char *path, uint32_t pid,
+                 uint64_t (*to_shared)(void *arg, uint64_t mono_us), void *arg) {
+    static wttrace_rec_t snap[WTTRACE_RING_SLOTS];
+
+    FILE *f = fopen(path, "w");
+    if (!f) {
+        perror(path);
+        return -1;
+    }
+
+    // One dump at a time, they share the snapshot buffer; and no ring
+    // changes hands while we read it
+    pthread_mutex_lock(&ring_lock);
+
+    fprintf(f, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+    fprintf(f, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%u,\"args\":{\"name\":\"board %u\"}}",
+            pid, pid);
+
+    int spans = 0;
+    for (int t = 0; t < n_rings; t++) {
+        wttrace_ring_t *r = rings[t];
+        if (!__atomic_load_n(&r->used, __ATOMIC_ACQUIRE)) continue;
+
+        fprintf(f, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%u,\"tid\":%d,"
+                "\"args\":{\"name\":\"", pid, t);
+        put_name(f, r->name);
+        fprintf(f, "\"}}");
+
+        int count = ring_snapshot(r, snap);
+        for (int i = 0; i < count; i++) {
+            const wttrace_rec_t *rec = &snap[i];
+            uint64_t ts_ns = rec->begin_ns;
+
+            // Master time keeps the microseconds, the fraction is ours
+            if (to_shared) {
+                uint64_t shared = to_shared(arg, ts_ns / 1000);
+                if (shared) ts_ns = shared * 1000 + ts_ns % 1000;
+            }
+
+            fprintf(f, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":%u,\"tid\":%d,"
+                    "\"ts\":%lu.%03u,\"dur\":%u.%03u,\"args\":{\"board\":%u,\"seq\":%u}}",
+                    rec->name, pid, t, (unsigned long)(ts_ns / 1000), (unsigned)(ts_ns % 1000),
+                    rec->dur_ns / 1000, rec->dur_ns % 1000, rec->board, rec->seq);
+            spans++;
+        }
+    }
+    fprintf(f, "\n]}\n");
+
+    pthread_mutex_unlock(&ring_lock);
+
+    if (fclose(f) != 0) {
+        perror(path);
+        return -1;
+    }
+    return spans;
+}
+
+void wttrace_get_stats(uint64_t *spans, uint64_t *no_ring) {
+    pthread_mutex_lock(&ring_lock);
+    uint64_t total = stat_recycled;
+    for (int t = 0; t < n_rings; t++) {
+        total += __atomic_load_n(&rings[t]->head, __ATOMIC_RELAXED);
+    }
+    pthread_mutex_unlock(&ring_lock);
+
+    *spans = total;
+    *no_ring = __atomic_load_n(&stat_no_ring, __ATOMIC_RELAXED);
+}
@@ -0,0 +1,63 @@
+#ifndef WTTRACE_H
+#define WTTRACE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Pipeline tracing: where did the time of a frame go. Each stage of the
+// TX and RX paths is a span (capture, encode, send, recv, decode, play,
+// ...) tagged with the board and seq_num of the frame it worked on.
+// Spans go into the calling thread's own ring, like wtlog records: a
+// begin timestamp from the monotonic clock, the duration, no formatting
+// and no locks. The rings keep the last WTTRACE_RING_SLOTS spans of each
+// thread (a flight recorder), and wttrace_dump writes them out as Chrome
+// trace JSON ("X" events, one process per board, one track per thread)
+// for chrome://tracing or ui.perfetto.dev.
+//
+//   uint64_t t0 = WTTRACE_BEGIN();
+//   size = opus_encode_frame(...);
+//   WTTRACE_END("encode", t0, board_id, seq_num);
+//
+// Off (the default) a span costs a load and a branch; switch it with
+// wttrace_enable at any time. Boards with clock sync dump in master time,
+// so their files line up on one timeline when merged:
+//
+//   jq -s '{traceEvents: map(.traceEvents) | add}' board*.json > all.json
+//
+// A ring is allocated for a thread's first span; when the thread exits it
+// is kept for the dumps and handed to the next new thread. So
+// WTTRACE_MAX_THREADS bounds the threads alive at once, not the total.
+
+#define WT_TRACE_FILE       "/tmp/walkietalkie-trace.json"
+#define WTTRACE_MAX_THREADS 4096
+#define WTTRACE_RING_SLOTS  4096            // Per thread, power of 2 (about 40 s)
+
+extern bool wttrace_enabled;
+
+void wttrace_enable(bool on);
+
+// Span start: a timestamp, 0 while tracing is off
+uint64_t wttrace_now_ns(void);
+
+// Record a span that began at begin_ns (name must be a literal)
+void wttrace_span(const char *name, uint64_t begin_ns, uint32_t board, uint32_t seq);
+
+// Write what the rings hold as Chrome trace JSON. pid is our board ID;
+// to_shared, when set, maps CLOCK_MONOTONIC microseconds to the shared
+// time base (0: not available, local time is kept). Returns the number
+// of spans written or -1.
+int wttrace_dump(const char *path, uint32_t pid,
+                 uint64_t (*to_shared)(void *arg, uint64_t mono_us), void *arg);
+
+// Spans recorded so far, and spans lost because more than
+// WTTRACE_MAX_THREADS threads traced at once
+void wttrace_get_stats(uint64_t *spans, uint64_t *no_ring);
+
+#define WTTRACE_BEGIN() \
+    (__atomic_load_n(&wttrace_enabled, __ATOMIC_RELAXED) ? wttrace_now_ns() : 0)
+
+#define WTTRACE_END(name, begin, board, seq) do { \
+        if (begin) wttrace_span((name), (begin), (board), (seq)); \
+    } while (0)
+
+#endif // WTTRACE_H